@@ -0,0 +1,1561 @@
+/*
+  finance.c - ledger engine: record store, bulk insert, load/save, sort,
+  search and aggregates. See finance.h for the API.
+
+  Concurrency: the rows visible to readers form an immutable Version
+  (rows[0..count) and totals) published through an atomic pointer.
+  Writers serialize on writeLock, build the next version and publish it
+  with one atomic exchange: appends write past the published count in
+  the shared array, while deletes, sorts, reloads and array growth copy
+  into a fresh array. Readers never lock; they announce the epoch they
+  started in, and a replaced version (or array) is freed only once no
+  reader from its epoch or earlier is still active.
+*/
+
+#include "finance.h"
+#include "finance_probes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define MAX_READERS 128              // concurrently pinned reader threads per ledger
+#define MAX_PINS    8                // ledgers one thread may pin at once
+#define SCAN_BLOCK  16384            // rows per parallel scan/aggregate task
+#define READ_BLOCK  (1 << 20)        // input bytes per import pipeline block
+#define PARSE_GRAIN 1024             // lines per parse task
+#define PIPE_DEPTH  4                // blocks queued between import stages
+#define PIPE_SPINS  64               // yields before a stage sleeps on its queue
+
+typedef struct {
+    Transaction *rows;            // shared with later versions on append
+    int count, cap;
+    long long incCents, expCents; // all-time totals of rows[0..count)
+} Version;
+
+typedef struct {
+    void *ptr;                    // Version or row array
+    unsigned long epoch;          // epoch in which it was replaced
+} Retired;
+
+struct Ledger {
+    _Atomic(Version *) cur;       // published version
+    atomic_ulong epoch;
+    atomic_ulong slots[MAX_READERS]; // 0 idle, else announced epoch + 1
+    atomic_int snapshots;         // slots held by LedgerSnapshots
+    pthread_mutex_t writeLock;
+    Retired *retired;             // guarded by writeLock
+    int nRetired, capRetired;
+};
+
+/* A thread's pin on a ledger; nested read sections share it. */
+typedef struct {
+    const Ledger *L;
+    Version *v;
+    int slot, depth;              // slot -1: borrowed from a LedgerSnapshot
+} Pin;
+
+struct LedgerSnapshot {
+    const Ledger *L;
+    Version *v;
+    int slot;
+};
+
+static _Thread_local Pin pins[MAX_PINS];
+
+/* ----------------------- Snapshots -------------------------------- */
+
+static Pin *pin_enter(const Ledger *L) {
+    Ledger *W = (Ledger *)L;     // only the atomic slots are written
+    Pin *p = NULL;
+    for (int k = 0; k < MAX_PINS; ++k) {
+        if (pins[k].L == L) { pins[k].depth++; return &pins[k]; }
+        if (!p && !pins[k].L) p = &pins[k];
+    }
+    if (!p) abort();             // more than MAX_PINS ledgers pinned by one thread
+
+    int start = (int)(((unsigned long)(size_t)pins >> 6) % MAX_READERS);
+    for (;;) {
+        for (int k = 0; k < MAX_READERS; ++k) {
+            int s = (start + k) % MAX_READERS;
+            unsigned long idle = 0, e = atomic_load(&W->epoch);
+            if (atomic_compare_exchange_strong(&W->slots[s], &idle, e + 1)) {
+                p->L = L;
+                p->slot = s;
+                p->depth = 1;
+                p->v = atomic_load(&W->cur);
+                return p;
+            }
+        }
+        sched_yield();           // every slot busy; wait for a reader to finish
+    }
+}
+
+static void pin_exit(const Ledger *L) {
+    for (int k = 0; k < MAX_PINS; ++k) {
+        if (pins[k].L != L) continue;
+        if (--pins[k].depth == 0) {
+            if (pins[k].slot >= 0) atomic_store(&((Ledger *)L)->slots[pins[k].slot], 0);
+            pins[k].L = NULL;
+        }
+        return;
+    }
+}
+
+void ledger_read_begin(const Ledger *L) { pin_enter(L); }
+void ledger_read_end(const Ledger *L) { pin_exit(L); }
+
+/* Announces itself in a reader slot as pin_enter() does, but only tries
+   each slot once: a caller holding snapshots on the thread that would
+   have to release one cannot wait. */
+LedgerSnapshot *ledger_snapshot(const Ledger *L) {
+    Ledger *W = (Ledger *)L;
+    LedgerSnapshot *s = fin_malloc(MEM_SNAPSHOTS, sizeof(*s));
+    if (!s) return NULL;
+    for (int k = 0; k < MAX_READERS; ++k) {
+        unsigned long idle = 0, e = atomic_load(&W->epoch);
+        if (atomic_compare_exchange_strong(&W->slots[k], &idle, e + 1)) {
+            *s = (LedgerSnapshot){ L, atomic_load(&W->cur), k };
+            atomic_fetch_add(&W->snapshots, 1);
+            return s;
+        }
+    }
+    fin_free(s);
+    errno = EBUSY;
+    return NULL;
+}
+
+void ledger_snapshot_release(LedgerSnapshot *s) {
+    if (!s) return;
+    Ledger *W = (Ledger *)s->L;
+    atomic_fetch_sub(&W->snapshots, 1);
+    atomic_store(&W->slots[s->slot], 0);
+    fin_free(s);
+}
+
+void ledger_read_begin_at(const Ledger *L, const LedgerSnapshot *s) {
+    for (int k = 0; k < MAX_PINS; ++k) {
+        if (pins[k].L) continue;
+        pins[k] = (Pin){ L, s->v, -1, 1 };
+        return;
+    }
+    abort();                     // more than MAX_PINS ledgers pinned by one thread
+}
+
+static const Version *read_enter(const Ledger *L) { return pin_enter(L)->v; }
+
+/* Frees retired objects no active reader can still reach. Writer only. */
+static void reclaim(Ledger *L) {
+    unsigned long oldest = (unsigned long)-1;
+    for (int s = 0; s < MAX_READERS; ++s) {
+        unsigned long a = atomic_load(&L->slots[s]);
+        if (a && a - 1 < oldest) oldest = a - 1;
+    }
+    int keep = 0;
+    for (int k = 0; k < L->nRetired; ++k) {
+        if (L->retired[k].epoch < oldest) fin_free(L->retired[k].ptr);
+        else L->retired[keep++] = L->retired[k];
+    }
+    L->nRetired = keep;
+}
+
+static void retire(Ledger *L, void *ptr, unsigned long epoch) {
+    if (!ptr) return;
+    if (L->nRetired == L->capRetired) {
+        int cap = L->capRetired ? L->capRetired * 2 : 16;
+        Retired *r = fin_realloc(MEM_SNAPSHOTS, L->retired, (size_t)cap * sizeof(Retired));
+        if (!r) {                // can't defer safely; wait for readers instead
+            if (atomic_load(&L->snapshots)) return;   // may be held by this thread: leak it
+            for (;;) {
+                int busy = 0;
+                for (int s = 0; s < MAX_READERS; ++s) busy |= atomic_load(&L->slots[s]) != 0;
+                if (!busy) break;
+                sched_yield();
+            }
+            fin_free(ptr);
+            return;
+        }
+        L->retired = r;
+        L->capRetired = cap;
+    }
+    L->retired[L->nRetired++] = (Retired){ ptr, epoch };
+}
+
+static Version *version_new(Transaction *rows, int count, int cap, long long inc, long long exp) {
+    Version *v = fin_malloc(MEM_SNAPSHOTS, sizeof(*v));
+    if (v) *v = (Version){ rows, count, cap, inc, exp };
+    return v;
+}
+
+/* Makes nv current. oldRows is the previous array if nv no longer
+   shares it. Called with writeLock held. */
+static void publish(Ledger *L, Version *nv, Transaction *oldRows) {
+    Version *old = atomic_exchange(&L->cur, nv);
+    unsigned long e = atomic_fetch_add(&L->epoch, 1);
+    retire(L, old, e);
+    retire(L, oldRows, e);
+    reclaim(L);
+}
+
+/* ----------------------- Encoded columns -------------------------- */
+/* Each full SCAN_BLOCK block of a row array also keeps narrow encoded
+   columns, stored in the same allocation after the rows (so they are
+   copied, shared and retired with them):
+     date      u16 offset from the block's smallest date key
+               (y << 9 | m << 5 | d); min and max kept per block
+     type      u8, 1 for expenses
+     category  u16 code in a process-wide dictionary
+     amount    u32 cents over the block's smallest amount (frame of
+               reference), if every amount in the block is exact cents
+   Filters and aggregates test their predicates on these, skip whole
+   blocks on the date bounds and decode only the rows that match. A
+   block whose dates span too wide or whose amounts do not fit falls
+   back to the rows; so does the partial last block. Writers encode a
+   block when it fills, and re-encode after deletes and sorts. */
+
+#define DICT_MAX   65535              // category codes; DICT_NONE beyond that
+#define DICT_NONE  0xffff
+#define DICT_CHUNK 1024
+
+typedef struct {
+    int minKey, maxKey;           // date keys of the block
+    long long baseCents;
+    unsigned maxCents;            // largest offset from baseCents
+    unsigned char datesOk, centsOk;
+    int expenses;
+} BlockMeta;
+
+typedef struct {
+    unsigned *cents;
+    unsigned short *date, *cat;
+    unsigned char *type;
+    BlockMeta *meta;
+} Cols;
+
+static size_t col_offset(int cap, int which) {
+    size_t at = (size_t)cap * sizeof(Transaction);
+    const size_t width[5] = { sizeof(unsigned), sizeof(unsigned short), sizeof(unsigned short), 1, 0 };
+    for (int k = 0; k < which; ++k) at += (size_t)cap * width[k];
+    return which == 4 ? (at + 7) & ~(size_t)7 : at;
+}
+
+static size_t array_bytes(int cap) {
+    return col_offset(cap, 4) + (size_t)(cap / SCAN_BLOCK) * sizeof(BlockMeta);
+}
+
+static Transaction *rows_alloc(int cap) { return fin_malloc(MEM_RECORDS, array_bytes(cap)); }
+
+static Cols cols_of(const Transaction *rows, int cap) {
+    char *base = (char *)rows;
+    return (Cols){ (unsigned *)(base + col_offset(cap, 0)), (unsigned short *)(base + col_offset(cap, 1)),
+                   (unsigned short *)(base + col_offset(cap, 2)), (unsigned char *)(base + col_offset(cap, 3)),
+                   (BlockMeta *)(base + col_offset(cap, 4)) };
+}
+
+static int date_key(int y, int m, int d) { return y << 9 | m << 5 | d; }
+
+/* Append-only, shared by all ledgers, so codes survive loads and
+   adopts; readers index it without locking below dictCount. */
+static char (*dictChunks[DICT_MAX / DICT_CHUNK + 1])[STR_LEN];
+static atomic_int dictCount;
+static pthread_mutex_t dictLock = PTHREAD_MUTEX_INITIALIZER;
+static int *dictIndex;            // open addressing, code + 1; under dictLock
+static int dictIndexCap;
+
+static const char *dict_name(int code) { return dictChunks[code / DICT_CHUNK][code % DICT_CHUNK]; }
+
+static unsigned text_hash(const char *s) {
+    unsigned h = 2166136261u;
+    for (; *s; ++s) h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+/* Called with dictLock held. */
+static int dict_code(const char *cat) {
+    int n = atomic_load_explicit(&dictCount, memory_order_relaxed);
+    if (2 * (n + 1) > dictIndexCap) {
+        int cap = dictIndexCap ? dictIndexCap * 2 : 256;
+        int *idx = fin_calloc(MEM_COLUMNS, (size_t)cap, sizeof(int));
+        if (!idx) return DICT_NONE;
+        for (int c = 0; c < n; ++c) {
+            unsigned s = text_hash(dict_name(c)) & (unsigned)(cap - 1);
+            while (idx[s]) s = (s + 1) & (unsigned)(cap - 1);
+            idx[s] = c + 1;
+        }
+        fin_free(dictIndex);
+        dictIndex = idx;
+        dictIndexCap = cap;
+    }
+    unsigned s = text_hash(cat) & (unsigned)(dictIndexCap - 1);
+    for (; dictIndex[s]; s = (s + 1) & (unsigned)(dictIndexCap - 1))
+        if (strcmp(dict_name(dictIndex[s] - 1), cat) == 0) return dictIndex[s] - 1;
+    if (n >= DICT_MAX) return DICT_NONE;
+    if (!dictChunks[n / DICT_CHUNK] && !(dictChunks[n / DICT_CHUNK] = fin_malloc(MEM_COLUMNS, DICT_CHUNK * STR_LEN)))
+        return DICT_NONE;
+    memcpy(dictChunks[n / DICT_CHUNK][n % DICT_CHUNK], cat, STR_LEN);
+    dictIndex[s] = n + 1;
+    atomic_store_explicit(&dictCount, n + 1, memory_order_release);
+    return n;
+}
+
+static void encode_block(const Transaction *rows, Cols c, int k) {
+    const Transaction *r = rows + (size_t)k * SCAN_BLOCK;
+    BlockMeta *bm = &c.meta[k];
+    int at = k * SCAN_BLOCK, lo = r[0].y << 9, hi = lo;
+    long long cmin = 0, cmax = 0;
+    bm->centsOk = 1;
+    bm->expenses = 0;
+    for (int i = 0; i < SCAN_BLOCK; ++i) {
+        int key = date_key(r[i].y, r[i].m, r[i].d);
+        if (i == 0 || key < lo) lo = key;
+        if (i == 0 || key > hi) hi = key;
+        double a = r[i].amount, x = a * 100.0;
+        long long cents = x >= 0.0 && x < 9.0e15 ? llround(x) : -1;
+        if (cents < 0 || (double)cents / 100.0 != a) bm->centsOk = 0;
+        if (i == 0 || cents < cmin) cmin = cents;
+        if (i == 0 || cents > cmax) cmax = cents;
+        bm->expenses += c.type[at + i] = r[i].type == EXPENSE;
+    }
+    bm->minKey = lo;
+    bm->maxKey = hi;
+    bm->datesOk = hi - lo <= 0xffff;
+    if (bm->centsOk && cmax - cmin > 0xffffffffLL) bm->centsOk = 0;
+    bm->baseCents = cmin;
+    bm->maxCents = bm->centsOk ? (unsigned)(cmax - cmin) : 0;
+    for (int i = 0; i < SCAN_BLOCK; ++i) {
+        if (bm->datesOk) c.date[at + i] = (unsigned short)(date_key(r[i].y, r[i].m, r[i].d) - lo);
+        if (bm->centsOk) c.cents[at + i] = (unsigned)(llround(r[i].amount * 100.0) - cmin);
+    }
+    pthread_mutex_lock(&dictLock);
+    for (int i = 0; i < SCAN_BLOCK; ++i)
+        c.cat[at + i] = (unsigned short)(i && strcmp(r[i].category, r[i - 1].category) == 0
+                                         ? c.cat[at + i - 1] : dict_code(r[i].category));
+    pthread_mutex_unlock(&dictLock);
+}
+
+typedef struct {
+    const Transaction *rows;
+    Cols c;
+    long first;
+} EncodeCtx;
+
+static void encode_blocks(void *ctx, long b, long e) {
+    EncodeCtx *ec = ctx;
+    for (long k = b; k < e; ++k) encode_block(ec->rows, ec->c, (int)(ec->first + k));
+}
+
+/* Encodes the full blocks [from, to) of rows. Called with writeLock held. */
+static void encode_range(const Transaction *rows, int cap, int from, int to) {
+    EncodeCtx ec = { rows, cols_of(rows, cap), from };
+    if (to - from > 1) fin_parallel_for(to - from, 1, encode_blocks, &ec);
+    else if (to > from) encode_blocks(&ec, 0, 1);
+}
+
+/* Copies the columns of the first nBlocks full blocks. */
+static void cols_copy(Transaction *dst, int dcap, const Transaction *src, int scap, int nBlocks) {
+    if (nBlocks <= 0) return;
+    Cols d = cols_of(dst, dcap), s = cols_of(src, scap);
+    size_t n = (size_t)nBlocks * SCAN_BLOCK;
+    memcpy(d.cents, s.cents, n * sizeof(*d.cents));
+    memcpy(d.date, s.date, n * sizeof(*d.date));
+    memcpy(d.cat, s.cat, n * sizeof(*d.cat));
+    memcpy(d.type, s.type, n);
+    memcpy(d.meta, s.meta, (size_t)nBlocks * sizeof(BlockMeta));
+}
+
+/* ----------------------- Ledger ----------------------------------- */
+
+Ledger *ledger_new(void) {
+    Ledger *L = fin_calloc(MEM_SNAPSHOTS, 1, sizeof(*L));
+    if (!L) return NULL;
+    Version *v = version_new(NULL, 0, 0, 0.0, 0.0);
+    if (!v) { fin_free(L); return NULL; }
+    atomic_init(&L->cur, v);
+    atomic_init(&L->epoch, 0);
+    for (int s = 0; s < MAX_READERS; ++s) atomic_init(&L->slots[s], 0);
+    atomic_init(&L->snapshots, 0);
+    pthread_mutex_init(&L->writeLock, NULL);
+    return L;
+}
+
+void ledger_free(Ledger *L) {
+    if (!L) return;
+    Version *v = atomic_load(&L->cur);
+    for (int k = 0; k < L->nRetired; ++k) fin_free(L->retired[k].ptr);
+    fin_free(L->retired);
+    fin_free(v->rows);
+    fin_free(v);
+    pthread_mutex_destroy(&L->writeLock);
+    fin_free(L);
+}
+
+void ledger_clear(Ledger *L) {
+    pthread_mutex_lock(&L->writeLock);
+    Version *cur = atomic_load(&L->cur), *nv = version_new(NULL, 0, 0, 0.0, 0.0);
+    FIN_PROBE1(clear, cur->count);
+    if (nv) publish(L, nv, cur->rows);
+    pthread_mutex_unlock(&L->writeLock);
+}
+
+int ledger_replace(Ledger *L, Ledger *src) {
+    Version *empty = version_new(NULL, 0, 0, 0.0, 0.0);
+    if (!empty) return 0;
+    Version *nv = atomic_exchange(&src->cur, empty);
+    pthread_mutex_lock(&L->writeLock);
+    Version *cur = atomic_load(&L->cur);
+    publish(L, nv, cur->rows);
+    pthread_mutex_unlock(&L->writeLock);
+    return 1;
+}
+
+int ledger_count(const Ledger *L) {
+    int n = read_enter(L)->count;
+    pin_exit(L);
+    return n;
+}
+
+const Transaction *ledger_row(const Ledger *L, int i) {
+    const Version *v = read_enter(L);
+    const Transaction *t = (i >= 0 && i < v->count) ? &v->rows[i] : NULL;
+    pin_exit(L);
+    return t;
+}
+
+/* Text use is measured by scanning every row, so this is O(rows). */
+void ledger_mem_usage(const Ledger *L, LedgerMemUsage *u) {
+    memset(u, 0, sizeof(*u));
+    pthread_mutex_lock((pthread_mutex_t *)&L->writeLock);   // the retire list is writer-owned
+    for (int k = 0; k < L->nRetired; ++k) u->retiredBytes += (long long)fin_alloc_size(L->retired[k].ptr);
+    pthread_mutex_unlock((pthread_mutex_t *)&L->writeLock);
+
+    const Version *v = read_enter(L);
+    u->rows = v->count;
+    u->rowBytesUsed = (long long)v->count * (long long)sizeof(Transaction);
+    u->rowBytesReserved = (long long)fin_alloc_size(v->rows);
+    u->columnBytes = v->rows ? (long long)(array_bytes(v->cap) - (size_t)v->cap * sizeof(Transaction)) : 0;
+    u->textBytesReserved = (long long)v->count * (STR_LEN + NOTE_LEN);
+    for (int i = 0; i < v->count; ++i) {
+        const char *c = memchr(v->rows[i].category, 0, STR_LEN), *n = memchr(v->rows[i].note, 0, NOTE_LEN);
+        u->textBytesUsed += (c ? c - v->rows[i].category + 1 : STR_LEN) + (n ? n - v->rows[i].note + 1 : NOTE_LEN);
+    }
+    pin_exit(L);
+}
+
+long long fin_cents(double amount) { return llround(amount * 100.0); }
+
+int fin_valid_date(int y, int m, int d) {
+    if (y < 1900 || y > 3000) return 0;
+    if (m < 1 || m > 12) return 0;
+    int mdays[] = {0,31,28,31,30,31,30,31,31,30,31,30,31};
+    int leap = ( (y%4==0 && y%100!=0) || (y%400==0) );
+    if (leap) mdays[2] = 29;
+    if (d < 1 || d > mdays[m]) return 0;
+    return 1;
+}
+
+/* ----------------------- Bulk insert ------------------------------ */
+/* Each chunk of BATCH_CHUNK rows is checked in branch-free passes
+   (dates, then amount and type) into a mask, storage is grown once,
+   valid rows are copied and sanitized in one sweep, and the running
+   totals are updated once per chunk.
+*/
+
+static const unsigned char MDAYS[16] = {0,31,28,31,30,31,30,31,31,30,31,30,31,0,0,0};
+
+static void validate_batch(const Transaction *r, int n, unsigned char *ok) {
+    for (int i = 0; i < n; ++i) {
+        unsigned y = (unsigned)r[i].y, m = (unsigned)r[i].m, d = (unsigned)r[i].d;
+        unsigned leap = ((y % 4 == 0) & (y % 100 != 0)) | (y % 400 == 0);
+        unsigned dim = MDAYS[m & 15] + (leap & (m == 2));
+        ok[i] = (unsigned char)((y - 1900u <= 1100u) & (m - 1u < 12u) & (d - 1u < dim));
+    }
+    for (int i = 0; i < n; ++i) {
+        double a = r[i].amount;            // NaN fails the comparison
+        ok[i] &= (unsigned char)((a >= 0.0) & (a <= FIN_AMOUNT_MAX) & ((unsigned)r[i].type <= 1u));
+    }
+}
+
+static void sanitize_text(char *s, size_t n) {
+    s[n-1] = '\0';
+    for (; *s; ++s) if (*s == '|') *s = '/';
+}
+
+/* checked: recs were already validated and sanitized (import pipeline). */
+static int insert_rows(Ledger *L, const Transaction *recs, int n, int *rejected, int checked) {
+    unsigned char ok[BATCH_CHUNK];
+    int stored = 0, bad = 0;
+
+    pthread_mutex_lock(&L->writeLock);
+    Version *cur = atomic_load(&L->cur);
+    Transaction *rows = cur->rows;
+    int count = cur->count, cap = cur->cap;
+    long long inc = cur->incCents, exp = cur->expCents;
+
+    for (int base = 0; base < n; base += BATCH_CHUNK) {
+        int k = (n - base < BATCH_CHUNK) ? n - base : BATCH_CHUNK;
+        const Transaction *src = recs + base;
+        int valid = 0;
+
+        if (checked) memset(ok, 1, (size_t)k);
+        else validate_batch(src, k, ok);
+        for (int i = 0; i < k; ++i) valid += ok[i];
+        if (count + valid > cap) {
+            // Readers may be scanning the published array: grow by copying.
+            int ncap = cap ? cap : 256;
+            while (ncap < count + valid) ncap = (ncap > 0x3fffffff) ? count + valid : ncap * 2;
+            Transaction *nr = rows_alloc(ncap);
+            if (!nr) break;
+            if (count) memcpy(nr, rows, (size_t)count * sizeof(Transaction));
+            cols_copy(nr, ncap, rows, cap, count / SCAN_BLOCK);
+            if (rows != cur->rows) fin_free(rows);  // never published
+            rows = nr;
+            cap = ncap;
+        }
+
+        Transaction *dst = rows + count;
+        for (int i = 0; i < k; ++i) {
+            if (!ok[i]) continue;
+            *dst = src[i];
+            sanitize_text(dst->category, STR_LEN);
+            sanitize_text(dst->note, NOTE_LEN);
+            if (dst->type == INCOME) inc += fin_cents(dst->amount); else exp += fin_cents(dst->amount);
+            dst++;
+        }
+        encode_range(rows, cap, count / SCAN_BLOCK, (count + valid) / SCAN_BLOCK);
+        count += valid;
+        stored += valid;
+        bad += k - valid;
+    }
+
+    if (stored) {
+        Version *nv = version_new(rows, count, cap, inc, exp);
+        if (nv) publish(L, nv, rows != cur->rows ? cur->rows : NULL);
+        else {
+            if (rows != cur->rows) fin_free(rows);
+            stored = 0;
+        }
+    } else if (rows != cur->rows) {
+        fin_free(rows);
+    }
+    pthread_mutex_unlock(&L->writeLock);
+
+    if (rejected) *rejected = bad;
+    return stored;
+}
+
+int ledger_insert_batch(Ledger *L, const Transaction *recs, int n, int *rejected) {
+    unsigned long long t0 = fin_stat_begin();
+    int stored = insert_rows(L, recs, n, rejected, 0);
+    fin_stat_end(STAT_INSERT, t0, n, stored, 0, 0);
+    return stored;
+}
+
+int ledger_reserve(Ledger *L, int rows) {
+    int ok = 1;
+    pthread_mutex_lock(&L->writeLock);
+    Version *cur = atomic_load(&L->cur);
+    if (rows > cur->cap) {
+        Transaction *nr = rows_alloc(rows);
+        Version *nv = nr ? version_new(nr, cur->count, rows, cur->incCents, cur->expCents) : NULL;
+        if (nv) {
+            if (cur->count) memcpy(nr, cur->rows, (size_t)cur->count * sizeof(Transaction));
+            cols_copy(nr, rows, cur->rows, cur->cap, cur->count / SCAN_BLOCK);
+            publish(L, nv, cur->rows);
+        } else {
+            fin_free(nr);
+            ok = 0;
+        }
+    }
+    pthread_mutex_unlock(&L->writeLock);
+    return ok;
+}
+
+int ledger_add(Ledger *L, int y, int m, int d, TxType type,
+               const char *category, double amount, const char *note) {
+    Transaction t = { y, m, d, type, {0}, amount, {0} };
+    strncpy(t.category, category, STR_LEN-1);
+    strncpy(t.note, note, NOTE_LEN-1);
+    return ledger_insert_batch(L, &t, 1, NULL) == 1;
+}
+
+static void sum_totals(const Transaction *rows, int n, long long *inc, long long *exp) {
+    *inc = *exp = 0;
+    for (int i = 0; i < n; ++i) {
+        if (rows[i].type == INCOME) *inc += fin_cents(rows[i].amount);
+        else *exp += fin_cents(rows[i].amount);
+    }
+}
+
+int ledger_delete(Ledger *L, int idx) {
+    unsigned long long t0 = fin_stat_begin();
+    int ok = 0, n;
+    pthread_mutex_lock(&L->writeLock);
+    Version *cur = atomic_load(&L->cur);
+    n = cur->count;                              // cur may be freed once replaced
+    if (idx >= 0 && idx < cur->count) {
+        Transaction *nr = rows_alloc(cur->cap);
+        if (nr) {
+            memcpy(nr, cur->rows, (size_t)idx * sizeof(Transaction));
+            memcpy(nr + idx, cur->rows + idx + 1, (size_t)(cur->count-1-idx) * sizeof(Transaction));
+            cols_copy(nr, cur->cap, cur->rows, cur->cap, idx / SCAN_BLOCK);
+            encode_range(nr, cur->cap, idx / SCAN_BLOCK, (cur->count - 1) / SCAN_BLOCK);
+            long long inc, exp;
+            sum_totals(nr, cur->count - 1, &inc, &exp);
+            Version *nv = version_new(nr, cur->count - 1, cur->cap, inc, exp);
+            if (nv) { publish(L, nv, cur->rows); ok = 1; }
+            else fin_free(nr);
+        }
+    }
+    pthread_mutex_unlock(&L->writeLock);
+    fin_stat_end(STAT_DELETE, t0, n, ok, 0, 0);
+    return ok;
+}
+
+/* ----------------------- Sorting ---------------------------------- */
+
+static int cmp_date(const void *a, const void *b) {
+    const Transaction *x = (const Transaction*)a, *y = (const Transaction*)b;
+    if (x->y != y->y) return (x->y < y->y) ? -1 : 1;
+    if (x->m != y->m) return (x->m < y->m) ? -1 : 1;
+    if (x->d != y->d) return (x->d < y->d) ? -1 : 1;
+    return 0;
+}
+
+static int cmp_amount_desc(const void *a, const void *b) {
+    const Transaction *x = (const Transaction*)a, *y = (const Transaction*)b;
+    if (x->amount < y->amount) return 1;
+    if (x->amount > y->amount) return -1;
+    return 0;
+}
+
+/* Sorts a copy and publishes it, so readers never see a half-sorted
+   array and a cancelled sort leaves the ledger as it was. */
+int ledger_sort(Ledger *L, SortKey key) {
+    unsigned long long t0 = fin_stat_begin();
+    int ok = 1;
+    pthread_mutex_lock(&L->writeLock);
+    Version *cur = atomic_load(&L->cur);
+    int n = cur->count;
+    FIN_PROBE2(sort__start, key, n);
+    if (cur->count > 1) {
+        Transaction *nr = rows_alloc(cur->cap);
+        Version *nv = nr ? version_new(nr, cur->count, cur->cap, cur->incCents, cur->expCents) : NULL;
+        ok = nv != NULL;
+        if (nv) {
+            memcpy(nr, cur->rows, (size_t)cur->count * sizeof(Transaction));
+            ok = fin_parallel_sort(nr, (size_t)cur->count, sizeof(Transaction),
+                                   key == SORT_DATE ? cmp_date : cmp_amount_desc);
+        }
+        if (ok == 1) {
+            encode_range(nr, cur->cap, 0, cur->count / SCAN_BLOCK);
+            publish(L, nv, cur->rows);
+        } else {
+            fin_free(nv);
+            fin_free(nr);
+        }
+    }
+    pthread_mutex_unlock(&L->writeLock);
+    fin_stat_end(key == SORT_DATE ? STAT_SORT_DATE : STAT_SORT_AMOUNT, t0, n, ok == 1 ? n : 0, 0, 0);
+    return ok;
+}
+
+/* ----------------------- Save & Load ------------------------------ */
+
+int ledger_save(const Ledger *L, const char *fname) {
+    if (fin_packed_file(fname)) return ledger_save_packed(L, fname);
+    unsigned long long t0 = fin_stat_begin();
+    FIN_PROBE1(save__start, fname);
+    FILE *f = fopen(fname, "w");
+    if (!f) return 0;
+    const Version *v = read_enter(L);
+    int n = v->count;
+    for (int i = 0; i < n; ++i) {
+        const Transaction *t = &v->rows[i];
+        fprintf(f, "%d|%d|%d|%d|%s|%.2f|%s\n",
+            t->y, t->m, t->d, t->type, t->category, t->amount, t->note);
+    }
+    pin_exit(L);
+    int ok = !ferror(f);
+    long bytes = ftell(f);
+    if (fclose(f) != 0) ok = 0;
+    fin_stat_end(STAT_SAVE, t0, n, ok ? n : 0, 0, bytes);
+    return ok;
+}
+
+/* Dates and amounts are validated later by ledger_insert_batch(). */
+int fin_parse_record(const char *line, Transaction *t) {
+    char category[STR_LEN] = {0};
+    char note[NOTE_LEN] = {0};
+    int typeInt = 0;
+    double amount = 0.0;
+
+    *t = (Transaction){0};
+    // Parse | separated, note/category may have spaces
+    // Using sscanf with scansets to stop at '|' ( %[^\|] )
+    int matched = sscanf(line,
+        "%d|%d|%d|%d|%63[^|]|%lf|%127[^\n]",
+        &t->y, &t->m, &t->d, &typeInt, category, &amount, note);
+
+    if (matched < 6) return 0;
+    t->type = (typeInt==1)?EXPENSE:INCOME;
+    memcpy(t->category, category, STR_LEN);
+    t->amount = amount;
+    if (matched == 7) memcpy(t->note, note, NOTE_LEN); else t->note[0] = '\0';
+    return 1;
+}
+
+/* ----------------------- Import pipeline -------------------------- */
+/* ledger_ingest() runs four stages connected by bounded single-producer
+   single-consumer queues, so reading, parsing, checking and inserting
+   overlap on different cores:
+
+     reader    reads READ_BLOCK-byte blocks cut at the last newline (a
+               longer line grows its block until it fits)
+     parser    splits a block into lines, parses them on the pool
+     checker   drops invalid records and, if asked, rows already stored
+     inserter  the calling thread; one bulk insert per block
+
+   Each queue holds PIPE_DEPTH blocks, so a slow stage stalls the ones
+   before it and memory stays bounded however large the input. A stage
+   that fails, or sees a cancel request, sets failed (and err, unless it
+   was the cancel); the others then discard what they receive but keep
+   draining until the end marker (NULL), so none blocks forever.
+*/
+
+typedef struct {
+    void *slot[PIPE_DEPTH];
+    atomic_ulong head, tail;      // next pop, next push
+    atomic_int sleepers;
+    pthread_mutex_t mu;           // only for sleeping on cv
+    pthread_cond_t cv;
+} Pipe;
+
+typedef struct {
+    char *text;                   // reader -> parser
+    size_t len;
+    Transaction *recs;            // parser -> checker -> inserter
+    int n;
+} Block;
+
+typedef struct {
+    unsigned hash;
+    int row;                      // row index + 1, 0 empty
+} DedupeSlot;
+
+typedef struct {
+    Ledger *L;
+    const Ledger *against;        // dedupe against this ledger, or NULL
+    FILE *f;
+    FinControl *ctl;              // the caller's, attached by every stage
+    Pipe toParse, toCheck, toInsert;
+    atomic_int failed;
+    int err;                      // errno of the first failure, set before failed
+    IngestStats st;               // each counter has one writing stage
+    const Version *base;          // checker's pinned pre-import snapshot
+    DedupeSlot *index;
+    unsigned mask;
+} Ingest;
+
+static void pipe_init(Pipe *q) {
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->sleepers, 0);
+    pthread_mutex_init(&q->mu, NULL);
+    pthread_cond_init(&q->cv, NULL);
+}
+
+static void pipe_destroy(Pipe *q) {
+    pthread_mutex_destroy(&q->mu);
+    pthread_cond_destroy(&q->cv);
+}
+
+static int pipe_ready(Pipe *q, int push) {
+    unsigned long h = atomic_load(&q->head), t = atomic_load(&q->tail);
+    return push ? t - h < PIPE_DEPTH : t != h;
+}
+
+/* Spins briefly, then sleeps; the other end wakes sleepers after it
+   moves its index (both sides use seq_cst, so no wakeup is lost). */
+static void pipe_wait(Pipe *q, int push) {
+    for (int k = 0; k < PIPE_SPINS; ++k) {
+        if (pipe_ready(q, push)) return;
+        sched_yield();
+    }
+    pthread_mutex_lock(&q->mu);
+    atomic_fetch_add(&q->sleepers, 1);
+    while (!pipe_ready(q, push)) pthread_cond_wait(&q->cv, &q->mu);
+    atomic_fetch_sub(&q->sleepers, 1);
+    pthread_mutex_unlock(&q->mu);
+}
+
+static void pipe_wake(Pipe *q) {
+    if (!atomic_load(&q->sleepers)) return;
+    pthread_mutex_lock(&q->mu);
+    pthread_cond_broadcast(&q->cv);
+    pthread_mutex_unlock(&q->mu);
+}
+
+static void pipe_push(Pipe *q, void *p) {
+    pipe_wait(q, 1);
+    unsigned long t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    q->slot[t % PIPE_DEPTH] = p;
+    atomic_store(&q->tail, t + 1);
+    pipe_wake(q);
+}
+
+static void *pipe_pop(Pipe *q) {
+    pipe_wait(q, 0);
+    unsigned long h = atomic_load_explicit(&q->head, memory_order_relaxed);
+    void *p = q->slot[h % PIPE_DEPTH];
+    atomic_store(&q->head, h + 1);
+    pipe_wake(q);
+    return p;
+}
+
+static void ingest_fail(Ingest *g, int err) {
+    int was = 0;
+    if (atomic_compare_exchange_strong(&g->failed, &was, 1)) g->err = err;
+}
+
+static void block_free(Block *b) {
+    if (!b) return;
+    fin_free(b->text);
+    fin_free(b->recs);
+    fin_free(b);
+}
+
+/* --- reader --- */
+
+static void *stage_read(void *arg) {
+    Ingest *g = arg;
+    fin_control_attach(g->ctl);
+    fin_trace_thread_name("ingest-read");
+    size_t cap = READ_BLOCK, have = 0;
+    char *text = fin_malloc(MEM_INGEST, cap + 1);                 // +1 for a final terminator
+    if (!text) ingest_fail(g, ENOMEM);
+    while (text && !atomic_load(&g->failed)) {
+        unsigned long long t0 = fin_trace_begin();
+        errno = 0;
+        size_t got = fread(text + have, 1, cap - have, g->f);
+        fin_trace_end("read_block", t0);
+        have += got;
+        g->st.bytes += (long)got;
+        if (ferror(g->f)) { ingest_fail(g, errno ? errno : EIO); break; }
+        if (fin_checkpoint((long)got)) { atomic_store(&g->failed, 1); break; }
+        int last = feof(g->f);
+        size_t len = have;                        // complete lines only, unless at EOF
+        if (!last) {
+            while (len && text[len - 1] != '\n') len--;
+            if (!len) {                           // one line fills the block: grow it
+                char *big = fin_realloc(MEM_INGEST, text, 2 * cap + 1);
+                if (!big) { ingest_fail(g, ENOMEM); break; }
+                text = big;
+                cap *= 2;
+                continue;
+            }
+        }
+        size_t ncap = have - len > READ_BLOCK ? cap : READ_BLOCK;
+        Block *b = fin_calloc(MEM_INGEST, 1, sizeof(Block));
+        char *next = last ? NULL : fin_malloc(MEM_INGEST, ncap + 1);
+        if (!b || (!last && !next)) {
+            fin_free(b);
+            fin_free(next);
+            ingest_fail(g, ENOMEM);
+            break;
+        }
+        if (next) memcpy(next, text + len, have - len);
+        b->text = text;
+        b->len = len;
+        if (len) pipe_push(&g->toParse, b); else block_free(b);
+        text = next;
+        cap = ncap;
+        have -= len;
+        if (last) break;
+    }
+    fin_free(text);
+    pipe_push(&g->toParse, NULL);
+    return NULL;
+}
+
+/* --- parser --- */
+
+typedef struct {
+    char **lines;
+    Transaction *recs;
+    unsigned char *ok;
+} ParseCtx;
+
+static void parse_lines(void *c, long b, long e) {
+    ParseCtx *p = c;
+    unsigned long long t0 = fin_trace_begin();
+    for (long i = b; i < e; ++i) p->ok[i] = (unsigned char)fin_parse_record(p->lines[i], &p->recs[i]);
+    fin_trace_end("parse_lines", t0);
+}
+
+static int parse_text(Ingest *g, Block *b, ParseCtx *p, int *cap) {
+    unsigned long long t0 = FIN_PROBE_CLOCK();
+    int n = 1;
+    for (size_t i = 0; i < b->len; ++i) n += b->text[i] == '\n';
+    if (n > *cap) {
+        char **l = fin_realloc(MEM_INGEST, p->lines, (size_t)n * sizeof(char *));
+        if (l) p->lines = l;
+        unsigned char *o = fin_realloc(MEM_INGEST, p->ok, (size_t)n);
+        if (o) p->ok = o;
+        if (!l || !o) return 0;
+        *cap = n;
+    }
+    if (!(b->recs = fin_malloc(MEM_INGEST, (size_t)n * sizeof(Transaction)))) return 0;
+    p->recs = b->recs;
+
+    n = 0;
+    char *s = b->text, *end = b->text + b->len;
+    while (s < end) {
+        char *nl = memchr(s, '\n', (size_t)(end - s));
+        if (!nl) nl = end;
+        *nl = '\0';
+        p->lines[n++] = s;
+        s = nl + 1;
+    }
+    fin_parallel_for(n, PARSE_GRAIN, parse_lines, p);
+
+    int kept = 0;
+    for (int i = 0; i < n; ++i) if (p->ok[i]) { if (kept != i) b->recs[kept] = b->recs[i]; kept++; }
+    g->st.lines += n;
+    g->st.malformed += n - kept;
+    b->n = kept;
+    fin_free(b->text);
+    b->text = NULL;
+    FIN_PROBE3(parse__batch, n, kept, FIN_PROBE_CLOCK() - t0);
+    return 1;
+}
+
+static void *stage_parse(void *arg) {
+    Ingest *g = arg;
+    fin_control_attach(g->ctl);
+    fin_trace_thread_name("ingest-parse");
+    ParseCtx p = {0};
+    int cap = 0;
+    Block *b;
+    while ((b = pipe_pop(&g->toParse))) {
+        unsigned long long t0 = fin_trace_begin();
+        if (atomic_load(&g->failed) || !parse_text(g, b, &p, &cap)) {
+            ingest_fail(g, ENOMEM);
+            block_free(b);
+            continue;
+        }
+        fin_trace_end("parse_block", t0);
+        pipe_push(&g->toCheck, b);
+    }
+    fin_free(p.lines);
+    fin_free(p.ok);
+    pipe_push(&g->toCheck, NULL);
+    return NULL;
+}
+
+/* --- checker --- */
+
+static long long to_cents(double a) { return (long long)(a * 100.0 + 0.5); }
+
+static unsigned row_hash(const Transaction *t) {
+    unsigned long long h = 1469598103934665603ull;
+    long long k[3] = { t->y * 10000LL + t->m * 100 + t->d, t->type, to_cents(t->amount) };
+    for (int i = 0; i < 3; ++i) { h ^= (unsigned long long)k[i]; h *= 1099511628211ull; }
+    for (const char *c = t->category; *c; ++c) { h ^= (unsigned char)*c; h *= 1099511628211ull; }
+    h ^= '|';
+    for (const char *c = t->note; *c; ++c) { h ^= (unsigned char)*c; h *= 1099511628211ull; }
+    return (unsigned)(h ^ (h >> 32));
+}
+
+/* Amounts match to the cent, as they are saved. */
+static int same_row(const Transaction *a, const Transaction *b) {
+    return a->y == b->y && a->m == b->m && a->d == b->d && a->type == b->type
+        && to_cents(a->amount) == to_cents(b->amount)
+        && strcmp(a->category, b->category) == 0 && strcmp(a->note, b->note) == 0;
+}
+
+static int dedupe_build(Ingest *g) {
+    const Version *v = g->base;
+    unsigned size = 16;
+    while (size < 2u * (unsigned)v->count) size *= 2;
+    if (!(g->index = fin_calloc(MEM_DEDUPE_INDEX, size, sizeof(DedupeSlot)))) return 0;
+    g->mask = size - 1;
+    for (int i = 0; i < v->count; ++i) {
+        unsigned h = row_hash(&v->rows[i]), k = h & g->mask;
+        while (g->index[k].row) k = (k + 1) & g->mask;
+        g->index[k] = (DedupeSlot){ h, i + 1 };
+    }
+    return 1;
+}
+
+static int dedupe_hit(const Ingest *g, const Transaction *t) {
+    unsigned h = row_hash(t);
+    for (unsigned k = h & g->mask; g->index[k].row; k = (k + 1) & g->mask)
+        if (g->index[k].hash == h && same_row(&g->base->rows[g->index[k].row - 1], t)) return 1;
+    return 0;
+}
+
+static void check_block(Ingest *g, Block *b) {
+    unsigned char ok[BATCH_CHUNK];
+    int kept = 0;
+    for (int base = 0; base < b->n; base += BATCH_CHUNK) {
+        int k = (b->n - base < BATCH_CHUNK) ? b->n - base : BATCH_CHUNK;
+        Transaction *src = b->recs + base;
+        validate_batch(src, k, ok);
+        for (int i = 0; i < k; ++i) {
+            if (!ok[i]) { g->st.rejected++; continue; }
+            sanitize_text(src[i].category, STR_LEN);
+            sanitize_text(src[i].note, NOTE_LEN);
+            if (g->index && dedupe_hit(g, &src[i])) { g->st.duplicates++; continue; }
+            b->recs[kept++] = src[i];
+        }
+    }
+    b->n = kept;
+}
+
+static void *stage_check(void *arg) {
+    Ingest *g = arg;
+    fin_control_attach(g->ctl);
+    fin_trace_thread_name("ingest-check");
+    if (g->against && !atomic_load(&g->failed)) {
+        unsigned long long t0 = fin_trace_begin();
+        g->base = read_enter(g->against);
+        if (!dedupe_build(g)) ingest_fail(g, ENOMEM);
+        fin_trace_end("dedupe_index", t0);
+    }
+    Block *b;
+    while ((b = pipe_pop(&g->toCheck))) {
+        if (atomic_load(&g->failed)) { block_free(b); continue; }
+        unsigned long long t0 = fin_trace_begin();
+        check_block(g, b);
+        fin_trace_end("check_block", t0);
+        pipe_push(&g->toInsert, b);
+    }
+    if (g->base) pin_exit(g->against);
+    fin_free(g->index);
+    pipe_push(&g->toInsert, NULL);
+    return NULL;
+}
+
+/* --- driver / inserter --- */
+
+static int ingest(Ledger *L, const Ledger *against, FILE *f, IngestStats *st) {
+    Ingest g;
+    memset(&g, 0, sizeof(g));
+    g.L = L;
+    g.against = against;
+    g.f = f;
+    g.ctl = fin_control_current();
+    atomic_init(&g.failed, 0);
+
+    long pos = ftell(f), size = 0;               // progress in bytes, if seekable
+    if (pos >= 0 && fseek(f, 0, SEEK_END) == 0) {
+        size = ftell(f) - pos;
+        fseek(f, pos, SEEK_SET);
+    }
+    fin_progress_begin(size > 0 ? size : 0);
+    pipe_init(&g.toParse);
+    pipe_init(&g.toCheck);
+    pipe_init(&g.toInsert);
+
+    pthread_t tid[3];
+    void *(*stage[3])(void *) = { stage_read, stage_parse, stage_check };
+    int started = 0, rc = 0;
+    for (; started < 3; ++started)
+        if ((rc = pthread_create(&tid[started], NULL, stage[started], &g)) != 0) break;
+    if (started < 3) {                           // no thread: fail, draining inline
+        ingest_fail(&g, rc);
+        for (int k = started; k < 3; ++k) stage[k](&g);
+    }
+
+    Block *b;
+    while ((b = pipe_pop(&g.toInsert))) {
+        if (fin_checkpoint(0)) atomic_store(&g.failed, 1);
+        if (!atomic_load(&g.failed) && b->n) {
+            unsigned long long t0 = fin_trace_begin();
+            int stored = insert_rows(L, b->recs, b->n, NULL, 1);
+            fin_trace_end("insert_block", t0);
+            g.st.stored += stored;
+            if (stored < b->n) ingest_fail(&g, ENOMEM);
+        }
+        block_free(b);
+    }
+    for (int k = 0; k < started; ++k) pthread_join(tid[k], NULL);
+    pipe_destroy(&g.toParse);
+    pipe_destroy(&g.toCheck);
+    pipe_destroy(&g.toInsert);
+    if (st) *st = g.st;
+    if (fin_checkpoint(0)) return FIN_CANCELLED;
+    if (atomic_load(&g.failed)) { errno = g.err; return -1; }
+    return (int)g.st.stored;
+}
+
+/* Ingests into a private ledger, then appends its rows in one bulk
+   insert, so a failed or cancelled ingest leaves L untouched. */
+int ledger_ingest(Ledger *L, FILE *f, int dedupe, IngestStats *st) {
+    unsigned long long t0 = fin_stat_begin();
+    IngestStats is;
+    memset(&is, 0, sizeof(is));
+    Ledger *tmp = ledger_new();
+    int added = tmp ? ingest(tmp, dedupe ? L : NULL, f, &is) : -1;
+    if (added > 0) {
+        const Version *v = read_enter(tmp);
+        if (insert_rows(L, v->rows, v->count, NULL, 1) < v->count) { added = -1; errno = ENOMEM; }
+        pin_exit(tmp);
+    }
+    ledger_free(tmp);
+    fin_stat_end(STAT_IMPORT, t0, is.lines, added > 0 ? added : 0, is.bytes, 0);
+    if (st) *st = is;
+    return added;
+}
+
+int ledger_read_stream(Ledger *L, FILE *f) { return ledger_ingest(L, f, 0, NULL); }
+
+/* A replacing load ingests into a private ledger and publishes it in one
+   step, so readers see either the old rows or the new ones. */
+int ledger_load(Ledger *L, const char *fname) {
+    unsigned long long t0 = fin_stat_begin();
+    IngestStats st;
+    FIN_PROBE1(load__start, fname);
+    FILE *f = fopen(fname, "r");
+    if (!f) return -1;
+    Ledger *tmp = ledger_new();
+    if (!tmp) { fclose(f); return -1; }
+    int added = fin_packed_file(fname) ? ledger_read_packed(tmp, f, &st) : ingest(tmp, NULL, f, &st);
+    fclose(f);
+    if (added >= 0 && !ledger_replace(L, tmp)) added = -1;
+    ledger_free(tmp);
+    fin_stat_end(STAT_LOAD, t0, st.lines, added > 0 ? added : 0, st.bytes, 0);
+    return added;
+}
+
+int ledger_import(Ledger *L, const char *fname, IngestStats *st) {
+    FIN_PROBE1(import__start, fname);
+    FILE *f = fopen(fname, "r");
+    if (!f) return -1;
+    int added = ledger_ingest(L, f, 1, st);
+    fclose(f);
+    return added;
+}
+
+
+/* ----------------------- Searching/Filtering ---------------------- */
+
+void rowset_free(RowSet *rs) {
+    fin_free(rs->ids);
+    rs->ids = NULL;
+    rs->count = rs->cap = 0;
+}
+
+static int rowset_push(RowSet *rs, int id) {
+    if (rs->count == rs->cap) {
+        int cap = rs->cap ? rs->cap * 2 : 64;
+        int *p = fin_realloc(MEM_RESULTS, rs->ids, (size_t)cap * sizeof(int));
+        if (!p) return 0;
+        rs->ids = p;
+        rs->cap = cap;
+    }
+    rs->ids[rs->count++] = id;
+    return 1;
+}
+
+static void to_lower_str(char *s) {
+    for (; *s; ++s) *s = (char)tolower((unsigned char)*s);
+}
+
+int ledger_select_all(const Ledger *L, RowSet *out) {
+    unsigned long long t0 = fin_stat_begin();
+    const Version *v = read_enter(L);
+    int r = 0, n = v->count;
+    out->count = 0;
+    for (int i = 0; i < n; ++i) if (!rowset_push(out, i)) { r = -1; break; }
+    pin_exit(L);
+    fin_stat_end(STAT_LIST, t0, n, out->count, 0, 0);
+    return r < 0 ? r : out->count;
+}
+
+/* Scans run as parallel tasks of SCAN_BLOCK rows, each collecting its
+   matches in a private RowSet; the parts are then concatenated in row
+   order, so results are the same for any thread count. Full blocks go
+   to the block predicate first, if the query has one. */
+typedef int (*RowPred)(const Transaction *t, const void *arg);
+typedef struct ScanCtx ScanCtx;
+
+/* Matches of full block k from its encoded columns, appended to rs; 0
+   if the block has to be scanned row by row, -1 if memory runs out. */
+typedef int (*BlockPred)(const ScanCtx *s, int k, RowSet *rs);
+
+struct ScanCtx {
+    const Transaction *rows;
+    int count, full;              // full: blocks with encoded columns
+    Cols c;
+    RowPred pred;
+    BlockPred block;
+    const void *arg;
+    RowSet *parts;                // one per block
+    atomic_int failed;
+};
+
+static void scan_blocks(void *c, long b, long e) {
+    ScanCtx *s = c;
+    for (long k = b; k < e; ++k) {
+        RowSet *rs = &s->parts[k];
+        int lo = (int)k * SCAN_BLOCK, hi = lo + SCAN_BLOCK < s->count ? lo + SCAN_BLOCK : s->count;
+        if (fin_checkpoint(0)) return;
+        unsigned long long t0 = fin_trace_begin();
+        int done = s->block && k < s->full ? s->block(s, (int)k, rs) : 0;
+        if (done < 0) atomic_store(&s->failed, 1);
+        for (int i = lo; !done && i < hi; ++i)
+            if (s->pred(&s->rows[i], s->arg) && !rowset_push(rs, i)) { atomic_store(&s->failed, 1); break; }
+        fin_trace_end("scan_block", t0);
+        fin_checkpoint(hi - lo);
+    }
+}
+
+static int scan_rows(const Ledger *L, FinStat op, RowPred pred, BlockPred block, const void *arg, RowSet *out) {
+    unsigned long long t0 = fin_stat_begin();
+    const Version *v = read_enter(L);
+    int nb = (v->count + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    ScanCtx s = { v->rows, v->count, v->count / SCAN_BLOCK, cols_of(v->rows, v->cap), pred, block, arg, out, 0 };
+    out->count = 0;
+    fin_progress_begin(v->count);
+    if (nb <= 1) {
+        scan_blocks(&s, 0, nb);
+    } else if (!(s.parts = fin_calloc(MEM_RESULTS, (size_t)nb, sizeof(RowSet)))) {
+        atomic_store(&s.failed, 1);
+    } else {
+        fin_parallel_for(nb, 1, scan_blocks, &s);
+        int total = 0;
+        for (int k = 0; k < nb; ++k) total += s.parts[k].count;
+        if (!atomic_load(&s.failed) && total > out->cap) {
+            int *p = fin_realloc(MEM_RESULTS, out->ids, (size_t)total * sizeof(int));
+            if (p) { out->ids = p; out->cap = total; } else atomic_store(&s.failed, 1);
+        }
+        for (int k = 0; k < nb; ++k) {
+            if (!atomic_load(&s.failed) && s.parts[k].count) {
+                memcpy(out->ids + out->count, s.parts[k].ids, (size_t)s.parts[k].count * sizeof(int));
+                out->count += s.parts[k].count;
+            }
+            rowset_free(&s.parts[k]);
+        }
+        fin_free(s.parts);
+    }
+    pin_exit(L);
+    if (fin_checkpoint(0)) out->count = 0;
+    fin_stat_end(op, t0, s.count, out->count, 0, 0);
+    if (fin_checkpoint(0)) return FIN_CANCELLED;
+    return atomic_load(&s.failed) ? -1 : out->count;
+}
+
+typedef struct {
+    SearchField field;
+    char ql[STR_LEN];
+    unsigned char *codeHit;       // per category code, whether it matches
+    int nCodes;
+} TextQuery;
+
+static int match_text(const Transaction *t, const void *arg) {
+    const TextQuery *q = arg;
+    char hay[NOTE_LEN];
+    if (q->field == FIELD_CATEGORY) {
+        strncpy(hay, t->category, sizeof(hay)); hay[NOTE_LEN-1] = 0;
+    } else {
+        strncpy(hay, t->note, sizeof(hay)); hay[NOTE_LEN-1] = 0;
+    }
+    to_lower_str(hay);
+    return strstr(hay, q->ql) != NULL;
+}
+
+/* Category matches test the code; codes newer than the query's table
+   (or DICT_NONE) check the row. */
+static int block_category(const ScanCtx *s, int k, RowSet *rs) {
+    const TextQuery *q = s->arg;
+    const unsigned short *cat = s->c.cat + (size_t)k * SCAN_BLOCK;
+    int base = k * SCAN_BLOCK;
+    for (int i = 0; i < SCAN_BLOCK; ++i) {
+        int hit = cat[i] < q->nCodes ? q->codeHit[cat[i]] : match_text(&s->rows[base + i], q);
+        if (hit && !rowset_push(rs, base + i)) return -1;
+    }
+    return 1;
+}
+
+int ledger_search_text(const Ledger *L, SearchField field, const char *q, RowSet *out) {
+    TextQuery tq;
+    tq.field = field;
+    strncpy(tq.ql, q, sizeof(tq.ql)); tq.ql[STR_LEN-1] = 0; to_lower_str(tq.ql);
+    tq.nCodes = 0;
+    tq.codeHit = NULL;
+    if (field == FIELD_CATEGORY) {                 // match each distinct category once
+        int n = atomic_load_explicit(&dictCount, memory_order_acquire);
+        if (n && (tq.codeHit = fin_malloc(MEM_RESULTS, (size_t)n))) {
+            char hay[STR_LEN];
+            for (int c = 0; c < n; ++c) {
+                memcpy(hay, dict_name(c), STR_LEN);
+                to_lower_str(hay);
+                tq.codeHit[c] = strstr(hay, tq.ql) != NULL;
+            }
+            tq.nCodes = n;
+        }
+    }
+    int r = scan_rows(L, field == FIELD_CATEGORY ? STAT_SEARCH_CATEGORY : STAT_SEARCH_NOTE,
+                      match_text, tq.codeHit ? block_category : NULL, &tq, out);
+    fin_free(tq.codeHit);
+    return r;
+}
+
+/* Date keys order (y, m, d) like yyyymmdd as long as month and day fit
+   their bit fields; other inputs take the row path. */
+static int key_safe(int y, int m, int d) {
+    return y >= 0 && y < (1 << 21) && m >= 0 && m <= 15 && d >= 0 && d <= 31;
+}
+
+static int match_date(const Transaction *t, const void *arg) {
+    const int *ymd = arg;
+    return t->y==ymd[0] && t->m==ymd[1] && t->d==ymd[2];
+}
+
+static int block_date(const ScanCtx *s, int k, RowSet *rs) {
+    const BlockMeta *bm = &s->c.meta[k];
+    const int *ymd = s->arg;
+    if (!bm->datesOk) return 0;
+    int key = date_key(ymd[0], ymd[1], ymd[2]), base = k * SCAN_BLOCK;
+    if (key < bm->minKey || key > bm->maxKey) return 1;
+    unsigned short off = (unsigned short)(key - bm->minKey);
+    const unsigned short *date = s->c.date + base;
+    for (int i = 0; i < SCAN_BLOCK; ++i)
+        if (date[i] == off && !rowset_push(rs, base + i)) return -1;
+    return 1;
+}
+
+int ledger_search_date(const Ledger *L, int y, int m, int d, RowSet *out) {
+    int ymd[3] = { y, m, d };
+    return scan_rows(L, STAT_SEARCH_DATE, match_date, key_safe(y, m, d) ? block_date : NULL, ymd, out);
+}
+
+typedef struct {
+    double threshold;
+    long long cents;              // smallest amount in cents above it
+} AmountQuery;
+
+/* Smallest whole number of cents c with c / 100.0 > thr, or LLONG_MAX
+   if no amount a block can encode is above it. Division by 100 is
+   monotonic, so comparing encoded cents with this is exact. */
+static long long cents_above(double thr) {
+    if (!(thr < 9.0e13)) return LLONG_MAX;        // NaN too
+    if (thr < 0.0) return 0;
+    long long c = (long long)(thr * 100.0) - 2;
+    if (c < 0) c = 0;
+    while ((double)c / 100.0 <= thr) ++c;
+    return c;
+}
+
+static int match_expense_over(const Transaction *t, const void *arg) {
+    return t->type == EXPENSE && t->amount > ((const AmountQuery *)arg)->threshold;
+}
+
+static int block_expense_over(const ScanCtx *s, int k, RowSet *rs) {
+    const BlockMeta *bm = &s->c.meta[k];
+    const AmountQuery *q = s->arg;
+    if (!bm->centsOk) return 0;
+    if (!bm->expenses || q->cents == LLONG_MAX || q->cents - bm->baseCents > (long long)bm->maxCents) return 1;
+    unsigned lim = q->cents > bm->baseCents ? (unsigned)(q->cents - bm->baseCents) : 0;
+    int base = k * SCAN_BLOCK;
+    const unsigned *cents = s->c.cents + base;
+    const unsigned char *type = s->c.type + base;
+    for (int i = 0; i < SCAN_BLOCK; ++i)
+        if ((type[i] & (cents[i] >= lim)) && !rowset_push(rs, base + i)) return -1;
+    return 1;
+}
+
+int ledger_filter_expenses(const Ledger *L, double threshold, RowSet *out) {
+    AmountQuery q = { threshold, cents_above(threshold) };
+    return scan_rows(L, STAT_FILTER, match_expense_over, block_expense_over, &q, out);
+}
+
+/* ----------------------- Aggregates ------------------------------- */
+
+/* Each block sums whole cents (fin_cents()) into its own row of partial
+   totals. Integer sums are exact, so the result is the same whatever
+   the block boundaries, thread count or path a block took. */
+typedef struct {
+    const Transaction *rows;
+    int count, year, full;
+    Cols c;
+    long long (*part)[13];
+} MonthCtx;
+
+static void month_sum(const Transaction *rows, int lo, int hi, int year, long long sums[13]) {
+    for (int i = lo; i < hi; ++i) {
+        const Transaction *t = &rows[i];
+        if (t->type == EXPENSE && t->y == year) {
+            if (t->m >=1 && t->m <=12) sums[t->m] += fin_cents(t->amount);
+        }
+    }
+}
+
+/* Same sums as month_sum(): the encoded cents are fin_cents() of each
+   amount. 0 if the block has to use the rows. */
+static int month_encoded(const MonthCtx *mc, int k, long long sums[13]) {
+    const BlockMeta *bm = &mc->c.meta[k];
+    if (k >= mc->full || !bm->datesOk || !bm->centsOk || !key_safe(mc->year, 0, 0)) return 0;
+    if (!bm->expenses || bm->maxKey >> 9 < mc->year || bm->minKey >> 9 > mc->year) return 1;
+    int base = k * SCAN_BLOCK;
+    const unsigned short *date = mc->c.date + base;
+    const unsigned *cents = mc->c.cents + base;
+    const unsigned char *type = mc->c.type + base;
+    for (int i = 0; i < SCAN_BLOCK; ++i) {
+        int key = bm->minKey + date[i];
+        if (type[i] && key >> 9 == mc->year) sums[key >> 5 & 15] += bm->baseCents + cents[i];
+    }
+    return 1;
+}
+
+static void month_blocks(void *c, long b, long e) {
+    MonthCtx *mc = c;
+    for (long k = b; k < e; ++k) {
+        int lo = (int)k * SCAN_BLOCK, hi = lo + SCAN_BLOCK < mc->count ? lo + SCAN_BLOCK : mc->count;
+        if (fin_checkpoint(0)) return;
+        unsigned long long t0 = fin_trace_begin();
+        if (!month_encoded(mc, (int)k, mc->part[k])) month_sum(mc->rows, lo, hi, mc->year, mc->part[k]);
+        fin_trace_end("month_block", t0);
+        fin_checkpoint(hi - lo);
+    }
+}
+
+int ledger_monthly_expenses(const Ledger *L, int year, double sums[13]) {
+    unsigned long long t0 = fin_stat_begin();
+    int any = 0;
+    long long cents[13] = {0};
+    const Version *v = read_enter(L);
+    int nb = (v->count + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    MonthCtx mc = { v->rows, v->count, year, v->count / SCAN_BLOCK, cols_of(v->rows, v->cap), NULL };
+    fin_progress_begin(v->count);
+    if (nb > 1) mc.part = fin_calloc(MEM_AGGREGATES, (size_t)nb, sizeof(*mc.part));
+    if (mc.part) {
+        fin_parallel_for(nb, 1, month_blocks, &mc);
+        for (int k = 0; k < nb; ++k)
+            for (int m = 1; m <= 12; ++m) cents[m] += mc.part[k][m];
+        fin_free(mc.part);
+    } else {                                     // one block, or no memory for partials
+        month_sum(v->rows, 0, v->count, year, cents);
+    }
+    pin_exit(L);
+    for (int m = 0; m <= 12; ++m) sums[m] = (double)cents[m] / 100.0;
+    if (fin_checkpoint(0)) {
+        fin_stat_end(STAT_CHART, t0, mc.count, 0, 0, 0);
+        return FIN_CANCELLED;
+    }
+    for (int m = 1; m <= 12; ++m) any += sums[m] > 0.0;
+    fin_stat_end(STAT_CHART, t0, mc.count, any, 0, 0);   // months with expenses
+    return any > 0;
+}
+
+/* Range totals use the same block partials, two per block. */
+typedef struct {
+    const Transaction *rows;
+    int count, full;
+    Cols c;
+    long long from, to;           // yyyymmdd, inclusive
+    int fromKey, toKey, keysOk;   // the same as date keys
+    long long (*part)[2];
+    int *hits;
+} RangeCtx;
+
+static int range_sum(const RangeCtx *rc, int lo, int hi, long long sums[2]) {
+    int n = 0;
+    for (int i = lo; i < hi; ++i) {
+        const Transaction *t = &rc->rows[i];
+        long long key = t->y * 10000LL + t->m * 100 + t->d;
+        if (key < rc->from || key > rc->to) continue;
+        sums[t->type == EXPENSE] += fin_cents(t->amount);
+        n++;
+    }
+    return n;
+}
+
+/* Rows matched in block k from its columns, summed as range_sum()
+   does, or -1 if the block has to use the rows. */
+static int range_encoded(const RangeCtx *rc, int k, long long sums[2]) {
+    const BlockMeta *bm = &rc->c.meta[k];
+    if (k >= rc->full || !rc->keysOk || !bm->datesOk || !bm->centsOk) return -1;
+    if (bm->maxKey < rc->fromKey || bm->minKey > rc->toKey) return 0;
+    int base = k * SCAN_BLOCK, n = 0;
+    const unsigned short *date = rc->c.date + base;
+    const unsigned *cents = rc->c.cents + base;
+    const unsigned char *type = rc->c.type + base;
+    unsigned from = rc->fromKey > bm->minKey ? (unsigned)(rc->fromKey - bm->minKey) : 0;
+    unsigned to = rc->toKey < bm->maxKey ? (unsigned)(rc->toKey - bm->minKey) : 0xffff;
+    for (int i = 0; i < SCAN_BLOCK; ++i) {
+        if (date[i] < from || date[i] > to) continue;
+        sums[type[i]] += bm->baseCents + cents[i];
+        n++;
+    }
+    return n;
+}
+
+static void range_blocks(void *c, long b, long e) {
+    RangeCtx *rc = c;
+    for (long k = b; k < e; ++k) {
+        int lo = (int)k * SCAN_BLOCK, hi = lo + SCAN_BLOCK < rc->count ? lo + SCAN_BLOCK : rc->count;
+        if (fin_checkpoint(0)) return;
+        unsigned long long t0 = fin_trace_begin();
+        rc->hits[k] = range_encoded(rc, (int)k, rc->part[k]);
+        if (rc->hits[k] < 0) rc->hits[k] = range_sum(rc, lo, hi, rc->part[k]);
+        fin_trace_end("range_block", t0);
+        fin_checkpoint(hi - lo);
+    }
+}
+
+int ledger_range_totals(const Ledger *L, int y0, int m0, int d0, int y1, int m1, int d1,
+                        double *income, double *expense) {
+    unsigned long long t0 = fin_stat_begin();
+    long long sums[2] = { 0, 0 };
+    int n = 0;
+    const Version *v = read_enter(L);
+    int nb = (v->count + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    int keysOk = key_safe(y0, m0, d0) && key_safe(y1, m1, d1);
+    RangeCtx rc = { v->rows, v->count, v->count / SCAN_BLOCK, cols_of(v->rows, v->cap),
+                    y0 * 10000LL + m0 * 100 + d0, y1 * 10000LL + m1 * 100 + d1,
+                    keysOk ? date_key(y0, m0, d0) : 0, keysOk ? date_key(y1, m1, d1) : 0, keysOk,
+                    NULL, NULL };
+    fin_progress_begin(v->count);
+    if (nb > 1) {
+        rc.part = fin_calloc(MEM_AGGREGATES, (size_t)nb, sizeof(*rc.part));
+        rc.hits = fin_calloc(MEM_AGGREGATES, (size_t)nb, sizeof(int));
+    }
+    if (rc.part && rc.hits) {
+        fin_parallel_for(nb, 1, range_blocks, &rc);
+        for (int k = 0; k < nb; ++k) {
+            sums[0] += rc.part[k][0];
+            sums[1] += rc.part[k][1];
+            n += rc.hits[k];
+        }
+    } else {                                     // one block, or no memory for partials
+        n = range_sum(&rc, 0, v->count, sums);
+    }
+    fin_free(rc.part);
+    fin_free(rc.hits);
+    pin_exit(L);
+    *income = (double)sums[0] / 100.0;
+    *expense = (double)sums[1] / 100.0;
+    if (fin_checkpoint(0)) {
+        fin_stat_end(STAT_RANGE_SUM, t0, rc.count, 0, 0, 0);
+        return FIN_CANCELLED;
+    }
+    fin_stat_end(STAT_RANGE_SUM, t0, rc.count, n, 0, 0);
+    return n;
+}
+
+void ledger_totals(const Ledger *L, double *income, double *expense) {
+    unsigned long long t0 = fin_stat_begin();
+    const Version *v = read_enter(L);
+    *income = (double)v->incCents / 100.0;
+    *expense = (double)v->expCents / 100.0;
+    pin_exit(L);
+    fin_stat_end(STAT_SUMMARY, t0, 0, 1, 0, 0);
+}
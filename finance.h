@@ -0,0 +1,732 @@
+/*
+  finance.h - Personal Finance Tracker engine (libfinance)
+
+  The ledger engine behind the finance_tracker program: record store,
+  bulk insert, load/save, sort, search and aggregates, plus streaming
+  result writers. All state lives in an explicit Ledger context, so
+  several ledgers can be open at once; nothing here reads stdin or
+  prints to the terminal.
+
+  Query functions return row indexes in a RowSet (or plain numbers for
+  aggregates); rows are fetched with ledger_row() and can be streamed
+  out with a Writer.
+
+  Threads: any number of threads may read a ledger while one thread at a
+  time writes (writers are serialized internally). Readers never block
+  and always see a complete snapshot; each call sees the latest one. To
+  keep one snapshot across several calls, e.g. a query and then
+  ledger_row() on its results, bracket them with ledger_read_begin() /
+  ledger_read_end(); row pointers stay valid until that end.
+*/
+
+#ifndef FINANCE_H
+#define FINANCE_H
+
+#include <stdio.h>
+
+#define STR_LEN 64
+#define NOTE_LEN 128
+#define BATCH_CHUNK 4096             // rows validated per bulk-insert pass
+
+typedef enum { INCOME = 0, EXPENSE = 1 } TxType;
+
+typedef struct {
+    int y, m, d;                  // date: year, month, day
+    TxType type;                  // 0 income, 1 expense
+    char category[STR_LEN];       // e.g., Food, Rent, Salary
+    double amount;                // positive amount
+    char note[NOTE_LEN];          // optional note
+} Transaction;
+
+typedef struct Ledger Ledger;
+
+#define FIN_AMOUNT_MAX 1e12       // largest amount a row may hold
+
+/* amount in whole cents, rounded. Totals add these and divide once at
+   the end, so every way of summing the same rows gives the same cents. */
+long long fin_cents(double amount);
+
+/* Row indexes produced by a query. Reuse one RowSet across queries to
+   avoid reallocating; release it with rowset_free(). */
+typedef struct {
+    int *ids;
+    int count, cap;
+} RowSet;
+
+typedef enum { SORT_DATE = 0, SORT_AMOUNT_DESC = 1 } SortKey;
+typedef enum { FIELD_CATEGORY = 1, FIELD_NOTE = 2 } SearchField;
+
+/* ----------------------- Ledger ----------------------------------- */
+
+Ledger *ledger_new(void);
+void ledger_free(Ledger *L);
+void ledger_clear(Ledger *L);
+int ledger_count(const Ledger *L);
+const Transaction *ledger_row(const Ledger *L, int i);
+/* Moves src's rows into L as one publish, leaving src empty; 0 if
+   memory runs out. */
+int ledger_replace(Ledger *L, Ledger *src);
+
+/* Pins the current snapshot for this thread until the matching end;
+   sections nest. */
+void ledger_read_begin(const Ledger *L);
+void ledger_read_end(const Ledger *L);
+
+/* A snapshot held apart from any thread, e.g. across the requests of one
+   connection. ledger_snapshot() takes one of the ledger's reader slots,
+   so it returns NULL (errno EBUSY) rather than wait when none is free;
+   memory the snapshot can still reach is kept until it is released.
+   ledger_read_begin_at() opens a read section that sees s instead of
+   the latest snapshot; it must not be nested in another section on L. */
+typedef struct LedgerSnapshot LedgerSnapshot;
+LedgerSnapshot *ledger_snapshot(const Ledger *L);
+void ledger_snapshot_release(LedgerSnapshot *s);
+void ledger_read_begin_at(const Ledger *L, const LedgerSnapshot *s);
+
+int fin_valid_date(int y, int m, int d);
+
+/* Appends the valid records of recs[0..n); returns how many were stored
+   (short only if memory runs out). Invalid dates, negative amounts or
+   ones above FIN_AMOUNT_MAX and unknown types are skipped; if rejected is non-NULL it receives their
+   count. '|' in text fields is replaced with '/'. */
+int ledger_insert_batch(Ledger *L, const Transaction *recs, int n, int *rejected);
+
+/* Grows the row array to hold rows in all, so appends up to that size
+   do not copy it again; 0 if memory runs out. */
+int ledger_reserve(Ledger *L, int rows);
+
+/* Appends one transaction; returns 0 if it is invalid or memory runs out. */
+int ledger_add(Ledger *L, int y, int m, int d, TxType type,
+               const char *category, double amount, const char *note);
+
+int ledger_delete(Ledger *L, int idx);                  // 0 if idx out of range
+int ledger_sort(Ledger *L, SortKey key);                // 0 if memory runs out, or FIN_CANCELLED
+
+/* ----------------------- Save & Load ------------------------------ */
+/* Format: y|m|d|type|category|amount|note\n
+   type: 0 income, 1 expense
+*/
+
+/* Loading runs as a pipeline (read, parse, validate/dedupe, insert) on
+   separate threads with bounded queues between the stages, so memory
+   use does not grow with the input. */
+
+typedef struct {
+    long lines;                   // lines read
+    long bytes;                   // input bytes read
+    long malformed;               // lines that did not parse
+    long rejected;                // parsed but invalid (date, amount, type)
+    long duplicates;              // identical to a row already stored
+    long stored;
+} IngestStats;
+
+int fin_parse_record(const char *line, Transaction *t); // 1 if well formed
+
+/* Appends the records in f; returns rows stored, -1 with errno set if
+   memory runs out or f has a read error, or FIN_CANCELLED. On -1 or a
+   cancel L is unchanged. With dedupe, records identical (to the cent) to
+   a row in L when the call starts are skipped; repeats within f itself
+   are kept. st may be NULL. */
+int ledger_ingest(Ledger *L, FILE *f, int dedupe, IngestStats *st);
+int ledger_read_stream(Ledger *L, FILE *f);             // ledger_ingest, no dedupe
+
+/* Both are all-or-nothing: rows, -1 if the file cannot be opened (or
+   memory runs out, or a packed file is damaged), or FIN_CANCELLED with L
+   unchanged. ledger_load() reads packed files too. */
+int ledger_load(Ledger *L, const char *fname);          // replaces
+int ledger_import(Ledger *L, const char *fname, IngestStats *st); // appends, dedupes
+/* Writes the text format, or the packed one if fname already holds a
+   packed ledger. */
+int ledger_save(const Ledger *L, const char *fname);    // 1 ok, 0 error
+
+/* Packed ledgers store rows in compressed column blocks (delta-of-delta
+   dates, dictionary categories, bit-packed cents, LZ-compressed notes),
+   typically a fifth of the text size, and load faster than text. The
+   layout is described in finance_pack.c. */
+#define FIN_PACK_MAGIC "FINPACK1"
+
+int ledger_save_packed(const Ledger *L, const char *fname);  // 1 ok, 0 error
+/* The same, recording hotFrom, the first year an archive leaves to its
+   data file, in the header (see fin_paged_stats()). */
+int ledger_save_archive(const Ledger *L, const char *fname, int hotFrom);
+int fin_packed_file(const char *fname);                 // 1 if fname holds a packed ledger
+/* Appends the packed ledger in f, like ledger_ingest() without dedupe;
+   -1 with errno set (EINVAL: not packed or damaged) if it cannot. */
+int ledger_read_packed(Ledger *L, FILE *f, IngestStats *st);
+
+/* File helpers shared by the packed and LSM formats. fin_pread_full()
+   reads all n bytes at off or returns 0 with errno set, EINVAL if the
+   file ends first (a file shorter than its own metadata is damaged). */
+int fin_pread_full(int fd, void *buf, size_t n, long long off);
+long long fin_days_from_civil(int y, int m, int d);     // days since 1970-01-01, proleptic Gregorian
+
+/* ----------------------- Queries ---------------------------------- */
+/* Each query replaces out's contents and returns the number of matching
+   rows, -1 if memory runs out, or FIN_CANCELLED. */
+
+void rowset_free(RowSet *rs);
+int ledger_select_all(const Ledger *L, RowSet *out);
+int ledger_search_text(const Ledger *L, SearchField field, const char *q, RowSet *out);
+int ledger_search_date(const Ledger *L, int y, int m, int d, RowSet *out);
+int ledger_filter_expenses(const Ledger *L, double threshold, RowSet *out);
+
+/* sums[1..12] receive the year's expenses per month; returns 0 if the
+   year has none, or FIN_CANCELLED. */
+int ledger_monthly_expenses(const Ledger *L, int year, double sums[13]);
+void ledger_totals(const Ledger *L, double *income, double *expense);
+/* Income and expense of the rows dated y0-m0-d0 through y1-m1-d1
+   inclusive; returns how many rows that is, or FIN_CANCELLED. */
+int ledger_range_totals(const Ledger *L, int y0, int m0, int d0, int y1, int m1, int d1,
+                        double *income, double *expense);
+
+/* ----------------------- Result writers --------------------------- */
+/* A Writer streams rows and aggregates to a FILE* through one reusable
+   buffer, as a table, CSV, JSON Lines or fixed-width binary records.
+
+   BINARY: 16-byte header (magic "FTREC1\0\0", u32 record size, u32 kind)
+           followed by fixed-width little-endian records:
+             rows       (kind 0, 216 bytes): u32 idx, u16 year, u8 month,
+                        u8 day, u8 type, 7 pad, f64 amount,
+                        char category[64], char note[128] (NUL padded)
+             aggregates (kind 1, 24 bytes):  char key[16], f64 value
+*/
+
+typedef enum { FMT_TABLE = 0, FMT_CSV = 1, FMT_JSONL = 2, FMT_BINARY = 3 } OutFormat;
+
+#define BIN_MAGIC      "FTREC1\0\0"
+#define BIN_ROW_LEN    216
+#define BIN_AGG_LEN    24
+#define BIN_AGG_KEYLEN 16
+
+typedef struct Writer Writer;
+
+extern const char *const FMT_NAMES[4];
+int fin_parse_format(const char *s, OutFormat *fmt);    // 1 if s names a format
+
+Writer *writer_new(FILE *sink, OutFormat fmt);
+void writer_free(Writer *w);                            // flushes first
+void writer_set_format(Writer *w, OutFormat fmt);
+OutFormat writer_format(const Writer *w);
+
+void writer_begin_rows(Writer *w);
+void writer_row(Writer *w, int idx, const Transaction *t);
+void writer_rowset(Writer *w, const Ledger *L, const RowSet *rs);
+
+/* Aggregates are (key, value) pairs, e.g. month -> expense total. */
+void writer_begin_agg(Writer *w, const char *keyName, const char *valName);
+void writer_agg(Writer *w, const char *key, double v);
+
+int writer_end(Writer *w);                              // flush; 0 on I/O error
+
+/* One BIN_ROW_LEN-byte row record, as written by the binary format. */
+void fin_encode_row(unsigned char *rec, int idx, const Transaction *t);
+void fin_decode_row(const unsigned char *rec, int *idx, Transaction *t);
+
+/* ----------------------- Thread pool ------------------------------ */
+/* One process-wide work-stealing pool runs the engine's parallel scans,
+   aggregates, sorts and parsing. It starts on first use with one thread
+   per online core (or $FIN_THREADS); fin_pool_init() resizes it, 1 makes
+   everything run on the calling thread. */
+
+typedef void (*FinTaskFn)(void *ctx, long begin, long end);
+
+int fin_pool_init(int threads);                         // 0 = auto; 0 on error
+void fin_pool_shutdown(void);
+int fin_pool_threads(void);
+
+/* Calls fn on disjoint subranges covering [0, n), at most grain long,
+   spread over the pool; returns when all have run. The caller helps. */
+void fin_parallel_for(long n, long grain, FinTaskFn fn, void *ctx);
+
+/* Parallel qsort replacement (not stable); 1 ok, 0 if memory runs out,
+   or FIN_CANCELLED. Unless it returns 1, base's contents are unspecified
+   (elements may be lost or repeated), so callers sort a copy. */
+int fin_parallel_sort(void *base, size_t n, size_t size,
+                      int (*cmp)(const void *, const void *));
+
+/* ----------------------- Cancellation ----------------------------- */
+/* A FinControl attached to a thread governs the long operations that
+   thread runs, including the pool tasks they start: scans, aggregates,
+   sorts, loads and writer_rowset() check it between blocks and stop
+   early. Cancelled queries return FIN_CANCELLED; cancelled sorts, loads
+   and imports change nothing. The control also carries an optional
+   deadline (a timeout stops the operation the same way) and progress
+   of the running phase, in rows (bytes for loads). fin_control_cancel()
+   is async-signal-safe. */
+
+#define FIN_CANCELLED (-2)
+
+enum { FIN_RUN = 0, FIN_STOP_CANCEL = 1, FIN_STOP_TIMEOUT = 2 };
+
+typedef struct FinControl FinControl;
+
+FinControl *fin_control_new(double timeoutSec);          // 0 = no timeout
+void fin_control_free(FinControl *c);
+void fin_control_cancel(FinControl *c);
+int fin_control_status(const FinControl *c);            // FIN_RUN / FIN_STOP_*
+void fin_control_progress(const FinControl *c, long *done, long *total);
+
+FinControl *fin_control_attach(FinControl *c);          // returns the previous one
+FinControl *fin_control_current(void);
+
+/* For operations: start a phase of total work units; report work done
+   and learn whether to stop (1). Both are no-ops without a control. */
+void fin_progress_begin(long total);
+int fin_checkpoint(long work);
+
+/* ----------------------- Synthetic ledgers ------------------------ */
+/* Realistic fake histories for benchmarks: monthly rent and salary,
+   Zipf-distributed categories, heavy-tailed amounts, merchant notes. */
+
+typedef struct {
+    unsigned long long seed;
+    long rows;
+    int startYear, years;         // dates run from startYear-01-01 for years
+    int binary;                   // 1: FMT_BINARY row records, 0: data file text
+} GenSpec;
+
+/* Writes spec->rows transactions to f in date order, rendering on the
+   pool; a spec always yields the same bytes, whatever the thread count.
+   1 ok, 0 on a bad spec or error, or FIN_CANCELLED. */
+int fin_generate(FILE *f, const GenSpec *spec);
+
+/* ----------------------- Statistics ------------------------------- */
+/* Each public operation records its latency (monotonic clock) in a
+   histogram with ~3% resolution, plus counts of calls, rows scanned and
+   returned, and bytes read and written. Recording is lock-free and on
+   by default; the numbers are process-wide, across all ledgers. Front
+   ends record the operations they implement themselves (STAT_EXPORT,
+   listing through a Writer) with the same two calls. */
+
+typedef enum {
+    STAT_LOAD, STAT_IMPORT, STAT_SAVE, STAT_EXPORT, STAT_INSERT, STAT_DELETE,
+    STAT_SORT_DATE, STAT_SORT_AMOUNT, STAT_LIST, STAT_SEARCH_CATEGORY,
+    STAT_SEARCH_NOTE, STAT_SEARCH_DATE, STAT_FILTER, STAT_CHART, STAT_SUMMARY,
+    STAT_RANGE_SUM, STAT_OPS
+} FinStat;
+
+extern const char *const FIN_STAT_NAMES[STAT_OPS];     // "load", "sort_date", ...
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long rowsScanned, rowsReturned;
+    unsigned long long bytesRead, bytesWritten;
+    unsigned long long totalNs, maxNs;
+    unsigned long long p50Ns, p90Ns, p99Ns, p999Ns;
+} FinOpStats;
+
+int fin_stats_enable(int on);                           // returns the previous setting
+void fin_stats_reset(void);
+void fin_stats_get(FinStat op, FinOpStats *s);
+
+/* All operations with their counters, percentiles and non-empty
+   histogram buckets as one JSON object; 0 on I/O error. */
+int fin_stats_write_json(FILE *f);
+
+/* For operations: t0 = fin_stat_begin() (0 while disabled), then
+   fin_stat_end() with what the call did. */
+unsigned long long fin_clock_ns(void);                  // CLOCK_MONOTONIC
+unsigned long long fin_stat_begin(void);
+void fin_stat_end(FinStat op, unsigned long long t0, long scanned, long returned,
+                  long bytesRead, long bytesWritten);
+
+/* Raw latency samples, for the tools that report exact percentiles
+   (replay, load generator, benchmark). fin_samples_pct() is nearest-rank
+   over sorted samples (p in percent), the definition fin_stats_get()
+   applies to its histograms; 0 for no samples. */
+typedef struct {
+    unsigned long long *ns;
+    size_t n, cap;
+} FinSamples;
+
+int fin_samples_add(FinSamples *s, unsigned long long ns);     // 0 when out of memory
+void fin_samples_sort(FinSamples *s);
+unsigned long long fin_samples_pct(const FinSamples *s, double p);
+void fin_samples_free(FinSamples *s);
+
+/* ----------------------- Tracing ---------------------------------- */
+/* Optional timeline of spans (operation calls and the stages inside
+   them: import pipeline blocks, scan and sort blocks, merges) for a
+   trace viewer such as chrome://tracing or Perfetto. Each thread records
+   into its own ring of eventsPerThread spans without locking; when it
+   fills, the oldest spans go. Off by default; while off a span costs one
+   relaxed load. */
+
+int fin_trace_start(long eventsPerThread);              // 0 = default (65536)
+void fin_trace_stop(void);
+int fin_tracing(void);
+
+/* t0 = fin_trace_begin() (0 while off); name must outlive the trace. */
+unsigned long long fin_trace_begin(void);
+void fin_trace_end(const char *name, unsigned long long t0);
+void fin_trace_thread_name(const char *name);           // label for this thread
+
+/* Chrome trace-event JSON of every span still in the rings; call once
+   the traced threads are idle (e.g. at exit). 0 on I/O error. */
+int fin_trace_write_json(FILE *f);
+
+/* ----------------------- Memory accounting ------------------------ */
+/* All engine memory is allocated through these hooks, tagged with the
+   subsystem that owns it, so bytes in use, peak and allocation counts
+   are known per subsystem. Blocks from fin_malloc() must be released
+   with fin_free() (RowSet ids and FinBuf data included, which
+   rowset_free() and finbuf_free() do). */
+
+typedef enum {
+    MEM_RECORDS,                  // row arrays of ledger snapshots
+    MEM_SNAPSHOTS,                // ledgers, versions, retire lists
+    MEM_DEDUPE_INDEX,             // import duplicate-detection hash index
+    MEM_RESULTS,                  // RowSets and per-block scan results
+    MEM_AGGREGATES,               // per-block partial sums
+    MEM_SORT,                     // sort scratch
+    MEM_INGEST,                   // import pipeline blocks
+    MEM_WRITER,                   // result writers and their buffers
+    MEM_DAEMON,                   // connections and request/reply buffers
+    MEM_POOL,                     // thread pool deques and controls
+    MEM_GENERATOR,                // synthetic ledger tables and batches
+    MEM_TRACE,                    // trace rings
+    MEM_REPLAY,                   // session logs and latency samples
+    MEM_LSM,                      // LSM memtable, fences, bloom filters, blocks
+    MEM_PACK,                     // packed-ledger blocks and codec scratch
+    MEM_COLUMNS,                  // category dictionary of the encoded columns
+    MEM_CACHE,                    // block cache entries and cached blocks
+    MEM_EXTERNAL,                 // external sort run buffers and spilling hash tables
+    MEM_TAGS
+} FinMemTag;
+
+extern const char *const FIN_MEM_NAMES[MEM_TAGS];
+
+typedef struct {
+    long long bytes, peak;        // requested bytes, excluding headers
+    unsigned long long allocs, frees;
+} FinMemStats;
+
+void *fin_malloc(FinMemTag tag, size_t n);
+void *fin_calloc(FinMemTag tag, size_t n, size_t size);
+void *fin_realloc(FinMemTag tag, void *p, size_t n);   // keeps p's tag
+void fin_free(void *p);
+size_t fin_alloc_size(const void *p);                   // bytes requested for p
+
+void fin_mem_get(FinMemTag tag, FinMemStats *s);
+long long fin_mem_total(void);                          // bytes in use, all tags
+
+/* What one ledger holds: its row array (used = count, reserved = cap,
+   encoded columns included), how much of the fixed category/note fields
+   holds text (NUL included), and older snapshots still waiting for
+   readers to finish. */
+typedef struct {
+    long rows;
+    long long rowBytesUsed, rowBytesReserved;
+    long long columnBytes;        // the reserved bytes that hold encoded columns
+    long long textBytesUsed, textBytesReserved;
+    long long retiredBytes;
+} LedgerMemUsage;
+
+void ledger_mem_usage(const Ledger *L, LedgerMemUsage *u);
+
+/* Per-subsystem counters and, if L is non-NULL, its usage and bytes per
+   row, as one JSON object; 0 on I/O error. */
+int fin_mem_write_json(FILE *f, const Ledger *L);
+
+/* ----------------------- Daemon / client -------------------------- */
+/* The daemon keeps one Ledger resident and answers requests on a Unix
+   domain socket; the wire format is described in finance_daemon.c. */
+
+#define FIN_DEFAULT_SOCKET "finance.sock"
+
+typedef enum {
+    OP_PING = 0, OP_ADD = 1, OP_LIST = 2, OP_SEARCH_TEXT = 3, OP_SEARCH_DATE = 4,
+    OP_FILTER = 5, OP_CHART = 6, OP_SUMMARY = 7, OP_SAVE = 8, OP_SORT = 9,
+    OP_DELETE = 10, OP_LOAD = 11, OP_RANGE_SUM = 12, OP_PAGE = 13,
+    FIN_OPS
+} FinOp;
+
+extern const char *const FIN_OP_NAMES[FIN_OPS];        // "ping", "add", ...
+
+enum { FIN_ST_OK = 0, FIN_ST_BAD_REQUEST = 1, FIN_ST_FAILED = 2 };
+
+#define FIN_PAGE_ROWS 4096            // most rows in one reply; OP_PAGE asks for more
+
+/* Growable byte buffer for request and reply payloads. */
+typedef struct {
+    unsigned char *data;
+    size_t len, cap;
+} FinBuf;
+
+int finbuf_reserve(FinBuf *b, size_t n);                // room for n more bytes; 0 if memory runs out
+int finbuf_put(FinBuf *b, const void *p, size_t n);     // 0 if memory runs out
+int finbuf_put_le(FinBuf *b, unsigned long long v, int bytes);
+int finbuf_put_f64(FinBuf *b, double v);
+void finbuf_free(FinBuf *b);
+unsigned long long fin_get_le(const unsigned char *p, int bytes);
+double fin_get_f64(const unsigned char *p);
+
+/* Serves L on sockPath until SIGINT/SIGTERM. OP_SAVE and a clean
+   shutdown after changes write saveFile (may be NULL). 0 on error. */
+int fin_daemon_run(Ledger *L, const char *sockPath, const char *saveFile);
+
+/* Answers one request frame into out, as the daemon does; OP_SAVE and
+   OP_LOAD use saveFile. Returns 1 if the ledger changed. Queries take a
+   read section of their own, so row replies match the query's
+   snapshot; call it outside one, or replies to writes (the row count
+   after an add or delete) would come from the older snapshot. */
+int fin_serve_request(Ledger *L, const char *saveFile, RowSet *hits,
+                      int op, const unsigned char *p, size_t n, FinBuf *out);
+
+/* Returns a connected socket, or -1 with errno set. */
+int fin_client_connect(const char *sockPath);
+
+/* Sends one request and waits for its reply; returns the reply status
+   (FIN_ST_*) with its payload in resp, or -1 on I/O error. */
+int fin_client_call(int fd, FinOp op, const unsigned char *payload, size_t n, FinBuf *resp);
+
+/* ----------------------- Session record / replay ------------------ */
+/* A session log holds the operations a session ran (not keystrokes),
+   each framed exactly as a daemon request, after an 8-byte magic.
+   Replaying it pushes every request through fin_serve_request() back to
+   back and reports the latency distribution of each operation. */
+
+typedef struct FinRecorder FinRecorder;
+
+FinRecorder *fin_record_open(const char *fname);        // appends; NULL with errno set
+int fin_record(FinRecorder *r, FinOp op, const unsigned char *payload, size_t n);  // 0 on I/O error
+int fin_record_close(FinRecorder *r);                   // 0 on I/O error
+
+typedef struct {
+    unsigned long long count, totalNs, minNs, maxNs;
+    unsigned long long p50Ns, p90Ns, p99Ns, p999Ns;
+} FinReplayOpStats;
+
+typedef struct {
+    long requests, failed;        // failed: replies other than FIN_ST_OK
+    unsigned long long wallNs;
+    FinReplayOpStats ops[FIN_OPS];
+} FinReplayStats;
+
+/* Replays logFile against L; saves go to saveFile and loads read it
+   back. Returns requests replayed, -1 with errno set if the log cannot
+   be read (EINVAL: not a session log), or FIN_CANCELLED (st then
+   covers the requests that ran). */
+long fin_replay(Ledger *L, const char *logFile, const char *saveFile, FinReplayStats *st);
+int fin_replay_write_json(FILE *f, const FinReplayStats *st);
+
+/* ----------------------- Block cache ------------------------------ */
+/* A byte-budgeted cache of file blocks, keyed by (file id, block), for
+   data read on demand. Sharded, each shard under its own lock; eviction
+   is CLOCK-Pro style (a block turns hot on its second use, one-time
+   scans are evicted first), described in finance_cache.c. */
+
+typedef struct FinCache FinCache;
+typedef struct FinCacheRef FinCacheRef;   // a pinned block
+
+typedef struct {
+    long long budget, bytes, hotBytes;    // bytes include per-block overhead
+    int shards;
+    long blocks, ghosts;                  // ghosts: keys of recently evicted blocks
+    unsigned long long hits, misses, ghostHits, promotions, demotions, evictions;
+} FinCacheStats;
+
+/* Reads a block on a miss: returns a fin_malloc()ed buffer the cache
+   takes over and sets *len, or NULL with errno set. */
+typedef unsigned char *(*FinCacheLoad)(void *ctx, size_t *len);
+
+FinCache *fin_cache_new(long long budget, int shards);  // NULL with errno set
+void fin_cache_free(FinCache *c);                       // no block may be pinned
+unsigned long long fin_cache_file_id(void);             // a key no other file uses
+/* Returns the block, loading it on a miss, pinned until
+   fin_cache_release(*pin); NULL with errno set if load fails. */
+const unsigned char *fin_cache_get(FinCache *c, unsigned long long file, unsigned long long block,
+                                   FinCacheLoad load, void *ctx, size_t *len, FinCacheRef **pin);
+void fin_cache_release(FinCacheRef *pin);
+void fin_cache_drop_file(FinCache *c, unsigned long long file);
+void fin_cache_stats(FinCache *c, FinCacheStats *st);
+int fin_cache_write_stats_json(FILE *f, FinCache *c);
+
+/* A packed ledger read in blocks on demand instead of loaded whole:
+   opening reads only the block index (date range and offset of every
+   block), a scan decodes just the blocks whose dates overlap it, and
+   decoded blocks stay in the cache, so repeated queries over the same
+   period are served from memory. Files saved before the index existed
+   are indexed by walking the block headers; their blocks are never
+   skipped. */
+typedef struct FinPaged FinPaged;
+
+typedef struct {
+    long long rows, fileBytes;
+    long blocks;
+    int firstYear, lastYear;                                  // from the index; 0 if the file has none
+    int hotFrom;                                              // from ledger_save_archive(), else 0
+    unsigned long long scans, blocksScanned, blocksSkipped;   // skipped: outside the scan's dates
+    unsigned long long blocksRead, bytesRead;                 // cache misses that went to the file
+} FinPagedStats;
+
+/* Row callback: idx is the row's position in the file; return nonzero
+   to stop the scan. */
+typedef int (*FinPagedRowFn)(void *ctx, long idx, const Transaction *t);
+
+FinPaged *fin_paged_open(const char *fname, FinCache *cache);  // NULL with errno set (EINVAL: not packed)
+void fin_paged_close(FinPaged *p);
+/* Visits the rows dated y0-m0-d0 .. y1-m1-d1 in file order; returns the
+   rows visited, -1 with errno set (EINVAL: damaged block), or
+   FIN_CANCELLED. */
+long fin_paged_scan(FinPaged *p, int y0, int m0, int d0, int y1, int m1, int d1,
+                    FinPagedRowFn fn, void *ctx);
+void fin_paged_stats(FinPaged *p, FinPagedStats *st);
+
+/* ----------------------- Tiered storage --------------------------- */
+/* Hot/cold tiers for a data file: years before the first hot year live
+   in DATAFILE.archive, a packed ledger read in blocks on demand, and the
+   data file keeps only the hot years, so ledger_load() of it brings in
+   just those. Archived years enter the ledger on first access through
+   fin_tier_fault(); fin_tier_save() writes the hot years to the data
+   file and rewrites the archive only if an archived year changed or
+   more years are archived. Call both outside read sections. */
+
+#define FIN_ARCHIVE_SUFFIX ".archive"
+
+typedef struct FinTier FinTier;
+
+typedef struct {
+    int hotFrom;                      // first year kept in the data file; 0: nothing archived
+    long long archivedRows, archiveBytes;
+    long archiveBlocks;
+    int residentYears;                // archived years now in the ledger
+    long long residentRows;
+    unsigned long long faults, blocksRead, blocksSkipped;
+    long long faultedRows;
+} FinTierStats;
+
+FinTier *fin_tier_open(const char *dataFile);           // NULL with errno set; no archive yet is fine
+void fin_tier_close(FinTier *t);
+int fin_tier_hot_from(const FinTier *t);
+/* Brings the archived rows of years y0..y1 not yet resident into L;
+   returns rows added, -1 with errno set, or FIN_CANCELLED. They are
+   merged by date into the archived-year rows at the front of L, ahead
+   of the first hot row, so a ledger in date order stays in date order:
+   row indexes depend on which years are resident, not on the order they
+   were faulted in, and match the whole ledger once all of them are. */
+int fin_tier_fault(FinTier *t, Ledger *L, int y0, int y1);
+int fin_tier_fault_all(FinTier *t, Ledger *L);
+/* Saves L, archiving every year before hotFrom as well (the hot range
+   only shrinks; pass 0 to keep it); 1 ok, 0 with errno set. */
+int fin_tier_save(FinTier *t, Ledger *L, int hotFrom);
+void fin_tier_stats(FinTier *t, FinTierStats *st);
+
+/* ----------------------- External memory -------------------------- */
+/* Sorting and grouping for ledgers larger than memory. Rows are pushed
+   one at a time and the work stays within a byte budget (0 = no limit):
+   a sorter fills a buffer, sorts it and writes it to a temporary file as
+   a run, then merges the runs k at a time, as many as the budget has
+   read buffers for; an aggregation keeps a hash table of groups and,
+   when it would outgrow the budget, spills the partial sums to files
+   partitioned by key hash and aggregates each partition on its own.
+   Temporary files go to $TMPDIR (or /tmp) and are unlinked as soon as
+   they are created. Budgets below FIN_EXT_MIN_BUDGET are raised to it. */
+
+#define FIN_EXT_MIN_BUDGET (1024 * 1024)
+
+typedef enum { GROUP_CATEGORY = 0, GROUP_MONTH = 1, GROUP_YEAR = 2 } FinGroupKey;
+
+typedef struct {
+    char key[STR_LEN];                // category, YYYY-MM or YYYY
+    long long income, expense;        // cents
+    long long rows;
+} FinGroup;
+
+typedef struct {
+    long long budget;
+    long long rows;                   // rows added
+    long runs, merges;                // sort: runs written, merges (0 if it fit)
+    long spills, partitions;          // aggregation: tables spilled, partitions aggregated
+    long long groups;                 // aggregation: groups produced
+    unsigned long long bytesWritten, bytesRead;   // temporary files
+} FinExtStats;
+
+typedef struct FinExtSort FinExtSort;
+typedef struct FinExtAgg FinExtAgg;
+
+/* Row callback: idx is the row's position in the output (or, for
+   fin_ext_scan, among the file's valid rows); return nonzero to stop. */
+typedef int (*FinExtRowFn)(void *ctx, long long idx, const Transaction *t);
+typedef int (*FinGroupFn)(void *ctx, const FinGroup *g);
+
+/* Visits the valid rows of a data file (text or packed) in file order
+   without loading it; returns the rows visited, -1 with errno set, or
+   FIN_CANCELLED. */
+long long fin_ext_scan(const char *fname, FinExtRowFn fn, void *ctx);
+
+FinExtSort *fin_ext_sort_new(SortKey key, long long budget);   // NULL with errno set
+void fin_ext_sort_free(FinExtSort *s);
+int fin_ext_sort_add(FinExtSort *s, const Transaction *t);      // 1 ok, 0 with errno set
+/* Visits the rows in ledger_sort() order, equal keys in the order they
+   were added; returns the rows visited, -1 with errno set, or
+   FIN_CANCELLED. Call once. */
+long long fin_ext_sort_finish(FinExtSort *s, FinExtRowFn fn, void *ctx);
+void fin_ext_sort_stats(const FinExtSort *s, FinExtStats *st);
+
+FinExtAgg *fin_ext_agg_new(FinGroupKey by, long long budget);  // NULL with errno set
+void fin_ext_agg_free(FinExtAgg *a);
+int fin_ext_agg_add(FinExtAgg *a, const Transaction *t);       // 1 ok, 0 with errno set
+/* Visits the groups in key order; returns their number, -1 with errno
+   set, or FIN_CANCELLED. Call once. */
+long long fin_ext_agg_finish(FinExtAgg *a, FinGroupFn fn, void *ctx);
+void fin_ext_agg_stats(const FinExtAgg *a, FinExtStats *st);
+
+/* ----------------------- LSM store -------------------------------- */
+/* An on-disk store for continuous ingestion that never rewrites the
+   whole ledger: rows go to a write-ahead log and a memtable, which is
+   sorted and flushed to an immutable run file when full; a flush that
+   overfills a level merges runs down (leveled or tiered compaction).
+   Rows are keyed by date plus an insertion sequence number (shown as
+   the row index by fin_lsm_scan). Each run has a fence index (first key
+   of every block) and a bloom filter over its dates, so a one-day
+   lookup reads at most one or two blocks per run whose filter admits
+   the date. A put or delete returns once the log holds it on disk
+   (fsync). One directory per store; calls are serialized internally. */
+
+#define LSM_MAX_LEVELS 8
+
+typedef enum { LSM_LEVELED = 0, LSM_TIERED = 1 } FinLsmPolicy;
+
+/* Used when a store is created; an existing store keeps its own. */
+typedef struct {
+    FinLsmPolicy policy;
+    long memtableRows;            // flush threshold (0 = 65536)
+    int fanout;                   // level size ratio, or runs per tier (0 = 10)
+    int bloomBitsPerKey;          // per distinct date (0 = 10)
+} FinLsmOptions;
+
+typedef struct {
+    FinLsmPolicy policy;
+    int fanout;
+    long memtableRows;
+    int runs[LSM_MAX_LEVELS];
+    long long entries[LSM_MAX_LEVELS], bytes[LSM_MAX_LEVELS];  // tombstones included
+    /* Lifetime I/O accounting (kept in the manifest). */
+    unsigned long long userBytes;     // rows put or deleted, ENTRY bytes each
+    unsigned long long walBytes, flushBytes, compactReadBytes, compactWriteBytes;
+    unsigned long long flushes, compactions;
+    double writeAmp;                  // (wal + flush + compaction writes) / user bytes
+    unsigned long long lookups, scans, runsProbed, bloomSkips, bloomFalsePositives, blocksRead;
+} FinLsmStats;
+
+typedef struct FinLsm FinLsm;
+
+/* Row callback: seq identifies the row for fin_lsm_delete(); return
+   nonzero to stop the scan. */
+typedef int (*FinLsmRowFn)(void *ctx, unsigned long long seq, const Transaction *t);
+
+FinLsm *fin_lsm_open(const char *dir, const FinLsmOptions *opt);  // NULL with errno set
+int fin_lsm_close(FinLsm *db);                          // flushes; 0 on I/O error
+int fin_lsm_put(FinLsm *db, const Transaction *rows, int n, int *rejected);  // rows stored, -1 on I/O error
+int fin_lsm_delete(FinLsm *db, int y, int m, int d, unsigned long long seq);  // 0 on I/O error
+int fin_lsm_flush(FinLsm *db);                          // 0 on I/O error
+int fin_lsm_compact(FinLsm *db);                        // everything into one run; 0 on I/O error
+/* Visits live rows dated y0-m0-d0 .. y1-m1-d1 in date order; returns the
+   rows visited, or -1 on I/O error. A single day uses the bloom filters. */
+long fin_lsm_scan(FinLsm *db, int y0, int m0, int d0, int y1, int m1, int d1,
+                  FinLsmRowFn fn, void *ctx);
+void fin_lsm_stats(FinLsm *db, FinLsmStats *st);
+int fin_lsm_write_stats_json(FILE *f, FinLsm *db);
+
+#endif /* FINANCE_H */
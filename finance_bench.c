@@ -0,0 +1,239 @@
+/*
+  finance_bench.c - benchmarks every libfinance operation at several
+  ledger sizes and prints the timings as JSON.
+
+  For each size a synthetic ledger (fin_generate, fixed seed) is written
+  to a scratch directory and loaded once; each operation then runs a few
+  untimed warmup rounds and is repeated until it has at least -r samples
+  and has run for MIN_SECONDS (capped at MAX_SAMPLES). Results report
+  min, median, mean and p99 latency and rows/s (plus MB/s for load and
+  save; packed load and save are rated against the text size). Keys
+  and order are stable, so the output of two builds can be diffed
+  directly.
+
+  Usage: finance_bench [-s 10000,1000000,10000000] [-r REPS] [-w WARMUP]
+                       [-j THREADS] [-d SCRATCH_DIR] [-o OUT.json]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "finance.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_SIZES   8
+#define MAX_SAMPLES 1000
+#define MIN_SECONDS 0.2
+#define BENCH_SEED  20240601ull
+#define BENCH_CACHE (256ll << 20)    // block cache for the paged ops
+
+typedef struct {
+    Ledger *L;                       // the loaded fixture
+    Ledger *work;                    // scratch copy for operations that modify
+    RowSet rs;
+    const char *fixture, *saveFile;
+    const char *packed;              // the fixture as a packed ledger
+    FinPaged *paged;                 // the packed fixture read on demand, cached
+    long rows;
+    long bytes;                      // fixture size
+} Bench;
+
+typedef struct {
+    const char *name;
+    int (*setup)(Bench *b);          // untimed, before every run (may be NULL)
+    int (*run)(Bench *b);            // 0 on failure
+    int io;                          // report MB/s of the fixture size
+} Op;
+
+/* ----------------------- Operations ------------------------------- */
+
+static int copy_to_work(Bench *b) {
+    ledger_clear(b->work);
+    ledger_read_begin(b->L);
+    int n = ledger_count(b->L), ok = 1;
+    for (int i = 0; i < n && ok; i += BATCH_CHUNK) {
+        int k = n - i < BATCH_CHUNK ? n - i : BATCH_CHUNK;
+        ok = ledger_insert_batch(b->work, ledger_row(b->L, i), k, NULL) == k;
+    }
+    ledger_read_end(b->L);
+    return ok;
+}
+
+static int op_load(Bench *b)         { return ledger_load(b->work, b->fixture) == b->rows; }
+static int op_save(Bench *b)         { return ledger_save(b->L, b->saveFile); }
+static int op_load_packed(Bench *b)  { return ledger_load(b->work, b->packed) == b->rows; }
+static int op_save_packed(Bench *b)  { return ledger_save_packed(b->L, b->saveFile); }
+static int op_sort_date(Bench *b)    { return ledger_sort(b->work, SORT_DATE) == 1; }
+static int op_sort_amount(Bench *b)  { return ledger_sort(b->work, SORT_AMOUNT_DESC) == 1; }
+static int op_list(Bench *b)         { return ledger_select_all(b->L, &b->rs) >= 0; }
+static int op_search_cat(Bench *b)   { return ledger_search_text(b->L, FIELD_CATEGORY, "groc", &b->rs) >= 0; }
+static int op_search_note(Bench *b)  { return ledger_search_text(b->L, FIELD_NOTE, "coffee", &b->rs) >= 0; }
+static int op_search_date(Bench *b)  { return ledger_search_date(b->L, 2020, 6, 15, &b->rs) >= 0; }
+static int op_filter(Bench *b)       { return ledger_filter_expenses(b->L, 100.0, &b->rs) >= 0; }
+
+static int op_chart(Bench *b) {
+    double sums[13];
+    return ledger_monthly_expenses(b->L, 2020, sums) >= 0;
+}
+
+static int op_summary(Bench *b) {
+    double inc, exp;
+    ledger_totals(b->L, &inc, &exp);
+    return inc >= 0.0;
+}
+
+static int op_range_sum(Bench *b) {
+    double inc, exp;
+    return ledger_range_totals(b->L, 2020, 1, 1, 2020, 12, 31, &inc, &exp) >= 0;
+}
+
+static int count_row(void *ctx, long idx, const Transaction *t) {
+    (void)idx; (void)t;
+    ++*(long *)ctx;
+    return 0;
+}
+
+static int op_paged_month(Bench *b) {
+    long n = 0;
+    return fin_paged_scan(b->paged, 2020, 6, 1, 2020, 6, 30, count_row, &n) >= 0;
+}
+
+static const Op OPS[] = {
+    { "load",          NULL,         op_load,        1 },
+    { "save",          NULL,         op_save,        1 },
+    { "load_packed",   NULL,         op_load_packed, 1 },
+    { "save_packed",   NULL,         op_save_packed, 1 },
+    { "sort_date",     copy_to_work, op_sort_date,   0 },
+    { "sort_amount",   copy_to_work, op_sort_amount, 0 },
+    { "list",          NULL,         op_list,        0 },
+    { "search_category", NULL,       op_search_cat,  0 },
+    { "search_note",   NULL,         op_search_note, 0 },
+    { "search_date",   NULL,         op_search_date, 0 },
+    { "filter",        NULL,         op_filter,      0 },
+    { "chart",         NULL,         op_chart,       0 },
+    { "summary",       NULL,         op_summary,     0 },
+    { "range_sum",     NULL,         op_range_sum,   0 },
+    { "paged_month",   NULL,         op_paged_month, 0 },
+};
+#define N_OPS ((int)(sizeof(OPS) / sizeof(OPS[0])))
+
+/* ----------------------- Timing ----------------------------------- */
+
+static int bench_op(FILE *json, Bench *b, const Op *op, int reps, int warmup, int *first) {
+    FinSamples t = {0};
+    unsigned long long spent = 0;
+    for (int k = 0; k < warmup; ++k) {
+        if ((op->setup && !op->setup(b)) || !op->run(b)) return 0;
+    }
+    while (t.n < MAX_SAMPLES && ((int)t.n < reps || spent < MIN_SECONDS * 1e9)) {
+        if (op->setup && !op->setup(b)) { fin_samples_free(&t); return 0; }
+        unsigned long long t0 = fin_clock_ns();
+        if (!op->run(b)) { fin_samples_free(&t); return 0; }
+        unsigned long long dt = fin_clock_ns() - t0;
+        if (!fin_samples_add(&t, dt)) { fin_samples_free(&t); return 0; }
+        spent += dt;
+    }
+    fin_samples_sort(&t);
+    int n = (int)t.n;
+    double mean = (double)spent / n, med = (double)fin_samples_pct(&t, 50), p99 = (double)fin_samples_pct(&t, 99);
+
+    fprintf(stderr, "%8ld rows  %-16s median %10.3f ms  p99 %10.3f ms  (%d runs)\n",
+            b->rows, op->name, med / 1e6, p99 / 1e6, n);
+    fprintf(json, "%s    {\"op\": \"%s\", \"rows\": %ld, \"samples\": %d, "
+                  "\"min_ns\": %llu, \"median_ns\": %.0f, \"mean_ns\": %.0f, \"p99_ns\": %.0f, "
+                  "\"rows_per_s\": %.0f",
+            *first ? "" : ",\n", op->name, b->rows, n,
+            t.ns[0], med, mean, p99, med > 0 ? b->rows / (med / 1e9) : 0.0);
+    if (op->io) fprintf(json, ", \"mb_per_s\": %.1f", med > 0 ? b->bytes / (med / 1e9) / 1e6 : 0.0);
+    fprintf(json, "}");
+    *first = 0;
+    fin_samples_free(&t);
+    return 1;
+}
+
+/* ----------------------- Driver ----------------------------------- */
+
+static int make_fixture(const char *path, long rows, long *bytes) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    GenSpec spec = { BENCH_SEED, rows, 2016, 10, 0 };
+    int ok = fin_generate(f, &spec) == 1;
+    if (ok && fseek(f, 0, SEEK_END) == 0) *bytes = ftell(f);
+    if (fclose(f) != 0) ok = 0;
+    return ok;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "Usage: finance_bench [-s SIZE,SIZE,...] [-r REPS] [-w WARMUP] [-j THREADS]\n"
+        "                     [-d SCRATCH_DIR] [-o OUT.json]\n"
+        "Defaults: -s 10000,1000000,10000000 -r 5 -w 1 -d /tmp; JSON goes to stdout.\n");
+}
+
+int main(int argc, char **argv) {
+    long sizes[MAX_SIZES] = { 10000, 1000000, 10000000 };
+    int nSizes = 3, reps = 5, warmup = 1, threads = 0;
+    const char *dir = "/tmp", *outPath = NULL;
+
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) { usage(); return 2; }
+        const char *v = argv[i + 1];
+        if (strcmp(argv[i], "-s") == 0) {
+            nSizes = 0;
+            for (char *p = (char *)v, *end; *p && nSizes < MAX_SIZES; p = *end ? end + 1 : end) {
+                sizes[nSizes++] = strtol(p, &end, 10);
+                if (end == p || sizes[nSizes - 1] <= 0 || (*end && *end != ',')) { usage(); return 2; }
+            }
+        } else if (strcmp(argv[i], "-r") == 0 && (reps = atoi(v)) > 0) {}
+        else if (strcmp(argv[i], "-w") == 0 && (warmup = atoi(v)) >= 0) {}
+        else if (strcmp(argv[i], "-j") == 0 && (threads = atoi(v)) > 0) {}
+        else if (strcmp(argv[i], "-d") == 0) dir = v;
+        else if (strcmp(argv[i], "-o") == 0) outPath = v;
+        else { usage(); return 2; }
+    }
+    fin_pool_init(threads);                     // start it now so "threads" is accurate
+
+    FILE *json = outPath ? fopen(outPath, "w") : stdout;
+    if (!json) { perror(outPath); return 1; }
+    fprintf(json, "{\n  \"threads\": %d,\n  \"seed\": %llu,\n  \"results\": [\n",
+            fin_pool_threads(), BENCH_SEED);
+
+    char fixture[512], saveFile[512], packed[512];
+    snprintf(fixture, sizeof(fixture), "%s/finance_bench_fixture.txt", dir);
+    snprintf(packed, sizeof(packed), "%s/finance_bench_fixture.pack", dir);
+    snprintf(saveFile, sizeof(saveFile), "%s/finance_bench_save.txt", dir);
+
+    int first = 1, rc = 0;
+    FinCache *cache = fin_cache_new(BENCH_CACHE, fin_pool_threads());
+    for (int s = 0; s < nSizes && !rc; ++s) {
+        Bench b = { ledger_new(), ledger_new(), {0}, fixture, saveFile, packed, NULL, sizes[s], 0 };
+        fprintf(stderr, "Generating %ld rows...\n", sizes[s]);
+        if (!b.L || !b.work || !make_fixture(fixture, sizes[s], &b.bytes)
+            || ledger_load(b.L, fixture) != sizes[s] || !ledger_save_packed(b.L, packed)
+            || !(b.paged = fin_paged_open(packed, cache))) {
+            fprintf(stderr, "Cannot prepare a %ld-row fixture in '%s'.\n", sizes[s], dir);
+            rc = 1;
+        }
+        for (int k = 0; k < N_OPS && !rc; ++k) {
+            if (!bench_op(json, &b, &OPS[k], reps, warmup, &first)) {
+                fprintf(stderr, "%s failed at %ld rows.\n", OPS[k].name, sizes[s]);
+                rc = 1;
+            }
+        }
+        fin_paged_close(b.paged);
+        rowset_free(&b.rs);
+        ledger_free(b.work);
+        ledger_free(b.L);
+    }
+    fin_cache_free(cache);
+    remove(fixture);
+    remove(packed);
+    remove(saveFile);
+
+    fprintf(json, "\n  ]\n}\n");
+    if (outPath && fclose(json) != 0) rc = 1;
+    fin_pool_shutdown();
+    return rc;
+}
@@ -0,0 +1,385 @@
+/*
+  finance_cache.c - sharded block cache (see finance.h).
+
+  Blocks are keyed by (file id, block number) and spread over shards by
+  a hash of the key, each shard with its own lock, hash table and byte
+  budget (the cache budget split evenly).
+
+  Eviction is CLOCK-Pro style. Resident blocks are cold or hot and sit
+  on one clock ring; a new block enters cold, behind the hand. When a
+  shard is over budget the hand sweeps:
+    cold, referenced      promoted to hot (its second use)
+    cold, unreferenced    evicted; its key stays as a ghost
+    hot                   passed over while hot blocks fit HOT_SHARE of
+                          the budget; beyond it a referenced one has its
+                          reference cleared and an unreferenced one is
+                          demoted to cold
+  A miss on a ghost key means the block came back within one sweep, so
+  it is loaded straight into the hot set. Ghosts are bounded by the
+  resident count. Blocks touched once (a long scan) only ever occupy
+  the cold share and are evicted on the hand's first visit, so scans do
+  not flush the working set. Pinned blocks are skipped by the hand.
+*/
+
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define MAX_SHARDS   64
+#define MIN_BUCKETS  64
+#define MIN_GHOSTS   16
+#define HOT_SHARE    0.75               // of a shard's budget
+
+enum { CACHE_COLD, CACHE_HOT, CACHE_GHOST };
+
+typedef struct CacheShard CacheShard;
+
+struct FinCacheRef {
+    unsigned long long file, block;
+    struct FinCacheRef *hnext;        // hash chain
+    struct FinCacheRef *prev, *next;  // clock ring, or ghost FIFO
+    CacheShard *shard;
+    unsigned char *data;              // NULL for a ghost
+    size_t len;
+    int pins;
+    unsigned char state, ref, dead;   // dead: dropped while pinned
+};
+typedef struct FinCacheRef Entry;
+
+struct CacheShard {
+    pthread_mutex_t mu;
+    Entry **buckets;
+    size_t nBuckets, nEntries;        // resident and ghost
+    Entry *hand;                      // clock ring of resident blocks
+    Entry ghosts;                     // ghost FIFO sentinel, oldest at next
+    long resident, nGhosts;
+    long long bytes, hotBytes, budget, hotMax;
+    unsigned long long hits, misses, ghostHits, promotions, demotions, evictions;
+};
+
+struct FinCache {
+    int nShards;
+    long long budget;
+    CacheShard shards[];
+};
+
+static atomic_ullong nextFile = 1;
+
+/* ----------------------- Hash table ------------------------------- */
+
+static unsigned long long mix64(unsigned long long x) {
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ull;
+    return x ^ (x >> 33);
+}
+
+static unsigned long long key_hash(unsigned long long file, unsigned long long block) {
+    return mix64(file * 0x9e3779b97f4a7c15ull ^ block);
+}
+
+static Entry **slot_of(CacheShard *s, unsigned long long file, unsigned long long block) {
+    Entry **p = &s->buckets[(key_hash(file, block) >> 8) & (s->nBuckets - 1)];
+    while (*p && ((*p)->file != file || (*p)->block != block)) p = &(*p)->hnext;
+    return p;
+}
+
+static int grow(CacheShard *s) {
+    size_t n = s->nBuckets * 2;
+    Entry **b = fin_calloc(MEM_CACHE, n, sizeof(Entry *));
+    if (!b) return 0;
+    for (size_t k = 0; k < s->nBuckets; ++k) {
+        for (Entry *e = s->buckets[k], *next; e; e = next) {
+            next = e->hnext;
+            Entry **p = &b[(key_hash(e->file, e->block) >> 8) & (n - 1)];
+            e->hnext = *p;
+            *p = e;
+        }
+    }
+    fin_free(s->buckets);
+    s->buckets = b;
+    s->nBuckets = n;
+    return 1;
+}
+
+static void unhash(CacheShard *s, Entry *e) {
+    Entry **p = slot_of(s, e->file, e->block);
+    if (*p == e) { *p = e->hnext; s->nEntries--; }
+}
+
+/* ----------------------- Lists ------------------------------------ */
+
+static void ring_insert(CacheShard *s, Entry *e) {   // just behind the hand
+    if (!s->hand) {
+        e->prev = e->next = e;
+        s->hand = e;
+        return;
+    }
+    e->next = s->hand;
+    e->prev = s->hand->prev;
+    e->prev->next = e;
+    s->hand->prev = e;
+}
+
+static void ring_remove(CacheShard *s, Entry *e) {
+    if (e->next == e) s->hand = NULL;
+    else {
+        if (s->hand == e) s->hand = e->next;
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+static void ghost_push(CacheShard *s, Entry *e) {
+    e->state = CACHE_GHOST;
+    e->next = &s->ghosts;
+    e->prev = s->ghosts.prev;
+    e->prev->next = e;
+    s->ghosts.prev = e;
+    s->nGhosts++;
+}
+
+static void ghost_remove(CacheShard *s, Entry *e) {
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+    e->prev = e->next = NULL;
+    s->nGhosts--;
+}
+
+static long long cost(const Entry *e) { return (long long)(e->len + sizeof(Entry)); }
+
+/* ----------------------- Eviction --------------------------------- */
+
+static void trim_ghosts(CacheShard *s) {
+    long cap = s->resident > MIN_GHOSTS ? s->resident : MIN_GHOSTS;
+    while (s->nGhosts > cap) {
+        Entry *g = s->ghosts.next;
+        ghost_remove(s, g);
+        unhash(s, g);
+        fin_free(g);
+    }
+}
+
+static void evict(CacheShard *s, Entry *e) {
+    ring_remove(s, e);
+    s->bytes -= cost(e);
+    if (e->state == CACHE_HOT) s->hotBytes -= cost(e);
+    s->resident--;
+    s->evictions++;
+    fin_free(e->data);
+    e->data = NULL;
+    e->len = 0;
+    e->ref = 0;
+    ghost_push(s, e);
+}
+
+/* Runs the hand until the shard fits its budget or only pinned blocks
+   are left (three passes: clear, demote, evict). */
+static void make_room(CacheShard *s) {
+    long steps = 3 * s->resident + 3;
+    while (s->bytes > s->budget && s->hand && steps-- > 0) {
+        Entry *e = s->hand;
+        s->hand = e->next;
+        if (e->pins) continue;
+        if (e->state == CACHE_HOT) {
+            if (s->hotBytes <= s->hotMax) continue;
+            if (e->ref) e->ref = 0;
+            else { e->state = CACHE_COLD; s->hotBytes -= cost(e); s->demotions++; }
+        } else if (e->ref) {
+            e->ref = 0;
+            e->state = CACHE_HOT;
+            s->hotBytes += cost(e);
+            s->promotions++;
+        } else {
+            evict(s, e);
+        }
+    }
+    trim_ghosts(s);
+}
+
+/* ----------------------- Public API ------------------------------- */
+
+FinCache *fin_cache_new(long long budget, int shards) {
+    if (shards < 1) shards = 1;
+    if (shards > MAX_SHARDS) shards = MAX_SHARDS;
+    if (budget < 0) budget = 0;
+    FinCache *c = fin_calloc(MEM_CACHE, 1, sizeof(FinCache) + (size_t)shards * sizeof(CacheShard));
+    if (!c) { errno = ENOMEM; return NULL; }
+    c->budget = budget;
+    for (int k = 0; k < shards; ++k) {
+        CacheShard *s = &c->shards[k];
+        pthread_mutex_init(&s->mu, NULL);
+        c->nShards = k + 1;               // what fin_cache_free() may tear down
+        s->budget = budget / shards;
+        s->hotMax = (long long)((double)s->budget * HOT_SHARE);
+        s->ghosts.next = s->ghosts.prev = &s->ghosts;
+        s->nBuckets = MIN_BUCKETS;
+        if (!(s->buckets = fin_calloc(MEM_CACHE, MIN_BUCKETS, sizeof(Entry *)))) {
+            fin_cache_free(c);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    return c;
+}
+
+void fin_cache_free(FinCache *c) {
+    if (!c) return;
+    for (int k = 0; k < c->nShards; ++k) {
+        CacheShard *s = &c->shards[k];
+        for (size_t b = 0; s->buckets && b < s->nBuckets; ++b) {
+            for (Entry *e = s->buckets[b], *next; e; e = next) {
+                next = e->hnext;
+                fin_free(e->data);
+                fin_free(e);
+            }
+        }
+        fin_free(s->buckets);
+        pthread_mutex_destroy(&s->mu);
+    }
+    fin_free(c);
+}
+
+unsigned long long fin_cache_file_id(void) {
+    return atomic_fetch_add(&nextFile, 1);
+}
+
+const unsigned char *fin_cache_get(FinCache *c, unsigned long long file, unsigned long long block,
+                                   FinCacheLoad load, void *ctx, size_t *len, FinCacheRef **pin) {
+    CacheShard *s = &c->shards[key_hash(file, block) % (unsigned long long)c->nShards];
+    pthread_mutex_lock(&s->mu);
+    Entry *e = *slot_of(s, file, block);
+    if (e && e->data) {
+        s->hits++;
+        e->ref = 1;
+        e->pins++;
+        pthread_mutex_unlock(&s->mu);
+        *len = e->len;
+        *pin = e;
+        return e->data;
+    }
+    s->misses++;
+    pthread_mutex_unlock(&s->mu);
+
+    size_t n = 0;
+    unsigned char *data = load(ctx, &n);   // outside the lock; a racing miss loads it too
+    if (!data) return NULL;
+
+    pthread_mutex_lock(&s->mu);
+    Entry **p = slot_of(s, file, block);
+    if ((e = *p) != NULL && e->data) {      // lost the race: use the other copy
+        fin_free(data);
+        e->ref = 1;
+    } else {
+        if (e) {
+            ghost_remove(s, e);
+            e->state = CACHE_HOT;
+            s->ghostHits++;
+        } else if (!(e = fin_calloc(MEM_CACHE, 1, sizeof(Entry)))) {
+            pthread_mutex_unlock(&s->mu);
+            fin_free(data);
+            errno = ENOMEM;
+            return NULL;
+        } else {
+            e->file = file;
+            e->block = block;
+            e->shard = s;
+            e->state = CACHE_COLD;
+            e->hnext = *p;
+            *p = e;
+            if (++s->nEntries > s->nBuckets) grow(s);   // a failed grow only lengthens chains
+        }
+        e->data = data;
+        e->len = n;
+        e->ref = 0;
+        ring_insert(s, e);
+        s->resident++;
+        s->bytes += cost(e);
+        if (e->state == CACHE_HOT) s->hotBytes += cost(e);
+    }
+    e->pins++;
+    make_room(s);
+    pthread_mutex_unlock(&s->mu);
+    *len = e->len;
+    *pin = e;
+    return e->data;
+}
+
+void fin_cache_release(FinCacheRef *e) {
+    if (!e) return;
+    CacheShard *s = e->shard;
+    pthread_mutex_lock(&s->mu);
+    if (--e->pins == 0 && e->dead) {
+        fin_free(e->data);
+        fin_free(e);
+    } else if (s->bytes > s->budget) {
+        make_room(s);
+    }
+    pthread_mutex_unlock(&s->mu);
+}
+
+void fin_cache_drop_file(FinCache *c, unsigned long long file) {
+    for (int k = 0; k < c->nShards; ++k) {
+        CacheShard *s = &c->shards[k];
+        pthread_mutex_lock(&s->mu);
+        for (size_t b = 0; b < s->nBuckets; ++b) {
+            Entry **p = &s->buckets[b];
+            while (*p) {
+                Entry *e = *p;
+                if (e->file != file) { p = &e->hnext; continue; }
+                *p = e->hnext;
+                s->nEntries--;
+                if (e->state == CACHE_GHOST) {
+                    ghost_remove(s, e);
+                    fin_free(e);
+                    continue;
+                }
+                ring_remove(s, e);
+                s->resident--;
+                s->bytes -= cost(e);
+                if (e->state == CACHE_HOT) s->hotBytes -= cost(e);
+                if (e->pins) e->dead = 1;
+                else { fin_free(e->data); fin_free(e); }
+            }
+        }
+        pthread_mutex_unlock(&s->mu);
+    }
+}
+
+void fin_cache_stats(FinCache *c, FinCacheStats *st) {
+    memset(st, 0, sizeof(*st));
+    st->budget = c->budget;
+    st->shards = c->nShards;
+    for (int k = 0; k < c->nShards; ++k) {
+        CacheShard *s = &c->shards[k];
+        pthread_mutex_lock(&s->mu);
+        st->bytes += s->bytes;
+        st->hotBytes += s->hotBytes;
+        st->blocks += s->resident;
+        st->ghosts += s->nGhosts;
+        st->hits += s->hits;
+        st->misses += s->misses;
+        st->ghostHits += s->ghostHits;
+        st->promotions += s->promotions;
+        st->demotions += s->demotions;
+        st->evictions += s->evictions;
+        pthread_mutex_unlock(&s->mu);
+    }
+}
+
+int fin_cache_write_stats_json(FILE *f, FinCache *c) {
+    FinCacheStats s;
+    fin_cache_stats(c, &s);
+    unsigned long long lookups = s.hits + s.misses;
+    fprintf(f, "{\"budget_bytes\": %lld, \"shards\": %d, \"bytes\": %lld, \"hot_bytes\": %lld, "
+               "\"blocks\": %ld, \"ghosts\": %ld, \"hits\": %llu, \"misses\": %llu, \"hit_ratio\": %.4f, "
+               "\"ghost_hits\": %llu, \"promotions\": %llu, \"demotions\": %llu, \"evictions\": %llu}\n",
+            s.budget, s.shards, s.bytes, s.hotBytes, s.blocks, s.ghosts, s.hits, s.misses,
+            lookups ? (double)s.hits / (double)lookups : 0.0, s.ghostHits, s.promotions, s.demotions,
+            s.evictions);
+    return !ferror(f);
+}
@@ -0,0 +1,592 @@
+/*
+  finance_daemon.c - resident daemon serving one Ledger over a Unix
+  domain socket, plus the matching client calls (see finance.h).
+
+  The daemon is a single-threaded epoll loop: sockets are non-blocking,
+  every complete request frame in a connection's input buffer is
+  answered in order, and replies are queued per connection and written
+  as the socket allows. A connection whose queued replies pass
+  MAX_QUEUED is not read, and its buffered frames wait, until they
+  drain. A client that shuts down its write side still gets the replies
+  to the frames it sent before; the connection closes once they are
+  flushed. Out of file descriptors, the listener is paused until a
+  connection closes or ACCEPT_RETRY_MS pass. The ledger is only touched
+  from the loop, so no locking is needed.
+
+  Wire format (all integers little-endian):
+    request:  u32 len, u8 op, payload[len-1]
+    reply:    u32 len, u8 status, payload[len-1]   status: FIN_ST_*
+
+    op             request payload              reply payload
+    OP_PING        -                            -
+    OP_ADD         row record (BIN_ROW_LEN)     u32 row count
+    OP_LIST        -                            rows
+    OP_SEARCH_TEXT u8 field, text bytes         rows
+    OP_SEARCH_DATE u16 year, u8 month, u8 day   rows
+    OP_FILTER      f64 threshold                rows
+    OP_CHART       u16 year                     f64 sums[12]
+    OP_SUMMARY     -                            f64 income, f64 expense
+    OP_SAVE        -                            -
+    OP_SORT        u8 key (SortKey)             -
+    OP_DELETE      u32 row index                u32 row count
+    OP_LOAD        -                            u32 row count  (re-reads the data file)
+    OP_RANGE_SUM   u16 y, u8 m, u8 d (from),    u32 rows, f64 income, f64 expense
+                   u16 y, u8 m, u8 d (to)
+    OP_PAGE        u32 first, u8 op, payload    rows, starting at match first
+                   (op: one of the four above that reply with rows)
+
+  "rows" is u32 total matches, u32 count, then count row records in the
+  binary writer's row format (fin_encode_row): matches first.. of the
+  query, at most FIN_PAGE_ROWS of them, so no frame in either direction
+  exceeds MAX_FRAME. A client wanting more sends OP_PAGE for the next
+  slice. The daemon keeps each connection's last row result with the
+  snapshot it was taken from, so an OP_PAGE for the same query and a
+  first past 0 continues it: the pages add up to one consistent result
+  even if writes land in between, and the query runs once. first 0, or
+  another query, starts over. fin_serve_request() holds no results, so
+  its callers re-run the query for each page.
+*/
+
+#define _GNU_SOURCE
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#define MAX_FRAME   (1 << 20)        // largest request or reply
+#define MAX_EVENTS  64
+#define READ_CHUNK  65536
+#define MAX_QUEUED  (4 * MAX_FRAME)  // reply bytes queued before a connection is not read
+#define MAX_CURSORS 32               // connections holding a result (and a reader slot)
+#define ACCEPT_RETRY_MS 100
+
+const char *const FIN_OP_NAMES[FIN_OPS] = {
+    "ping", "add", "list", "search_text", "search_date", "filter", "chart",
+    "summary", "save", "sort", "delete", "load", "range_sum", "page"
+};
+
+/* ----------------------- Buffers ---------------------------------- */
+
+int finbuf_reserve(FinBuf *b, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + n) cap *= 2;
+        unsigned char *q = fin_realloc(MEM_DAEMON, b->data, cap);
+        if (!q) return 0;
+        b->data = q;
+        b->cap = cap;
+    }
+    return 1;
+}
+
+int finbuf_put(FinBuf *b, const void *p, size_t n) {
+    if (!finbuf_reserve(b, n)) return 0;
+    if (n) memcpy(b->data + b->len, p, n);
+    b->len += n;
+    return 1;
+}
+
+int finbuf_put_le(FinBuf *b, unsigned long long v, int bytes) {
+    unsigned char tmp[8];
+    for (int k = 0; k < bytes; ++k) { tmp[k] = (unsigned char)(v & 0xff); v >>= 8; }
+    return finbuf_put(b, tmp, (size_t)bytes);
+}
+
+int finbuf_put_f64(FinBuf *b, double v) {
+    unsigned long long u;
+    memcpy(&u, &v, sizeof(u));
+    return finbuf_put_le(b, u, 8);
+}
+
+void finbuf_free(FinBuf *b) {
+    fin_free(b->data);
+    b->data = NULL;
+    b->len = b->cap = 0;
+}
+
+unsigned long long fin_get_le(const unsigned char *p, int bytes) {
+    unsigned long long v = 0;
+    for (int k = bytes - 1; k >= 0; --k) v = (v << 8) | p[k];
+    return v;
+}
+
+double fin_get_f64(const unsigned char *p) {
+    unsigned long long u = fin_get_le(p, 8);
+    double v;
+    memcpy(&v, &u, sizeof(v));
+    return v;
+}
+
+/* ----------------------- Request handling ------------------------- */
+
+/* A connection's last row result, for OP_PAGE. */
+typedef struct {
+    LedgerSnapshot *snap;            // NULL: none held
+    RowSet rows;
+    int op;
+    FinBuf query;                    // the query's payload
+} Cursor;
+
+typedef struct {
+    int fd;
+    FinBuf in, out;
+    size_t outOff;                   // bytes of out already sent
+    int eof;                         // the client shut down its write side
+    Cursor cur;
+} Conn;
+
+static int nCursors;                 // cursors holding a snapshot
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void on_stop_signal(int sig) { (void)sig; stopRequested = 1; }
+
+/* Reserves the reply header; reply_end() fills in the length. */
+static size_t reply_begin(FinBuf *out, int status) {
+    size_t at = out->len;
+    finbuf_put_le(out, 0, 4);
+    finbuf_put_le(out, (unsigned)status, 1);
+    return at;
+}
+
+/* A reply that would exceed MAX_FRAME is replaced by FIN_ST_FAILED. */
+static void reply_end(FinBuf *out, size_t at) {
+    unsigned long long n = out->len - at - 4;
+    if (n > MAX_FRAME) {
+        out->len = at + 5;
+        out->data[at + 4] = FIN_ST_FAILED;
+        n = 1;
+    }
+    for (int k = 0; k < 4; ++k) { out->data[at + k] = (unsigned char)(n & 0xff); n >>= 8; }
+}
+
+/* Matches first.. of a query, at most FIN_PAGE_ROWS of them. */
+static void reply_rows(FinBuf *out, const Ledger *L, const RowSet *rs, int found, int first) {
+    if (found < 0) { reply_end(out, reply_begin(out, FIN_ST_FAILED)); return; }
+    int end = first < rs->count ? rs->count : first;
+    if (end - first > FIN_PAGE_ROWS) end = first + FIN_PAGE_ROWS;
+    size_t at = reply_begin(out, FIN_ST_OK);
+    unsigned char rec[BIN_ROW_LEN];
+    finbuf_put_le(out, (unsigned)rs->count, 4);
+    finbuf_put_le(out, (unsigned)(end - first), 4);
+    if (!finbuf_reserve(out, (size_t)(end - first) * BIN_ROW_LEN)) {
+        out->len = at;
+        reply_end(out, reply_begin(out, FIN_ST_FAILED));
+        return;
+    }
+    for (int k = first; k < end; ++k) {
+        fin_encode_row(rec, rs->ids[k], ledger_row(L, rs->ids[k]));
+        finbuf_put(out, rec, BIN_ROW_LEN);
+    }
+    reply_end(out, at);
+}
+
+static int is_row_query(int op) {
+    return op == OP_LIST || op == OP_SEARCH_TEXT || op == OP_SEARCH_DATE || op == OP_FILTER;
+}
+
+/* Whether p[0..n) is a well-formed payload for row query op. */
+static int query_ok(int op, const unsigned char *p, size_t n) {
+    switch (op) {
+        case OP_LIST:        return 1;
+        case OP_SEARCH_TEXT: return n >= 1 && (p[0] == FIELD_CATEGORY || p[0] == FIELD_NOTE);
+        case OP_SEARCH_DATE: return n == 4;
+        case OP_FILTER:      return n == 8;
+    }
+    return 0;
+}
+
+/* Runs a row query with a payload query_ok() accepted. */
+static int run_query(const Ledger *L, int op, const unsigned char *p, size_t n, RowSet *rs) {
+    switch (op) {
+        case OP_SEARCH_TEXT: {
+            char q[STR_LEN];
+            size_t qn = (n - 1 < STR_LEN - 1) ? n - 1 : STR_LEN - 1;
+            memcpy(q, p + 1, qn);
+            q[qn] = '\0';
+            return ledger_search_text(L, (SearchField)p[0], q, rs);
+        }
+        case OP_SEARCH_DATE: return ledger_search_date(L, (int)fin_get_le(p, 2), p[2], p[3], rs);
+        case OP_FILTER:      return ledger_filter_expenses(L, fin_get_f64(p), rs);
+        default:             return ledger_select_all(L, rs);
+    }
+}
+
+/* first: the first match of a row reply to send (OP_PAGE). */
+static int serve(Ledger *L, const char *saveFile, RowSet *hits,
+                 int op, const unsigned char *p, size_t n, FinBuf *out, int first) {
+    size_t at;
+    int changed = 0;
+
+    switch (op) {
+        case OP_PING:
+            at = reply_begin(out, FIN_ST_OK);
+            break;
+        case OP_ADD: {
+            Transaction t;
+            if (n != BIN_ROW_LEN) { at = reply_begin(out, FIN_ST_BAD_REQUEST); break; }
+            fin_decode_row(p, NULL, &t);
+            if (ledger_insert_batch(L, &t, 1, NULL) != 1) { at = reply_begin(out, FIN_ST_FAILED); break; }
+            changed = 1;
+            at = reply_begin(out, FIN_ST_OK);
+            finbuf_put_le(out, (unsigned)ledger_count(L), 4);
+            break;
+        }
+        case OP_LIST:
+        case OP_SEARCH_TEXT:
+        case OP_SEARCH_DATE:
+        case OP_FILTER:
+            if (!query_ok(op, p, n)) { at = reply_begin(out, FIN_ST_BAD_REQUEST); break; }
+            reply_rows(out, L, hits, run_query(L, op, p, n, hits), first);
+            return 0;
+        case OP_CHART: {
+            double sums[13];
+            if (n != 2) { at = reply_begin(out, FIN_ST_BAD_REQUEST); break; }
+            ledger_monthly_expenses(L, (int)fin_get_le(p, 2), sums);
+            at = reply_begin(out, FIN_ST_OK);
+            for (int m = 1; m <= 12; ++m) finbuf_put_f64(out, sums[m]);
+            break;
+        }
+        case OP_SUMMARY: {
+            double income, expense;
+            ledger_totals(L, &income, &expense);
+            at = reply_begin(out, FIN_ST_OK);
+            finbuf_put_f64(out, income);
+            finbuf_put_f64(out, expense);
+            break;
+        }
+        case OP_SAVE:
+            at = reply_begin(out, (saveFile && ledger_save(L, saveFile)) ? FIN_ST_OK : FIN_ST_FAILED);
+            break;
+        case OP_SORT:
+            if (n != 1 || (p[0] != SORT_DATE && p[0] != SORT_AMOUNT_DESC)) { at = reply_begin(out, FIN_ST_BAD_REQUEST); break; }
+            changed = ledger_sort(L, (SortKey)p[0]) == 1;
+            at = reply_begin(out, changed ? FIN_ST_OK : FIN_ST_FAILED);
+            break;
+        case OP_DELETE:
+            if (n != 4) { at = reply_begin(out, FIN_ST_BAD_REQUEST); break; }
+            changed = ledger_delete(L, (int)fin_get_le(p, 4));
+            at = reply_begin(out, changed ? FIN_ST_OK : FIN_ST_FAILED);
+            if (changed) finbuf_put_le(out, (unsigned)ledger_count(L), 4);
+            break;
+        case OP_RANGE_SUM: {
+            double income, expense;
+            if (n != 8) { at = reply_begin(out, FIN_ST_BAD_REQUEST); break; }
+            int rows = ledger_range_totals(L, (int)fin_get_le(p, 2), p[2], p[3],
+                                           (int)fin_get_le(p + 4, 2), p[6], p[7], &income, &expense);
+            if (rows < 0) { at = reply_begin(out, FIN_ST_FAILED); break; }
+            at = reply_begin(out, FIN_ST_OK);
+            finbuf_put_le(out, (unsigned)rows, 4);
+            finbuf_put_f64(out, income);
+            finbuf_put_f64(out, expense);
+            break;
+        }
+        case OP_LOAD:
+            if (!saveFile || ledger_load(L, saveFile) < 0) { at = reply_begin(out, FIN_ST_FAILED); break; }
+            at = reply_begin(out, FIN_ST_OK);
+            finbuf_put_le(out, (unsigned)ledger_count(L), 4);
+            break;
+        default:
+            at = reply_begin(out, FIN_ST_BAD_REQUEST);
+            break;
+    }
+    reply_end(out, at);
+    return changed;
+}
+
+/* Replaces an OP_PAGE request by the query it wraps; 0 if malformed. */
+static int unwrap_page(int *op, const unsigned char **p, size_t *n, int *first) {
+    if (*n < 5 || fin_get_le(*p, 4) > INT_MAX || !is_row_query((*p)[4])) return 0;
+    *first = (int)fin_get_le(*p, 4);
+    *op = (*p)[4];
+    *p += 5;
+    *n -= 5;
+    return 1;
+}
+
+/* Queries run in a read section of their own, so row replies are
+   encoded from the snapshot the query ran on; writes run outside one,
+   so the row count they reply with is the one they published. */
+int fin_serve_request(Ledger *L, const char *saveFile, RowSet *hits,
+                      int op, const unsigned char *p, size_t n, FinBuf *out) {
+    int first = 0;
+    if (op == OP_ADD || op == OP_DELETE || op == OP_SORT || op == OP_LOAD)
+        return serve(L, saveFile, hits, op, p, n, out, 0);
+    if (op == OP_PAGE && !unwrap_page(&op, &p, &n, &first)) {
+        reply_end(out, reply_begin(out, FIN_ST_BAD_REQUEST));
+        return 0;
+    }
+    ledger_read_begin(L);
+    int changed = serve(L, saveFile, hits, op, p, n, out, first);
+    ledger_read_end(L);
+    return changed;
+}
+
+static void cursor_drop(Cursor *cu) {
+    if (!cu->snap) return;
+    ledger_snapshot_release(cu->snap);
+    cu->snap = NULL;
+    nCursors--;
+}
+
+/* Answers a row query, or an OP_PAGE of one, from the connection's
+   cursor: a continuation reads the held result on its snapshot, a new
+   query replaces it. Without a free cursor or reader slot, or memory to
+   keep the query, it is answered as fin_serve_request() would. */
+static void conn_query(Conn *c, Ledger *L, RowSet *hits, int op, const unsigned char *p, size_t n) {
+    Cursor *cu = &c->cur;
+    int first = 0, wrapped = op == OP_PAGE;
+    if (wrapped && !unwrap_page(&op, &p, &n, &first)) {
+        reply_end(&c->out, reply_begin(&c->out, FIN_ST_BAD_REQUEST));
+        return;
+    }
+    if (!query_ok(op, p, n)) {
+        reply_end(&c->out, reply_begin(&c->out, FIN_ST_BAD_REQUEST));
+        return;
+    }
+    int found;
+    if (cu->snap && first > 0 && op == cu->op && n == cu->query.len && (!n || memcmp(p, cu->query.data, n) == 0)) {
+        ledger_read_begin_at(L, cu->snap);
+        found = cu->rows.count;
+    } else {
+        cursor_drop(cu);
+        cu->query.len = 0;
+        if (nCursors < MAX_CURSORS && finbuf_put(&cu->query, p, n) && (cu->snap = ledger_snapshot(L))) {
+            nCursors++;
+            cu->op = op;
+            ledger_read_begin_at(L, cu->snap);
+            found = run_query(L, op, p, n, &cu->rows);
+        } else {
+            ledger_read_begin(L);
+            found = run_query(L, op, p, n, hits);
+            reply_rows(&c->out, L, hits, found, first);
+            ledger_read_end(L);
+            return;
+        }
+    }
+    reply_rows(&c->out, L, &cu->rows, found, first);
+    ledger_read_end(L);
+    if (found < 0 || first + FIN_PAGE_ROWS >= cu->rows.count) cursor_drop(cu);   // nothing left to page
+}
+
+static void conn_close(int ep, Conn *c) {
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    cursor_drop(&c->cur);
+    rowset_free(&c->cur.rows);
+    finbuf_free(&c->cur.query);
+    finbuf_free(&c->in);
+    finbuf_free(&c->out);
+    fin_free(c);
+}
+
+/* Sends as much queued reply data as the socket takes; 0 on error. */
+static int conn_flush(int ep, Conn *c) {
+    while (c->outOff < c->out.len) {
+        ssize_t w = send(c->fd, c->out.data + c->outOff, c->out.len - c->outOff, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return 0;
+        }
+        c->outOff += (size_t)w;
+    }
+    if (c->outOff == c->out.len) { c->out.len = 0; c->outOff = 0; }
+    int readable = !c->eof && c->out.len - c->outOff <= MAX_QUEUED;
+    struct epoll_event ev = { .events = (readable ? EPOLLIN : 0) | (c->out.len ? EPOLLOUT : 0), .data.ptr = c };
+    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+    return 1;
+}
+
+/* Reads what is available; 0 to close. */
+static int conn_read(Conn *c) {
+    unsigned char chunk[READ_CHUNK];
+    while (!c->eof) {
+        ssize_t r = recv(c->fd, chunk, sizeof(chunk), 0);
+        if (r == 0) { c->eof = 1; break; }
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return 0;
+        }
+        if (!finbuf_put(&c->in, chunk, (size_t)r)) return 0;
+    }
+    return 1;
+}
+
+/* Whether a whole frame is buffered. */
+static int conn_pending(const Conn *c) {
+    return c->in.len >= 4 && c->in.len - 4 >= (size_t)fin_get_le(c->in.data, 4);
+}
+
+/* Answers complete frames until the queued replies pass MAX_QUEUED; 0
+   to close. At end of input the frames already received are still
+   answered. */
+static int conn_answer(Conn *c, Ledger *L, const char *saveFile, RowSet *hits, int *dirty) {
+    size_t off = 0;
+    while (c->in.len - off >= 4 && c->out.len - c->outOff <= MAX_QUEUED) {
+        size_t n = (size_t)fin_get_le(c->in.data + off, 4);
+        if (n == 0 || n > MAX_FRAME) return 0;
+        if (c->in.len - off - 4 < n) break;
+        const unsigned char *frame = c->in.data + off + 4;
+        if (is_row_query(frame[0]) || frame[0] == OP_PAGE) conn_query(c, L, hits, frame[0], frame + 1, n - 1);
+        else *dirty |= fin_serve_request(L, saveFile, hits, frame[0], frame + 1, n - 1, &c->out);
+        off += 4 + n;
+    }
+    if (off) {
+        memmove(c->in.data, c->in.data + off, c->in.len - off);
+        c->in.len -= off;
+    }
+    return 1;
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) { errno = ENAMETOOLONG; return -1; }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);                                   // stale socket from a previous run
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int fin_daemon_run(Ledger *L, const char *sockPath, const char *saveFile) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal;                 // no SA_RESTART: epoll_wait returns EINTR
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    stopRequested = 0;
+
+    int lfd = listen_unix(sockPath);
+    if (lfd < 0) return 0;
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) { close(lfd); return 0; }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+
+    RowSet hits = {0};
+    int dirty = 0, ok = 1, acceptPaused = 0;
+    struct epoll_event events[MAX_EVENTS];
+
+    nCursors = 0;
+    while (!stopRequested) {
+        int n = epoll_wait(ep, events, MAX_EVENTS, acceptPaused ? ACCEPT_RETRY_MS : -1), closed = 0;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = 0;
+            break;
+        }
+        for (int k = 0; k < n; ++k) {
+            Conn *c = events[k].data.ptr;
+            if (!c) {
+                int cfd;
+                while ((cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0 || errno == EINTR || errno == ECONNABORTED) {
+                    if (cfd < 0) continue;
+                    Conn *nc = fin_calloc(MEM_DAEMON, 1, sizeof(*nc));
+                    if (!nc) { close(cfd); continue; }
+                    nc->fd = cfd;
+                    struct epoll_event cev = { .events = EPOLLIN, .data.ptr = nc };
+                    epoll_ctl(ep, EPOLL_CTL_ADD, cfd, &cev);
+                }
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    struct epoll_event lev = { .events = 0, .data.ptr = NULL };   // level-triggered: would spin
+                    epoll_ctl(ep, EPOLL_CTL_MOD, lfd, &lev);
+                    acceptPaused = 1;
+                }
+                continue;
+            }
+            int alive = 1;
+            if (events[k].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) alive = conn_read(c);
+            if (alive) alive = conn_answer(c, L, saveFile, &hits, &dirty);
+            while (alive && (alive = conn_flush(ep, c)) && !c->out.len && conn_pending(c))
+                alive = conn_answer(c, L, saveFile, &hits, &dirty);   // drained: answer what waited
+            if (alive && c->eof && !c->out.len && !conn_pending(c)) alive = 0;   // all answered
+            if (!alive) { conn_close(ep, c); closed = 1; }
+        }
+        if (acceptPaused && (closed || n == 0)) {
+            struct epoll_event lev = { .events = EPOLLIN, .data.ptr = NULL };
+            epoll_ctl(ep, EPOLL_CTL_MOD, lfd, &lev);
+            acceptPaused = 0;
+        }
+    }
+
+    close(ep);                                      // open connections are dropped with the process
+    close(lfd);
+    unlink(sockPath);
+    rowset_free(&hits);
+    if (dirty && saveFile && !ledger_save(L, saveFile)) ok = 0;
+    return ok;
+}
+
+/* ----------------------- Client ----------------------------------- */
+
+int fin_client_connect(const char *sockPath) {
+    struct sockaddr_un addr;
+    if (strlen(sockPath) >= sizeof(addr.sun_path)) { errno = ENAMETOOLONG; return -1; }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sockPath);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+    return fd;
+}
+
+static int write_all(int fd, const unsigned char *p, size_t n) {
+    while (n) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0) { if (errno == EINTR) continue; return 0; }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 1;
+}
+
+static int read_all(int fd, unsigned char *p, size_t n) {
+    while (n) {
+        ssize_t r = recv(fd, p, n, 0);
+        if (r == 0) { errno = ECONNRESET; return 0; }
+        if (r < 0) { if (errno == EINTR) continue; return 0; }
+        p += r;
+        n -= (size_t)r;
+    }
+    return 1;
+}
+
+int fin_client_call(int fd, FinOp op, const unsigned char *payload, size_t n, FinBuf *resp) {
+    unsigned char hdr[5];
+    unsigned long long len = n + 1;
+    for (int k = 0; k < 4; ++k) { hdr[k] = (unsigned char)(len & 0xff); len >>= 8; }
+    hdr[4] = (unsigned char)op;
+    if (!write_all(fd, hdr, 5) || (n && !write_all(fd, payload, n))) return -1;
+
+    if (!read_all(fd, hdr, 5)) return -1;
+    size_t rn = (size_t)fin_get_le(hdr, 4);
+    if (rn == 0 || rn > MAX_FRAME) { errno = EPROTO; return -1; }
+    resp->len = 0;
+    if (rn > 1) {
+        if (resp->cap < rn - 1) {
+            unsigned char *q = fin_realloc(MEM_DAEMON, resp->data, rn - 1);
+            if (!q) return -1;
+            resp->data = q;
+            resp->cap = rn - 1;
+        }
+        if (!read_all(fd, resp->data, rn - 1)) return -1;
+        resp->len = rn - 1;
+    }
+    return hdr[4];
+}
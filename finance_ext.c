@@ -0,0 +1,823 @@
+/*
+  finance_ext.c - external-memory sorting and grouping (see finance.h).
+
+  Both take rows one at a time and keep their memory within a byte
+  budget whatever the number of rows, so reports can run over data
+  files many times the size of memory (fin_ext_scan() streams one
+  without loading it).
+
+  Sorting generates runs: rows are buffered until the budget is full,
+  the buffer is sorted by pointer on the pool and written to a temporary
+  file as length-prefixed compact records (strings without their
+  padding, typically a quarter of a Transaction). Finishing merges the
+  runs through a binary heap, k at a time, where k is as many RUN_BUF
+  read buffers as the budget holds; while more than k runs are left the
+  oldest k are merged into a new run, so every row is written once per
+  pass and there are about log_k(runs) passes. Each row carries its
+  arrival number as the last key, which makes the order stable whatever
+  the run boundaries. When everything fits, nothing is written.
+
+  Grouping keeps partial sums per key in an open-addressing hash table.
+  When a new key would need a bigger table than the budget allows, the
+  groups are appended to PARTITIONS temporary files picked by PART_BITS
+  bits of the key hash and the table starts empty again. Finishing
+  spills the rest the same way and aggregates each partition in a table
+  of its own, splitting on the next hash bits if a partition is still
+  too big. Groups come out in key order: a table that never spilled is
+  sorted in memory, otherwise the finished groups go through the
+  external sorter.
+
+  Temporary files are created in $TMPDIR (default /tmp) and unlinked at
+  once, so they disappear with the process; I/O is positioned (pread/
+  pwrite), so a file needs no seeking between writing and reading.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define RUN_BUF     (64 * 1024)     // buffer per run being written or merged
+#define PART_BUF    (16 * 1024)     // buffer per partition during a spill
+#define MAX_FANIN   256
+#define MAX_REC     512             // longest encoded record
+#define PARTITIONS  16
+#define PART_BITS   4
+#define MAX_LEVEL   (64 / PART_BITS)
+#define INIT_RECS   1024
+#define INIT_SLOTS  256
+#define LINE_MAX_LEN 1024
+
+/* ----------------------- Temporary files -------------------------- */
+
+static int temp_fd(void) {
+    const char *dir = getenv("TMPDIR");
+    char path[4096];
+    if (!dir || !*dir) dir = "/tmp";
+    if (snprintf(path, sizeof(path), "%s/finance-ext-XXXXXX", dir) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = mkstemp(path);
+    if (fd >= 0) unlink(path);
+    return fd;
+}
+
+typedef struct {                  // a temporary file, written once and read once
+    int fd;
+    long long bytes;
+} Run;
+
+typedef struct {                  // buffered sequential access to a Run
+    Run *run;
+    unsigned char *buf;
+    size_t cap, len, pos;
+    long long off;                // next file offset to read
+    unsigned long long *io;       // byte counter to charge
+} Stream;
+
+static int stream_open(Stream *s, Run *r, size_t cap, unsigned long long *io) {
+    *s = (Stream){ r, fin_malloc(MEM_EXTERNAL, cap), cap, 0, 0, 0, io };
+    if (!s->buf) errno = ENOMEM;
+    return s->buf != NULL;
+}
+
+static void stream_close(Stream *s) {
+    fin_free(s->buf);
+    s->buf = NULL;
+}
+
+static int stream_flush(Stream *s) {
+    size_t done = 0;
+    while (done < s->len) {
+        ssize_t k = pwrite(s->run->fd, s->buf + done, s->len - done, s->run->bytes);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) { if (k == 0) errno = EIO; return 0; }
+        done += (size_t)k;
+        s->run->bytes += k;
+    }
+    *s->io += s->len;
+    s->len = 0;
+    return 1;
+}
+
+/* Appends one record, after a two-byte length. */
+static int stream_put(Stream *s, const unsigned char *rec, size_t n) {
+    if (s->len + 2 + n > s->cap && !stream_flush(s)) return 0;
+    s->buf[s->len++] = (unsigned char)(n & 0xff);
+    s->buf[s->len++] = (unsigned char)(n >> 8);
+    memcpy(s->buf + s->len, rec, n);
+    s->len += n;
+    return 1;
+}
+
+/* Makes want bytes available at buf + pos: 1, 0 if the file ended first. */
+static int stream_fill(Stream *s, size_t want) {
+    if (s->len - s->pos >= want) return 1;
+    memmove(s->buf, s->buf + s->pos, s->len - s->pos);
+    s->len -= s->pos;
+    s->pos = 0;
+    while (s->len < want && s->off < s->run->bytes) {
+        ssize_t k = pread(s->run->fd, s->buf + s->len, s->cap - s->len, s->off);
+        if (k < 0 && errno == EINTR) continue;
+        if (k < 0) return -1;
+        if (k == 0) break;
+        s->len += (size_t)k;
+        s->off += k;
+        *s->io += (unsigned long long)k;
+    }
+    return s->len >= want;
+}
+
+/* The next record: 1 with *rec and *n set, 0 at the end, -1 with errno
+   set (EINVAL: truncated). */
+static int stream_next(Stream *s, const unsigned char **rec, size_t *n) {
+    int r = stream_fill(s, 2);
+    if (r < 0) return -1;
+    if (r == 0) {
+        if (s->len == s->pos) return 0;
+        errno = EINVAL;
+        return -1;
+    }
+    size_t len = s->buf[s->pos] | (size_t)s->buf[s->pos + 1] << 8;
+    if ((r = stream_fill(s, 2 + len)) <= 0) {
+        if (r == 0) errno = EINVAL;
+        return -1;
+    }
+    *rec = s->buf + s->pos + 2;
+    *n = len;
+    s->pos += 2 + len;
+    return 1;
+}
+
+/* ----------------------- Sorted runs ------------------------------ */
+
+typedef struct {
+    size_t size;                                          // bytes in memory
+    int (*cmp)(const void *a, const void *b);             // records
+    int (*pcmp)(const void *a, const void *b);            // pointers to records
+    size_t (*enc)(const void *rec, unsigned char *buf);   // at most MAX_REC bytes
+    void (*dec)(const unsigned char *buf, size_t n, void *rec);
+} RecType;
+
+typedef int (*RecFn)(void *ctx, const void *rec);        // nonzero stops
+
+typedef struct {
+    const RecType *rt;
+    long long budget;
+    size_t maxRecs;               // buffered before a run is written; 0 = no limit
+    unsigned char *recs;
+    size_t n, cap;
+    Run *runs;
+    int nRuns, capRuns;
+    FinExtStats st;
+} XSort;
+
+static void xsort_init(XSort *x, const RecType *rt, long long budget) {
+    memset(x, 0, sizeof(*x));
+    x->rt = rt;
+    x->budget = x->st.budget = budget;
+    // each buffered record also costs a pointer and its sort scratch
+    if (budget) x->maxRecs = (size_t)budget / (rt->size + 2 * sizeof(void *));
+}
+
+static void xsort_release(XSort *x) {
+    for (int i = 0; i < x->nRuns; ++i) if (x->runs[i].fd >= 0) close(x->runs[i].fd);
+    fin_free(x->runs);
+    fin_free(x->recs);
+    x->runs = NULL;
+    x->recs = NULL;
+    x->nRuns = x->capRuns = 0;
+    x->n = x->cap = 0;
+}
+
+/* Pointers to the buffered records in order: 1, 0 with errno set, or
+   FIN_CANCELLED. */
+static int sort_buffer(XSort *x, const unsigned char ***out) {
+    const unsigned char **p = fin_malloc(MEM_EXTERNAL, (x->n ? x->n : 1) * sizeof(*p));
+    int r = p ? 1 : 0;
+    for (size_t i = 0; p && i < x->n; ++i) p[i] = x->recs + i * x->rt->size;
+    if (p) r = fin_parallel_sort(p, x->n, sizeof(*p), x->rt->pcmp);
+    if (r != 1) {
+        fin_free(p);
+        if (r == 0) errno = ENOMEM;
+        return r;
+    }
+    *out = p;
+    return 1;
+}
+
+static Run *new_run(XSort *x) {
+    if (x->nRuns == x->capRuns) {
+        int ncap = x->capRuns ? x->capRuns * 2 : 16;
+        Run *nr = fin_realloc(MEM_EXTERNAL, x->runs, (size_t)ncap * sizeof(Run));
+        if (!nr) { errno = ENOMEM; return NULL; }
+        x->runs = nr;
+        x->capRuns = ncap;
+    }
+    int fd = temp_fd();
+    if (fd < 0) return NULL;
+    x->runs[x->nRuns] = (Run){ fd, 0 };
+    return &x->runs[x->nRuns++];
+}
+
+/* Writes the buffered records out as a sorted run: 1, 0 with errno
+   set, or FIN_CANCELLED. */
+static int write_run(XSort *x) {
+    unsigned long long t0 = fin_trace_begin();
+    const unsigned char **p;
+    int r = sort_buffer(x, &p);
+    if (r != 1) return r;
+    unsigned char rec[MAX_REC];
+    Stream w = {0};
+    Run *run = new_run(x);
+    int ok = run && stream_open(&w, run, RUN_BUF, &x->st.bytesWritten);
+    for (size_t i = 0; ok && i < x->n; ++i) ok = stream_put(&w, rec, x->rt->enc(p[i], rec));
+    ok = ok && stream_flush(&w);
+    stream_close(&w);
+    fin_free(p);
+    x->n = 0;
+    x->st.runs++;
+    fin_trace_end("ext_run", t0);
+    return ok;
+}
+
+static int xsort_add(XSort *x, const void *rec) {
+    if (x->maxRecs && x->n == x->maxRecs) {
+        int r = write_run(x);
+        if (r == FIN_CANCELLED) errno = ECANCELED;
+        if (r != 1) return 0;
+    }
+    if (x->n == x->cap) {
+        size_t ncap = x->cap ? x->cap * 2 : INIT_RECS;
+        if (x->maxRecs && ncap > x->maxRecs) ncap = x->maxRecs;
+        unsigned char *nr = fin_realloc(MEM_EXTERNAL, x->recs, ncap * x->rt->size);
+        if (!nr) { errno = ENOMEM; return 0; }
+        x->recs = nr;
+        x->cap = ncap;
+    }
+    memcpy(x->recs + x->n++ * x->rt->size, rec, x->rt->size);
+    x->st.rows++;
+    return 1;
+}
+
+static void sift_down(int *heap, int h, int i, const unsigned char *cur, const RecType *rt) {
+    for (;;) {
+        int l = 2 * i + 1, m = i;
+        if (l < h && rt->cmp(cur + heap[l] * rt->size, cur + heap[m] * rt->size) < 0) m = l;
+        if (l + 1 < h && rt->cmp(cur + heap[l + 1] * rt->size, cur + heap[m] * rt->size) < 0) m = l + 1;
+        if (m == i) return;
+        int t = heap[i]; heap[i] = heap[m]; heap[m] = t;
+        i = m;
+    }
+}
+
+/* Merges runs[0..k) into w or, if w is NULL, into fn; returns the
+   records merged, -1 with errno set, or FIN_CANCELLED. */
+static long long merge_runs(XSort *x, Run *runs, int k, Stream *w, RecFn fn, void *ctx) {
+    unsigned long long t0 = fin_trace_begin();
+    const RecType *rt = x->rt;
+    Stream *in = fin_calloc(MEM_EXTERNAL, (size_t)k, sizeof(*in));
+    unsigned char *cur = fin_malloc(MEM_EXTERNAL, (size_t)k * rt->size);
+    int *heap = fin_malloc(MEM_EXTERNAL, (size_t)k * sizeof(int));
+    unsigned char rec[MAX_REC];
+    const unsigned char *src;
+    size_t len;
+    long long n = 0;
+    int h = 0, ok = in && cur && heap;
+    if (!ok) errno = ENOMEM;
+    for (int i = 0; ok && i < k; ++i) {
+        int r = stream_open(&in[i], &runs[i], RUN_BUF, &x->st.bytesRead) ? stream_next(&in[i], &src, &len) : -1;
+        if (r < 0) ok = 0;
+        else if (r) {
+            rt->dec(src, len, cur + (size_t)i * rt->size);
+            heap[h++] = i;
+        }
+    }
+    for (int i = h / 2 - 1; ok && i >= 0; --i) sift_down(heap, h, i, cur, rt);
+    while (ok && h > 0) {
+        int i = heap[0];
+        const unsigned char *top = cur + (size_t)i * rt->size;
+        ++n;
+        if (w) ok = stream_put(w, rec, rt->enc(top, rec));
+        else if (fn(ctx, top)) break;
+        if (n % 4096 == 0 && fin_checkpoint(4096)) { n = FIN_CANCELLED; break; }
+        int r = stream_next(&in[i], &src, &len);
+        if (r < 0) ok = 0;
+        else if (r) rt->dec(src, len, cur + (size_t)i * rt->size);
+        else heap[0] = heap[--h];
+        sift_down(heap, h, 0, cur, rt);
+    }
+    for (int i = 0; in && i < k; ++i) stream_close(&in[i]);
+    fin_free(in);
+    fin_free(cur);
+    fin_free(heap);
+    fin_trace_end("ext_merge", t0);
+    return ok ? n : -1;
+}
+
+/* Visits every record added, in order; returns the records visited, -1
+   with errno set, or FIN_CANCELLED. */
+static long long xsort_finish(XSort *x, RecFn fn, void *ctx) {
+    const RecType *rt = x->rt;
+    if (!x->nRuns) {                                  // everything fit
+        const unsigned char **p;
+        int r = sort_buffer(x, &p);
+        if (r != 1) return r ? r : -1;
+        long long n = 0;
+        while ((size_t)n < x->n) {
+            if (fn(ctx, p[n++])) break;
+            if (n % 4096 == 0 && fin_checkpoint(4096)) { n = FIN_CANCELLED; break; }
+        }
+        fin_free(p);
+        return n;
+    }
+    if (x->n) {
+        int r = write_run(x);
+        if (r != 1) return r ? r : -1;
+    }
+    fin_free(x->recs);                                // the merge buffers need the room
+    x->recs = NULL;
+    x->cap = 0;
+
+    long long fanin = x->budget ? x->budget / (RUN_BUF + MAX_REC + (long long)rt->size) : MAX_FANIN;
+    if (fanin < 2) fanin = 2;
+    if (fanin > MAX_FANIN) fanin = MAX_FANIN;
+    int first = 0;
+    while (x->nRuns - first > fanin) {                // merge the oldest runs into a longer one
+        Stream w = {0};
+        Run *out = new_run(x);
+        long long r = out && stream_open(&w, out, RUN_BUF, &x->st.bytesWritten)
+                      ? merge_runs(x, x->runs + first, (int)fanin, &w, NULL, NULL) : -1;
+        if (r >= 0 && !stream_flush(&w)) r = -1;
+        stream_close(&w);
+        if (r < 0) return r;
+        for (int i = first; i < first + fanin; ++i) {   // frees their disk space
+            close(x->runs[i].fd);
+            x->runs[i].fd = -1;
+        }
+        first += (int)fanin;
+        x->st.merges++;
+    }
+    x->st.merges++;
+    return merge_runs(x, x->runs + first, x->nRuns - first, NULL, fn, ctx);
+}
+
+/* ----------------------- Row sort --------------------------------- */
+
+typedef struct {
+    unsigned long long seq;       // arrival order, the last key
+    Transaction t;
+} RowRec;
+
+struct FinExtSort {
+    XSort x;
+    unsigned long long seq;
+};
+
+static int cmp_seq(const RowRec *a, const RowRec *b) {
+    return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+static int cmp_row_date(const void *a, const void *b) {
+    const RowRec *x = a, *y = b;
+    if (x->t.y != y->t.y) return x->t.y < y->t.y ? -1 : 1;
+    if (x->t.m != y->t.m) return x->t.m < y->t.m ? -1 : 1;
+    if (x->t.d != y->t.d) return x->t.d < y->t.d ? -1 : 1;
+    return cmp_seq(x, y);
+}
+
+static int cmp_row_amount(const void *a, const void *b) {
+    const RowRec *x = a, *y = b;
+    if (x->t.amount < y->t.amount) return 1;
+    if (x->t.amount > y->t.amount) return -1;
+    return cmp_seq(x, y);
+}
+
+static int pcmp_row_date(const void *a, const void *b) {
+    return cmp_row_date(*(const void *const *)a, *(const void *const *)b);
+}
+
+static int pcmp_row_amount(const void *a, const void *b) {
+    return cmp_row_amount(*(const void *const *)a, *(const void *const *)b);
+}
+
+/* seq, amount, year (2 bytes), month, day, type, category length,
+   category, note. */
+static size_t enc_row(const void *rec, unsigned char *buf) {
+    const RowRec *r = rec;
+    size_t c = strnlen(r->t.category, STR_LEN - 1), n = strnlen(r->t.note, NOTE_LEN - 1);
+    memcpy(buf, &r->seq, 8);
+    memcpy(buf + 8, &r->t.amount, 8);
+    buf[16] = (unsigned char)(r->t.y & 0xff);
+    buf[17] = (unsigned char)(r->t.y >> 8);
+    buf[18] = (unsigned char)r->t.m;
+    buf[19] = (unsigned char)r->t.d;
+    buf[20] = (unsigned char)r->t.type;
+    buf[21] = (unsigned char)c;
+    memcpy(buf + 22, r->t.category, c);
+    memcpy(buf + 22 + c, r->t.note, n);
+    return 22 + c + n;
+}
+
+static void dec_row(const unsigned char *buf, size_t n, void *rec) {
+    RowRec *r = rec;
+    size_t c = buf[21];
+    memcpy(&r->seq, buf, 8);
+    memcpy(&r->t.amount, buf + 8, 8);
+    r->t.y = buf[16] | buf[17] << 8;
+    r->t.m = buf[18];
+    r->t.d = buf[19];
+    r->t.type = buf[20] ? EXPENSE : INCOME;
+    memset(r->t.category, 0, STR_LEN);
+    memset(r->t.note, 0, NOTE_LEN);
+    memcpy(r->t.category, buf + 22, c);
+    memcpy(r->t.note, buf + 22 + c, n - 22 - c);
+}
+
+static const RecType ROW_BY_DATE = { sizeof(RowRec), cmp_row_date, pcmp_row_date, enc_row, dec_row };
+static const RecType ROW_BY_AMOUNT = { sizeof(RowRec), cmp_row_amount, pcmp_row_amount, enc_row, dec_row };
+
+static long long ext_budget(long long budget) {
+    if (budget <= 0) return 0;
+    return budget < FIN_EXT_MIN_BUDGET ? FIN_EXT_MIN_BUDGET : budget;
+}
+
+FinExtSort *fin_ext_sort_new(SortKey key, long long budget) {
+    FinExtSort *s = fin_malloc(MEM_EXTERNAL, sizeof(*s));
+    if (!s) { errno = ENOMEM; return NULL; }
+    xsort_init(&s->x, key == SORT_DATE ? &ROW_BY_DATE : &ROW_BY_AMOUNT, ext_budget(budget));
+    s->seq = 0;
+    return s;
+}
+
+void fin_ext_sort_free(FinExtSort *s) {
+    if (!s) return;
+    xsort_release(&s->x);
+    fin_free(s);
+}
+
+int fin_ext_sort_add(FinExtSort *s, const Transaction *t) {
+    RowRec r;
+    r.seq = s->seq++;
+    r.t = *t;
+    return xsort_add(&s->x, &r);
+}
+
+typedef struct {
+    FinExtRowFn fn;
+    void *ctx;
+    long long idx;
+} RowSink;
+
+static int emit_row(void *ctx, const void *rec) {
+    RowSink *k = ctx;
+    return k->fn(k->ctx, k->idx++, &((const RowRec *)rec)->t);
+}
+
+long long fin_ext_sort_finish(FinExtSort *s, FinExtRowFn fn, void *ctx) {
+    unsigned long long t0 = fin_trace_begin();
+    RowSink k = { fn, ctx, 0 };
+    long long n = xsort_finish(&s->x, emit_row, &k);
+    fin_trace_end("ext_sort", t0);
+    return n;
+}
+
+void fin_ext_sort_stats(const FinExtSort *s, FinExtStats *st) {
+    *st = s->x.st;
+}
+
+/* ----------------------- Grouping --------------------------------- */
+
+typedef struct {
+    unsigned long long hash;
+    FinGroup g;                   // g.rows == 0: free slot
+} Slot;
+
+struct FinExtAgg {
+    FinGroupKey by;
+    long long budget;
+    int level;                    // partition by hash bits level*PART_BITS and up
+    Slot *tab;
+    size_t cap, n, maxCap;        // maxCap: the largest table the budget allows (0 = no limit)
+    int logCap;
+    int spilled;
+    Run part[PARTITIONS];         // fd -1 until a group lands there
+    FinExtStats st;
+};
+
+static int cmp_group(const void *a, const void *b) {
+    return strcmp(((const FinGroup *)a)->key, ((const FinGroup *)b)->key);
+}
+
+static int pcmp_group(const void *a, const void *b) {
+    return cmp_group(*(const void *const *)a, *(const void *const *)b);
+}
+
+/* income, expense, rows, key. */
+static size_t enc_group(const void *rec, unsigned char *buf) {
+    const FinGroup *g = rec;
+    size_t k = strnlen(g->key, STR_LEN - 1);
+    memcpy(buf, &g->income, 8);
+    memcpy(buf + 8, &g->expense, 8);
+    memcpy(buf + 16, &g->rows, 8);
+    memcpy(buf + 24, g->key, k);
+    return 24 + k;
+}
+
+static void dec_group(const unsigned char *buf, size_t n, void *rec) {
+    FinGroup *g = rec;
+    memcpy(&g->income, buf, 8);
+    memcpy(&g->expense, buf + 8, 8);
+    memcpy(&g->rows, buf + 16, 8);
+    memcpy(g->key, buf + 24, n - 24);
+    g->key[n - 24] = '\0';
+}
+
+static const RecType GROUP_REC = { sizeof(FinGroup), cmp_group, pcmp_group, enc_group, dec_group };
+
+static unsigned long long key_hash(const char *k) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (; *k; ++k) { h ^= (unsigned char)*k; h *= 1099511628211ULL; }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 33);
+}
+
+/* Partitions take the low hash bits, so slots come from the high ones. */
+static size_t slot_of(const FinExtAgg *a, unsigned long long h) {
+    return (size_t)((h * 0x9E3779B97F4A7C15ULL) >> (64 - a->logCap));
+}
+
+static FinExtAgg *agg_new(FinGroupKey by, long long budget, int level) {
+    FinExtAgg *a = fin_calloc(MEM_EXTERNAL, 1, sizeof(*a));
+    if (!a) { errno = ENOMEM; return NULL; }
+    a->by = by;
+    a->budget = a->st.budget = budget;
+    a->level = level;
+    for (int p = 0; p < PARTITIONS; ++p) a->part[p].fd = -1;
+    if (budget) {                 // leave room for the partition buffers of a spill
+        long long room = budget - (long long)PARTITIONS * PART_BUF;
+        a->maxCap = INIT_SLOTS;
+        while ((long long)(a->maxCap * 2 * sizeof(Slot)) <= room) a->maxCap *= 2;
+    }
+    return a;
+}
+
+static int agg_grow(FinExtAgg *a) {
+    size_t ncap = a->cap ? a->cap * 2 : INIT_SLOTS;
+    Slot *nt = fin_calloc(MEM_EXTERNAL, ncap, sizeof(Slot));
+    if (!nt) { errno = ENOMEM; return 0; }
+    Slot *old = a->tab;
+    size_t ocap = a->cap;
+    a->tab = nt;
+    a->cap = ncap;
+    a->logCap = 0;
+    while (((size_t)1 << a->logCap) < ncap) a->logCap++;
+    for (size_t i = 0; i < ocap; ++i) {
+        if (!old[i].g.rows) continue;
+        size_t j = slot_of(a, old[i].hash);
+        while (nt[j].g.rows) j = (j + 1) & (ncap - 1);
+        nt[j] = old[i];
+    }
+    fin_free(old);
+    return 1;
+}
+
+/* Appends every group to its partition file and empties the table. */
+static int agg_spill(FinExtAgg *a) {
+    unsigned long long t0 = fin_trace_begin();
+    Stream w[PARTITIONS];
+    unsigned char rec[MAX_REC];
+    int ok = 1;
+    memset(w, 0, sizeof(w));
+    for (size_t i = 0; ok && i < a->cap; ++i) {
+        const Slot *s = &a->tab[i];
+        if (!s->g.rows) continue;
+        int p = (int)(s->hash >> (a->level * PART_BITS)) & (PARTITIONS - 1);
+        if (!w[p].buf) {
+            if (a->part[p].fd < 0 && (a->part[p].fd = temp_fd()) < 0) { ok = 0; break; }
+            if (!(ok = stream_open(&w[p], &a->part[p], PART_BUF, &a->st.bytesWritten))) break;
+        }
+        ok = stream_put(&w[p], rec, enc_group(&s->g, rec));
+    }
+    for (int p = 0; p < PARTITIONS; ++p) {
+        if (w[p].buf && ok) ok = stream_flush(&w[p]);
+        stream_close(&w[p]);
+    }
+    memset(a->tab, 0, a->cap * sizeof(Slot));
+    a->n = 0;
+    a->spilled = 1;
+    a->st.spills++;
+    fin_trace_end("ext_spill", t0);
+    return ok;
+}
+
+/* Adds g's sums to its group, spilling first if a new group does not fit. */
+static int agg_merge(FinExtAgg *a, const FinGroup *g, unsigned long long h) {
+    for (;;) {
+        if (a->cap) {
+            size_t mask = a->cap - 1, i = slot_of(a, h);
+            for (; a->tab[i].g.rows; i = (i + 1) & mask) {
+                Slot *s = &a->tab[i];
+                if (s->hash == h && strcmp(s->g.key, g->key) == 0) {
+                    s->g.income += g->income;
+                    s->g.expense += g->expense;
+                    s->g.rows += g->rows;
+                    return 1;
+                }
+            }
+            if (2 * (a->n + 1) <= a->cap) {
+                a->tab[i].hash = h;
+                a->tab[i].g = *g;
+                a->n++;
+                return 1;
+            }
+        }
+        if (a->maxCap && a->cap >= a->maxCap && a->level < MAX_LEVEL) {
+            if (!agg_spill(a)) return 0;
+        } else if (!agg_grow(a)) return 0;
+    }
+}
+
+FinExtAgg *fin_ext_agg_new(FinGroupKey by, long long budget) {
+    return agg_new(by, ext_budget(budget), 0);
+}
+
+void fin_ext_agg_free(FinExtAgg *a) {
+    if (!a) return;
+    for (int p = 0; p < PARTITIONS; ++p) if (a->part[p].fd >= 0) close(a->part[p].fd);
+    fin_free(a->tab);
+    fin_free(a);
+}
+
+int fin_ext_agg_add(FinExtAgg *a, const Transaction *t) {
+    FinGroup g;
+    if (a->by == GROUP_CATEGORY) {
+        memcpy(g.key, t->category, STR_LEN);
+        g.key[STR_LEN - 1] = '\0';
+    } else if (a->by == GROUP_MONTH) snprintf(g.key, sizeof(g.key), "%04d-%02d", t->y, t->m);
+    else snprintf(g.key, sizeof(g.key), "%04d", t->y);
+    g.income = t->type == INCOME ? fin_cents(t->amount) : 0;
+    g.expense = t->type == EXPENSE ? fin_cents(t->amount) : 0;
+    g.rows = 1;
+    a->st.rows++;
+    return agg_merge(a, &g, key_hash(g.key));
+}
+
+typedef struct {
+    XSort *x;
+    int failed;
+} SortSink;
+
+static int sort_group(void *ctx, const FinGroup *g) {
+    SortSink *k = ctx;
+    if (!xsort_add(k->x, g)) k->failed = 1;
+    return k->failed;
+}
+
+typedef struct {
+    FinGroupFn fn;
+    void *ctx;
+} GroupSink;
+
+static int emit_group(void *ctx, const void *rec) {
+    GroupSink *k = ctx;
+    return k->fn(k->ctx, rec);
+}
+
+static long long agg_finish(FinExtAgg *a, FinGroupFn fn, void *ctx);
+
+/* Aggregates partition p in a table of its own, splitting on the next
+   hash bits if it does not fit, and adds the groups to k. */
+static long long agg_partition(FinExtAgg *a, int p, SortSink *k) {
+    FinExtAgg *sub = agg_new(a->by, a->budget, a->level + 1);
+    Stream in = {0};
+    const unsigned char *src;
+    size_t len;
+    int r = sub && stream_open(&in, &a->part[p], RUN_BUF, &a->st.bytesRead) ? 1 : -1;
+    while (r > 0 && (r = stream_next(&in, &src, &len)) > 0) {
+        FinGroup g;
+        dec_group(src, len, &g);
+        if (!agg_merge(sub, &g, key_hash(g.key))) r = -1;
+    }
+    stream_close(&in);
+    close(a->part[p].fd);
+    a->part[p].fd = -1;
+    long long n = r < 0 ? -1 : agg_finish(sub, sort_group, k);
+    if (k->failed) n = -1;
+    if (sub) {
+        a->st.bytesWritten += sub->st.bytesWritten;
+        a->st.bytesRead += sub->st.bytesRead;
+        a->st.spills += sub->st.spills;
+        a->st.partitions += sub->st.partitions;
+    }
+    a->st.partitions++;
+    fin_ext_agg_free(sub);
+    return n;
+}
+
+static long long agg_finish(FinExtAgg *a, FinGroupFn fn, void *ctx) {
+    long long n = 0;
+    if (!a->spilled) {                                // one table: sort it in memory
+        const FinGroup **p = fin_malloc(MEM_EXTERNAL, (a->n ? a->n : 1) * sizeof(*p));
+        if (!p) { errno = ENOMEM; return -1; }
+        for (size_t i = 0; i < a->cap; ++i) if (a->tab[i].g.rows) p[n++] = &a->tab[i].g;
+        qsort(p, (size_t)n, sizeof(*p), pcmp_group);
+        for (long long i = 0; i < n; ++i) if (fn(ctx, p[i])) { n = i + 1; break; }
+        fin_free(p);
+        a->st.groups = n;
+        return n;
+    }
+    if (a->n && !agg_spill(a)) return -1;
+    fin_free(a->tab);                                 // the partitions need the room
+    a->tab = NULL;
+    a->cap = 0;
+
+    XSort x;
+    xsort_init(&x, &GROUP_REC, a->budget);
+    SortSink k = { &x, 0 };
+    for (int p = 0; p < PARTITIONS && n >= 0; ++p) {
+        if (a->part[p].fd < 0) continue;
+        n = agg_partition(a, p, &k);
+        if (n >= 0 && fin_checkpoint(0)) n = FIN_CANCELLED;
+    }
+    if (n >= 0) {
+        GroupSink g = { fn, ctx };
+        n = xsort_finish(&x, emit_group, &g);
+        a->st.groups = n > 0 ? n : 0;
+    }
+    a->st.bytesWritten += x.st.bytesWritten;
+    a->st.bytesRead += x.st.bytesRead;
+    xsort_release(&x);
+    return n;
+}
+
+long long fin_ext_agg_finish(FinExtAgg *a, FinGroupFn fn, void *ctx) {
+    unsigned long long t0 = fin_trace_begin();
+    long long n = agg_finish(a, fn, ctx);
+    fin_trace_end("ext_aggregate", t0);
+    return n;
+}
+
+void fin_ext_agg_stats(const FinExtAgg *a, FinExtStats *st) {
+    *st = a->st;
+}
+
+/* ----------------------- Streaming a data file -------------------- */
+
+typedef struct {
+    FinExtRowFn fn;
+    void *ctx;
+    long long n;
+} ScanSink;
+
+static int paged_row(void *ctx, long idx, const Transaction *t) {
+    ScanSink *k = ctx;
+    (void)idx;
+    return k->fn(k->ctx, k->n++, t);
+}
+
+/* What ledger_insert_batch() would store: a valid date and amount, and
+   no '|' in the note. */
+static int clean_row(Transaction *t) {
+    if (!fin_valid_date(t->y, t->m, t->d) || !(t->amount >= 0.0 && t->amount <= FIN_AMOUNT_MAX)) return 0;
+    for (char *s = t->note; *s; ++s) if (*s == '|') *s = '/';
+    return 1;
+}
+
+long long fin_ext_scan(const char *fname, FinExtRowFn fn, void *ctx) {
+    ScanSink k = { fn, ctx, 0 };
+    if (fin_packed_file(fname)) {
+        FinPaged *p = fin_paged_open(fname, NULL);
+        if (!p) return -1;
+        long r = fin_paged_scan(p, 1900, 1, 1, 3000, 12, 31, paged_row, &k);
+        int e = errno;
+        fin_paged_close(p);
+        errno = e;
+        return r < 0 ? r : k.n;
+    }
+    FILE *f = fopen(fname, "r");
+    if (!f) return -1;
+    char line[LINE_MAX_LEN];
+    long long lines = 0, r = 0;
+    while (fgets(line, sizeof(line), f)) {
+        Transaction t;
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n') {   // too long: skip the rest
+            int c;
+            while ((c = fgetc(f)) != EOF && c != '\n') {}
+            continue;
+        }
+        if (++lines % 4096 == 0 && fin_checkpoint(4096)) { r = FIN_CANCELLED; break; }
+        if (!fin_parse_record(line, &t) || !clean_row(&t)) continue;
+        if (fn(ctx, k.n++, &t)) break;
+    }
+    if (r == 0 && ferror(f)) { r = -1; errno = EIO; }
+    fclose(f);
+    return r < 0 ? r : k.n;
+}
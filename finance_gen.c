@@ -0,0 +1,300 @@
+/*
+  finance_gen.c - deterministic synthetic ledgers for benchmarks and
+  tests (see finance.h).
+
+  A generated ledger is one household's history stretched to any size:
+  dates advance evenly from the first to the last day of the span, the
+  first row of each month is the rent and the first row on or after the
+  25th is the salary (both recurring, with a yearly raise), and the rest
+  are everyday transactions: mostly expenses whose categories follow a
+  Zipf law, with log-normal amounts around a per-category median plus a
+  rare Pareto tail, and merchant-style notes ("WHOLE FOODS #0412").
+
+  Rows are produced in chunks of GEN_CHUNK whose random stream is seeded
+  from (seed, chunk number) alone, so chunks render in parallel on the
+  pool and the output is byte-identical for any thread count.
+*/
+
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define GEN_CHUNK    16384           // rows per independently seeded chunk
+#define GEN_ROW_MAX  (STR_LEN + NOTE_LEN + 48) // longest rendered text row
+#define ZIPF_S       1.1             // category skew
+#define TAIL_P       0.01            // share of amounts from the Pareto tail
+#define TAIL_ALPHA   1.3
+
+typedef struct {
+    const char *name;
+    double median;                   // typical amount
+    const char *merchants[4];
+} GenCategory;
+
+static const GenCategory EXPENSES[] = {
+    { "Groceries",     46.0, { "WHOLE FOODS", "TRADER JOE'S", "SAFEWAY", "ALDI" } },
+    { "Dining",        28.0, { "CHIPOTLE", "SQ *CORNER BISTRO", "DOORDASH*THAI HOUSE", "SUSHI KO" } },
+    { "Transport",     14.0, { "UBER *TRIP", "LYFT *RIDE", "METRO TRANSIT", "PARKING METER" } },
+    { "Coffee",         5.2, { "STARBUCKS", "SQ *BLUE BOTTLE", "PEET'S COFFEE", "DUNKIN" } },
+    { "Shopping",      38.0, { "AMZN MKTP US", "TARGET", "WALMART", "COSTCO WHSE" } },
+    { "Fuel",          42.0, { "SHELL OIL", "CHEVRON", "EXXONMOBIL", "BP" } },
+    { "Utilities",     95.0, { "PG&E", "CITY WATER DEPT", "COMCAST", "CON EDISON" } },
+    { "Subscriptions", 13.0, { "NETFLIX.COM", "SPOTIFY", "APPLE.COM/BILL", "NYTIMES" } },
+    { "Entertainment", 24.0, { "AMC THEATRES", "STEAM GAMES", "TICKETMASTER", "BOWLERO" } },
+    { "Health",        35.0, { "CVS PHARMACY", "WALGREENS", "CITY DENTAL", "KAISER" } },
+    { "Phone",         55.0, { "VERIZON WIRELESS", "T-MOBILE", "AT&T", "MINT MOBILE" } },
+    { "Clothing",      48.0, { "UNIQLO", "H&M", "NIKE.COM", "GAP" } },
+    { "Home",          52.0, { "HOME DEPOT", "IKEA", "LOWE'S", "BED BATH" } },
+    { "Travel",       210.0, { "DELTA AIR", "MARRIOTT", "AIRBNB", "HERTZ" } },
+    { "Insurance",    120.0, { "GEICO", "STATE FARM", "ALLSTATE", "PROGRESSIVE" } },
+    { "Pets",          30.0, { "PETCO", "CHEWY.COM", "BANFIELD VET", "PETSMART" } },
+    { "Education",     60.0, { "COURSERA", "UDEMY", "BARNES & NOBLE", "CITY COLLEGE" } },
+    { "Gifts",         40.0, { "ETSY", "1-800-FLOWERS", "AMZN GIFT", "HALLMARK" } },
+    { "Charity",       25.0, { "RED CROSS", "UNICEF", "LOCAL FOOD BANK", "WIKIMEDIA" } },
+    { "Fees",           8.0, { "ATM FEE", "MONTHLY SERVICE FEE", "OVERDRAFT FEE", "WIRE FEE" } },
+};
+#define N_EXPENSES ((int)(sizeof(EXPENSES) / sizeof(EXPENSES[0])))
+
+static const GenCategory INCOMES[] = {
+    { "Freelance",    350.0, { "UPWORK", "STRIPE TRANSFER", "PAYPAL TRANSFER", "CLIENT INVOICE" } },
+    { "Refund",        35.0, { "AMZN REFUND", "TARGET RETURN", "AIRLINE REFUND", "TAX REFUND" } },
+    { "Interest",       6.0, { "SAVINGS INTEREST", "CD INTEREST", "BOND COUPON", "MONEY MARKET" } },
+    { "Gift",          80.0, { "VENMO", "ZELLE", "CASH DEPOSIT", "CHECK DEPOSIT" } },
+};
+#define N_INCOMES ((int)(sizeof(INCOMES) / sizeof(INCOMES[0])))
+#define INCOME_SHARE 0.07            // everyday rows that are income
+
+typedef struct {
+    const GenSpec *spec;
+    long days;                       // length of the span
+    short *dayY;                     // calendar for each day of the span
+    unsigned char *dayM, *dayD;
+    double zipf[N_EXPENSES];         // cumulative category weights
+    double rent, salary;             // first-year amounts
+    char landlord[32], employer[32];
+} Gen;
+
+/* ----------------------- Randomness ------------------------------- */
+
+static unsigned long long splitmix64(unsigned long long *s) {
+    unsigned long long z = (*s += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static double uniform(unsigned long long *s) {           // [0, 1)
+    return (double)(splitmix64(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double normal(unsigned long long *s) {
+    double u = uniform(s), v = uniform(s);
+    return sqrt(-2.0 * log(1.0 - u)) * cos(6.283185307179586 * v);
+}
+
+static int zipf_pick(const Gen *g, unsigned long long *s) {
+    double u = uniform(s) * g->zipf[N_EXPENSES - 1];
+    int lo = 0, hi = N_EXPENSES - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (g->zipf[mid] > u) hi = mid; else lo = mid + 1;
+    }
+    return lo;
+}
+
+/* Log-normal around median, occasionally scaled by a Pareto factor;
+   rounded to cents. */
+static double heavy_amount(unsigned long long *s, double median) {
+    double a = median * exp(0.75 * normal(s));
+    if (uniform(s) < TAIL_P) {
+        double f = pow(1.0 - uniform(s), -1.0 / TAIL_ALPHA);
+        a *= f < 500.0 ? f : 500.0;
+    }
+    long cents = (long)(a * 100.0 + 0.5);
+    return (cents < 1 ? 1 : cents) / 100.0;
+}
+
+/* ----------------------- Rows ------------------------------------- */
+
+static long day_of(const Gen *g, long i) {
+    return (long)((long long)i * g->days / g->spec->rows);
+}
+
+static void gen_row(const Gen *g, unsigned long long *s, long i, Transaction *t) {
+    long day = day_of(g, i), prev = i ? day_of(g, i - 1) : -1;
+    int y = g->dayY[day], m = g->dayM[day], d = g->dayD[day];
+    int newMonth = prev < 0 || g->dayM[prev] != m || g->dayY[prev] != y;
+    int years = y - g->spec->startYear;
+
+    memset(t, 0, sizeof(*t));
+    t->y = y; t->m = m; t->d = d;
+    if (newMonth) {
+        t->type = EXPENSE;
+        strcpy(t->category, "Rent");
+        t->amount = floor(g->rent * pow(1.03, years) + 0.5);
+        snprintf(t->note, NOTE_LEN, "RENT %s", g->landlord);
+    } else if (d >= 25 && g->dayD[prev] < 25) {
+        t->type = INCOME;
+        strcpy(t->category, "Salary");
+        t->amount = floor(g->salary * pow(1.04, years) + 0.5);
+        snprintf(t->note, NOTE_LEN, "PAYROLL %s", g->employer);
+    } else {
+        const GenCategory *c;
+        if (uniform(s) < INCOME_SHARE) {
+            t->type = INCOME;
+            c = &INCOMES[(int)(uniform(s) * N_INCOMES)];
+        } else {
+            t->type = EXPENSE;
+            c = &EXPENSES[zipf_pick(g, s)];
+        }
+        strcpy(t->category, c->name);
+        t->amount = heavy_amount(s, c->median);
+        // Earlier merchants are more common; most carry a store number.
+        double u = uniform(s);
+        const char *merchant = c->merchants[u < 0.5 ? 0 : u < 0.75 ? 1 : u < 0.9 ? 2 : 3];
+        if (uniform(s) < 0.6)
+            snprintf(t->note, NOTE_LEN, "%s #%04d", merchant, (int)(uniform(s) * 10000));
+        else
+            snprintf(t->note, NOTE_LEN, "%s", merchant);
+    }
+}
+
+/* ----------------------- Rendering -------------------------------- */
+
+static char *put_uint(char *p, unsigned long v) {
+    char tmp[24];
+    int n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+static char *put_text(char *p, const char *s) {
+    size_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+/* One line of the data file format (see ledger_save). */
+static char *render_text(char *p, const Transaction *t) {
+    long cents = (long)(t->amount * 100.0 + 0.5);
+    p = put_uint(p, (unsigned long)t->y); *p++ = '|';
+    p = put_uint(p, (unsigned long)t->m); *p++ = '|';
+    p = put_uint(p, (unsigned long)t->d); *p++ = '|';
+    *p++ = (char)('0' + t->type); *p++ = '|';
+    p = put_text(p, t->category); *p++ = '|';
+    p = put_uint(p, (unsigned long)(cents / 100)); *p++ = '.';
+    *p++ = (char)('0' + cents / 10 % 10); *p++ = (char)('0' + cents % 10); *p++ = '|';
+    p = put_text(p, t->note); *p++ = '\n';
+    return p;
+}
+
+typedef struct {
+    const Gen *g;
+    long first;                      // first chunk of this batch
+    char **buf;                      // one output buffer per chunk
+    size_t *len;
+} RenderCtx;
+
+static void render_chunks(void *c, long b, long e) {
+    RenderCtx *r = c;
+    const Gen *g = r->g;
+    for (long k = b; k < e; ++k) {
+        long chunk = r->first + k;
+        long lo = chunk * GEN_CHUNK, hi = lo + GEN_CHUNK < g->spec->rows ? lo + GEN_CHUNK : g->spec->rows;
+        unsigned long long s = g->spec->seed ^ (0x5851f42d4c957f2dull * (unsigned long long)(chunk + 1));
+        splitmix64(&s);
+        unsigned long long t0 = fin_trace_begin();
+        char *p = r->buf[k];
+        for (long i = lo; i < hi; ++i) {
+            Transaction t;
+            gen_row(g, &s, i, &t);
+            if (g->spec->binary) { fin_encode_row((unsigned char *)p, (int)i, &t); p += BIN_ROW_LEN; }
+            else p = render_text(p, &t);
+        }
+        r->len[k] = (size_t)(p - r->buf[k]);
+        fin_trace_end("gen_chunk", t0);
+        fin_checkpoint(hi - lo);
+    }
+}
+
+/* ----------------------- Driver ----------------------------------- */
+
+static int gen_init(Gen *g, const GenSpec *spec) {
+    memset(g, 0, sizeof(*g));
+    g->spec = spec;
+    int y = spec->startYear, m = 1, d = 1;
+    g->days = 0;
+    for (int k = 0; k < spec->years; ++k) {
+        int yy = spec->startYear + k;
+        g->days += ((yy % 4 == 0 && yy % 100 != 0) || yy % 400 == 0) ? 366 : 365;
+    }
+    g->dayY = fin_malloc(MEM_GENERATOR, (size_t)g->days * sizeof(short));
+    g->dayM = fin_malloc(MEM_GENERATOR, (size_t)g->days);
+    g->dayD = fin_malloc(MEM_GENERATOR, (size_t)g->days);
+    if (!g->dayY || !g->dayM || !g->dayD) return 0;
+    for (long k = 0; k < g->days; ++k) {
+        g->dayY[k] = (short)y; g->dayM[k] = (unsigned char)m; g->dayD[k] = (unsigned char)d;
+        if (!fin_valid_date(y, m, ++d)) { d = 1; if (++m > 12) { m = 1; y++; } }
+    }
+
+    double cum = 0.0;
+    for (int k = 0; k < N_EXPENSES; ++k) g->zipf[k] = cum += 1.0 / pow(k + 1, ZIPF_S);
+
+    static const char *const STREETS[] = { "OAK ST APTS", "MAPLE COURT LLC", "RIVERSIDE PM", "HILLTOP HOMES" };
+    static const char *const FIRMS[] = { "ACME CORP", "GLOBEX INC", "INITECH", "UMBRELLA LLC" };
+    unsigned long long s = spec->seed;
+    g->rent = 900.0 + (double)(splitmix64(&s) % 1600);
+    g->salary = g->rent * (2.6 + uniform(&s));
+    strcpy(g->landlord, STREETS[splitmix64(&s) % 4]);
+    strcpy(g->employer, FIRMS[splitmix64(&s) % 4]);
+    return 1;
+}
+
+static void gen_free(Gen *g) {
+    fin_free(g->dayY);
+    fin_free(g->dayM);
+    fin_free(g->dayD);
+}
+
+int fin_generate(FILE *f, const GenSpec *spec) {
+    if (spec->rows < 0 || spec->years < 1 || !fin_valid_date(spec->startYear, 1, 1)
+        || !fin_valid_date(spec->startYear + spec->years - 1, 12, 31)) return 0;
+    Gen g;
+    if (!gen_init(&g, spec)) { gen_free(&g); return 0; }
+
+    if (spec->binary) {                          // the writer's file header
+        Writer *w = writer_new(f, FMT_BINARY);
+        if (!w) { gen_free(&g); return 0; }
+        writer_begin_rows(w);
+        writer_free(w);
+    }
+
+    long chunks = (spec->rows + GEN_CHUNK - 1) / GEN_CHUNK;
+    int batch = fin_pool_threads() * 2;
+    size_t cap = (size_t)GEN_CHUNK * (spec->binary ? BIN_ROW_LEN : GEN_ROW_MAX);
+    char **buf = fin_calloc(MEM_GENERATOR, (size_t)batch, sizeof(char *));
+    size_t *len = fin_calloc(MEM_GENERATOR, (size_t)batch, sizeof(size_t));
+    int ok = buf && len;
+    for (int k = 0; ok && k < batch; ++k) ok = (buf[k] = fin_malloc(MEM_GENERATOR, cap)) != NULL;
+
+    fin_progress_begin(spec->rows);
+    for (long first = 0; ok && first < chunks; first += batch) {
+        long n = chunks - first < batch ? chunks - first : batch;
+        RenderCtx r = { &g, first, buf, len };
+        fin_parallel_for(n, 1, render_chunks, &r);
+        if (fin_checkpoint(0)) { ok = FIN_CANCELLED; break; }
+        unsigned long long t0 = fin_trace_begin();
+        for (long k = 0; k < n; ++k)
+            if (fwrite(buf[k], 1, len[k], f) != len[k]) { ok = 0; break; }
+        fin_trace_end("gen_write", t0);
+    }
+
+    for (int k = 0; buf && k < batch; ++k) fin_free(buf[k]);
+    fin_free(buf);
+    fin_free(len);
+    gen_free(&g);
+    return ok;
+}
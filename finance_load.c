@@ -0,0 +1,354 @@
+/*
+  finance_load.c - open-loop load generator: N concurrent clients issue
+  a weighted mix of inserts, searches, filters, range sums, charts and
+  summaries at a fixed total rate, and the run reports throughput and
+  latency percentiles per operation.
+
+  Clients are threads. By default they share one in-process Ledger and
+  answer each request with fin_serve_request(), exactly as the daemon
+  would; with -s each client opens its own connection to a running
+  daemon (finance_tracker -f FILE daemon SOCKET) instead. Requests are
+  the daemon's wire frames either way.
+
+  The schedule is fixed up front: client c sends request k at
+  start + (k + c / clients) * clients / rate, whether or not earlier
+  requests have finished. Latency is measured from that intended send
+  time, so a stall is charged to every request queued behind it
+  (coordinated omission corrected); service time, measured from the
+  actual send, is reported next to it. Requests still unsent when the
+  run ends are counted as unsent: a non-zero count means the target
+  rate is above what the engine sustains.
+
+  Usage: finance_load [-c CLIENTS] [-r RATE] [-d SECONDS] [-m MIX]
+                      [-n ROWS | -f DATAFILE | -s SOCKET] [-j THREADS]
+                      [-o OUT.json]
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "finance.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS  64              // well under the ledger's reader slots
+#define FIRST_YEAR   2016            // dates drawn from the generator's range
+#define YEARS        10
+#define LOAD_SEED    20240601ull
+
+typedef enum { K_ADD, K_SEARCH, K_FILTER, K_RANGE, K_CHART, K_SUMMARY, KINDS } Kind;
+
+static const char *const KIND_NAMES[KINDS] = { "add", "search", "filter", "range", "chart", "summary" };
+
+static const char *const TERMS[] = {
+    "groc", "dining", "coffee", "fuel", "rent", "salary", "STARBUCKS", "UBER", "AMZN", "SHELL"
+};
+#define N_TERMS ((int)(sizeof(TERMS) / sizeof(TERMS[0])))
+
+typedef struct {
+    int id;
+    unsigned long long rng;
+    FinSamples lat[KINDS], svc[KINDS];  // corrected latency, service time
+    long sent, failed, unsent, oom;
+    int fd;                          // socket mode
+    FinBuf req, resp;
+    RowSet hits;
+} Client;
+
+static Ledger *ledger;               // in-process mode
+static const char *sockPath;
+static int nClients = 4;
+static double rate = 1000.0, seconds = 10.0;
+static int weights[KINDS] = { 10, 30, 10, 30, 15, 5 };
+static int totalWeight;
+static unsigned long long startNs, endNs;
+
+/* ----------------------- Requests --------------------------------- */
+
+static unsigned long long next_rand(unsigned long long *s) {
+    *s ^= *s << 13; *s ^= *s >> 7; *s ^= *s << 17;
+    return *s;
+}
+
+static Kind pick_kind(Client *c) {
+    int r = (int)(next_rand(&c->rng) % (unsigned long long)totalWeight);
+    int k = 0;
+    while (r >= weights[k]) r -= weights[k++];
+    return (Kind)k;
+}
+
+static void put_date(FinBuf *b, int y, int m, int d) {
+    finbuf_put_le(b, (unsigned)y, 2);
+    finbuf_put_le(b, (unsigned)m, 1);
+    finbuf_put_le(b, (unsigned)d, 1);
+}
+
+/* Fills c->req with a request of kind k; returns its FinOp. */
+static FinOp build(Client *c, Kind k) {
+    unsigned long long r = next_rand(&c->rng);
+    int y = FIRST_YEAR + (int)(r % YEARS), m = 1 + (int)((r >> 8) % 12), d = 1 + (int)((r >> 16) % 28);
+    c->req.len = 0;
+    switch (k) {
+    case K_ADD: {
+        Transaction t = {0};
+        unsigned char rec[BIN_ROW_LEN];
+        t.y = y; t.m = m; t.d = d;
+        t.type = (r >> 24) % 8 ? EXPENSE : INCOME;
+        t.amount = 1 + (double)((r >> 32) % 20000) / 100.0;
+        strcpy(t.category, TERMS[(r >> 40) % 4]);
+        snprintf(t.note, NOTE_LEN, "LOADGEN %d #%04d", c->id, (int)((r >> 48) % 10000));
+        fin_encode_row(rec, 0, &t);
+        finbuf_put(&c->req, rec, BIN_ROW_LEN);
+        return OP_ADD;
+    }
+    case K_SEARCH:
+        if ((r >> 24) % 4 == 0) { put_date(&c->req, y, m, d); return OP_SEARCH_DATE; }
+        finbuf_put_le(&c->req, (r >> 26) % 2 ? FIELD_NOTE : FIELD_CATEGORY, 1);
+        finbuf_put(&c->req, TERMS[(r >> 32) % N_TERMS], strlen(TERMS[(r >> 32) % N_TERMS]));
+        return OP_SEARCH_TEXT;
+    case K_FILTER:
+        finbuf_put_f64(&c->req, 50.0 + (double)((r >> 24) % 1000));
+        return OP_FILTER;
+    case K_RANGE: {                  // one to twelve months from the drawn date
+        int months = 1 + (int)((r >> 24) % 12), y1 = y + (m - 1 + months) / 12, m1 = 1 + (m - 1 + months) % 12;
+        put_date(&c->req, y, m, 1);
+        put_date(&c->req, y1, m1, 1);
+        return OP_RANGE_SUM;
+    }
+    case K_CHART:
+        finbuf_put_le(&c->req, (unsigned)y, 2);
+        return OP_CHART;
+    default:
+        return OP_SUMMARY;
+    }
+}
+
+/* Sends c->req as op; returns the reply status, or -1 on I/O error. */
+static int issue(Client *c, FinOp op) {
+    if (sockPath) return fin_client_call(c->fd, op, c->req.data, c->req.len, &c->resp);
+    c->resp.len = 0;
+    fin_serve_request(ledger, NULL, &c->hits, op, c->req.data, c->req.len, &c->resp);
+    return c->resp.len >= 5 ? c->resp.data[4] : -1;
+}
+
+/* ----------------------- Clients ---------------------------------- */
+
+static void sleep_until(unsigned long long ns) {
+    struct timespec ts = { (time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull) };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+static void *client_main(void *arg) {
+    Client *c = arg;
+    double interval = nClients / rate * 1e9;
+    char name[16];
+    snprintf(name, sizeof(name), "client-%d", c->id);
+    fin_trace_thread_name(name);
+    for (long k = 0; ; ++k) {
+        unsigned long long due = startNs + (unsigned long long)((k + (double)c->id / nClients) * interval);
+        if (due >= endNs) break;
+        unsigned long long now = fin_clock_ns();
+        if (now >= endNs) {          // behind schedule when time ran out
+            c->unsent += (long)((endNs - due) / interval) + 1;
+            break;
+        }
+        if (now < due) sleep_until(due);
+        Kind kind = pick_kind(c);
+        FinOp op = build(c, kind);
+        unsigned long long sent = fin_clock_ns();
+        int st = issue(c, op);
+        unsigned long long done = fin_clock_ns();
+        if (st < 0 && sockPath) { c->failed++; break; }
+        if (st != FIN_ST_OK) c->failed++;
+        c->sent++;
+        c->oom |= !fin_samples_add(&c->lat[kind], done - due) | !fin_samples_add(&c->svc[kind], done - sent);
+    }
+    return NULL;
+}
+
+/* ----------------------- Report ----------------------------------- */
+
+/* Concatenates one kind's samples of every client (kind KINDS: all). */
+static int gather(Client *cl, int kind, int service, FinSamples *out) {
+    out->n = 0;
+    for (int c = 0; c < nClients; ++c)
+        for (int k = 0; k < KINDS; ++k) {
+            if (kind != KINDS && k != kind) continue;
+            const FinSamples *s = service ? &cl[c].svc[k] : &cl[c].lat[k];
+            for (size_t i = 0; i < s->n; ++i)
+                if (!fin_samples_add(out, s->ns[i])) return 0;
+        }
+    fin_samples_sort(out);
+    return 1;
+}
+
+static void write_dist(FILE *f, const char *key, const FinSamples *s) {
+    fprintf(f, "\"%s\": {\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+            key, fin_samples_pct(s, 50), fin_samples_pct(s, 90), fin_samples_pct(s, 99), fin_samples_pct(s, 99.9),
+            s->n ? s->ns[s->n - 1] : 0);
+}
+
+static int report(FILE *json, Client *cl, double wall) {
+    long sent = 0, failed = 0, unsent = 0;
+    for (int c = 0; c < nClients; ++c) {
+        sent += cl[c].sent;
+        failed += cl[c].failed;
+        unsent += cl[c].unsent;
+    }
+    fprintf(stderr, "%ld request(s) in %.2f s: %.0f/s against a target of %.0f/s, %ld failed, %ld unsent\n",
+            sent, wall, sent / wall, rate, failed, unsent);
+    fprintf(stderr, "%-8s %9s %11s %11s %11s %11s %13s\n",
+            "Op", "Count", "p50 ms", "p99 ms", "p99.9 ms", "Max ms", "svc p99 ms");
+    fprintf(json, "{\n  \"mode\": \"%s\",\n  \"clients\": %d,\n  \"threads\": %d,\n  \"target_rate\": %.1f,\n"
+                  "  \"seconds\": %.3f,\n  \"requests\": %ld,\n  \"failed\": %ld,\n  \"unsent\": %ld,\n"
+                  "  \"throughput\": %.1f,\n  \"ops\": [",
+            sockPath ? "socket" : "in-process", nClients, fin_pool_threads(), rate, wall, sent, failed, unsent,
+            sent / wall);
+    FinSamples lat = {0}, svc = {0};
+    int first = 1, ok = 1;
+    for (int k = 0; k <= KINDS && ok; ++k) {
+        if (k < KINDS && !weights[k]) continue;
+        ok = gather(cl, k, 0, &lat) && gather(cl, k, 1, &svc);
+        const char *name = k < KINDS ? KIND_NAMES[k] : "all";
+        fprintf(stderr, "%-8s %9zu %11.3f %11.3f %11.3f %11.3f %13.3f\n", name, lat.n,
+                fin_samples_pct(&lat, 50) / 1e6, fin_samples_pct(&lat, 99) / 1e6, fin_samples_pct(&lat, 99.9) / 1e6,
+                lat.n ? lat.ns[lat.n - 1] / 1e6 : 0.0, fin_samples_pct(&svc, 99) / 1e6);
+        fprintf(json, "%s\n    {\"op\": \"%s\", \"count\": %zu, ", first ? "" : ",", name, lat.n);
+        write_dist(json, "latency", &lat);
+        fprintf(json, ", ");
+        write_dist(json, "service", &svc);
+        fprintf(json, "}");
+        first = 0;
+    }
+    fprintf(json, "\n  ]\n}\n");
+    fin_samples_free(&lat);
+    fin_samples_free(&svc);
+    if (!ok) fprintf(stderr, "Out of memory while reporting.\n");
+    return ok;
+}
+
+/* ----------------------- Driver ----------------------------------- */
+
+static int parse_mix(const char *s) {
+    int w[KINDS] = {0}, total = 0;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", s);
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        char *eq = strchr(tok, '='), *end;
+        int k = 0;
+        if (!eq) return 0;
+        *eq = '\0';
+        while (k < KINDS && strcmp(tok, KIND_NAMES[k]) != 0) k++;
+        if (k == KINDS) return 0;
+        w[k] = (int)strtol(eq + 1, &end, 10);
+        if (*end || w[k] < 0 || w[k] > 1000000) return 0;
+        total += w[k];
+    }
+    if (!total) return 0;
+    memcpy(weights, w, sizeof(w));
+    return 1;
+}
+
+static int load_fixture(const char *dataFile, long rows) {
+    char path[] = "/tmp/finance_load_XXXXXX";
+    if (!dataFile) {
+        int fd = mkstemp(path);
+        if (fd < 0) { fprintf(stderr, "Cannot create a fixture file: %s\n", strerror(errno)); return 0; }
+        FILE *f = fdopen(fd, "w");
+        if (!f) close(fd);
+        GenSpec spec = { LOAD_SEED, rows, FIRST_YEAR, YEARS, 0 };
+        int ok = f && fin_generate(f, &spec) == 1;
+        if (f && fclose(f) != 0) ok = 0;
+        if (!ok) { fprintf(stderr, "Cannot generate a fixture in '%s'.\n", path); remove(path); return 0; }
+    }
+    int n = ledger_load(ledger, dataFile ? dataFile : path);
+    if (!dataFile) remove(path);
+    if (n < 0) { fprintf(stderr, "Cannot read '%s': %s\n", dataFile ? dataFile : path, strerror(errno)); return 0; }
+    fprintf(stderr, "Loaded %d record(s).\n", n);
+    return 1;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+        "Usage: finance_load [-c CLIENTS] [-r RATE] [-d SECONDS] [-m MIX]\n"
+        "                    [-n ROWS | -f DATAFILE | -s SOCKET] [-j THREADS] [-o OUT.json]\n"
+        "Defaults: -c 4 -r 1000 -d 10 -n 100000, and\n"
+        "          -m add=10,search=30,filter=10,range=30,chart=15,summary=5\n"
+        "RATE is requests per second over all clients. Without -s the clients\n"
+        "share an in-process ledger (-f, or ROWS synthetic records); with -s they\n"
+        "connect to a running daemon, whose ledger the adds really change.\n");
+}
+
+int main(int argc, char **argv) {
+    const char *dataFile = NULL, *outPath = NULL;
+    long rows = 100000;
+    int threads = 0;
+
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) { usage(); return 2; }
+        const char *v = argv[i + 1];
+        char *end;
+        if (strcmp(argv[i], "-c") == 0 && (nClients = atoi(v)) > 0 && nClients <= MAX_CLIENTS) {}
+        else if (strcmp(argv[i], "-r") == 0 && (rate = strtod(v, &end)) > 0 && !*end) {}
+        else if (strcmp(argv[i], "-d") == 0 && (seconds = strtod(v, &end)) > 0 && !*end) {}
+        else if (strcmp(argv[i], "-m") == 0 && parse_mix(v)) {}
+        else if (strcmp(argv[i], "-n") == 0 && (rows = strtol(v, &end, 10)) >= 0 && !*end) {}
+        else if (strcmp(argv[i], "-f") == 0) dataFile = v;
+        else if (strcmp(argv[i], "-s") == 0) sockPath = v;
+        else if (strcmp(argv[i], "-j") == 0 && (threads = atoi(v)) > 0) {}
+        else if (strcmp(argv[i], "-o") == 0) outPath = v;
+        else { usage(); return 2; }
+    }
+    for (int k = 0; k < KINDS; ++k) totalWeight += weights[k];
+    fin_pool_init(threads);
+
+    Client *cl = calloc((size_t)nClients, sizeof(Client));
+    if (!cl) { fprintf(stderr, "Out of memory.\n"); return 1; }
+    if (!sockPath && (!(ledger = ledger_new()) || !load_fixture(dataFile, rows))) return 1;
+    for (int c = 0; c < nClients; ++c) {
+        cl[c].id = c;
+        cl[c].rng = LOAD_SEED + 0x9e3779b97f4a7c15ull * (unsigned long long)(c + 1);
+        cl[c].fd = -1;
+        if (sockPath && (cl[c].fd = fin_client_connect(sockPath)) < 0) {
+            fprintf(stderr, "Cannot connect to '%s': %s\n", sockPath, strerror(errno));
+            return 1;
+        }
+    }
+
+    pthread_t tids[MAX_CLIENTS];
+    int started = 0, rc = 0;
+    startNs = fin_clock_ns() + 10000000ull;      // 10 ms for the threads to start
+    endNs = startNs + (unsigned long long)(seconds * 1e9);
+    for (; started < nClients; ++started)
+        if (pthread_create(&tids[started], NULL, client_main, &cl[started]) != 0) break;
+    if (started < nClients) {
+        fprintf(stderr, "Could only start %d client thread(s).\n", started);
+        rc = 1;
+    }
+    for (int c = 0; c < started; ++c) pthread_join(tids[c], NULL);
+    double wall = (fin_clock_ns() - startNs) / 1e9;
+
+    FILE *json = outPath ? fopen(outPath, "w") : stdout;
+    if (!json) { perror(outPath); rc = 1; }
+    else {
+        if (!report(json, cl, wall)) rc = 1;
+        if (outPath && fclose(json) != 0) rc = 1;
+    }
+    for (int c = 0; c < nClients; ++c) {
+        if (cl[c].oom) { fprintf(stderr, "Client %d ran out of memory for samples.\n", c); rc = 1; }
+        if (cl[c].fd >= 0) close(cl[c].fd);
+        for (int k = 0; k < KINDS; ++k) { fin_samples_free(&cl[c].lat[k]); fin_samples_free(&cl[c].svc[k]); }
+        finbuf_free(&cl[c].req);
+        finbuf_free(&cl[c].resp);
+        rowset_free(&cl[c].hits);
+    }
+    free(cl);
+    ledger_free(ledger);
+    fin_pool_shutdown();
+    return rc;
+}
@@ -0,0 +1,807 @@
+/*
+  finance_lsm.c - log-structured merge store (see finance.h).
+
+  A store directory holds:
+    MANIFEST        live runs, options, next ids and I/O counters;
+                    replaced atomically (write + rename) on every change
+    wal.log         entries put since the last flush
+    run-NNNNNN.sst  immutable sorted runs
+
+  An entry is a u64 key (date yyyymmdd << SEQ_BITS | sequence number)
+  followed by a BIN_ROW_LEN row record whose index field holds the
+  entry's flags; a tombstone is an entry with ENTRY_TOMBSTONE set and
+  the key of the row it deletes. Sequence numbers are never reused, so
+  a key is put at most once and any tombstone for it is newer: merges
+  need no notion of run age, only "a key with a tombstone is dead".
+
+  Run file: entries in key order, in blocks of BLOCK_ENTRIES; then the
+  fence index (first key of each block, u64); then the bloom filter over
+  the run's distinct dates; then a footer (magic, entries, min key, max
+  key, bloom bits, bloom hashes). Fences and filters stay in memory,
+  blocks are read with pread() on demand.
+
+  Compaction (synchronous, after the flush that triggers it):
+    leveled  L0 collects flushed runs; at L0_TRIGGER runs they are merged
+             with L1 into a new L1. Level i >= 1 holds one run, and when
+             it outgrows memtableRows * fanout^i entries it is merged into
+             level i+1. A row is rewritten about fanout times per level.
+    tiered   every level collects up to fanout runs, which are then merged
+             into one new run on the next level. A row is rewritten once
+             per level, at the cost of up to fanout runs to probe per level.
+  Tombstones are dropped when a merge has no older data below it.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define SEQ_BITS        38
+#define SEQ_MASK        ((1ull << SEQ_BITS) - 1)
+#define ENTRY_LEN       (8 + BIN_ROW_LEN)
+#define ENTRY_TOMBSTONE 1
+#define BLOCK_ENTRIES   64
+#define BLOCK_BYTES     ((long long)BLOCK_ENTRIES * ENTRY_LEN)
+#define FOOTER_LEN      48
+#define RUN_MAGIC       0x31524d534c4e4946ull   // "FINLSMR1"
+#define L0_TRIGGER      4
+#define MAX_FANOUT      64
+#define MAX_BLOOM_K     30
+#define PATH_LEN        4096
+#define DIR_LEN         (PATH_LEN - 64)  // leaves room for file names
+
+typedef struct {
+    unsigned long long key;
+    int flags;
+    Transaction t;
+} Entry;
+
+typedef struct {
+    int id, level, fd;
+    int picked;                       // input of the merge being set up
+    long long n, bytes;
+    long nBlocks;
+    unsigned long long minKey, maxKey;
+    unsigned long long *fence;        // first key of each block
+    unsigned char *bloom;
+    unsigned long long bloomBits;
+    int bloomK;
+} Run;
+
+struct FinLsm {
+    pthread_mutex_t mu;
+    char dir[DIR_LEN];
+    FinLsmOptions opt;
+    FILE *wal;
+    Entry *mem;                       // memtable, sorted lazily
+    long memN, memCap;
+    int memSorted;
+    Run *runs;                        // by level, then newest first
+    int nRuns, capRuns;
+    unsigned long long nextSeq;
+    int nextId;
+    FinLsmStats st;                   // counters; the per-level fields are filled on demand
+};
+
+/* ----------------------- Keys and encoding ------------------------ */
+
+static unsigned long long date_num(int y, int m, int d) { return (unsigned long long)(y * 10000 + m * 100 + d); }
+static unsigned long long key_of(unsigned long long date, unsigned long long seq) { return date << SEQ_BITS | seq; }
+static unsigned long long key_date(unsigned long long key) { return key >> SEQ_BITS; }
+
+static void put_u64(unsigned char *p, unsigned long long v) {
+    for (int k = 0; k < 8; ++k) { p[k] = (unsigned char)(v & 0xff); v >>= 8; }
+}
+
+static void encode_entry(unsigned char *p, const Entry *e) {
+    put_u64(p, e->key);
+    fin_encode_row(p + 8, e->flags, &e->t);
+}
+
+static void decode_entry(const unsigned char *p, Entry *e) {
+    e->key = fin_get_le(p, 8);
+    fin_decode_row(p + 8, &e->flags, &e->t);
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    unsigned long long x = ((const Entry *)a)->key, y = ((const Entry *)b)->key;
+    return (x > y) - (x < y);
+}
+
+/* Days from 1970-01-01 of a yyyymmdd date, for sizing filters. */
+static long long days_of(unsigned long long date) {
+    return fin_days_from_civil((int)(date / 10000), (int)(date / 100 % 100), (int)(date % 100));
+}
+
+/* ----------------------- Bloom filters ---------------------------- */
+
+static unsigned long long mix64(unsigned long long x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static void bloom_add(Run *r, unsigned long long date) {
+    unsigned long long h = mix64(date), h2 = (h >> 32) | 1;
+    for (int i = 0; i < r->bloomK; ++i, h += h2) {
+        unsigned long long bit = h % r->bloomBits;
+        r->bloom[bit >> 3] |= (unsigned char)(1u << (bit & 7));
+    }
+}
+
+static int bloom_may_contain(const Run *r, unsigned long long date) {
+    unsigned long long h = mix64(date), h2 = (h >> 32) | 1;
+    for (int i = 0; i < r->bloomK; ++i, h += h2) {
+        unsigned long long bit = h % r->bloomBits;
+        if (!(r->bloom[bit >> 3] & (1u << (bit & 7)))) return 0;
+    }
+    return 1;
+}
+
+/* ----------------------- Run files -------------------------------- */
+
+static void run_path(const FinLsm *db, int id, char *path) {
+    snprintf(path, PATH_LEN, "%s/run-%06d.sst", db->dir, id);
+}
+
+static void run_release(Run *r) {
+    if (r->fd >= 0) close(r->fd);
+    fin_free(r->fence);
+    fin_free(r->bloom);
+    r->fd = -1;
+    r->fence = NULL;
+    r->bloom = NULL;
+}
+
+/* Opens run id and loads its fences and filter. */
+static int run_open(FinLsm *db, Run *r, int id, int level) {
+    char path[PATH_LEN];
+    unsigned char foot[FOOTER_LEN];
+    struct stat sb;
+    memset(r, 0, sizeof(*r));
+    r->id = id;
+    r->level = level;
+    run_path(db, id, path);
+    if ((r->fd = open(path, O_RDONLY)) < 0) return 0;
+    if (fstat(r->fd, &sb) != 0 || sb.st_size < FOOTER_LEN
+        || !fin_pread_full(r->fd, foot, FOOTER_LEN, sb.st_size - FOOTER_LEN)) goto bad;
+    if (fin_get_le(foot, 8) != RUN_MAGIC) goto bad;
+    r->n = (long long)fin_get_le(foot + 8, 8);
+    r->minKey = fin_get_le(foot + 16, 8);
+    r->maxKey = fin_get_le(foot + 24, 8);
+    r->bloomBits = fin_get_le(foot + 32, 8);
+    r->bloomK = (int)fin_get_le(foot + 40, 8);
+    r->nBlocks = (long)((r->n + BLOCK_ENTRIES - 1) / BLOCK_ENTRIES);
+    r->bytes = sb.st_size;
+    long long bloomBytes = (long long)(r->bloomBits + 7) / 8;
+    if (r->n <= 0 || r->bloomBits == 0 || r->bloomK < 1 || r->bloomK > MAX_BLOOM_K
+        || r->n * ENTRY_LEN + r->nBlocks * 8 + bloomBytes + FOOTER_LEN != sb.st_size) goto bad;
+    r->fence = fin_malloc(MEM_LSM, (size_t)r->nBlocks * 8);
+    r->bloom = fin_malloc(MEM_LSM, (size_t)bloomBytes);
+    unsigned char *raw = fin_malloc(MEM_LSM, (size_t)r->nBlocks * 8);
+    int ok = r->fence && r->bloom && raw
+             && fin_pread_full(r->fd, raw, (size_t)r->nBlocks * 8, (off_t)(r->n * ENTRY_LEN))
+             && fin_pread_full(r->fd, r->bloom, (size_t)bloomBytes, (off_t)(r->n * ENTRY_LEN + r->nBlocks * 8));
+    for (long b = 0; ok && b < r->nBlocks; ++b) r->fence[b] = fin_get_le(raw + b * 8, 8);
+    fin_free(raw);
+    if (ok) return 1;
+    if (!r->fence || !r->bloom) errno = ENOMEM;
+    run_release(r);
+    return 0;
+bad:
+    run_release(r);
+    errno = EINVAL;
+    return 0;
+}
+
+/* Streams sorted entries into a new run file. */
+typedef struct {
+    FILE *f;
+    Run r;
+    long long cap;                    // entries the fence array can hold
+    unsigned long long lastDate;
+    unsigned char buf[ENTRY_LEN];
+} RunWriter;
+
+static int rw_begin(FinLsm *db, RunWriter *w, int level, long long maxEntries, long maxDates) {
+    char path[PATH_LEN];
+    memset(w, 0, sizeof(*w));
+    w->r.fd = -1;
+    w->r.id = db->nextId++;
+    w->r.level = level;
+    w->cap = maxEntries;
+    w->lastDate = (unsigned long long)-1;
+    long long keys = maxDates < maxEntries ? maxDates : maxEntries;
+    w->r.bloomBits = (unsigned long long)(keys > 0 ? keys : 1) * (unsigned long long)db->opt.bloomBitsPerKey;
+    if (w->r.bloomBits < 64) w->r.bloomBits = 64;
+    w->r.bloomK = (int)(db->opt.bloomBitsPerKey * 0.69 + 0.5);
+    if (w->r.bloomK < 1) w->r.bloomK = 1;
+    if (w->r.bloomK > MAX_BLOOM_K) w->r.bloomK = MAX_BLOOM_K;
+    w->r.fence = fin_malloc(MEM_LSM, (size_t)((maxEntries + BLOCK_ENTRIES - 1) / BLOCK_ENTRIES + 1) * 8);
+    w->r.bloom = fin_calloc(MEM_LSM, 1, (size_t)(w->r.bloomBits + 7) / 8);
+    run_path(db, w->r.id, path);
+    if (!w->r.fence || !w->r.bloom) { run_release(&w->r); errno = ENOMEM; return 0; }
+    if (!(w->f = fopen(path, "wb"))) { run_release(&w->r); return 0; }
+    return 1;
+}
+
+static int rw_add(RunWriter *w, const Entry *e) {
+    if (w->r.n == w->cap) { errno = EOVERFLOW; return 0; }
+    if (w->r.n % BLOCK_ENTRIES == 0) w->r.fence[w->r.n / BLOCK_ENTRIES] = e->key;
+    if (!w->r.n) w->r.minKey = e->key;
+    w->r.maxKey = e->key;
+    unsigned long long date = key_date(e->key);
+    if (date != w->lastDate) { bloom_add(&w->r, date); w->lastDate = date; }
+    encode_entry(w->buf, e);
+    w->r.n++;
+    return fwrite(w->buf, 1, ENTRY_LEN, w->f) == ENTRY_LEN;
+}
+
+/* Writes the index and footer and reopens the run for reading. An
+   empty run is removed and reported as r.n == 0. */
+static int rw_finish(FinLsm *db, RunWriter *w, int ok) {
+    char path[PATH_LEN];
+    unsigned char u[8], foot[FOOTER_LEN];
+    Run *r = &w->r;
+    r->nBlocks = (long)((r->n + BLOCK_ENTRIES - 1) / BLOCK_ENTRIES);
+    for (long b = 0; ok && b < r->nBlocks; ++b) {
+        put_u64(u, r->fence[b]);
+        ok = fwrite(u, 1, 8, w->f) == 8;
+    }
+    if (ok) ok = fwrite(r->bloom, 1, (size_t)(r->bloomBits + 7) / 8, w->f) == (r->bloomBits + 7) / 8;
+    unsigned long long fields[6] = { RUN_MAGIC, (unsigned long long)r->n, r->minKey, r->maxKey,
+                                     r->bloomBits, (unsigned long long)r->bloomK };
+    for (int k = 0; k < 6; ++k) put_u64(foot + 8 * k, fields[k]);
+    if (ok) ok = fwrite(foot, 1, FOOTER_LEN, w->f) == FOOTER_LEN;
+    if (ok) ok = fflush(w->f) == 0 && fsync(fileno(w->f)) == 0;
+    if (fclose(w->f) != 0) ok = 0;
+    run_path(db, r->id, path);
+    if (!ok || r->n == 0) {
+        run_release(r);
+        remove(path);
+        return ok;
+    }
+    r->bytes = r->n * ENTRY_LEN + r->nBlocks * 8 + (long long)(r->bloomBits + 7) / 8 + FOOTER_LEN;
+    if ((r->fd = open(path, O_RDONLY)) < 0) { run_release(r); return 0; }
+    return 1;
+}
+
+/* ----------------------- Manifest --------------------------------- */
+
+static int write_manifest(FinLsm *db) {
+    char path[PATH_LEN], tmp[PATH_LEN];
+    snprintf(path, PATH_LEN, "%s/MANIFEST", db->dir);
+    snprintf(tmp, PATH_LEN, "%s/MANIFEST.tmp", db->dir);
+    FILE *f = fopen(tmp, "w");
+    if (!f) return 0;
+    const FinLsmStats *s = &db->st;
+    fprintf(f, "finlsm 1\npolicy %d %d %ld %d\nnext %llu %d\n", db->opt.policy, db->opt.fanout,
+            db->opt.memtableRows, db->opt.bloomBitsPerKey, db->nextSeq, db->nextId);
+    fprintf(f, "written %llu %llu %llu %llu %llu %llu %llu\n", s->userBytes, s->walBytes, s->flushBytes,
+            s->compactReadBytes, s->compactWriteBytes, s->flushes, s->compactions);
+    fprintf(f, "read %llu %llu %llu %llu %llu %llu\n", s->lookups, s->scans, s->runsProbed, s->bloomSkips,
+            s->bloomFalsePositives, s->blocksRead);
+    for (int k = 0; k < db->nRuns; ++k) fprintf(f, "run %d %d\n", db->runs[k].level, db->runs[k].id);
+    int ok = fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0) ok = 0;
+    return ok && rename(tmp, path) == 0;
+}
+
+/* Keeps runs ordered by level, newest (highest id) first within one. */
+static int cmp_run(const void *a, const void *b) {
+    const Run *x = a, *y = b;
+    if (x->level != y->level) return x->level - y->level;
+    return y->id - x->id;
+}
+
+static int add_run(FinLsm *db, const Run *r) {
+    if (db->nRuns == db->capRuns) {
+        int cap = db->capRuns ? db->capRuns * 2 : 16;
+        Run *p = fin_realloc(MEM_LSM, db->runs, (size_t)cap * sizeof(Run));
+        if (!p) { errno = ENOMEM; return 0; }
+        db->runs = p;
+        db->capRuns = cap;
+    }
+    db->runs[db->nRuns++] = *r;
+    qsort(db->runs, (size_t)db->nRuns, sizeof(Run), cmp_run);
+    return 1;
+}
+
+static int read_manifest(FinLsm *db, FILE *f) {
+    char line[256];
+    int version = 0, policy = 0, level, id;
+    FinLsmStats *s = &db->st;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "finlsm %d", &version) == 1) continue;
+        if (sscanf(line, "policy %d %d %ld %d", &policy, &db->opt.fanout,
+                   &db->opt.memtableRows, &db->opt.bloomBitsPerKey) == 4) {
+            db->opt.policy = policy ? LSM_TIERED : LSM_LEVELED;
+            continue;
+        }
+        if (sscanf(line, "next %llu %d", &db->nextSeq, &db->nextId) == 2) continue;
+        if (sscanf(line, "written %llu %llu %llu %llu %llu %llu %llu", &s->userBytes, &s->walBytes,
+                   &s->flushBytes, &s->compactReadBytes, &s->compactWriteBytes, &s->flushes,
+                   &s->compactions) == 7) continue;
+        if (sscanf(line, "read %llu %llu %llu %llu %llu %llu", &s->lookups, &s->scans, &s->runsProbed,
+                   &s->bloomSkips, &s->bloomFalsePositives, &s->blocksRead) == 6) continue;
+        if (sscanf(line, "run %d %d", &level, &id) == 2 && level >= 0 && level < LSM_MAX_LEVELS) {
+            Run r;
+            if (!run_open(db, &r, id, level)) return 0;
+            if (!add_run(db, &r)) { run_release(&r); return 0; }
+            continue;
+        }
+        errno = EINVAL;
+        return 0;
+    }
+    if (version != 1 || db->opt.fanout < 2 || db->opt.memtableRows < 1 || db->opt.bloomBitsPerKey < 1) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+/* ----------------------- Memtable and WAL ------------------------- */
+
+static int mem_add(FinLsm *db, const Entry *e) {
+    if (db->memN == db->memCap) {
+        long cap = db->memCap ? db->memCap * 2 : 1024;
+        Entry *p = fin_realloc(MEM_LSM, db->mem, (size_t)cap * sizeof(Entry));
+        if (!p) { errno = ENOMEM; return 0; }
+        db->mem = p;
+        db->memCap = cap;
+    }
+    db->mem[db->memN++] = *e;
+    db->memSorted = 0;
+    return 1;
+}
+
+static void mem_sort(FinLsm *db) {
+    if (!db->memSorted) qsort(db->mem, (size_t)db->memN, sizeof(Entry), cmp_entry);
+    db->memSorted = 1;
+}
+
+/* Appends entries to the log before they reach the memtable; wal_sync()
+   makes them durable before a put or delete returns. A crash after a
+   flush wrote its run but before the log was emptied replays entries
+   the run already has; they carry the same keys, and a merge keeps one
+   entry per key. */
+static int wal_append(FinLsm *db, const Entry *e, int n) {
+    unsigned char buf[ENTRY_LEN];
+    for (int i = 0; i < n; ++i) {
+        encode_entry(buf, &e[i]);
+        if (fwrite(buf, 1, ENTRY_LEN, db->wal) != ENTRY_LEN) return 0;
+    }
+    db->st.walBytes += (unsigned long long)n * ENTRY_LEN;
+    return 1;
+}
+
+static int wal_sync(FinLsm *db) {
+    return fflush(db->wal) == 0 && fsync(fileno(db->wal)) == 0;
+}
+
+static int wal_replay(FinLsm *db, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return errno == ENOENT;
+    unsigned char buf[ENTRY_LEN];
+    int ok = 1;
+    while (ok && fread(buf, 1, ENTRY_LEN, f) == ENTRY_LEN) {   // a torn last entry is dropped
+        Entry e;
+        decode_entry(buf, &e);
+        if (!(e.flags & ENTRY_TOMBSTONE) && (e.key & SEQ_MASK) >= db->nextSeq) db->nextSeq = (e.key & SEQ_MASK) + 1;
+        ok = mem_add(db, &e);
+    }
+    fclose(f);
+    return ok;
+}
+
+/* ----------------------- Merging ---------------------------------- */
+
+/* Cursor over the memtable (run == NULL) or one run, limited to [lo, hi]. */
+typedef struct {
+    FinLsm *db;
+    const Run *run;
+    long long pos, end;
+    unsigned char *blk;
+    long blkNo;
+    unsigned long long hi;
+    Entry cur;
+    int valid;
+} Iter;
+
+static int it_load(Iter *it) {
+    it->valid = 0;
+    if (it->pos >= it->end) return 1;
+    if (!it->run) {
+        it->cur = it->db->mem[it->pos];
+    } else {
+        long b = (long)(it->pos / BLOCK_ENTRIES);
+        if (b != it->blkNo) {
+            long long first = (long long)b * BLOCK_ENTRIES;
+            long long k = it->run->n - first < BLOCK_ENTRIES ? it->run->n - first : BLOCK_ENTRIES;
+            if (!fin_pread_full(it->run->fd, it->blk, (size_t)(k * ENTRY_LEN), (off_t)(first * ENTRY_LEN))) return 0;
+            it->blkNo = b;
+            it->db->st.blocksRead++;
+        }
+        decode_entry(it->blk + (it->pos % BLOCK_ENTRIES) * ENTRY_LEN, &it->cur);
+    }
+    it->valid = it->cur.key <= it->hi;
+    return 1;
+}
+
+/* Positions it at the first key >= lo. */
+static int it_seek(FinLsm *db, Iter *it, const Run *run, unsigned long long lo, unsigned long long hi) {
+    memset(it, 0, sizeof(*it));
+    it->db = db;
+    it->run = run;
+    it->hi = hi;
+    it->blkNo = -1;
+    long long a = 0, b;
+    if (!run) {
+        b = db->memN;
+        while (a < b) {
+            long long mid = (a + b) / 2;
+            if (db->mem[mid].key < lo) a = mid + 1; else b = mid;
+        }
+        it->pos = a;
+        it->end = db->memN;
+        return it_load(it);
+    }
+    if (!(it->blk = fin_malloc(MEM_LSM, (size_t)BLOCK_BYTES))) { errno = ENOMEM; return 0; }
+    b = run->nBlocks;                    // last block whose first key <= lo
+    while (a < b) {
+        long long mid = (a + b) / 2;
+        if (run->fence[mid] <= lo) a = mid + 1; else b = mid;
+    }
+    it->pos = (a ? a - 1 : 0) * BLOCK_ENTRIES;
+    it->end = run->n;
+    if (!it_load(it)) return 0;
+    while (it->valid && it->cur.key < lo) {
+        it->pos++;
+        if (!it_load(it)) return 0;
+    }
+    return 1;
+}
+
+static int it_next(Iter *it) {
+    it->pos++;
+    return it_load(it);
+}
+
+/* Visits the entries of its[0..n) in key order, one per key. A key with
+   a tombstone in any source is dead: it is skipped, or passed on as a
+   tombstone when keepTombs and no source still holds its row. emit
+   returns nonzero to stop; merge returns 0 on an I/O error (or emit < 0). */
+static int merge(Iter *its, int n, int keepTombs, int (*emit)(void *ctx, const Entry *e), void *ctx) {
+    for (;;) {
+        int best = -1;
+        for (int k = 0; k < n; ++k)
+            if (its[k].valid && (best < 0 || its[k].cur.key < its[best].cur.key)) best = k;
+        if (best < 0) return 1;
+        Entry e = its[best].cur;
+        int tomb = 0, puts = 0;
+        for (int k = 0; k < n; ++k) {
+            if (!its[k].valid || its[k].cur.key != e.key) continue;
+            if (its[k].cur.flags & ENTRY_TOMBSTONE) tomb = 1;
+            else { puts = 1; e = its[k].cur; }
+            if (!it_next(&its[k])) return 0;
+        }
+        int r = 0;
+        if (!tomb) r = emit(ctx, &e);
+        else if (keepTombs && !puts) { e.flags = ENTRY_TOMBSTONE; r = emit(ctx, &e); }
+        if (r < 0) return 0;
+        if (r > 0) return 1;
+    }
+}
+
+static int emit_to_run(void *ctx, const Entry *e) {
+    return rw_add(ctx, e) ? 0 : -1;
+}
+
+static void close_iters(Iter *its, int n) {
+    for (int k = 0; k < n; ++k) fin_free(its[k].blk);
+    fin_free(its);
+}
+
+/* ----------------------- Flush and compaction --------------------- */
+
+/* Merges the picked runs (plus the memtable if withMem) into one new
+   run on outLevel, then swaps it in. */
+static int merge_runs(FinLsm *db, int withMem, int outLevel) {
+    unsigned long long t0 = fin_trace_begin();
+    int n = withMem, bottom = 1;
+    long long entries = withMem ? db->memN : 0, readBytes = 0;
+    unsigned long long minKey = (unsigned long long)-1, maxKey = 0;
+    if (withMem && db->memN) { mem_sort(db); minKey = db->mem[0].key; maxKey = db->mem[db->memN - 1].key; }
+    for (int k = 0; k < db->nRuns; ++k) {
+        const Run *r = &db->runs[k];
+        if (!r->picked) { if (r->level >= outLevel) bottom = 0; continue; }
+        n++;
+        entries += r->n;
+        readBytes += r->bytes;
+        if (r->minKey < minKey) minKey = r->minKey;
+        if (r->maxKey > maxKey) maxKey = r->maxKey;
+    }
+    if (!entries) return 1;
+
+    Iter *its = fin_calloc(MEM_LSM, (size_t)n, sizeof(Iter));
+    int *ids = fin_malloc(MEM_LSM, (size_t)n * sizeof(int));
+    RunWriter w;
+    int ok = its && ids, m = 0;
+    if (!ok) errno = ENOMEM;
+    if (ok && withMem) ok = it_seek(db, &its[m++], NULL, 0, (unsigned long long)-1);
+    for (int k = 0; ok && k < db->nRuns; ++k)
+        if (db->runs[k].picked) ok = it_seek(db, &its[m++], &db->runs[k], 0, (unsigned long long)-1);
+    if (ok) ok = rw_begin(db, &w, outLevel, entries, days_of(key_date(maxKey)) - days_of(key_date(minKey)) + 1);
+    if (ok) ok = rw_finish(db, &w, merge(its, m, !bottom, emit_to_run, &w));
+    if (its) close_iters(its, n);
+    if (!ok) { fin_free(ids); return 0; }
+
+    // Drop the inputs, add the output, make that durable, then delete the inputs' files.
+    char path[PATH_LEN];
+    int keep = 0, nIds = 0;
+    for (int k = 0; k < db->nRuns; ++k) {
+        if (!db->runs[k].picked) { db->runs[keep++] = db->runs[k]; continue; }
+        ids[nIds++] = db->runs[k].id;
+        run_release(&db->runs[k]);
+    }
+    db->nRuns = keep;
+    if (w.r.n && !add_run(db, &w.r)) { run_release(&w.r); fin_free(ids); return 0; }
+    if (withMem) {
+        db->memN = 0;
+        db->st.flushBytes += (unsigned long long)w.r.bytes;
+        db->st.flushes++;
+    }
+    if (n > withMem) {
+        db->st.compactReadBytes += (unsigned long long)readBytes;
+        db->st.compactWriteBytes += (unsigned long long)w.r.bytes;
+        db->st.compactions++;
+    }
+    if (!write_manifest(db)) { fin_free(ids); return 0; }
+    for (int k = 0; k < nIds; ++k) { run_path(db, ids[k], path); remove(path); }
+    fin_free(ids);
+    fin_trace_end(withMem ? "lsm_flush" : "lsm_compact", t0);
+    return 1;
+}
+
+static void level_totals(const FinLsm *db, int level, int *runs, long long *entries) {
+    *runs = 0;
+    *entries = 0;
+    for (int k = 0; k < db->nRuns; ++k)
+        if (db->runs[k].level == level) { (*runs)++; *entries += db->runs[k].n; }
+}
+
+/* Merges until no level is over its limit. */
+static int compact_as_needed(FinLsm *db) {
+    for (int level = 0; level < LSM_MAX_LEVELS; ++level) {
+        int runs, out = level + 1 < LSM_MAX_LEVELS ? level + 1 : level;
+        long long entries, limit = db->opt.memtableRows;
+        level_totals(db, level, &runs, &entries);
+        for (int k = 1; k <= level && limit < LLONG_MAX / db->opt.fanout; ++k) limit *= db->opt.fanout;
+        int over = db->opt.policy == LSM_TIERED ? runs >= db->opt.fanout
+                 : level == 0 ? runs >= L0_TRIGGER
+                 : entries > limit && out != level;
+        if (!over) continue;
+        for (int k = 0; k < db->nRuns; ++k)
+            db->runs[k].picked = db->runs[k].level == level
+                                 || (db->opt.policy == LSM_LEVELED && db->runs[k].level == out);
+        if (!merge_runs(db, 0, out)) return 0;
+    }
+    return 1;
+}
+
+static int flush_locked(FinLsm *db) {
+    if (!db->memN) return 1;
+    for (int k = 0; k < db->nRuns; ++k) db->runs[k].picked = 0;
+    if (!merge_runs(db, 1, 0)) return 0;
+    char path[PATH_LEN];
+    snprintf(path, PATH_LEN, "%s/wal.log", db->dir);
+    FILE *wal = fopen(path, "wb");   // the memtable is in a run now
+    if (!wal) return 0;              // keep logging to the old one; replay skips what the run has
+    fclose(db->wal);
+    db->wal = wal;
+    return compact_as_needed(db);
+}
+
+/* ----------------------- Public API ------------------------------- */
+
+FinLsm *fin_lsm_open(const char *dir, const FinLsmOptions *opt) {
+    char path[PATH_LEN];
+    if (strlen(dir) >= DIR_LEN) { errno = ENAMETOOLONG; return NULL; }
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return NULL;
+    FinLsm *db = fin_calloc(MEM_LSM, 1, sizeof(FinLsm));
+    if (!db) { errno = ENOMEM; return NULL; }
+    pthread_mutex_init(&db->mu, NULL);
+    strcpy(db->dir, dir);
+    if (opt) db->opt = *opt;
+    if (db->opt.memtableRows <= 0) db->opt.memtableRows = 65536;
+    if (db->opt.fanout < 2) db->opt.fanout = 10;
+    if (db->opt.fanout > MAX_FANOUT) db->opt.fanout = MAX_FANOUT;
+    if (db->opt.bloomBitsPerKey <= 0) db->opt.bloomBitsPerKey = 10;
+    if (db->opt.bloomBitsPerKey > 64) db->opt.bloomBitsPerKey = 64;
+    db->memSorted = 1;
+
+    snprintf(path, PATH_LEN, "%s/MANIFEST", dir);
+    FILE *f = fopen(path, "r");
+    int ok;
+    if (f) {
+        ok = read_manifest(db, f);
+        fclose(f);
+    } else {
+        ok = errno == ENOENT && write_manifest(db);
+    }
+    snprintf(path, PATH_LEN, "%s/wal.log", dir);
+    if (ok) ok = wal_replay(db, path) && (db->wal = fopen(path, "ab")) != NULL;
+    if (ok) return db;
+    int err = errno;
+    fin_lsm_close(db);
+    errno = err;
+    return NULL;
+}
+
+int fin_lsm_close(FinLsm *db) {
+    if (!db) return 1;
+    int ok = 1;
+    if (db->wal) {
+        ok = fin_lsm_flush(db) && write_manifest(db);
+        if (fclose(db->wal) != 0) ok = 0;
+    }
+    for (int k = 0; k < db->nRuns; ++k) run_release(&db->runs[k]);
+    fin_free(db->runs);
+    fin_free(db->mem);
+    pthread_mutex_destroy(&db->mu);
+    fin_free(db);
+    return ok;
+}
+
+int fin_lsm_put(FinLsm *db, const Transaction *rows, int n, int *rejected) {
+    Entry batch[256];
+    int stored = 0, bad = 0, ok = 1;
+    pthread_mutex_lock(&db->mu);
+    for (int i = 0; i < n && ok; ) {
+        int k = 0;
+        for (; i < n && k < (int)(sizeof(batch) / sizeof(batch[0])); ++i) {
+            const Transaction *t = &rows[i];
+            if (!fin_valid_date(t->y, t->m, t->d) || !(t->amount >= 0.0 && t->amount <= FIN_AMOUNT_MAX) || (unsigned)t->type > 1u
+                || db->nextSeq > SEQ_MASK) { bad++; continue; }
+            Entry *e = &batch[k++];
+            e->key = key_of(date_num(t->y, t->m, t->d), db->nextSeq++);
+            e->flags = 0;
+            e->t = *t;
+            e->t.category[STR_LEN-1] = e->t.note[NOTE_LEN-1] = '\0';
+            for (char *s = e->t.category; *s; ++s) if (*s == '|') *s = '/';
+            for (char *s = e->t.note; *s; ++s) if (*s == '|') *s = '/';
+        }
+        ok = wal_append(db, batch, k);
+        for (int j = 0; ok && j < k; ++j) ok = mem_add(db, &batch[j]);
+        if (ok) {
+            stored += k;
+            db->st.userBytes += (unsigned long long)k * ENTRY_LEN;
+        }
+        if (ok && db->memN >= db->opt.memtableRows) ok = flush_locked(db);
+    }
+    if (ok && stored) ok = wal_sync(db);
+    pthread_mutex_unlock(&db->mu);
+    if (rejected) *rejected = bad;
+    return ok ? stored : -1;
+}
+
+int fin_lsm_delete(FinLsm *db, int y, int m, int d, unsigned long long seq) {
+    Entry e;
+    memset(&e, 0, sizeof(e));
+    e.key = key_of(date_num(y, m, d), seq & SEQ_MASK);
+    e.flags = ENTRY_TOMBSTONE;
+    e.t.y = y; e.t.m = m; e.t.d = d;
+    pthread_mutex_lock(&db->mu);
+    int ok = wal_append(db, &e, 1) && wal_sync(db) && mem_add(db, &e);
+    if (ok) db->st.userBytes += ENTRY_LEN;
+    if (ok && db->memN >= db->opt.memtableRows) ok = flush_locked(db);
+    pthread_mutex_unlock(&db->mu);
+    return ok;
+}
+
+int fin_lsm_flush(FinLsm *db) {
+    pthread_mutex_lock(&db->mu);
+    int ok = flush_locked(db);
+    pthread_mutex_unlock(&db->mu);
+    return ok;
+}
+
+int fin_lsm_compact(FinLsm *db) {
+    pthread_mutex_lock(&db->mu);
+    int ok = flush_locked(db), out = 1;
+    for (int k = 0; ok && k < db->nRuns; ++k) {
+        db->runs[k].picked = 1;
+        if (db->runs[k].level > out) out = db->runs[k].level;
+    }
+    if (ok && db->nRuns > 0) ok = merge_runs(db, 0, out);
+    pthread_mutex_unlock(&db->mu);
+    return ok;
+}
+
+typedef struct {
+    FinLsmRowFn fn;
+    void *ctx;
+    long rows;
+} ScanCtx;
+
+static int emit_row(void *c, const Entry *e) {
+    ScanCtx *sc = c;
+    sc->rows++;
+    return sc->fn(sc->ctx, e->key & SEQ_MASK, &e->t) ? 1 : 0;
+}
+
+long fin_lsm_scan(FinLsm *db, int y0, int m0, int d0, int y1, int m1, int d1,
+                  FinLsmRowFn fn, void *ctx) {
+    unsigned long long from = date_num(y0, m0, d0), to = date_num(y1, m1, d1);
+    unsigned long long lo = key_of(from, 0), hi = key_of(to, SEQ_MASK);
+    int point = from == to, n = 0, ok = 1;
+    ScanCtx sc = { fn, ctx, 0 };
+    pthread_mutex_lock(&db->mu);
+    if (point) db->st.lookups++; else db->st.scans++;
+    Iter *its = fin_calloc(MEM_LSM, (size_t)db->nRuns + 1, sizeof(Iter));
+    if (!its) { errno = ENOMEM; ok = 0; }
+    if (ok && db->memN) { mem_sort(db); ok = it_seek(db, &its[n++], NULL, lo, hi); }
+    for (int k = 0; ok && k < db->nRuns; ++k) {
+        const Run *r = &db->runs[k];
+        if (r->maxKey < lo || r->minKey > hi) continue;
+        if (point && !bloom_may_contain(r, from)) { db->st.bloomSkips++; continue; }
+        ok = it_seek(db, &its[n++], r, lo, hi);
+        if (ok && point) {
+            db->st.runsProbed++;
+            db->st.bloomFalsePositives += !its[n - 1].valid;   // filter passed, no such date
+        }
+    }
+    if (ok) ok = merge(its, n, 0, emit_row, &sc);
+    if (its) close_iters(its, db->nRuns + 1);
+    pthread_mutex_unlock(&db->mu);
+    return ok ? sc.rows : -1;
+}
+
+void fin_lsm_stats(FinLsm *db, FinLsmStats *st) {
+    pthread_mutex_lock(&db->mu);
+    *st = db->st;
+    st->policy = db->opt.policy;
+    st->fanout = db->opt.fanout;
+    st->memtableRows = db->memN;
+    for (int l = 0; l < LSM_MAX_LEVELS; ++l) { st->runs[l] = 0; st->entries[l] = st->bytes[l] = 0; }
+    for (int k = 0; k < db->nRuns; ++k) {
+        const Run *r = &db->runs[k];
+        st->runs[r->level]++;
+        st->entries[r->level] += r->n;
+        st->bytes[r->level] += r->bytes;
+    }
+    st->writeAmp = st->userBytes
+        ? (double)(st->walBytes + st->flushBytes + st->compactWriteBytes) / (double)st->userBytes : 0.0;
+    pthread_mutex_unlock(&db->mu);
+}
+
+int fin_lsm_write_stats_json(FILE *f, FinLsm *db) {
+    FinLsmStats s;
+    fin_lsm_stats(db, &s);
+    fprintf(f, "{\"policy\": \"%s\", \"fanout\": %d, \"memtable_rows\": %ld, \"levels\": [",
+            s.policy == LSM_TIERED ? "tiered" : "leveled", s.fanout, s.memtableRows);
+    int first = 1;
+    for (int l = 0; l < LSM_MAX_LEVELS; ++l) {
+        if (!s.runs[l]) continue;
+        fprintf(f, "%s\n  {\"level\": %d, \"runs\": %d, \"entries\": %lld, \"bytes\": %lld}",
+                first ? "" : ",", l, s.runs[l], s.entries[l], s.bytes[l]);
+        first = 0;
+    }
+    fprintf(f, "\n],\n\"user_bytes\": %llu, \"wal_bytes\": %llu, \"flush_bytes\": %llu, "
+               "\"compaction_read_bytes\": %llu, \"compaction_write_bytes\": %llu, \"flushes\": %llu, "
+               "\"compactions\": %llu, \"write_amplification\": %.2f,\n"
+               "\"lookups\": %llu, \"scans\": %llu, \"runs_probed\": %llu, \"bloom_skips\": %llu, "
+               "\"bloom_false_positives\": %llu, \"blocks_read\": %llu}\n",
+            s.userBytes, s.walBytes, s.flushBytes, s.compactReadBytes, s.compactWriteBytes, s.flushes,
+            s.compactions, s.writeAmp, s.lookups, s.scans, s.runsProbed, s.bloomSkips,
+            s.bloomFalsePositives, s.blocksRead);
+    return !ferror(f);
+}
@@ -0,0 +1,135 @@
+/*
+  finance_mem.c - tracked allocator and memory report (see finance.h).
+
+  Every engine allocation goes through fin_malloc() and friends with a
+  FinMemTag naming the subsystem that owns it. A small header in front
+  of each block records its size and tag, so fin_free() can charge the
+  right counter without being told; counters are relaxed atomics, so
+  any thread may allocate. ledger_mem_usage() adds what the counters
+  cannot see: how much of a ledger's row array and of each record's
+  fixed-width text fields is actually used.
+*/
+
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef union {
+    max_align_t align;            // keeps the block after it aligned
+    struct {
+        size_t size;
+        int tag;
+    } h;
+} MemHead;
+
+typedef struct {
+    atomic_llong bytes, peak;
+    atomic_ullong allocs, frees;
+} MemCounters;
+
+const char *const FIN_MEM_NAMES[MEM_TAGS] = {
+    "records", "snapshots", "dedupe_index", "results", "aggregates", "sort",
+    "ingest", "writer", "daemon", "pool", "generator", "trace", "replay", "lsm", "pack", "columns", "cache",
+    "external"
+};
+
+static MemCounters mem[MEM_TAGS];
+
+/* ----------------------- Allocation hooks ------------------------- */
+
+static void charge(int tag, long long delta) {
+    MemCounters *c = &mem[tag];
+    long long now = atomic_fetch_add_explicit(&c->bytes, delta, memory_order_relaxed) + delta;
+    long long pk = atomic_load_explicit(&c->peak, memory_order_relaxed);
+    while (now > pk && !atomic_compare_exchange_weak_explicit(&c->peak, &pk, now,
+                                                              memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+static void *track(MemHead *h, FinMemTag tag, size_t n) {
+    if (!h) return NULL;
+    h->h.size = n;
+    h->h.tag = tag;
+    atomic_fetch_add_explicit(&mem[tag].allocs, 1, memory_order_relaxed);
+    charge(tag, (long long)n);
+    return h + 1;
+}
+
+void *fin_malloc(FinMemTag tag, size_t n) {
+    if ((unsigned)tag >= MEM_TAGS || n > (size_t)-1 - sizeof(MemHead)) return NULL;
+    return track(malloc(sizeof(MemHead) + n), tag, n);
+}
+
+void *fin_calloc(FinMemTag tag, size_t n, size_t size) {
+    if ((unsigned)tag >= MEM_TAGS || (size && n > ((size_t)-1 - sizeof(MemHead)) / size)) return NULL;
+    MemHead *h = calloc(1, sizeof(MemHead) + n * size);
+    return track(h, tag, n * size);
+}
+
+/* Like realloc(); the block keeps the tag it was allocated with. */
+void *fin_realloc(FinMemTag tag, void *p, size_t n) {
+    if (!p) return fin_malloc(tag, n);
+    if (n > (size_t)-1 - sizeof(MemHead)) return NULL;
+    MemHead *h = (MemHead *)p - 1;
+    size_t old = h->h.size;
+    h = realloc(h, sizeof(MemHead) + n);
+    if (!h) return NULL;
+    h->h.size = n;
+    charge(h->h.tag, (long long)n - (long long)old);
+    return h + 1;
+}
+
+void fin_free(void *p) {
+    if (!p) return;
+    MemHead *h = (MemHead *)p - 1;
+    atomic_fetch_add_explicit(&mem[h->h.tag].frees, 1, memory_order_relaxed);
+    charge(h->h.tag, -(long long)h->h.size);
+    free(h);
+}
+
+size_t fin_alloc_size(const void *p) {
+    return p ? ((const MemHead *)p - 1)->h.size : 0;
+}
+
+/* ----------------------- Reporting -------------------------------- */
+
+void fin_mem_get(FinMemTag tag, FinMemStats *s) {
+    memset(s, 0, sizeof(*s));
+    if ((unsigned)tag >= MEM_TAGS) return;
+    s->bytes = atomic_load(&mem[tag].bytes);
+    s->peak = atomic_load(&mem[tag].peak);
+    s->allocs = atomic_load(&mem[tag].allocs);
+    s->frees = atomic_load(&mem[tag].frees);
+}
+
+long long fin_mem_total(void) {
+    long long t = 0;
+    for (int k = 0; k < MEM_TAGS; ++k) t += atomic_load(&mem[k].bytes);
+    return t;
+}
+
+int fin_mem_write_json(FILE *f, const Ledger *L) {
+    long long total = fin_mem_total();
+    fprintf(f, "{\"header_bytes\": %zu, \"total_bytes\": %lld, \"subsystems\": [", sizeof(MemHead), total);
+    for (int k = 0; k < MEM_TAGS; ++k) {
+        FinMemStats s;
+        fin_mem_get((FinMemTag)k, &s);
+        fprintf(f, "%s\n  {\"name\": \"%s\", \"bytes\": %lld, \"peak_bytes\": %lld, \"allocs\": %llu, \"frees\": %llu}",
+                k ? "," : "", FIN_MEM_NAMES[k], s.bytes, s.peak, s.allocs, s.frees);
+    }
+    fprintf(f, "\n]");
+    if (L) {
+        LedgerMemUsage u;
+        ledger_mem_usage(L, &u);
+        fprintf(f, ",\n\"ledger\": {\"rows\": %ld, \"row_bytes_used\": %lld, \"row_bytes_reserved\": %lld, "
+                   "\"column_bytes\": %lld, \"text_bytes_used\": %lld, \"text_bytes_reserved\": %lld, \"retired_bytes\": %lld, "
+                   "\"bytes_per_row\": %.1f, \"total_bytes_per_row\": %.1f}",
+                u.rows, u.rowBytesUsed, u.rowBytesReserved, u.columnBytes, u.textBytesUsed, u.textBytesReserved,
+                u.retiredBytes, u.rows ? (double)u.rowBytesReserved / u.rows : 0.0,
+                u.rows ? (double)total / u.rows : 0.0);
+    }
+    fprintf(f, "}\n");
+    return !ferror(f);
+}
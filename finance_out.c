@@ -0,0 +1,393 @@
+/*
+  finance_out.c - result writers: rows and aggregates streamed as a
+  table, CSV, JSON Lines or fixed-width binary records (see finance.h).
+
+  Rows are rendered into one large reusable buffer with hand-written
+  formatters and handed to the sink in big fwrite() chunks, instead of
+  one printf per row; nothing is allocated per row. Call writer_end()
+  before printing anything else to the same FILE so output stays in
+  order.
+*/
+
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define OUT_BUF_LEN (1 << 16)
+#define OUT_ROW_MAX 512              // upper bound on one rendered row
+#define WRITE_CHECK 4096             // rows written between cancel checkpoints
+
+struct Writer {
+    FILE *sink;
+    OutFormat fmt;
+    const char *keyName, *valName;   // aggregate field names (JSONL)
+    size_t len;
+    char buf[OUT_BUF_LEN];
+};
+
+const char *const FMT_NAMES[4] = { "table", "csv", "jsonl", "binary" };
+
+static const char SPACES[] = "                                                                ";
+static const char DIGIT_PAIRS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* ----------------------- Buffered output -------------------------- */
+
+static void out_flush(Writer *w) {
+    if (w->len) { fwrite(w->buf, 1, w->len, w->sink); w->len = 0; }
+}
+
+static void out_reserve(Writer *w, size_t n) {
+    if (w->len + n > OUT_BUF_LEN) out_flush(w);
+}
+
+static void out_mem(Writer *w, const char *s, size_t n) {
+    if (n > OUT_BUF_LEN) { out_flush(w); fwrite(s, 1, n, w->sink); return; }
+    out_reserve(w, n);
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static void out_pad(Writer *w, int n) {
+    while (n > 0) {
+        int k = n < (int)sizeof(SPACES)-1 ? n : (int)sizeof(SPACES)-1;
+        out_mem(w, SPACES, (size_t)k);
+        n -= k;
+    }
+}
+
+/* Left-justified string, at least `width` characters (like %-Ns). */
+static void out_str(Writer *w, const char *s, int width) {
+    size_t n = strlen(s);
+    out_mem(w, s, n);
+    if ((int)n < width) out_pad(w, width - (int)n);
+}
+
+/* Writes the decimal digits of v right-aligned ending at `end`,
+   returns a pointer to the first digit. */
+static char *fmt_u64(char *end, unsigned long long v) {
+    while (v >= 100) {
+        unsigned r = (unsigned)(v % 100); v /= 100;
+        end -= 2; memcpy(end, DIGIT_PAIRS + 2*r, 2);
+    }
+    if (v >= 10) { end -= 2; memcpy(end, DIGIT_PAIRS + 2*v, 2); }
+    else *--end = (char)('0' + v);
+    return end;
+}
+
+/* Integer; width > 0 right-justifies, width < 0 left-justifies,
+   zeroPad fills with '0' (like %0Nd for non-negative v). */
+static void out_int(Writer *w, long long v, int width, int zeroPad) {
+    char tmp[24], *end = tmp + sizeof(tmp);
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    char *p = fmt_u64(end, u);
+    if (zeroPad) while (end - p < width) *--p = '0';
+    if (v < 0) *--p = '-';
+    int n = (int)(end - p);
+    if (width > n) out_pad(w, width - n);
+    out_mem(w, p, (size_t)n);
+    if (-width > n) out_pad(w, -width - n);
+}
+
+/* Fixed-point with two decimals, right-justified (like %N.2f). Values
+   too large for exact cents arithmetic, or sitting on a half-cent tie,
+   fall back to snprintf so output matches printf exactly. */
+static void out_money(Writer *w, double v, int width) {
+    char tmp[64], *end = tmp + sizeof(tmp), *p;
+    double a = v < 0 ? -v : v;
+    double x = a * 100.0;
+    unsigned long long c = (unsigned long long)x;
+    double frac = x - (double)c;
+
+    if (!(a < 1e9) || (frac > 0.4999 && frac < 0.5001)) {
+        int n = snprintf(tmp, sizeof(tmp), "%.2f", v);
+        if (n < 0) return;
+        if (width > n) out_pad(w, width - n);
+        out_mem(w, tmp, (size_t)n);
+        return;
+    }
+    if (frac > 0.5) c++;
+    p = end;
+    *--p = (char)('0' + c % 10);
+    *--p = (char)('0' + c / 10 % 10);
+    *--p = '.';
+    p = fmt_u64(p, c / 100);
+    if (v < 0) *--p = '-';
+    int n = (int)(end - p);
+    if (width > n) out_pad(w, width - n);
+    out_mem(w, p, (size_t)n);
+}
+
+/* ----------------------- Row formats ------------------------------ */
+
+static void print_header(Writer *w) {
+    static const char hdr[] =
+        "Idx  Date        Type     Category               Amount      Note\n"
+        "---- ----------- -------- ---------------------- ----------- ------------------------------\n";
+    out_mem(w, hdr, sizeof(hdr)-1);
+}
+
+static void print_transaction(Writer *w, int i, const Transaction *t) {
+    out_reserve(w, OUT_ROW_MAX);
+    out_int(w, i, -4, 0);
+    out_mem(w, " ", 1);
+    out_int(w, t->y, 4, 1);
+    out_mem(w, "-", 1);
+    out_int(w, t->m, 2, 1);
+    out_mem(w, "-", 1);
+    out_int(w, t->d, 2, 1);
+    out_mem(w, " ", 1);
+    if (t->type == INCOME) out_mem(w, "INCOME   ", 9); else out_mem(w, "EXPENSE  ", 9);
+    out_str(w, t->category, 22);
+    out_mem(w, " ", 1);
+    out_money(w, t->amount, 11);
+    out_mem(w, " ", 1);
+    out_str(w, t->note, 0);
+    out_mem(w, "\n", 1);
+}
+
+static void out_le(Writer *w, unsigned long long v, int bytes) {
+    char b[8];
+    for (int k = 0; k < bytes; ++k) { b[k] = (char)(v & 0xff); v >>= 8; }
+    out_mem(w, b, (size_t)bytes);
+}
+
+static void out_f64(Writer *w, double v) {
+    unsigned long long u;
+    memcpy(&u, &v, sizeof(u));
+    out_le(w, u, 8);
+}
+
+/* Fixed-size NUL-padded text field. */
+static void out_field(Writer *w, const char *s, size_t width) {
+    static const char zeros[NOTE_LEN] = {0};
+    size_t n = 0;
+    while (n < width && s[n]) n++;
+    out_mem(w, s, n);
+    out_mem(w, zeros, width - n);
+}
+
+static void out_bin_header(Writer *w, unsigned recLen, unsigned kind) {
+    out_mem(w, BIN_MAGIC, 8);
+    out_le(w, recLen, 4);
+    out_le(w, kind, 4);
+}
+
+static void out_csv_str(Writer *w, const char *s) {
+    if (!strpbrk(s, ",\"\r\n")) { out_str(w, s, 0); return; }
+    out_mem(w, "\"", 1);
+    for (const char *p = s; *p; ++p) {
+        if (*p == '"') out_mem(w, "\"\"", 2); else out_mem(w, p, 1);
+    }
+    out_mem(w, "\"", 1);
+}
+
+/* Length of the well-formed UTF-8 sequence at p, or 0 if it is not
+   one (overlong forms, surrogates and code points past U+10FFFF
+   included). */
+static int utf8_len(const unsigned char *p) {
+    if (*p < 0x80) return 1;
+    if (*p < 0xc2) return 0;
+    if (*p < 0xe0) return (p[1] & 0xc0) == 0x80 ? 2 : 0;
+    if (*p < 0xf0) {
+        unsigned lo = *p == 0xe0 ? 0xa0 : 0x80, hi = *p == 0xed ? 0x9f : 0xbf;
+        return p[1] >= lo && p[1] <= hi && (p[2] & 0xc0) == 0x80 ? 3 : 0;
+    }
+    if (*p < 0xf5) {
+        unsigned lo = *p == 0xf0 ? 0x90 : 0x80, hi = *p == 0xf4 ? 0x8f : 0xbf;
+        return p[1] >= lo && p[1] <= hi && (p[2] & 0xc0) == 0x80 && (p[3] & 0xc0) == 0x80 ? 4 : 0;
+    }
+    return 0;
+}
+
+/* JSON strings must be UTF-8: a byte that does not start a well-formed
+   sequence is written as U+FFFD. */
+static void out_json_str(Writer *w, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    out_mem(w, "\"", 1);
+    for (const unsigned char *p = (const unsigned char *)s; *p; ) {
+        int n = utf8_len(p);
+        if (*p == '"' || *p == '\\') { char e[2] = { '\\', (char)*p }; out_mem(w, e, 2); }
+        else if (*p < 0x20) { char e[6] = { '\\', 'u', '0', '0', hex[*p >> 4], hex[*p & 15] }; out_mem(w, e, 6); }
+        else if (n) out_mem(w, (const char *)p, (size_t)n);
+        else { out_mem(w, "\xef\xbf\xbd", 3); n = 1; }
+        p += n;
+    }
+    out_mem(w, "\"", 1);
+}
+
+static void out_date(Writer *w, const Transaction *t) {
+    out_int(w, t->y, 4, 1);
+    out_mem(w, "-", 1);
+    out_int(w, t->m, 2, 1);
+    out_mem(w, "-", 1);
+    out_int(w, t->d, 2, 1);
+}
+
+/* ----------------------- Binary row codec ------------------------- */
+
+static void put_le(unsigned char *p, unsigned long long v, int bytes) {
+    for (int k = 0; k < bytes; ++k) { p[k] = (unsigned char)(v & 0xff); v >>= 8; }
+}
+
+static unsigned long long get_le(const unsigned char *p, int bytes) {
+    unsigned long long v = 0;
+    for (int k = bytes - 1; k >= 0; --k) v = (v << 8) | p[k];
+    return v;
+}
+
+void fin_encode_row(unsigned char *rec, int idx, const Transaction *t) {
+    unsigned long long u;
+    memset(rec, 0, BIN_ROW_LEN);
+    put_le(rec, (unsigned)idx, 4);
+    put_le(rec + 4, (unsigned)t->y, 2);
+    rec[6] = (unsigned char)t->m;
+    rec[7] = (unsigned char)t->d;
+    rec[8] = (unsigned char)t->type;
+    memcpy(&u, &t->amount, sizeof(u));
+    put_le(rec + 16, u, 8);
+    for (int k = 0; k < STR_LEN && t->category[k]; ++k) rec[24 + k] = (unsigned char)t->category[k];
+    for (int k = 0; k < NOTE_LEN && t->note[k]; ++k) rec[88 + k] = (unsigned char)t->note[k];
+}
+
+void fin_decode_row(const unsigned char *rec, int *idx, Transaction *t) {
+    unsigned long long u = get_le(rec + 16, 8);
+    if (idx) *idx = (int)get_le(rec, 4);
+    t->y = (int)get_le(rec + 4, 2);
+    t->m = rec[6];
+    t->d = rec[7];
+    t->type = rec[8] ? EXPENSE : INCOME;
+    memcpy(&t->amount, &u, sizeof(u));
+    memcpy(t->category, rec + 24, STR_LEN);
+    memcpy(t->note, rec + 88, NOTE_LEN);
+    t->category[STR_LEN-1] = '\0';
+    t->note[NOTE_LEN-1] = '\0';
+}
+
+/* ----------------------- Writer API ------------------------------- */
+
+Writer *writer_new(FILE *sink, OutFormat fmt) {
+    Writer *w = fin_malloc(MEM_WRITER, sizeof(*w));
+    if (!w) return NULL;
+    w->sink = sink;
+    w->fmt = fmt;
+    w->keyName = "key";
+    w->valName = "value";
+    w->len = 0;
+    return w;
+}
+
+void writer_free(Writer *w) {
+    if (!w) return;
+    out_flush(w);
+    fin_free(w);
+}
+
+void writer_set_format(Writer *w, OutFormat fmt) { w->fmt = fmt; }
+OutFormat writer_format(const Writer *w) { return w->fmt; }
+
+int fin_parse_format(const char *s, OutFormat *fmt) {
+    for (int k = 0; k < 4; ++k) {
+        if (strcmp(s, FMT_NAMES[k]) == 0) { *fmt = (OutFormat)k; return 1; }
+    }
+    return 0;
+}
+
+void writer_begin_rows(Writer *w) {
+    switch (w->fmt) {
+        case FMT_TABLE:  print_header(w); break;
+        case FMT_CSV:    out_str(w, "idx,date,type,category,amount,note\n", 0); break;
+        case FMT_JSONL:  break;
+        case FMT_BINARY: out_bin_header(w, BIN_ROW_LEN, 0); break;
+    }
+}
+
+void writer_row(Writer *w, int i, const Transaction *t) {
+    out_reserve(w, OUT_ROW_MAX);
+    switch (w->fmt) {
+        case FMT_TABLE:
+            print_transaction(w, i, t);
+            break;
+        case FMT_CSV:
+            out_int(w, i, 0, 0);
+            out_mem(w, ",", 1);
+            out_date(w, t);
+            out_str(w, t->type == INCOME ? ",INCOME," : ",EXPENSE,", 0);
+            out_csv_str(w, t->category);
+            out_mem(w, ",", 1);
+            out_money(w, t->amount, 0);
+            out_mem(w, ",", 1);
+            out_csv_str(w, t->note);
+            out_mem(w, "\n", 1);
+            break;
+        case FMT_JSONL:
+            out_str(w, "{\"idx\":", 0);
+            out_int(w, i, 0, 0);
+            out_str(w, ",\"date\":\"", 0);
+            out_date(w, t);
+            out_str(w, t->type == INCOME ? "\",\"type\":\"INCOME\",\"category\":"
+                                         : "\",\"type\":\"EXPENSE\",\"category\":", 0);
+            out_json_str(w, t->category);
+            out_str(w, ",\"amount\":", 0);
+            out_money(w, t->amount, 0);
+            out_str(w, ",\"note\":", 0);
+            out_json_str(w, t->note);
+            out_str(w, "}\n", 0);
+            break;
+        case FMT_BINARY: {
+            unsigned char rec[BIN_ROW_LEN];
+            fin_encode_row(rec, i, t);
+            out_mem(w, (const char *)rec, BIN_ROW_LEN);
+            break;
+        }
+    }
+}
+
+/* Stops early if the thread's FinControl asks to (see finance.h). */
+void writer_rowset(Writer *w, const Ledger *L, const RowSet *rs) {
+    for (int k = 0; k < rs->count; ++k) {
+        if (k % WRITE_CHECK == 0 && k && fin_checkpoint(WRITE_CHECK)) return;
+        writer_row(w, rs->ids[k], ledger_row(L, rs->ids[k]));
+    }
+}
+
+void writer_begin_agg(Writer *w, const char *keyName, const char *valName) {
+    w->keyName = keyName;
+    w->valName = valName;
+    switch (w->fmt) {
+        case FMT_TABLE:  break;
+        case FMT_CSV:    out_str(w, keyName, 0); out_mem(w, ",", 1); out_str(w, valName, 0); out_mem(w, "\n", 1); break;
+        case FMT_JSONL:  break;
+        case FMT_BINARY: out_bin_header(w, BIN_AGG_LEN, 1); break;
+    }
+}
+
+void writer_agg(Writer *w, const char *key, double v) {
+    out_reserve(w, OUT_ROW_MAX);
+    switch (w->fmt) {
+        case FMT_TABLE:
+            out_str(w, key, 12); out_money(w, v, 14); out_mem(w, "\n", 1);
+            break;
+        case FMT_CSV:
+            out_csv_str(w, key); out_mem(w, ",", 1); out_money(w, v, 0); out_mem(w, "\n", 1);
+            break;
+        case FMT_JSONL:
+            out_mem(w, "{", 1); out_json_str(w, w->keyName); out_mem(w, ":", 1); out_json_str(w, key);
+            out_mem(w, ",", 1); out_json_str(w, w->valName); out_mem(w, ":", 1); out_money(w, v, 0);
+            out_str(w, "}\n", 0);
+            break;
+        case FMT_BINARY:
+            out_field(w, key, BIN_AGG_KEYLEN);
+            out_f64(w, v);
+            break;
+    }
+}
+
+int writer_end(Writer *w) {
+    out_flush(w);
+    fflush(w->sink);
+    return !ferror(w->sink);
+}
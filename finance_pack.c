@@ -0,0 +1,842 @@
+/*
+  finance_pack.c - packed ledger files (see finance.h).
+
+  A packed ledger holds the rows in column blocks of PACK_BLOCK rows,
+  each column in an encoding that suits its data:
+    date      day numbers as delta-of-delta, zigzagged and bit-packed
+              (in date order mostly 0/±1, so one or two bits a row)
+    type      one bit a row
+    category  a per-block dictionary and bit-packed codes
+    amount    cents minus the block minimum (frame of reference),
+              bit-packed; raw doubles if the block holds amounts that
+              do not fit in cents
+    note      NUL-terminated and LZ77-compressed (LZ4-style sequences)
+  Bit-packed values are stored LSB first with padding after them, so
+  decoding one is a 64-bit load, a shift and a mask with no branches and
+  no bounds checks, in loops the compiler vectorizes.
+
+  File: header (magic, u32 block rows, u16 flags, u16 first hot year of
+  an archive or 0, u64 rows), then
+  blocks of u32 payload bytes, u32 rows, u32 payload checksum, payload.
+  With PACK_INDEXED in flags, a block index follows the last block:
+  per block u64 file offset, u32 rows, i32 first and last day number,
+  then a trailer of u64 index offset, u32 blocks, u32 index checksum.
+  All little-endian.
+  Saving encodes blocks in parallel; loading reads PACK_GROUP blocks at
+  a time, decodes them in parallel and appends them, so memory stays
+  bounded whatever the file size. fin_paged_open() reads only the index
+  and decodes blocks as scans reach them, through a FinCache.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include "finance.h"
+#include "finance_probes.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PACK_HDR_LEN  24
+#define BLOCK_HDR_LEN 12
+#define PACK_BLOCK    16384             // rows per block when saving
+#define PACK_MAX_ROWS 65536             // largest block a file may declare
+#define PACK_GROUP    8                 // blocks decoded per parallel pass
+#define PACK_PAD      8                 // zero bytes after each bit-packed run
+#define MAX_PAYLOAD   (64u << 20)
+#define PACK_INDEXED  1u                // flags: block index at the end
+#define INDEX_LEN     20                // per block
+#define TRAILER_LEN   16
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 13
+#define LZ_WINDOW    65535
+
+enum { AMOUNT_CENTS = 0, AMOUNT_RAW = 1 };
+
+/* ----------------------- Bit packing ------------------------------ */
+
+static int bits_for(unsigned long long v) {
+    int w = 0;
+    while (v) { ++w; v >>= 1; }
+    return w;
+}
+
+static unsigned long long load_le64(const unsigned char *p) {
+    unsigned long long v = 0;
+    for (int k = 7; k >= 0; --k) v = v << 8 | p[k];
+    return v;
+}
+
+/* Word-at-a-time multiplicative hash; catches damage, not tampering. */
+static unsigned checksum(const unsigned char *p, size_t n) {
+    unsigned long long h = 0xcbf29ce484222325ull;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) h = (h ^ load_le64(p + i)) * 0x100000001b3ull;
+    for (; i < n; ++i) h = (h ^ p[i]) * 0x100000001b3ull;
+    h ^= h >> 29;
+    return (unsigned)(h ^ h >> 32);
+}
+
+static size_t packed_len(long n, int w) { return ((size_t)n * (size_t)w + 7) / 8 + PACK_PAD; }
+
+/* u8 width, then n values of w bits. */
+static int put_packed(FinBuf *b, const unsigned long long *v, long n, int w) {
+    size_t len = packed_len(n, w);
+    if (!finbuf_put_le(b, (unsigned)w, 1) || !finbuf_reserve(b, len)) return 0;
+    unsigned char *p = b->data + b->len;
+    memset(p, 0, len);
+    for (long i = 0; i < n; ++i) {
+        unsigned long long bit = (unsigned long long)i * (unsigned)w, x = v[i];
+        unsigned char *q = p + (bit >> 3);
+        int s = (int)(bit & 7);
+        q[0] |= (unsigned char)(x << s);
+        for (int k = 1; 8 * k < w + s; ++k) q[k] |= (unsigned char)(x >> (8 * k - s));
+    }
+    b->len += len;
+    return 1;
+}
+
+static void unpack(const unsigned char *p, unsigned long long *v, long n, int w) {
+    if (w == 0) { memset(v, 0, (size_t)n * sizeof(*v)); return; }
+    unsigned long long mask = w == 64 ? ~0ull : (1ull << w) - 1;
+    if (w <= 57) {                       // every value lies in one 64-bit load
+        for (long i = 0; i < n; ++i) {
+            unsigned long long bit = (unsigned long long)i * (unsigned)w;
+            v[i] = (load_le64(p + (bit >> 3)) >> (bit & 7)) & mask;
+        }
+        return;
+    }
+    for (long i = 0; i < n; ++i) {
+        unsigned long long bit = (unsigned long long)i * (unsigned)w;
+        int s = (int)(bit & 7);
+        unsigned long long x = load_le64(p + (bit >> 3)) >> s;
+        if (s) x |= (unsigned long long)p[(bit >> 3) + 8] << (64 - s);
+        v[i] = x & mask;
+    }
+}
+
+/* ----------------------- LZ codec --------------------------------- */
+/* Sequences of: token (literal length << 4 | match length - 4, 15 in a
+   nibble meaning more follows in 255-continued bytes), the literals,
+   u16 match offset. The last sequence has literals only. */
+
+static size_t lz_bound(size_t n) { return n + n / 255 + 16; }
+
+static unsigned lz_hash(const unsigned char *p) {
+    unsigned v = (unsigned)p[0] | (unsigned)p[1] << 8 | (unsigned)p[2] << 16 | (unsigned)p[3] << 24;
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *lz_len(unsigned char *o, size_t n) {
+    for (; n >= 255; n -= 255) *o++ = 255;
+    *o++ = (unsigned char)n;
+    return o;
+}
+
+static unsigned char *lz_emit(unsigned char *o, const unsigned char *lit, size_t nLit, size_t off, size_t mLen) {
+    size_t m = mLen ? mLen - LZ_MIN_MATCH : 0;
+    *o++ = (unsigned char)((nLit < 15 ? nLit : 15) << 4 | (m < 15 ? m : 15));
+    if (nLit >= 15) o = lz_len(o, nLit - 15);
+    memcpy(o, lit, nLit);
+    o += nLit;
+    if (!mLen) return o;
+    *o++ = (unsigned char)(off & 0xff);
+    *o++ = (unsigned char)(off >> 8);
+    if (m >= 15) o = lz_len(o, m - 15);
+    return o;
+}
+
+/* dst holds lz_bound(n) bytes; returns the compressed length. */
+static size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst) {
+    unsigned table[1 << LZ_HASH_BITS];      // position + 1 of the last 4-byte match candidate
+    memset(table, 0, sizeof(table));
+    unsigned char *o = dst;
+    size_t i = 0, lit = 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        unsigned h = lz_hash(src + i);
+        size_t cand = table[h];
+        table[h] = (unsigned)(i + 1);
+        if (cand && i - (cand - 1) <= LZ_WINDOW && memcmp(src + cand - 1, src + i, LZ_MIN_MATCH) == 0) {
+            size_t from = cand - 1, len = LZ_MIN_MATCH;
+            while (i + len < n && src[from + len] == src[i + len]) ++len;
+            o = lz_emit(o, src + lit, i - lit, i - from, len);
+            i += len;
+            lit = i;
+        } else {
+            ++i;
+        }
+    }
+    o = lz_emit(o, src + lit, n - lit, 0, 0);
+    return (size_t)(o - dst);
+}
+
+static int lz_read_len(const unsigned char *src, size_t n, size_t *i, size_t *len) {
+    unsigned char b;
+    do {
+        if (*i >= n) return 0;
+        b = src[(*i)++];
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+/* 1 if src decodes to exactly cap bytes. */
+static int lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap) {
+    size_t i = 0, o = 0;
+    while (i < n) {
+        unsigned tok = src[i++];
+        size_t nLit = tok >> 4, len = (tok & 15) + LZ_MIN_MATCH;
+        if (nLit == 15 && !lz_read_len(src, n, &i, &nLit)) return 0;
+        if (nLit > n - i || nLit > cap - o) return 0;
+        memcpy(dst + o, src + i, nLit);
+        i += nLit;
+        o += nLit;
+        if (i == n) break;
+        if (n - i < 2) return 0;
+        size_t off = (size_t)src[i] | (size_t)src[i + 1] << 8;
+        i += 2;
+        if ((tok & 15) == 15 && !lz_read_len(src, n, &i, &len)) return 0;
+        if (off == 0 || off > o || len > cap - o) return 0;
+        if (off >= len) memcpy(dst + o, dst + o - off, len);
+        else for (size_t k = 0; k < len; ++k) dst[o + k] = dst[o + k - off];   // overlapping run
+        o += len;
+    }
+    return o == cap;
+}
+
+/* ----------------------- Dates ------------------------------------ */
+
+long long fin_days_from_civil(int y, int m, int d) {
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153u * (unsigned)(m + (m > 2 ? -3 : 9)) + 2) / 5 + (unsigned)d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (long long)doe - 719468;
+}
+
+static void civil_from_days(long long z, int *y, int *m, int *d) {
+    z += 719468;
+    long long era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned doe = (unsigned)(z - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    *d = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *m = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *y = (int)(yoe + era * 400) + (*m <= 2);
+}
+
+static unsigned long long zigzag(long long v) { return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63); }
+static long long unzigzag(unsigned long long v) { return (long long)(v >> 1) ^ -(long long)(v & 1); }
+
+/* ----------------------- Block encoding --------------------------- */
+
+typedef struct {
+    const Transaction *rows;
+    long n;
+    FinBuf *out;                  // one per block
+    int *minDay, *maxDay;         // per block, for the index
+    atomic_int failed;
+} EncodeCtx;
+
+static int encode_block(const Transaction *r, long n, FinBuf *b, unsigned long long *v) {
+    // Dates: first day, then delta-of-delta.
+    long long prevDay = fin_days_from_civil(r[0].y, r[0].m, r[0].d), prevDelta = 0;
+    int w = 0;
+    for (long i = 1; i < n; ++i) {
+        long long day = fin_days_from_civil(r[i].y, r[i].m, r[i].d), delta = day - prevDay;
+        v[i - 1] = zigzag(delta - prevDelta);
+        prevDay = day;
+        prevDelta = delta;
+        int bw = bits_for(v[i - 1]);
+        if (bw > w) w = bw;
+    }
+    if (!finbuf_put_le(b, (unsigned long long)fin_days_from_civil(r[0].y, r[0].m, r[0].d), 4)
+        || !put_packed(b, v, n - 1, w)) return 0;
+
+    for (long i = 0; i < n; ++i) v[i] = r[i].type == EXPENSE;
+    if (!put_packed(b, v, n, 1)) return 0;
+
+    // Categories: dictionary in first-seen order.
+    int hcap = 1;
+    while (hcap < 2 * n) hcap <<= 1;
+    int *slot = fin_malloc(MEM_PACK, (size_t)hcap * sizeof(int)), *dict = fin_malloc(MEM_PACK, (size_t)n * sizeof(int));
+    int nDict = 0, ok = slot && dict;
+    if (ok) {
+        memset(slot, -1, (size_t)hcap * sizeof(int));
+        for (long i = 0; i < n; ++i) {
+            unsigned h = 2166136261u;
+            for (const char *c = r[i].category; *c; ++c) h = (h ^ (unsigned char)*c) * 16777619u;
+            int s = (int)(h & (unsigned)(hcap - 1));
+            while (slot[s] >= 0 && strcmp(r[dict[slot[s]]].category, r[i].category) != 0) s = (s + 1) & (hcap - 1);
+            if (slot[s] < 0) { dict[nDict] = (int)i; slot[s] = nDict++; }
+            v[i] = (unsigned long long)slot[s];
+        }
+        ok = finbuf_put_le(b, (unsigned)nDict, 4);
+        for (int k = 0; ok && k < nDict; ++k) {
+            const char *c = r[dict[k]].category;
+            size_t len = strnlen(c, STR_LEN - 1);
+            ok = finbuf_put_le(b, (unsigned)len, 1) && finbuf_put(b, c, len);
+        }
+        ok = ok && put_packed(b, v, n, bits_for((unsigned long long)(nDict - 1)));
+    }
+    fin_free(slot);
+    fin_free(dict);
+    if (!ok) return 0;
+
+    // Amounts: cents over the block minimum, unless some are not cents.
+    long long lo = 0, hi = 0;
+    int cents = 1;
+    for (long i = 0; i < n && cents; ++i) {
+        double c = r[i].amount * 100.0;
+        if (!(c >= 0.0 && c < 9.0e15)) { cents = 0; break; }
+        long long x = llround(c);
+        if ((double)x / 100.0 != r[i].amount) { cents = 0; break; }   // decoding must give it back
+        if (i == 0 || x < lo) lo = x;
+        if (i == 0 || x > hi) hi = x;
+    }
+    if (!finbuf_put_le(b, cents ? AMOUNT_CENTS : AMOUNT_RAW, 1)) return 0;
+    if (cents) {
+        for (long i = 0; i < n; ++i) v[i] = (unsigned long long)(llround(r[i].amount * 100.0) - lo);
+        if (!finbuf_put_le(b, (unsigned long long)lo, 8) || !put_packed(b, v, n, bits_for((unsigned long long)(hi - lo))))
+            return 0;
+    } else {
+        for (long i = 0; i < n; ++i) if (!finbuf_put_f64(b, r[i].amount)) return 0;
+    }
+
+    // Notes: NUL-terminated, then LZ.
+    size_t raw = 0;
+    for (long i = 0; i < n; ++i) raw += strnlen(r[i].note, NOTE_LEN - 1) + 1;
+    unsigned char *text = fin_malloc(MEM_PACK, raw), *lz = fin_malloc(MEM_PACK, lz_bound(raw));
+    ok = text && lz;
+    if (ok) {
+        unsigned char *p = text;
+        for (long i = 0; i < n; ++i) {
+            size_t len = strnlen(r[i].note, NOTE_LEN - 1);
+            memcpy(p, r[i].note, len);
+            p[len] = 0;
+            p += len + 1;
+        }
+        size_t clen = lz_compress(text, raw, lz);
+        ok = finbuf_put_le(b, raw, 4) && finbuf_put_le(b, clen, 4) && finbuf_put(b, lz, clen);
+    }
+    fin_free(text);
+    fin_free(lz);
+    return ok;
+}
+
+static void encode_blocks(void *c, long bBegin, long bEnd) {
+    EncodeCtx *ec = c;
+    unsigned long long *v = fin_malloc(MEM_PACK, PACK_BLOCK * sizeof(*v));
+    if (!v) { atomic_store(&ec->failed, 1); return; }
+    for (long k = bBegin; k < bEnd && !atomic_load_explicit(&ec->failed, memory_order_relaxed); ++k) {
+        unsigned long long t0 = fin_trace_begin();
+        long lo = k * PACK_BLOCK, n = ec->n - lo < PACK_BLOCK ? ec->n - lo : PACK_BLOCK;
+        FinBuf *b = &ec->out[k];
+        b->cap = (size_t)n * 16;
+        b->data = fin_malloc(MEM_PACK, b->cap);
+        if (!b->data || !encode_block(ec->rows + lo, n, b, v)) atomic_store(&ec->failed, 1);
+        long long first = LLONG_MAX, last = LLONG_MIN;
+        for (long i = lo; i < lo + n; ++i) {
+            long long day = fin_days_from_civil(ec->rows[i].y, ec->rows[i].m, ec->rows[i].d);
+            if (day < first) first = day;
+            if (day > last) last = day;
+        }
+        ec->minDay[k] = (int)first;
+        ec->maxDay[k] = (int)last;
+        fin_trace_end("pack_block", t0);
+    }
+    fin_free(v);
+}
+
+int fin_packed_file(const char *fname) {
+    char magic[8];
+    FILE *f = fopen(fname, "rb");
+    if (!f) return 0;
+    int is = fread(magic, 1, 8, f) == 8 && memcmp(magic, FIN_PACK_MAGIC, 8) == 0;
+    fclose(f);
+    return is;
+}
+
+static int save_packed(const Ledger *L, const char *fname, int hotFrom) {
+    unsigned long long t0 = fin_stat_begin();
+    FIN_PROBE1(save__start, fname);
+    FILE *f = fopen(fname, "wb");
+    if (!f) return 0;
+    ledger_read_begin(L);
+    long n = ledger_count(L), nBlocks = (n + PACK_BLOCK - 1) / PACK_BLOCK;
+    EncodeCtx ec = { n ? ledger_row(L, 0) : NULL, n, fin_calloc(MEM_PACK, (size_t)nBlocks + 1, sizeof(FinBuf)),
+                     fin_malloc(MEM_PACK, ((size_t)nBlocks + 1) * sizeof(int)),
+                     fin_malloc(MEM_PACK, ((size_t)nBlocks + 1) * sizeof(int)), 0 };
+    unsigned char *index = fin_malloc(MEM_PACK, (size_t)nBlocks * INDEX_LEN + TRAILER_LEN);
+    int ok = ec.out && ec.minDay && ec.maxDay && index;
+    if (ok && nBlocks) {
+        fin_parallel_for(nBlocks, 1, encode_blocks, &ec);
+        ok = !atomic_load(&ec.failed);
+    }
+    ledger_read_end(L);
+
+    unsigned char hdr[PACK_HDR_LEN] = {0};
+    memcpy(hdr, FIN_PACK_MAGIC, 8);
+    for (int k = 0; k < 4; ++k) hdr[8 + k] = (unsigned char)(PACK_BLOCK >> (8 * k));
+    hdr[12] = PACK_INDEXED;
+    hdr[14] = (unsigned char)(hotFrom & 0xff);
+    hdr[15] = (unsigned char)(hotFrom >> 8 & 0xff);
+    for (int k = 0; k < 8; ++k) hdr[16 + k] = (unsigned char)((unsigned long long)n >> (8 * k));
+    ok = ok && fwrite(hdr, 1, PACK_HDR_LEN, f) == PACK_HDR_LEN;
+    unsigned long long at = PACK_HDR_LEN;
+    for (long k = 0; ok && k < nBlocks; ++k) {
+        unsigned char bh[BLOCK_HDR_LEN];
+        long rows = n - k * PACK_BLOCK < PACK_BLOCK ? n - k * PACK_BLOCK : PACK_BLOCK;
+        unsigned sum = checksum(ec.out[k].data, ec.out[k].len);
+        for (int j = 0; j < 4; ++j) {
+            bh[j] = (unsigned char)(ec.out[k].len >> (8 * j));
+            bh[4 + j] = (unsigned char)((unsigned long)rows >> (8 * j));
+            bh[8 + j] = (unsigned char)(sum >> (8 * j));
+        }
+        ok = ec.out[k].len <= MAX_PAYLOAD && fwrite(bh, 1, BLOCK_HDR_LEN, f) == BLOCK_HDR_LEN
+             && fwrite(ec.out[k].data, 1, ec.out[k].len, f) == ec.out[k].len;
+        unsigned char *ix = index + k * INDEX_LEN;
+        for (int j = 0; j < 8; ++j) ix[j] = (unsigned char)(at >> (8 * j));
+        for (int j = 0; j < 4; ++j) {
+            ix[8 + j] = (unsigned char)((unsigned long)rows >> (8 * j));
+            ix[12 + j] = (unsigned char)((unsigned)ec.minDay[k] >> (8 * j));
+            ix[16 + j] = (unsigned char)((unsigned)ec.maxDay[k] >> (8 * j));
+        }
+        at += BLOCK_HDR_LEN + ec.out[k].len;
+    }
+    if (ok) {
+        size_t ixLen = (size_t)nBlocks * INDEX_LEN;
+        unsigned char *tr = index + ixLen;
+        unsigned sum = checksum(index, ixLen);
+        for (int j = 0; j < 8; ++j) tr[j] = (unsigned char)(at >> (8 * j));
+        for (int j = 0; j < 4; ++j) {
+            tr[8 + j] = (unsigned char)((unsigned long)nBlocks >> (8 * j));
+            tr[12 + j] = (unsigned char)(sum >> (8 * j));
+        }
+        ok = fwrite(index, 1, ixLen + TRAILER_LEN, f) == ixLen + TRAILER_LEN;
+    }
+    for (long k = 0; ec.out && k < nBlocks; ++k) finbuf_free(&ec.out[k]);
+    fin_free(ec.out);
+    fin_free(ec.minDay);
+    fin_free(ec.maxDay);
+    fin_free(index);
+    if (ferror(f)) ok = 0;
+    long bytes = ftell(f);
+    if (fclose(f) != 0) ok = 0;
+    fin_stat_end(STAT_SAVE, t0, n, ok ? n : 0, 0, bytes);
+    return ok;
+}
+
+int ledger_save_packed(const Ledger *L, const char *fname) { return save_packed(L, fname, 0); }
+
+int ledger_save_archive(const Ledger *L, const char *fname, int hotFrom) {
+    if (hotFrom < 0 || hotFrom > 0xffff) { errno = EINVAL; return 0; }
+    return save_packed(L, fname, hotFrom);
+}
+
+/* ----------------------- Block decoding --------------------------- */
+
+typedef struct {
+    const unsigned char *p;
+    size_t n, at;
+    int bad;
+} Cursor;
+
+static const unsigned char *take(Cursor *c, size_t k) {
+    if (c->bad || k > c->n - c->at) { c->bad = 1; return NULL; }
+    const unsigned char *r = c->p + c->at;
+    c->at += k;
+    return r;
+}
+
+static unsigned long long take_le(Cursor *c, int bytes) {
+    const unsigned char *p = take(c, (size_t)bytes);
+    return p ? fin_get_le(p, bytes) : 0;
+}
+
+static int take_packed(Cursor *c, unsigned long long *v, long n, int maxW) {
+    int w = (int)take_le(c, 1);
+    if (w > maxW) c->bad = 1;
+    const unsigned char *p = take(c, packed_len(n, w));
+    if (!p) return 0;
+    unpack(p, v, n, w);
+    return 1;
+}
+
+static int decode_block(const unsigned char *data, size_t len, long n, Transaction *out, unsigned long long *v) {
+    Cursor c = { data, len, 0, 0 };
+    memset(out, 0, (size_t)n * sizeof(*out));
+
+    long long day = (int)(unsigned)take_le(&c, 4), delta = 0, lastDay = 0;
+    const long long minDay = fin_days_from_civil(1900, 1, 1), maxDay = fin_days_from_civil(3000, 12, 31);
+    if (!take_packed(&c, v, n - 1, 64)) return 0;
+    int y = 0, m = 0, d = 0;
+    for (long i = 0; i < n; ++i) {
+        if (i) { delta += unzigzag(v[i - 1]); day += delta; }
+        if (day < minDay || day > maxDay) return 0;
+        if (i == 0 || day != lastDay) civil_from_days(day, &y, &m, &d);   // days repeat: convert on change
+        lastDay = day;
+        out[i].y = y; out[i].m = m; out[i].d = d;
+    }
+
+    if (!take_packed(&c, v, n, 1)) return 0;
+    for (long i = 0; i < n; ++i) out[i].type = v[i] ? EXPENSE : INCOME;
+
+    unsigned long long nDict = take_le(&c, 4);
+    if (c.bad || nDict == 0 || nDict > (unsigned long long)n) return 0;
+    size_t *dictAt = fin_malloc(MEM_PACK, (size_t)nDict * sizeof(size_t));
+    if (!dictAt) return 0;
+    for (unsigned long long k = 0; k < nDict; ++k) {
+        size_t clen = (size_t)take_le(&c, 1);
+        dictAt[k] = c.at;
+        if (clen > STR_LEN - 1 || !take(&c, clen)) c.bad = 1;
+    }
+    int ok = !c.bad && take_packed(&c, v, n, 16);
+    for (long i = 0; ok && i < n; ++i) {
+        if (v[i] >= nDict) { ok = 0; break; }
+        size_t at = dictAt[v[i]];
+        memcpy(out[i].category, data + at, data[at - 1]);
+    }
+    fin_free(dictAt);
+    if (!ok) return 0;
+
+    int mode = (int)take_le(&c, 1);
+    if (mode == AMOUNT_CENTS) {
+        long long lo = (long long)take_le(&c, 8);
+        if (!take_packed(&c, v, n, 64)) return 0;
+        for (long i = 0; i < n; ++i) out[i].amount = (double)(lo + (long long)v[i]) / 100.0;
+    } else if (mode == AMOUNT_RAW) {
+        const unsigned char *p = take(&c, (size_t)n * 8);
+        if (!p) return 0;
+        for (long i = 0; i < n; ++i) out[i].amount = fin_get_f64(p + 8 * i);
+    } else {
+        return 0;
+    }
+
+    size_t raw = (size_t)take_le(&c, 4), clen = (size_t)take_le(&c, 4);
+    const unsigned char *lz = take(&c, clen);
+    if (!lz || raw > (size_t)n * NOTE_LEN || c.at != len) return 0;
+    unsigned char *text = fin_malloc(MEM_PACK, raw + 1);
+    ok = text && lz_decompress(lz, clen, text, raw);
+    const unsigned char *p = text, *end = text + raw;
+    for (long i = 0; ok && i < n; ++i) {
+        const unsigned char *z = p < end ? memchr(p, 0, (size_t)(end - p)) : NULL;
+        if (!z || z - p > NOTE_LEN - 1) { ok = 0; break; }
+        memcpy(out[i].note, p, (size_t)(z - p));
+        p = z + 1;
+    }
+    fin_free(text);
+    return ok && p == end;
+}
+
+typedef struct {
+    const unsigned char *buf;
+    size_t at[PACK_GROUP], len[PACK_GROUP];
+    long first[PACK_GROUP], rows[PACK_GROUP];
+    Transaction *recs;
+    atomic_int failed;
+} DecodeCtx;
+
+static void decode_blocks(void *c, long bBegin, long bEnd) {
+    DecodeCtx *dc = c;
+    unsigned long long *v = fin_malloc(MEM_PACK, PACK_MAX_ROWS * sizeof(*v));
+    if (!v) { atomic_store(&dc->failed, 1); return; }
+    for (long k = bBegin; k < bEnd; ++k) {
+        unsigned long long t0 = fin_trace_begin();
+        if (!decode_block(dc->buf + dc->at[k], dc->len[k], dc->rows[k], dc->recs + dc->first[k], v))
+            atomic_store(&dc->failed, 1);
+        fin_trace_end("unpack_block", t0);
+    }
+    fin_free(v);
+}
+
+int ledger_read_packed(Ledger *L, FILE *f, IngestStats *st) {
+    IngestStats is = {0};
+    unsigned char hdr[PACK_HDR_LEN];
+    if (st) *st = is;
+    long pos = ftell(f), size = 0;
+    if (pos >= 0 && fseek(f, 0, SEEK_END) == 0) {
+        size = ftell(f) - pos;
+        fseek(f, pos, SEEK_SET);
+    }
+    if (fread(hdr, 1, PACK_HDR_LEN, f) != PACK_HDR_LEN || memcmp(hdr, FIN_PACK_MAGIC, 8) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    long blockRows = (long)fin_get_le(hdr + 8, 4);
+    unsigned long long total = fin_get_le(hdr + 16, 8);
+    if (blockRows < 1 || blockRows > PACK_MAX_ROWS || total > 0x7fffffffull) { errno = EINVAL; return -1; }
+    is.bytes = PACK_HDR_LEN;
+    fin_progress_begin(size > 0 ? size : 0);
+    if (total <= (unsigned long long)size * 8)   // every row takes at least its type bit
+        ledger_reserve(L, ledger_count(L) + (int)total);
+
+    FinBuf buf = { fin_malloc(MEM_PACK, 1 << 16), 0, 1 << 16 };   // tagged here; growth keeps the tag
+    DecodeCtx dc;
+    memset(&dc, 0, sizeof(dc));
+    dc.recs = fin_malloc(MEM_PACK, (size_t)blockRows * PACK_GROUP * sizeof(Transaction));
+    int err = dc.recs && buf.data ? 0 : ENOMEM, cancelled = 0;
+    while (!err && !cancelled && (unsigned long long)is.lines < total) {
+        long nb = 0, rows = 0;
+        buf.len = 0;
+        for (; nb < PACK_GROUP && (unsigned long long)(is.lines + rows) < total; ++nb) {
+            unsigned char bh[BLOCK_HDR_LEN];
+            if (fread(bh, 1, BLOCK_HDR_LEN, f) != BLOCK_HDR_LEN) { err = ferror(f) ? EIO : EINVAL; break; }
+            size_t len = (size_t)fin_get_le(bh, 4);
+            long n = (long)fin_get_le(bh + 4, 4);
+            if (len > MAX_PAYLOAD || n < 1 || n > blockRows) { err = EINVAL; break; }
+            size_t at = buf.len;
+            if (!finbuf_reserve(&buf, len)) { err = ENOMEM; break; }
+            if (fread(buf.data + at, 1, len, f) != len) { err = ferror(f) ? EIO : EINVAL; break; }
+            if (checksum(buf.data + at, len) != (unsigned)fin_get_le(bh + 8, 4)) { err = EINVAL; break; }
+            buf.len = at + len;
+            dc.at[nb] = at;
+            dc.len[nb] = len;
+            dc.first[nb] = rows;
+            dc.rows[nb] = n;
+            rows += n;
+            is.bytes += (long)(BLOCK_HDR_LEN + len);
+        }
+        if (err || !nb) { if (!err) err = EINVAL; break; }
+        if (rows > (long)(total - (unsigned long long)is.lines)) { err = EINVAL; break; }
+
+        dc.buf = buf.data;
+        atomic_store(&dc.failed, 0);
+        fin_parallel_for(nb, 1, decode_blocks, &dc);
+        if (atomic_load(&dc.failed)) { err = EINVAL; break; }
+        is.lines += rows;
+        int bad = 0, stored = ledger_insert_batch(L, dc.recs, (int)rows, &bad);
+        is.rejected += bad;
+        is.stored += stored;
+        if (stored < rows - bad) { err = ENOMEM; break; }
+        if (fin_checkpoint((long)buf.len)) cancelled = 1;
+    }
+    finbuf_free(&buf);
+    fin_free(dc.recs);
+    if (st) *st = is;
+    if (cancelled) return FIN_CANCELLED;
+    if (err) { errno = err; return -1; }
+    return (int)is.stored;
+}
+
+/* ----------------------- Paged reading ---------------------------- */
+
+typedef struct {
+    long long off;                // of the block header
+    long long first;              // index of the block's first row
+    long rows;
+    int minDay, maxDay;           // INT_MIN / INT_MAX when the file has no index
+} PagedBlock;
+
+struct FinPaged {
+    int fd;
+    FinCache *cache;              // may be NULL: every scan reads the file
+    unsigned long long id;        // cache key
+    long long rows, fileBytes;
+    long nBlocks, blockRows;
+    int hotFrom;                  // from the header, 0 if not set
+    PagedBlock *blocks;
+    atomic_ullong scans, blocksScanned, blocksSkipped, blocksRead, bytesRead;
+};
+
+int fin_pread_full(int fd, void *buf, size_t n, long long off) {
+    unsigned char *p = buf;
+    while (n) {
+        ssize_t k = pread(fd, p, n, (off_t)off);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) { if (k == 0) errno = EINVAL; return 0; }
+        p += k; n -= (size_t)k; off += k;
+    }
+    return 1;
+}
+
+/* Reads the index written after the blocks. */
+static int read_index(FinPaged *p) {
+    unsigned char tr[TRAILER_LEN];
+    if (p->fileBytes < PACK_HDR_LEN + TRAILER_LEN
+        || !fin_pread_full(p->fd, tr, TRAILER_LEN, p->fileBytes - TRAILER_LEN)) return 0;
+    long long at = (long long)fin_get_le(tr, 8);
+    unsigned long long n = fin_get_le(tr + 8, 4);
+    if (at < PACK_HDR_LEN || n > (unsigned long long)(p->fileBytes / INDEX_LEN)
+        || at + (long long)n * INDEX_LEN + TRAILER_LEN != p->fileBytes) { errno = EINVAL; return 0; }
+    unsigned char *ix = fin_malloc(MEM_PACK, (size_t)n * INDEX_LEN + 1);
+    p->blocks = fin_malloc(MEM_PACK, ((size_t)n + 1) * sizeof(PagedBlock));
+    if (!ix || !p->blocks) { fin_free(ix); errno = ENOMEM; return 0; }
+    int ok = fin_pread_full(p->fd, ix, (size_t)n * INDEX_LEN, at)
+             && checksum(ix, (size_t)n * INDEX_LEN) == (unsigned)fin_get_le(tr + 12, 4);
+    long long rows = 0, end = PACK_HDR_LEN;
+    for (unsigned long long k = 0; ok && k < n; ++k) {
+        const unsigned char *e = ix + k * INDEX_LEN;
+        PagedBlock *b = &p->blocks[k];
+        b->off = (long long)fin_get_le(e, 8);
+        b->rows = (long)fin_get_le(e + 8, 4);
+        b->minDay = (int)(unsigned)fin_get_le(e + 12, 4);
+        b->maxDay = (int)(unsigned)fin_get_le(e + 16, 4);
+        b->first = rows;
+        rows += b->rows;
+        ok = b->off >= end && b->off < at && b->rows >= 1 && b->rows <= p->blockRows && b->minDay <= b->maxDay;
+        end = b->off + BLOCK_HDR_LEN;
+    }
+    fin_free(ix);
+    if (!ok || rows != p->rows) { errno = EINVAL; return 0; }
+    p->nBlocks = (long)n;
+    return 1;
+}
+
+/* Indexes a file saved without one by walking the block headers. */
+static int walk_blocks(FinPaged *p) {
+    long cap = 64;
+    long long off = PACK_HDR_LEN, rows = 0;
+    p->blocks = fin_malloc(MEM_PACK, (size_t)cap * sizeof(PagedBlock));
+    while (p->blocks && rows < p->rows) {
+        unsigned char bh[BLOCK_HDR_LEN];
+        if (!fin_pread_full(p->fd, bh, BLOCK_HDR_LEN, off)) return 0;
+        long long len = (long long)fin_get_le(bh, 4);
+        long n = (long)fin_get_le(bh + 4, 4);
+        if (len > MAX_PAYLOAD || n < 1 || n > p->blockRows || n > p->rows - rows
+            || off + BLOCK_HDR_LEN + len > p->fileBytes) { errno = EINVAL; return 0; }
+        if (p->nBlocks == cap) {
+            PagedBlock *nb = fin_realloc(MEM_PACK, p->blocks, (size_t)cap * 2 * sizeof(PagedBlock));
+            if (!nb) break;
+            p->blocks = nb;
+            cap *= 2;
+        }
+        p->blocks[p->nBlocks++] = (PagedBlock){ off, rows, n, INT_MIN, INT_MAX };
+        rows += n;
+        off += BLOCK_HDR_LEN + len;
+    }
+    if (rows < p->rows) { errno = ENOMEM; return 0; }
+    return 1;
+}
+
+FinPaged *fin_paged_open(const char *fname, FinCache *cache) {
+    unsigned char hdr[PACK_HDR_LEN];
+    struct stat sb;
+    FinPaged *p = fin_calloc(MEM_PACK, 1, sizeof(FinPaged));
+    if (!p) { errno = ENOMEM; return NULL; }
+    p->cache = cache;
+    p->id = fin_cache_file_id();
+    if ((p->fd = open(fname, O_RDONLY)) < 0) { fin_free(p); return NULL; }
+    int ok = fstat(p->fd, &sb) == 0 && fin_pread_full(p->fd, hdr, PACK_HDR_LEN, 0);
+    if (ok && memcmp(hdr, FIN_PACK_MAGIC, 8) != 0) { errno = EINVAL; ok = 0; }
+    if (ok) {
+        p->fileBytes = sb.st_size;
+        p->blockRows = (long)fin_get_le(hdr + 8, 4);
+        unsigned long long total = fin_get_le(hdr + 16, 8);
+        unsigned flags = (unsigned)fin_get_le(hdr + 12, 2);
+        p->hotFrom = (int)fin_get_le(hdr + 14, 2);
+        if (p->blockRows < 1 || p->blockRows > PACK_MAX_ROWS || total > 0x7fffffffull) { errno = EINVAL; ok = 0; }
+        p->rows = (long long)total;
+        ok = ok && (flags & PACK_INDEXED ? read_index(p) : walk_blocks(p));
+    }
+    if (ok) return p;
+    int err = errno;
+    fin_paged_close(p);
+    errno = err;
+    return NULL;
+}
+
+void fin_paged_close(FinPaged *p) {
+    if (!p) return;
+    if (p->cache) fin_cache_drop_file(p->cache, p->id);
+    close(p->fd);
+    fin_free(p->blocks);
+    fin_free(p);
+}
+
+typedef struct {
+    FinPaged *p;
+    const PagedBlock *b;
+} BlockLoad;
+
+/* Reads and decodes one block (a FinCacheLoad). */
+static unsigned char *load_block(void *c, size_t *len) {
+    BlockLoad *bl = c;
+    const PagedBlock *b = bl->b;
+    unsigned char bh[BLOCK_HDR_LEN];
+    if (!fin_pread_full(bl->p->fd, bh, BLOCK_HDR_LEN, b->off)) return NULL;
+    size_t n = (size_t)fin_get_le(bh, 4);
+    if (n > MAX_PAYLOAD || (long)fin_get_le(bh + 4, 4) != b->rows) { errno = EINVAL; return NULL; }
+    unsigned char *raw = fin_malloc(MEM_PACK, n + 1);
+    unsigned long long *v = fin_malloc(MEM_PACK, (size_t)b->rows * sizeof(*v));
+    Transaction *rows = fin_malloc(MEM_CACHE, (size_t)b->rows * sizeof(Transaction));
+    int ok = raw && v && rows;
+    if (!ok) errno = ENOMEM;
+    ok = ok && fin_pread_full(bl->p->fd, raw, n, b->off + BLOCK_HDR_LEN);
+    if (ok && (checksum(raw, n) != (unsigned)fin_get_le(bh + 8, 4) || !decode_block(raw, n, b->rows, rows, v))) {
+        errno = EINVAL;
+        ok = 0;
+    }
+    fin_free(raw);
+    fin_free(v);
+    if (!ok) { fin_free(rows); return NULL; }
+    atomic_fetch_add_explicit(&bl->p->blocksRead, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bl->p->bytesRead, BLOCK_HDR_LEN + n, memory_order_relaxed);
+    *len = (size_t)b->rows * sizeof(Transaction);
+    return (unsigned char *)rows;
+}
+
+long fin_paged_scan(FinPaged *p, int y0, int m0, int d0, int y1, int m1, int d1,
+                    FinPagedRowFn fn, void *ctx) {
+    long long from = fin_days_from_civil(y0, m0, d0), to = fin_days_from_civil(y1, m1, d1);
+    int lo = y0 * 10000 + m0 * 100 + d0, hi = y1 * 10000 + m1 * 100 + d1;
+    long found = 0;
+    int stop = 0;
+    atomic_fetch_add_explicit(&p->scans, 1, memory_order_relaxed);
+    for (long k = 0; k < p->nBlocks && !stop; ++k) {
+        const PagedBlock *b = &p->blocks[k];
+        if (b->maxDay < from || b->minDay > to) {
+            atomic_fetch_add_explicit(&p->blocksSkipped, 1, memory_order_relaxed);
+            continue;
+        }
+        atomic_fetch_add_explicit(&p->blocksScanned, 1, memory_order_relaxed);
+        BlockLoad bl = { p, b };
+        FinCacheRef *pin = NULL;
+        size_t len;
+        const Transaction *rows = p->cache
+            ? (const Transaction *)fin_cache_get(p->cache, p->id, (unsigned long long)k, load_block, &bl, &len, &pin)
+            : (const Transaction *)load_block(&bl, &len);
+        if (!rows) return -1;
+        for (long i = 0; i < b->rows; ++i) {
+            int key = rows[i].y * 10000 + rows[i].m * 100 + rows[i].d;
+            if (key < lo || key > hi) continue;
+            found++;
+            if (fn(ctx, (long)(b->first + i), &rows[i])) { stop = 1; break; }
+        }
+        if (pin) fin_cache_release(pin);
+        else fin_free((void *)rows);
+        if (fin_checkpoint(b->rows)) return FIN_CANCELLED;
+    }
+    return found;
+}
+
+void fin_paged_stats(FinPaged *p, FinPagedStats *st) {
+    st->rows = p->rows;
+    st->fileBytes = p->fileBytes;
+    st->blocks = p->nBlocks;
+    st->hotFrom = p->hotFrom;
+    st->firstYear = st->lastYear = 0;
+    int m, d;
+    if (p->nBlocks && p->blocks[0].minDay != INT_MIN) {
+        long long lo = LLONG_MAX, hi = LLONG_MIN;
+        for (long k = 0; k < p->nBlocks; ++k) {
+            if (p->blocks[k].minDay < lo) lo = p->blocks[k].minDay;
+            if (p->blocks[k].maxDay > hi) hi = p->blocks[k].maxDay;
+        }
+        civil_from_days(lo, &st->firstYear, &m, &d);
+        civil_from_days(hi, &st->lastYear, &m, &d);
+    }
+    st->scans = atomic_load(&p->scans);
+    st->blocksScanned = atomic_load(&p->blocksScanned);
+    st->blocksSkipped = atomic_load(&p->blocksSkipped);
+    st->blocksRead = atomic_load(&p->blocksRead);
+    st->bytesRead = atomic_load(&p->bytesRead);
+}
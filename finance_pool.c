@@ -0,0 +1,397 @@
+/*
+  finance_pool.c - shared work-stealing thread pool and the parallel
+  operators built on it (see finance.h).
+
+  Each thread owns a deque of range tasks. A thread runs a task by
+  repeatedly splitting it in half, pushing the upper half onto the
+  bottom of its own deque, until the range is at most one grain; idle
+  threads steal from the top of other deques, so large halves migrate
+  first. Threads that call fin_parallel_for() from outside the pool
+  share deque 0 and help execute tasks until their job is done, which
+  also makes nested parallel loops safe.
+
+  A job carries the FinControl attached to the thread that started it,
+  and whichever thread runs one of its tasks sees that control, so
+  fin_checkpoint() inside a task observes the caller's cancel request.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_THREADS 256
+#define SPIN_ROUNDS 64               // failed steal rounds before a worker sleeps
+
+struct FinControl {
+    atomic_int stop;                 // FIN_RUN, FIN_STOP_CANCEL or FIN_STOP_TIMEOUT
+    atomic_long done, total;         // progress of the current phase
+    double deadline;                 // seconds (CLOCK_MONOTONIC), 0 = none
+};
+
+typedef struct {
+    FinTaskFn fn;
+    void *ctx;
+    long grain;
+    FinControl *ctl;                 // the starting thread's control
+    atomic_long pending;             // iterations not yet executed
+} Job;
+
+typedef struct {
+    Job *job;
+    long begin, end;
+} Task;
+
+/* Ring buffer; the owner pushes and pops at the bottom, thieves take
+   from the top. A mutex per deque keeps it simple and correct. */
+typedef struct {
+    pthread_mutex_t mu;
+    Task *buf;
+    int cap, top, size;
+} Deque;
+
+static struct {
+    int nthreads;                    // including callers' shared deque 0
+    Deque *dq;
+    pthread_t *tids;
+    pthread_mutex_t sleepMu;
+    pthread_cond_t sleepCv;
+    atomic_long queued;
+    atomic_int stop;
+} P;
+
+static pthread_mutex_t initMu = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int poolReady = 0;
+static _Thread_local int myDeque = 0;  // workers own 1..nthreads-1
+static _Thread_local unsigned victimSeed = 2463534242u;
+static _Thread_local FinControl *curCtl = NULL;
+
+/* ----------------------- Deques ----------------------------------- */
+
+static int dq_push(Deque *d, Task t) {
+    pthread_mutex_lock(&d->mu);
+    if (d->size == d->cap) {
+        int cap = d->cap ? d->cap * 2 : 64;
+        Task *nb = fin_malloc(MEM_POOL, (size_t)cap * sizeof(Task));
+        if (!nb) { pthread_mutex_unlock(&d->mu); return 0; }
+        for (int k = 0; k < d->size; ++k) nb[k] = d->buf[(d->top + k) % d->cap];
+        fin_free(d->buf);
+        d->buf = nb;
+        d->cap = cap;
+        d->top = 0;
+    }
+    d->buf[(d->top + d->size) % d->cap] = t;
+    d->size++;
+    pthread_mutex_unlock(&d->mu);
+    return 1;
+}
+
+static int dq_pop_bottom(Deque *d, Task *t) {
+    int ok = 0;
+    pthread_mutex_lock(&d->mu);
+    if (d->size) { *t = d->buf[(d->top + d->size - 1) % d->cap]; d->size--; ok = 1; }
+    pthread_mutex_unlock(&d->mu);
+    return ok;
+}
+
+static int dq_steal_top(Deque *d, Task *t) {
+    int ok = 0;
+    pthread_mutex_lock(&d->mu);
+    if (d->size) { *t = d->buf[d->top]; d->top = (d->top + 1) % d->cap; d->size--; ok = 1; }
+    pthread_mutex_unlock(&d->mu);
+    return ok;
+}
+
+/* ----------------------- Scheduling ------------------------------- */
+
+static void wake_workers(void) {
+    pthread_mutex_lock(&P.sleepMu);
+    pthread_cond_broadcast(&P.sleepCv);
+    pthread_mutex_unlock(&P.sleepMu);
+}
+
+static void run_leaf(Task t) {
+    FinControl *saved = curCtl;
+    curCtl = t.job->ctl;
+    t.job->fn(t.job->ctx, t.begin, t.end);
+    curCtl = saved;
+    atomic_fetch_sub(&t.job->pending, t.end - t.begin);
+}
+
+static void push_task(Task t) {
+    if (!dq_push(&P.dq[myDeque], t)) {   // out of memory: run it here instead
+        run_leaf(t);
+        return;
+    }
+    atomic_fetch_add(&P.queued, 1);
+    wake_workers();
+}
+
+static int find_task(Task *t) {
+    if (atomic_load(&P.queued) == 0) return 0;
+    if (dq_pop_bottom(&P.dq[myDeque], t)) { atomic_fetch_sub(&P.queued, 1); return 1; }
+    victimSeed ^= victimSeed << 13; victimSeed ^= victimSeed >> 17; victimSeed ^= victimSeed << 5;
+    int n = P.nthreads, start = (int)(victimSeed % (unsigned)n);
+    for (int k = 0; k < n; ++k) {
+        int v = (start + k) % n;
+        if (v != myDeque && dq_steal_top(&P.dq[v], t)) { atomic_fetch_sub(&P.queued, 1); return 1; }
+    }
+    return 0;
+}
+
+static void run_task(Task t) {
+    while (t.end - t.begin > t.job->grain) {
+        long mid = t.begin + (t.end - t.begin) / 2;
+        push_task((Task){ t.job, mid, t.end });
+        t.end = mid;
+    }
+    run_leaf(t);
+}
+
+static void *worker_main(void *arg) {
+    char name[16];
+    myDeque = (int)(size_t)arg;
+    victimSeed += 0x9e3779b9u * (unsigned)myDeque;
+    snprintf(name, sizeof(name), "pool-%d", myDeque);
+    fin_trace_thread_name(name);
+    int idle = 0;
+    Task t;
+    while (!atomic_load(&P.stop)) {
+        if (find_task(&t)) { run_task(t); idle = 0; continue; }
+        if (++idle < SPIN_ROUNDS) { sched_yield(); continue; }
+        pthread_mutex_lock(&P.sleepMu);
+        while (!atomic_load(&P.stop) && atomic_load(&P.queued) == 0)
+            pthread_cond_wait(&P.sleepCv, &P.sleepMu);
+        pthread_mutex_unlock(&P.sleepMu);
+        idle = 0;
+    }
+    return NULL;
+}
+
+/* ----------------------- Pool lifecycle --------------------------- */
+
+static int auto_threads(void) {
+    const char *env = getenv("FIN_THREADS");
+    int n = env ? atoi(env) : 0;
+    if (n <= 0) n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+static void pool_stop_locked(void) {
+    if (!atomic_load(&poolReady)) return;
+    atomic_store(&P.stop, 1);
+    wake_workers();
+    for (int k = 1; k < P.nthreads; ++k) pthread_join(P.tids[k], NULL);
+    for (int k = 0; k < P.nthreads; ++k) {
+        pthread_mutex_destroy(&P.dq[k].mu);
+        fin_free(P.dq[k].buf);
+    }
+    fin_free(P.dq);
+    fin_free(P.tids);
+    pthread_mutex_destroy(&P.sleepMu);
+    pthread_cond_destroy(&P.sleepCv);
+    atomic_store(&poolReady, 0);
+}
+
+static int pool_start_locked(int threads) {
+    if (threads <= 0) threads = auto_threads();
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    memset(&P, 0, sizeof(P));
+    P.dq = fin_calloc(MEM_POOL, (size_t)threads, sizeof(Deque));
+    P.tids = fin_calloc(MEM_POOL, (size_t)threads, sizeof(pthread_t));
+    if (!P.dq || !P.tids) { fin_free(P.dq); fin_free(P.tids); return 0; }
+    pthread_mutex_init(&P.sleepMu, NULL);
+    pthread_cond_init(&P.sleepCv, NULL);
+    for (int k = 0; k < threads; ++k) pthread_mutex_init(&P.dq[k].mu, NULL);
+    P.nthreads = 1;
+    for (int k = 1; k < threads; ++k) {
+        if (pthread_create(&P.tids[k], NULL, worker_main, (void *)(size_t)k) != 0) break;
+        P.nthreads++;
+    }
+    atomic_store(&poolReady, 1);
+    return 1;
+}
+
+int fin_pool_init(int threads) {
+    pthread_mutex_lock(&initMu);
+    pool_stop_locked();
+    int ok = pool_start_locked(threads);
+    pthread_mutex_unlock(&initMu);
+    return ok;
+}
+
+void fin_pool_shutdown(void) {
+    pthread_mutex_lock(&initMu);
+    pool_stop_locked();
+    pthread_mutex_unlock(&initMu);
+}
+
+static int pool_ensure(void) {
+    if (atomic_load(&poolReady)) return 1;
+    pthread_mutex_lock(&initMu);
+    int ok = atomic_load(&poolReady) || pool_start_locked(0);
+    pthread_mutex_unlock(&initMu);
+    return ok;
+}
+
+int fin_pool_threads(void) {
+    return pool_ensure() ? P.nthreads : 1;
+}
+
+/* ----------------------- Parallel loops --------------------------- */
+
+void fin_parallel_for(long n, long grain, FinTaskFn fn, void *ctx) {
+    if (n <= 0) return;
+    if (grain < 1) grain = 1;
+    if (n <= grain || !pool_ensure() || P.nthreads == 1) { fn(ctx, 0, n); return; }
+
+    Job job = { fn, ctx, grain, curCtl, 0 };
+    atomic_init(&job.pending, n);
+    run_task((Task){ &job, 0, n });
+    Task t;
+    while (atomic_load(&job.pending) > 0) {      // help until our job is done
+        if (find_task(&t)) run_task(t);
+        else sched_yield();
+    }
+}
+
+/* ----------------------- Parallel sort ---------------------------- */
+/* Blocks are sorted concurrently with qsort, then merged pairwise in
+   rounds of doubling width, each round's merges running in parallel.
+   Like qsort, the result is not stable. Blocks are capped at
+   SORT_BLOCK_MAX elements so cancellation is noticed promptly. */
+
+#define SORT_BLOCK_MIN 4096
+#define SORT_BLOCK_MAX (1 << 18)
+#define MERGE_CHECK    16384         // elements merged between checkpoints
+
+typedef struct {
+    char *src, *dst;
+    size_t n, size, width;
+    int (*cmp)(const void *, const void *);
+} SortCtx;
+
+static void sort_blocks(void *c, long b, long e) {
+    SortCtx *s = c;
+    for (long k = b; k < e; ++k) {
+        size_t lo = (size_t)k * s->width, hi = lo + s->width < s->n ? lo + s->width : s->n;
+        if (fin_checkpoint(0)) return;
+        unsigned long long t0 = fin_trace_begin();
+        qsort(s->src + lo * s->size, hi - lo, s->size, s->cmp);
+        fin_trace_end("sort_block", t0);
+        fin_checkpoint((long)(hi - lo));
+    }
+}
+
+static void merge_pairs(void *c, long b, long e) {
+    SortCtx *s = c;
+    size_t sz = s->size;
+    for (long k = b; k < e; ++k) {
+        size_t lo = (size_t)k * 2 * s->width;
+        size_t mid = lo + s->width < s->n ? lo + s->width : s->n;
+        size_t hi = mid + s->width < s->n ? mid + s->width : s->n;
+        size_t i = lo, j = mid, o = lo;
+        unsigned long long t0 = fin_trace_begin();
+        while (i < mid && j < hi) {
+            if (s->cmp(s->src + j * sz, s->src + i * sz) < 0) { memcpy(s->dst + o * sz, s->src + j * sz, sz); j++; }
+            else { memcpy(s->dst + o * sz, s->src + i * sz, sz); i++; }
+            if (++o % MERGE_CHECK == 0 && fin_checkpoint(MERGE_CHECK)) return;
+        }
+        if (i < mid) memcpy(s->dst + o * sz, s->src + i * sz, (mid - i) * sz);
+        if (j < hi) memcpy(s->dst + (o + mid - i) * sz, s->src + j * sz, (hi - j) * sz);
+        fin_trace_end("merge", t0);
+    }
+}
+
+int fin_parallel_sort(void *base, size_t n, size_t size, int (*cmp)(const void *, const void *)) {
+    size_t width = n / ((size_t)fin_pool_threads() * 4) + 1;
+    if (width < SORT_BLOCK_MIN) width = SORT_BLOCK_MIN;
+    if (width > SORT_BLOCK_MAX) width = SORT_BLOCK_MAX;
+    if (n <= width) { qsort(base, n, size, cmp); return 1; }
+
+    char *tmp = fin_malloc(MEM_SORT, n * size);
+    if (!tmp) return 0;
+
+    int rounds = 0;
+    for (size_t w = width; w < n; w *= 2) rounds++;
+    fin_progress_begin((long)n * (rounds + 1));
+
+    SortCtx s = { base, tmp, n, size, width, cmp };
+    fin_parallel_for((long)((n + width - 1) / width), 1, sort_blocks, &s);
+    for (; s.width < n && !fin_checkpoint(0); s.width *= 2) {
+        fin_parallel_for((long)((n + 2 * s.width - 1) / (2 * s.width)), 1, merge_pairs, &s);
+        char *t = s.src; s.src = s.dst; s.dst = t;
+    }
+    int r = fin_checkpoint(0) ? FIN_CANCELLED : 1;
+    if (r == 1 && s.src != (char *)base) memcpy(base, s.src, n * size);
+    fin_free(tmp);
+    return r;
+}
+
+/* ----------------------- Cancellation ----------------------------- */
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+FinControl *fin_control_new(double timeoutSec) {
+    FinControl *c = fin_malloc(MEM_POOL, sizeof(*c));
+    if (!c) return NULL;
+    atomic_init(&c->stop, FIN_RUN);
+    atomic_init(&c->done, 0);
+    atomic_init(&c->total, 0);
+    c->deadline = timeoutSec > 0 ? now_seconds() + timeoutSec : 0;
+    return c;
+}
+
+void fin_control_free(FinControl *c) { fin_free(c); }
+
+void fin_control_cancel(FinControl *c) {
+    int run = FIN_RUN;
+    atomic_compare_exchange_strong(&c->stop, &run, FIN_STOP_CANCEL);
+}
+
+int fin_control_status(const FinControl *c) {
+    return atomic_load(&((FinControl *)c)->stop);
+}
+
+void fin_control_progress(const FinControl *c, long *done, long *total) {
+    *done = atomic_load(&((FinControl *)c)->done);
+    *total = atomic_load(&((FinControl *)c)->total);
+}
+
+FinControl *fin_control_attach(FinControl *c) {
+    FinControl *prev = curCtl;
+    curCtl = c;
+    return prev;
+}
+
+FinControl *fin_control_current(void) { return curCtl; }
+
+void fin_progress_begin(long total) {
+    FinControl *c = curCtl;
+    if (!c) return;
+    atomic_store(&c->done, 0);
+    atomic_store(&c->total, total);
+}
+
+int fin_checkpoint(long work) {
+    FinControl *c = curCtl;
+    if (!c) return 0;
+    if (work) atomic_fetch_add_explicit(&c->done, work, memory_order_relaxed);
+    int st = atomic_load_explicit(&c->stop, memory_order_relaxed);
+    if (st == FIN_RUN && c->deadline > 0 && now_seconds() >= c->deadline) {
+        int run = FIN_RUN;
+        atomic_compare_exchange_strong(&c->stop, &run, FIN_STOP_TIMEOUT);
+        st = atomic_load(&c->stop);
+    }
+    return st != FIN_RUN;
+}
@@ -0,0 +1,56 @@
+/*
+  finance_probes.h - USDT static tracepoints for perf, bpftrace and
+  SystemTap (private to the engine sources).
+
+  With <sys/sdt.h> available (systemtap-sdt-dev / systemtap-sdt-devel)
+  FIN_USDT is defined and every FIN_PROBEn() compiles to a single nop
+  plus an ELF note; the probe costs nothing until a tracer attaches.
+  Without the header, or built with -DFIN_NO_USDT (make USDT=0), the
+  macros compile to nothing and their arguments are not evaluated.
+
+  Provider "finance". Durations are nanoseconds, counts are rows unless
+  noted; strings are char *.
+
+    load__start(file)                     load__done(rows, bytes, ns)
+    import__start(file)                   import__done(rows, bytes, ns)
+    parse__batch(lines, parsed, ns)       one import pipeline block
+    save__start(file)                     save__done(rows, bytes, ns)
+    export__done(rows, bytes, ns)         recorded by the front end
+    sort__start(key, rows)                sort__done(key, rows, ns)
+    search__done(kind, scanned, matched, ns)   kind: a FIN_STAT_NAMES index
+    aggregate__done(kind, scanned, groups, ns) chart (groups = months),
+                                          summary or range_sum (groups = rows)
+    insert__done(offered, stored, ns)     every insert and ledger_add
+    delete__done(scanned, deleted, ns)
+    clear(rows)
+
+  e.g.  bpftrace -e 'usdt:./finance_tracker:finance:sort__done
+                     { @ms[arg0] = hist(arg2 / 1000000); }'
+        perf probe -x ./finance_tracker sdt_finance:load__done
+*/
+
+#ifndef FINANCE_PROBES_H
+#define FINANCE_PROBES_H
+
+#if !defined(FIN_USDT) && !defined(FIN_NO_USDT) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    define FIN_USDT 1
+#  endif
+#endif
+
+#ifdef FIN_USDT
+#include <sys/sdt.h>
+#define FIN_PROBE1(n, a)          DTRACE_PROBE1(finance, n, a)
+#define FIN_PROBE2(n, a, b)       DTRACE_PROBE2(finance, n, a, b)
+#define FIN_PROBE3(n, a, b, c)    DTRACE_PROBE3(finance, n, a, b, c)
+#define FIN_PROBE4(n, a, b, c, d) DTRACE_PROBE4(finance, n, a, b, c, d)
+#define FIN_PROBE_CLOCK()         fin_clock_ns()
+#else
+#define FIN_PROBE1(n, a)          ((void)sizeof(a))
+#define FIN_PROBE2(n, a, b)       ((void)sizeof(a), (void)sizeof(b))
+#define FIN_PROBE3(n, a, b, c)    ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#define FIN_PROBE4(n, a, b, c, d) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c), (void)sizeof(d))
+#define FIN_PROBE_CLOCK()         0ull
+#endif
+
+#endif /* FINANCE_PROBES_H */
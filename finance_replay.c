@@ -0,0 +1,171 @@
+/*
+  finance_replay.c - session logs and their replay (see finance.h).
+
+  A log is the magic "FINLOG1\n" followed by request frames in the
+  daemon's wire format (u32 len, u8 op, payload), so a recorded menu
+  session, a command-line run and a daemon client all produce the same
+  thing, and replay answers each frame with the daemon's own handler.
+  Recording appends, so one log can collect many short command-line
+  runs.
+
+  Replay reads the whole log first and then runs the requests back to
+  back on the calling thread, timing each one (read section and reply
+  encoding included, as the daemon would pay them). Latencies are kept
+  as raw samples, so the percentiles are exact.
+*/
+
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define LOG_MAGIC     "FINLOG1\n"
+#define LOG_MAGIC_LEN 8
+#define MAX_FRAME     (1 << 20)      // as the daemon accepts
+
+struct FinRecorder {
+    FILE *f;
+};
+
+/* ----------------------- Recording -------------------------------- */
+
+FinRecorder *fin_record_open(const char *fname) {
+    FILE *f = fopen(fname, "a+b");
+    if (!f) return NULL;
+    char magic[LOG_MAGIC_LEN];
+    size_t got = fread(magic, 1, sizeof(magic), f);
+    if (got == 0 && !ferror(f)) {                 // new log
+        if (fwrite(LOG_MAGIC, 1, LOG_MAGIC_LEN, f) != LOG_MAGIC_LEN || fflush(f) != 0) { fclose(f); return NULL; }
+    } else if (got != LOG_MAGIC_LEN || memcmp(magic, LOG_MAGIC, LOG_MAGIC_LEN) != 0) {
+        fclose(f);
+        errno = EINVAL;
+        return NULL;
+    }
+    FinRecorder *r = fin_malloc(MEM_REPLAY, sizeof(FinRecorder));
+    if (!r) { fclose(f); errno = ENOMEM; return NULL; }
+    r->f = f;
+    return r;
+}
+
+/* Flushed per request: a session that crashes still leaves its log. */
+int fin_record(FinRecorder *r, FinOp op, const unsigned char *payload, size_t n) {
+    unsigned char hdr[5];
+    if (n + 1 > MAX_FRAME) return 0;
+    unsigned long long len = n + 1;
+    for (int k = 0; k < 4; ++k) { hdr[k] = (unsigned char)(len & 0xff); len >>= 8; }
+    hdr[4] = (unsigned char)op;
+    return fwrite(hdr, 1, 5, r->f) == 5 && (n == 0 || fwrite(payload, 1, n, r->f) == n)
+           && fflush(r->f) == 0;
+}
+
+int fin_record_close(FinRecorder *r) {
+    if (!r) return 1;
+    int ok = fclose(r->f) == 0;
+    fin_free(r);
+    return ok;
+}
+
+/* ----------------------- Replay ----------------------------------- */
+
+static void summarize(FinSamples *s, FinReplayOpStats *o) {
+    memset(o, 0, sizeof(*o));
+    if (!s->n) return;
+    fin_samples_sort(s);
+    o->count = s->n;
+    for (size_t k = 0; k < s->n; ++k) o->totalNs += s->ns[k];
+    o->minNs = s->ns[0];
+    o->maxNs = s->ns[s->n - 1];
+    o->p50Ns = fin_samples_pct(s, 50);
+    o->p90Ns = fin_samples_pct(s, 90);
+    o->p99Ns = fin_samples_pct(s, 99);
+    o->p999Ns = fin_samples_pct(s, 99.9);
+}
+
+/* Reads the whole log; *frames gets the number of well-formed frames. */
+static unsigned char *read_log(const char *fname, size_t *len, long *frames) {
+    FILE *f = fopen(fname, "rb");
+    if (!f) return NULL;
+    size_t cap = 1 << 16, n = 0;
+    unsigned char *buf = fin_malloc(MEM_REPLAY, cap);
+    while (buf) {
+        n += fread(buf + n, 1, cap - n, f);
+        if (n < cap) break;
+        unsigned char *p = fin_realloc(MEM_REPLAY, buf, cap * 2);
+        if (!p) { fin_free(buf); buf = NULL; break; }
+        buf = p;
+        cap *= 2;
+    }
+    int err = ferror(f);
+    fclose(f);
+    if (!buf) { errno = ENOMEM; return NULL; }
+    if (err) { fin_free(buf); errno = EIO; return NULL; }
+    if (n < LOG_MAGIC_LEN || memcmp(buf, LOG_MAGIC, LOG_MAGIC_LEN) != 0) { fin_free(buf); errno = EINVAL; return NULL; }
+    *frames = 0;
+    size_t at = LOG_MAGIC_LEN;
+    while (at + 4 <= n) {
+        size_t fl = (size_t)fin_get_le(buf + at, 4);
+        if (fl < 1 || fl > MAX_FRAME || fl > n - at - 4) break;
+        at += 4 + fl;
+        ++*frames;
+    }
+    if (at != n) { fin_free(buf); errno = EINVAL; return NULL; }
+    *len = n;
+    return buf;
+}
+
+long fin_replay(Ledger *L, const char *logFile, const char *saveFile, FinReplayStats *st) {
+    size_t len;
+    long frames;
+    memset(st, 0, sizeof(*st));
+    unsigned char *log = read_log(logFile, &len, &frames);
+    if (!log) return -1;
+
+    FinSamples samples[FIN_OPS] = {{0}};
+    RowSet hits = {0};
+    FinBuf reply = {0};
+    int cancelled = 0, oom = 0;
+    fin_progress_begin(frames);
+    unsigned long long start = fin_clock_ns();
+    for (size_t at = LOG_MAGIC_LEN; at < len && !oom; ) {
+        size_t fl = (size_t)fin_get_le(log + at, 4);
+        const unsigned char *frame = log + at + 4;
+        at += 4 + fl;
+        if (fin_checkpoint(1)) { cancelled = 1; break; }
+        reply.len = 0;
+        unsigned long long t0 = fin_clock_ns();
+        fin_serve_request(L, saveFile, &hits, frame[0], frame + 1, fl - 1, &reply);
+        unsigned long long dt = fin_clock_ns() - t0;
+        st->requests++;
+        if (reply.len < 5 || reply.data[4] != FIN_ST_OK) st->failed++;
+        if (frame[0] < FIN_OPS) oom = !fin_samples_add(&samples[frame[0]], dt);
+    }
+    st->wallNs = fin_clock_ns() - start;
+
+    for (int op = 0; op < FIN_OPS; ++op) {
+        summarize(&samples[op], &st->ops[op]);
+        fin_samples_free(&samples[op]);
+    }
+    finbuf_free(&reply);
+    rowset_free(&hits);
+    fin_free(log);
+    if (oom) { errno = ENOMEM; return -1; }
+    return cancelled ? FIN_CANCELLED : st->requests;
+}
+
+int fin_replay_write_json(FILE *f, const FinReplayStats *st) {
+    fprintf(f, "{\"requests\": %ld, \"failed\": %ld, \"wall_ns\": %llu, \"requests_per_s\": %.1f, \"ops\": [",
+            st->requests, st->failed, st->wallNs, st->wallNs ? st->requests * 1e9 / st->wallNs : 0.0);
+    int first = 1;
+    for (int op = 0; op < FIN_OPS; ++op) {
+        const FinReplayOpStats *o = &st->ops[op];
+        if (!o->count) continue;
+        fprintf(f, "%s\n  {\"op\": \"%s\", \"count\": %llu, \"total_ns\": %llu, \"mean_ns\": %llu, \"min_ns\": %llu, "
+                   "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+                first ? "" : ",", FIN_OP_NAMES[op], o->count, o->totalNs, o->totalNs / o->count, o->minNs,
+                o->p50Ns, o->p90Ns, o->p99Ns, o->p999Ns, o->maxNs);
+        first = 0;
+    }
+    fprintf(f, "\n]}\n");
+    return !ferror(f);
+}
@@ -0,0 +1,234 @@
+/*
+  finance_stats.c - per-operation latency histograms and counters (see
+  finance.h).
+
+  Every public engine operation brackets itself with fin_stat_begin() /
+  fin_stat_end(), which read CLOCK_MONOTONIC and add the elapsed time to
+  that operation's histogram plus its row and byte counters (and, while
+  tracing, record the call as a span). All cells
+  are relaxed atomics, so recording never locks and any thread (pool
+  workers, daemon connections) may record at once; a reader sees each
+  cell exactly, though not all cells from the same instant.
+
+  Histograms are log-linear in the style of HdrHistogram: values below
+  2*SUB are exact, and above that every power of two is split into SUB
+  equal buckets, so a reported value is within 1/SUB (~3%) of the real
+  one. Values from 1 ns to about 4.9 hours fit in HIST_BUCKETS cells.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "finance.h"
+#include "finance_probes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#define SUB_BITS     5
+#define SUB          (1 << SUB_BITS)                 // buckets per power of two
+#define MAX_MSB      43                              // largest value: 2^44 - 1 ns
+#define HIST_BUCKETS ((MAX_MSB - SUB_BITS + 2) * SUB)
+
+typedef struct {
+    atomic_ullong calls, rowsScanned, rowsReturned, bytesRead, bytesWritten;
+    atomic_ullong totalNs, maxNs;
+    atomic_ullong hist[HIST_BUCKETS];
+} OpStats;
+
+const char *const FIN_STAT_NAMES[STAT_OPS] = {
+    "load", "import", "save", "export", "insert", "delete", "sort_date", "sort_amount",
+    "list", "search_category", "search_note", "search_date", "filter", "chart", "summary",
+    "range_sum"
+};
+
+static OpStats stats[STAT_OPS];
+static atomic_int enabled = 1;
+
+/* ----------------------- Histogram buckets ------------------------ */
+
+static int bucket_of(unsigned long long v) {
+    if (v >= 1ull << (MAX_MSB + 1)) v = (1ull << (MAX_MSB + 1)) - 1;
+    if (v < 2 * SUB) return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    return (msb - SUB_BITS) * SUB + (int)(v >> (msb - SUB_BITS));
+}
+
+/* Highest value that lands in bucket k. */
+static unsigned long long bucket_top(int k) {
+    if (k < 2 * SUB) return (unsigned long long)k;
+    int shift = k / SUB - 1;
+    return ((unsigned long long)(k % SUB + SUB) << shift) + (1ull << shift) - 1;
+}
+
+/* ----------------------- Recording -------------------------------- */
+
+int fin_stats_enable(int on) {
+    return atomic_exchange(&enabled, on != 0);
+}
+
+unsigned long long fin_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+/* Also starts the operation's trace span, so t0 is set while either
+   statistics or tracing is on (always, with USDT probes built in). */
+unsigned long long fin_stat_begin(void) {
+#ifndef FIN_USDT
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed) && !fin_tracing()) return 0;
+#endif
+    return fin_clock_ns();
+}
+
+/* The *__done USDT probes of finance_probes.h. */
+static void fire_probe(FinStat op, long scanned, long returned, long bytesRead,
+                       long bytesWritten, unsigned long long ns) {
+    switch (op) {
+    case STAT_LOAD:        FIN_PROBE3(load__done, returned, bytesRead, ns); break;
+    case STAT_IMPORT:      FIN_PROBE3(import__done, returned, bytesRead, ns); break;
+    case STAT_SAVE:        FIN_PROBE3(save__done, returned, bytesWritten, ns); break;
+    case STAT_EXPORT:      FIN_PROBE3(export__done, returned, bytesWritten, ns); break;
+    case STAT_INSERT:      FIN_PROBE3(insert__done, scanned, returned, ns); break;
+    case STAT_DELETE:      FIN_PROBE3(delete__done, scanned, returned, ns); break;
+    case STAT_SORT_DATE:
+    case STAT_SORT_AMOUNT: FIN_PROBE3(sort__done, op == STAT_SORT_DATE ? SORT_DATE : SORT_AMOUNT_DESC, scanned, ns); break;
+    case STAT_CHART:
+    case STAT_SUMMARY:
+    case STAT_RANGE_SUM:   FIN_PROBE4(aggregate__done, op, scanned, returned, ns); break;
+    default:               FIN_PROBE4(search__done, op, scanned, returned, ns); break;
+    }
+}
+
+void fin_stat_end(FinStat op, unsigned long long t0, long scanned, long returned,
+                  long bytesRead, long bytesWritten) {
+    if (!t0 || (unsigned)op >= STAT_OPS) return;
+    unsigned long long ns = fin_clock_ns();
+    ns = ns > t0 ? ns - t0 : 0;
+    fire_probe(op, scanned, returned, bytesRead, bytesWritten, ns);
+    fin_trace_end(FIN_STAT_NAMES[op], t0);
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed)) return;
+
+    OpStats *s = &stats[op];
+    atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+    if (scanned > 0) atomic_fetch_add_explicit(&s->rowsScanned, (unsigned long long)scanned, memory_order_relaxed);
+    if (returned > 0) atomic_fetch_add_explicit(&s->rowsReturned, (unsigned long long)returned, memory_order_relaxed);
+    if (bytesRead > 0) atomic_fetch_add_explicit(&s->bytesRead, (unsigned long long)bytesRead, memory_order_relaxed);
+    if (bytesWritten > 0) atomic_fetch_add_explicit(&s->bytesWritten, (unsigned long long)bytesWritten, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->totalNs, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->hist[bucket_of(ns)], 1, memory_order_relaxed);
+    unsigned long long mx = atomic_load_explicit(&s->maxNs, memory_order_relaxed);
+    while (ns > mx && !atomic_compare_exchange_weak_explicit(&s->maxNs, &mx, ns,
+                                                             memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+void fin_stats_reset(void) {
+    for (int op = 0; op < STAT_OPS; ++op) {
+        OpStats *s = &stats[op];
+        atomic_store(&s->calls, 0);
+        atomic_store(&s->rowsScanned, 0);
+        atomic_store(&s->rowsReturned, 0);
+        atomic_store(&s->bytesRead, 0);
+        atomic_store(&s->bytesWritten, 0);
+        atomic_store(&s->totalNs, 0);
+        atomic_store(&s->maxNs, 0);
+        for (int k = 0; k < HIST_BUCKETS; ++k) atomic_store_explicit(&s->hist[k], 0, memory_order_relaxed);
+    }
+}
+
+/* ----------------------- Reading ---------------------------------- */
+
+/* Nearest-rank percentiles over one copy of the histogram, so the
+   values of one call agree with each other. */
+void fin_stats_get(FinStat op, FinOpStats *out) {
+    static const double pct[4] = { 50.0, 90.0, 99.0, 99.9 };
+    unsigned long long h[HIST_BUCKETS], n = 0, *dst[4];
+    memset(out, 0, sizeof(*out));
+    if ((unsigned)op >= STAT_OPS) return;
+
+    const OpStats *s = &stats[op];
+    out->calls = atomic_load(&s->calls);
+    out->rowsScanned = atomic_load(&s->rowsScanned);
+    out->rowsReturned = atomic_load(&s->rowsReturned);
+    out->bytesRead = atomic_load(&s->bytesRead);
+    out->bytesWritten = atomic_load(&s->bytesWritten);
+    out->totalNs = atomic_load(&s->totalNs);
+    out->maxNs = atomic_load(&s->maxNs);
+    for (int k = 0; k < HIST_BUCKETS; ++k) n += h[k] = atomic_load_explicit(&s->hist[k], memory_order_relaxed);
+
+    dst[0] = &out->p50Ns; dst[1] = &out->p90Ns; dst[2] = &out->p99Ns; dst[3] = &out->p999Ns;
+    unsigned long long seen = 0;
+    int q = 0;
+    for (int k = 0; k < HIST_BUCKETS && q < 4 && n; ++k) {
+        seen += h[k];
+        while (q < 4 && (double)seen >= pct[q] / 100.0 * (double)n) {
+            unsigned long long v = bucket_top(k);
+            *dst[q++] = v < out->maxNs ? v : out->maxNs;
+        }
+    }
+}
+
+/* ----------------------- Raw samples ------------------------------ */
+
+int fin_samples_add(FinSamples *s, unsigned long long ns) {
+    if (s->n == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 1024;
+        unsigned long long *p = fin_realloc(MEM_REPLAY, s->ns, cap * sizeof(*p));
+        if (!p) return 0;
+        s->ns = p;
+        s->cap = cap;
+    }
+    s->ns[s->n++] = ns;
+    return 1;
+}
+
+static int cmp_ull(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+void fin_samples_sort(FinSamples *s) {
+    if (s->n) qsort(s->ns, s->n, sizeof(*s->ns), cmp_ull);
+}
+
+/* The smallest sample with at least p% of them at or below it. */
+unsigned long long fin_samples_pct(const FinSamples *s, double p) {
+    if (!s->n) return 0;
+    double r = p / 100.0 * (double)s->n;
+    size_t k = (size_t)r;
+    if ((double)k < r) ++k;          // rank ceil(r), counted from 1
+    return s->ns[k < 1 ? 0 : k > s->n ? s->n - 1 : k - 1];
+}
+
+void fin_samples_free(FinSamples *s) {
+    fin_free(s->ns);
+    *s = (FinSamples){0};
+}
+
+int fin_stats_write_json(FILE *f) {
+    fprintf(f, "{\"ops\": [");
+    for (int op = 0; op < STAT_OPS; ++op) {
+        FinOpStats s;
+        fin_stats_get((FinStat)op, &s);
+        fprintf(f, "%s\n  {\"op\": \"%s\", \"calls\": %llu, \"rows_scanned\": %llu, \"rows_returned\": %llu, "
+                   "\"bytes_read\": %llu, \"bytes_written\": %llu, \"total_ns\": %llu, \"mean_ns\": %llu, "
+                   "\"max_ns\": %llu, \"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+                   "\"histogram\": [",
+                op ? "," : "", FIN_STAT_NAMES[op], s.calls, s.rowsScanned, s.rowsReturned,
+                s.bytesRead, s.bytesWritten, s.totalNs, s.calls ? s.totalNs / s.calls : 0,
+                s.maxNs, s.p50Ns, s.p90Ns, s.p99Ns, s.p999Ns);
+        int first = 1;                   // [bucket upper bound ns, count] for non-empty buckets
+        for (int k = 0; k < HIST_BUCKETS; ++k) {
+            unsigned long long c = atomic_load_explicit(&stats[op].hist[k], memory_order_relaxed);
+            if (!c) continue;
+            fprintf(f, "%s[%llu, %llu]", first ? "" : ", ", bucket_top(k), c);
+            first = 0;
+        }
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n]}\n");
+    return !ferror(f);
+}
@@ -0,0 +1,362 @@
+/*
+  finance_tier.c - hot/cold tiered storage (see finance.h).
+
+  A data file may have an archive next to it, DATAFILE.archive: a packed
+  ledger (compressed column blocks with a block index, finance_pack.c)
+  holding every row dated before its first hot year. The data file
+  itself holds the hot years and is what ledger_load() reads, so a
+  process starts with only the hot rows resident.
+
+  fin_tier_fault() brings archived years into the ledger the first time
+  a query needs them, decoding only the blocks whose dates overlap, and
+  merges them by date into the archived-year rows that lead the ledger
+  (rebuilding it and publishing the result in one step). For
+  each year it brought in (or that moved to the archive from the hot
+  tier) the tier remembers the row count and an order-independent hash
+  of the rows, so fin_tier_save() can tell whether the resident copy of
+  an archived year was changed and the archive must be rewritten. Rows
+  for archived years found in the ledger without a fault (added, or
+  left in the data file by a client that ignores the archive) are
+  additions to that year: saving faults the year in first, so they are
+  merged, never duplicated. The archive is replaced (write and rename)
+  before the data file is written, so a crash in between can leave
+  moved rows in both files, but never in neither. The archive header
+  records the first hot year, so the split stays where the save that
+  made it put it.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include "finance.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+
+#define FIRST_YEAR 1900
+#define LAST_YEAR  3000
+#define N_YEARS    (LAST_YEAR - FIRST_YEAR + 1)
+#define PATH_LEN   4096
+
+typedef struct {
+    unsigned long long hash;
+    long rows;
+} YearSum;
+
+struct FinTier {
+    char dataFile[PATH_LEN], archive[PATH_LEN];
+    FinPaged *paged;                  // NULL while there is no archive
+    int hotFrom;                      // years before it are archived; 0: none
+    unsigned char resident[N_YEARS];  // archived year complete in the ledger
+    YearSum faulted[N_YEARS];         // what was resident after the last fault or save
+    unsigned long long faults;
+    long long faultedRows;
+};
+
+/* ----------------------- Row hashing ------------------------------ */
+
+static unsigned long long mix64(unsigned long long x) {
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ull;
+    return x ^ (x >> 33);
+}
+
+static unsigned long long fnv(unsigned long long h, const char *s) {
+    for (; *s; ++s) h = (h ^ (unsigned char)*s) * 0x100000001b3ull;
+    return h;
+}
+
+/* Summed per year, so the order of rows does not matter. */
+static unsigned long long row_hash(const Transaction *t) {
+    unsigned long long h = 0xcbf29ce484222325ull;
+    h = (h ^ (unsigned long long)(t->y * 10000 + t->m * 100 + t->d)) * 0x100000001b3ull;
+    h = (h ^ (unsigned long long)t->type) * 0x100000001b3ull;
+    h = (h ^ (unsigned long long)llround(t->amount * 100.0)) * 0x100000001b3ull;
+    h = fnv(fnv(h, t->category) * 0x100000001b3ull, t->note);
+    return mix64(h);
+}
+
+static void year_sums(const Ledger *L, int below, YearSum *sum) {
+    memset(sum, 0, N_YEARS * sizeof(YearSum));
+    int n = ledger_count(L);
+    for (int i = 0; i < n; ++i) {
+        const Transaction *t = ledger_row(L, i);
+        if (t->y >= below) continue;
+        YearSum *s = &sum[t->y - FIRST_YEAR];
+        s->hash += row_hash(t);
+        s->rows++;
+    }
+}
+
+/* ----------------------- Archive file ----------------------------- */
+
+static int max_year(void *ctx, long idx, const Transaction *t) {
+    (void)idx;
+    int *y = ctx;
+    if (t->y > *y) *y = t->y;
+    return 0;
+}
+
+/* (Re)opens the archive; a missing one is an empty archive. */
+static int open_archive(FinTier *t) {
+    fin_paged_close(t->paged);
+    t->paged = NULL;
+    t->hotFrom = 0;
+    if (!(t->paged = fin_paged_open(t->archive, NULL))) return errno == ENOENT;
+    FinPagedStats st;
+    fin_paged_stats(t->paged, &st);
+    int last = st.lastYear;
+    if (st.rows && !last && fin_paged_scan(t->paged, FIRST_YEAR, 1, 1, LAST_YEAR, 12, 31, max_year, &last) < 0)
+        return 0;
+    t->hotFrom = st.hotFrom ? st.hotFrom : st.rows ? last + 1 : 0;
+    return 1;
+}
+
+/* Buffers rows and appends them to a ledger BATCH_CHUNK at a time. */
+typedef struct {
+    Ledger *L;
+    Transaction buf[BATCH_CHUNK];
+    int n, failed;
+    long added;
+    const unsigned char *skip;        // for the archive rewrite: years taken from the ledger
+    YearSum *sums;                    // for a fault: per-year sums of what was added
+} Batch;
+
+static int batch_flush(Batch *b) {
+    if (!b->n || b->failed) return !b->failed;
+    int bad = 0, stored = ledger_insert_batch(b->L, b->buf, b->n, &bad);
+    if (stored < b->n - bad) b->failed = 1;
+    b->added += stored;
+    b->n = 0;
+    return !b->failed;
+}
+
+static int batch_row(void *ctx, long idx, const Transaction *t) {
+    (void)idx;
+    Batch *b = ctx;
+    if (b->skip && b->skip[t->y - FIRST_YEAR]) return 0;
+    if (b->sums) {
+        b->sums[t->y - FIRST_YEAR].hash += row_hash(t);
+        b->sums[t->y - FIRST_YEAR].rows++;
+    }
+    b->buf[b->n++] = *t;
+    return b->n == BATCH_CHUNK && !batch_flush(b);
+}
+
+static int row_key(const Transaction *t) { return t->y * 10000 + t->m * 100 + t->d; }
+
+/* Rebuilds L as its leading archived-year rows merged by date with F's
+   rows (equal dates: L's first), then the rest of L; 1 ok, 0 if memory
+   runs out. */
+static int merge_fault(const FinTier *t, Ledger *L, Ledger *F) {
+    Ledger *N = ledger_new();
+    Batch *b = fin_calloc(MEM_PACK, 1, sizeof(Batch));
+    int ok = N && b;
+    ledger_read_begin(L);
+    ledger_read_begin(F);
+    int n = ledger_count(L), m = ledger_count(F), p = 0, i = 0, j = 0;
+    while (p < n && ledger_row(L, p)->y < t->hotFrom) ++p;
+    if (ok) {
+        b->L = N;
+        ok = ledger_reserve(N, n + m);
+        while (ok && (i < p || j < m)) {
+            const Transaction *x = i < p ? ledger_row(L, i) : NULL, *y = j < m ? ledger_row(F, j) : NULL;
+            int fromL = x && (!y || row_key(x) <= row_key(y));
+            ok = !batch_row(b, 0, fromL ? x : y);
+            if (fromL) ++i; else ++j;
+        }
+        for (i = p; ok && i < n; ++i) ok = !batch_row(b, 0, ledger_row(L, i));
+        ok = ok && batch_flush(b);
+    }
+    ledger_read_end(F);
+    ledger_read_end(L);
+    ok = ok && ledger_replace(L, N);
+    ledger_free(N);
+    fin_free(b);
+    return ok;
+}
+
+/* ----------------------- Public API ------------------------------- */
+
+FinTier *fin_tier_open(const char *dataFile) {
+    if (strlen(dataFile) + sizeof(FIN_ARCHIVE_SUFFIX) > PATH_LEN) { errno = ENAMETOOLONG; return NULL; }
+    FinTier *t = fin_calloc(MEM_PACK, 1, sizeof(FinTier));
+    if (!t) { errno = ENOMEM; return NULL; }
+    strcpy(t->dataFile, dataFile);
+    snprintf(t->archive, PATH_LEN, "%s" FIN_ARCHIVE_SUFFIX, dataFile);
+    if (open_archive(t)) return t;
+    int err = errno;
+    fin_tier_close(t);
+    errno = err;
+    return NULL;
+}
+
+void fin_tier_close(FinTier *t) {
+    if (!t) return;
+    fin_paged_close(t->paged);
+    fin_free(t);
+}
+
+int fin_tier_hot_from(const FinTier *t) { return t->hotFrom; }
+
+/* Rows are gathered first and merged into L in one publish, so a
+   cancelled or failed fault leaves L as it was and the years not
+   resident. */
+int fin_tier_fault(FinTier *t, Ledger *L, int y0, int y1) {
+    if (!t->paged || y0 > y1) return 0;
+    if (y0 < FIRST_YEAR) y0 = FIRST_YEAR;
+    if (y1 >= t->hotFrom) y1 = t->hotFrom - 1;
+    long added = 0;
+    for (int y = y0; y <= y1; ++y) {
+        if (t->resident[y - FIRST_YEAR]) continue;
+        int z = y;                    // [y, z]: a run of years still archived
+        while (z < y1 && !t->resident[z + 1 - FIRST_YEAR]) ++z;
+        unsigned long long t0 = fin_trace_begin();
+        Ledger *tmp = ledger_new();
+        Batch *b = fin_calloc(MEM_PACK, 1, sizeof(Batch));
+        YearSum *sums = fin_calloc(MEM_PACK, N_YEARS, sizeof(YearSum));
+        if (!tmp || !b || !sums) {
+            ledger_free(tmp); fin_free(b); fin_free(sums);
+            errno = ENOMEM;
+            return -1;
+        }
+        b->L = tmp;
+        b->sums = sums;
+        long n = fin_paged_scan(t->paged, y, 1, 1, z, 12, 31, batch_row, b);
+        int ok = n >= 0 && batch_flush(b) && merge_fault(t, L, tmp);
+        if (ok) {
+            for (int q = y; q <= z; ++q) {
+                t->resident[q - FIRST_YEAR] = 1;
+                t->faulted[q - FIRST_YEAR] = sums[q - FIRST_YEAR];
+            }
+            t->faults++;
+            t->faultedRows += b->added;
+            added += b->added;
+        }
+        ledger_free(tmp);
+        fin_free(b);
+        fin_free(sums);
+        fin_trace_end("tier_fault", t0);
+        if (n == FIN_CANCELLED) return FIN_CANCELLED;
+        if (!ok) { if (n >= 0) errno = ENOMEM; return -1; }
+        y = z;
+    }
+    return (int)added;
+}
+
+int fin_tier_fault_all(FinTier *t, Ledger *L) {
+    return fin_tier_fault(t, L, FIRST_YEAR, LAST_YEAR);
+}
+
+/* Copies the rows of L dated in [from, to) to D. */
+static int copy_years(const Ledger *L, Ledger *D, int from, int to) {
+    int n = ledger_count(L), ok = 1;
+    for (int i = 0; i < n && ok; ) {
+        while (i < n && (ledger_row(L, i)->y < from || ledger_row(L, i)->y >= to)) ++i;
+        int j = i;
+        while (j < n && j - i < BATCH_CHUNK && ledger_row(L, j)->y >= from && ledger_row(L, j)->y < to) ++j;
+        if (j > i) ok = ledger_insert_batch(D, ledger_row(L, i), j - i, NULL) == j - i;
+        i = j;
+    }
+    return ok;
+}
+
+int fin_tier_save(FinTier *t, Ledger *L, int hotFrom) {
+    int oldHot = t->hotFrom, newHot = hotFrom > oldHot ? hotFrom : oldHot;
+    if (newHot > LAST_YEAR + 1) newHot = LAST_YEAR + 1;
+    YearSum *sums = fin_calloc(MEM_PACK, N_YEARS, sizeof(YearSum));
+    if (!sums) { errno = ENOMEM; return 0; }
+
+    // Additions to archived years that are not resident: merge them first.
+    ledger_read_begin(L);
+    year_sums(L, oldHot, sums);
+    ledger_read_end(L);
+    for (int y = FIRST_YEAR; y < oldHot; ++y) {
+        if (!sums[y - FIRST_YEAR].rows || t->resident[y - FIRST_YEAR]) continue;
+        int r = fin_tier_fault(t, L, y, y);
+        if (r < 0) { fin_free(sums); return 0; }
+    }
+
+    ledger_read_begin(L);
+    year_sums(L, newHot, sums);
+    int changed = 0, cold = 0;
+    for (int y = FIRST_YEAR; y < newHot; ++y) {
+        const YearSum *s = &sums[y - FIRST_YEAR], *f = &t->faulted[y - FIRST_YEAR];
+        cold |= s->rows > 0;
+        if (y >= oldHot) changed |= s->rows > 0;
+        else if (t->resident[y - FIRST_YEAR]) changed |= s->rows != f->rows || s->hash != f->hash;
+    }
+    changed |= t->paged && newHot > oldHot;       // record the new split in the header
+
+    int ok = 1;
+    if (changed) {
+        // Archive: resident and newly archived years from L, the rest as they were.
+        unsigned long long t0 = fin_trace_begin();
+        char tmpName[PATH_LEN + 8];
+        snprintf(tmpName, sizeof(tmpName), "%s.tmp", t->archive);
+        unsigned char *fromL = fin_calloc(MEM_PACK, N_YEARS, 1);
+        Ledger *A = ledger_new();
+        Batch *b = fin_calloc(MEM_PACK, 1, sizeof(Batch));
+        ok = fromL && A && b;
+        if (ok) {
+            for (int y = FIRST_YEAR; y < newHot; ++y)
+                fromL[y - FIRST_YEAR] = y >= oldHot || t->resident[y - FIRST_YEAR];
+            b->L = A;
+            b->skip = fromL;
+            ok = copy_years(L, A, FIRST_YEAR, newHot)
+                 && (!t->paged || fin_paged_scan(t->paged, FIRST_YEAR, 1, 1, LAST_YEAR, 12, 31, batch_row, b) >= 0)
+                 && batch_flush(b) && ledger_sort(A, SORT_DATE) == 1
+                 && ledger_save_archive(A, tmpName, newHot) && rename(tmpName, t->archive) == 0;
+            if (!ok) remove(tmpName);
+        }
+        fin_free(b);
+        ledger_free(A);
+        if (ok) {
+            for (int y = FIRST_YEAR; y < newHot; ++y) {
+                if (!fromL[y - FIRST_YEAR]) continue;
+                t->resident[y - FIRST_YEAR] = 1;
+                t->faulted[y - FIRST_YEAR] = sums[y - FIRST_YEAR];
+            }
+            int err = errno;
+            ok = open_archive(t);
+            if (ok && t->hotFrom < newHot) t->hotFrom = newHot;   // no rows in the last years moved
+            errno = ok ? err : errno;
+        }
+        fin_free(fromL);
+        fin_trace_end("tier_archive", t0);
+    }
+
+    // Data file: the hot years only.
+    if (ok && !cold) {
+        ok = ledger_save(L, t->dataFile);
+    } else if (ok) {
+        Ledger *H = ledger_new();
+        ok = H && copy_years(L, H, newHot, LAST_YEAR + 1) && ledger_save(H, t->dataFile);
+        ledger_free(H);
+    }
+    ledger_read_end(L);
+    fin_free(sums);
+    return ok;
+}
+
+void fin_tier_stats(FinTier *t, FinTierStats *st) {
+    memset(st, 0, sizeof(*st));
+    st->hotFrom = t->hotFrom;
+    if (t->paged) {
+        FinPagedStats ps;
+        fin_paged_stats(t->paged, &ps);
+        st->archivedRows = ps.rows;
+        st->archiveBytes = ps.fileBytes;
+        st->archiveBlocks = ps.blocks;
+        st->blocksRead = ps.blocksRead;
+        st->blocksSkipped = ps.blocksSkipped;
+    }
+    for (int y = FIRST_YEAR; y < t->hotFrom && y <= LAST_YEAR; ++y) {
+        if (!t->resident[y - FIRST_YEAR] || !t->faulted[y - FIRST_YEAR].rows) continue;
+        st->residentYears++;
+        st->residentRows += t->faulted[y - FIRST_YEAR].rows;
+    }
+    st->faults = t->faults;
+    st->faultedRows = t->faultedRows;
+}
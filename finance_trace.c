@@ -0,0 +1,178 @@
+/*
+  finance_trace.c - timeline tracing in Chrome trace-event format (see
+  finance.h).
+
+  Each thread records spans into its own ring of spans; only
+  the owner writes a ring, publishing each event with a release store
+  of head, so recording takes no lock. When a ring is full the oldest
+  events are overwritten. A thread claims a ring on its first span and
+  gives it back when it exits (the import pipeline starts fresh stage
+  threads per load), and the next new thread reuses it; every claim
+  gets a new trace tid, so spans never move between threads. Rings live
+  for the life of the process, so the dump still has the spans of
+  threads that have ended.
+
+  Thread names live in a small table under a mutex: they change only
+  when a thread starts, never on the recording path.
+*/
+
+#include "finance.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define DEFAULT_EVENTS (1 << 16)     // spans kept per thread
+#define NAME_LEN       24
+
+typedef struct {
+    const char *name;             // static string
+    unsigned long long t0, t1;    // monotonic ns
+    int tid;
+} Span;
+
+typedef struct Ring {
+    struct Ring *next;            // registry list, push-only
+    atomic_int owned;
+    int tid;                      // of the current owner
+    unsigned long cap;            // power of two
+    atomic_ulong head;            // spans ever written
+    Span *ev;
+} Ring;
+
+typedef struct {
+    int tid;
+    char name[NAME_LEN];
+} ThreadName;
+
+static atomic_int tracing = 0;
+static atomic_int nextTid = 1;
+static unsigned long ringCap = DEFAULT_EVENTS;
+static unsigned long long traceStart;
+static _Atomic(Ring *) rings = NULL;
+
+static pthread_mutex_t namesMu = PTHREAD_MUTEX_INITIALIZER;
+static ThreadName *names;
+static int nNames, capNames;
+
+static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t ringKey;
+static _Thread_local Ring *myRing;
+static _Thread_local char myName[NAME_LEN];
+
+/* ----------------------- Rings ------------------------------------ */
+
+static void release_ring(void *r) {
+    atomic_store(&((Ring *)r)->owned, 0);
+}
+
+static void make_key(void) { pthread_key_create(&ringKey, release_ring); }
+
+static void set_name(int tid, const char *name) {
+    pthread_mutex_lock(&namesMu);
+    int k = 0;
+    while (k < nNames && names[k].tid != tid) k++;
+    if (k == nNames && nNames == capNames) {
+        int cap = capNames ? capNames * 2 : 32;
+        ThreadName *p = fin_realloc(MEM_TRACE, names, (size_t)cap * sizeof(ThreadName));
+        if (p) { names = p; capNames = cap; }
+    }
+    if (k < capNames) {
+        names[k].tid = tid;
+        strncpy(names[k].name, name, NAME_LEN - 1);
+        names[k].name[NAME_LEN - 1] = '\0';
+        if (k == nNames) nNames++;
+    }
+    pthread_mutex_unlock(&namesMu);
+}
+
+static Ring *claim_ring(void) {
+    Ring *r;
+    for (r = atomic_load(&rings); r; r = r->next) {
+        int unowned = 0;
+        if (atomic_compare_exchange_strong(&r->owned, &unowned, 1)) break;
+    }
+    if (!r) {
+        r = fin_calloc(MEM_TRACE, 1, sizeof(Ring));
+        Span *ev = r ? fin_malloc(MEM_TRACE, ringCap * sizeof(Span)) : NULL;
+        if (!ev) { fin_free(r); return NULL; }
+        r->ev = ev;
+        r->cap = ringCap;
+        atomic_init(&r->owned, 1);
+        atomic_init(&r->head, 0);
+        r->next = atomic_load(&rings);
+        while (!atomic_compare_exchange_weak(&rings, &r->next, r)) {}
+    }
+    r->tid = atomic_fetch_add(&nextTid, 1);
+    pthread_once(&keyOnce, make_key);
+    pthread_setspecific(ringKey, r);
+    if (myName[0]) set_name(r->tid, myName);
+    return r;
+}
+
+/* ----------------------- Recording -------------------------------- */
+
+int fin_trace_start(long eventsPerThread) {
+    if (atomic_load(&tracing)) return 1;
+    unsigned long cap = 1024;
+    while (eventsPerThread > 0 && cap < (unsigned long)eventsPerThread && cap < (1ul << 24)) cap *= 2;
+    if (eventsPerThread > 0) ringCap = cap;
+    traceStart = fin_clock_ns();
+    atomic_store(&tracing, 1);
+    return 1;
+}
+
+int fin_tracing(void) {
+    return atomic_load_explicit(&tracing, memory_order_relaxed);
+}
+
+unsigned long long fin_trace_begin(void) {
+    return fin_tracing() ? fin_clock_ns() : 0;
+}
+
+void fin_trace_end(const char *name, unsigned long long t0) {
+    if (!t0 || !fin_tracing()) return;
+    unsigned long long t1 = fin_clock_ns();
+    Ring *r = myRing;
+    if (!r && !(r = myRing = claim_ring())) return;
+    unsigned long h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    r->ev[h & (r->cap - 1)] = (Span){ name, t0, t1, r->tid };
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+void fin_trace_thread_name(const char *name) {
+    strncpy(myName, name, NAME_LEN - 1);
+    if (myRing) set_name(myRing->tid, myName);
+}
+
+/* ----------------------- Output ----------------------------------- */
+
+int fin_trace_write_json(FILE *f) {
+    int first = 1;
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    pthread_mutex_lock(&namesMu);
+    for (int k = 0; k < nNames; ++k, first = 0)
+        fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                first ? "" : ",", names[k].tid, names[k].name);
+    pthread_mutex_unlock(&namesMu);
+    for (Ring *r = atomic_load(&rings); r; r = r->next) {
+        unsigned long h = atomic_load_explicit(&r->head, memory_order_acquire);
+        unsigned long from = h > r->cap ? h - r->cap : 0;
+        for (unsigned long i = from; i < h; ++i, first = 0) {
+            const Span *s = &r->ev[i & (r->cap - 1)];
+            unsigned long long t0 = s->t0 > traceStart ? s->t0 : traceStart;
+            fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    first ? "" : ",", s->name, s->tid,
+                    (double)(t0 - traceStart) / 1e3, (double)(s->t1 - t0) / 1e3);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    return !ferror(f);
+}
+
+/* Rings are kept (other threads may still hold theirs), so a dump after
+   stopping still has every span. */
+void fin_trace_stop(void) {
+    atomic_store(&tracing, 0);
+}
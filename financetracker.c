@@ -1,37 +1,57 @@
 /*
-  Personal Finance Tracker (C, single-file)
+  Personal Finance Tracker (C)
   Features:
     - Store transactions in an array of structs (income/expense)
     - Add/list/sort/search/filter
     - Save to and load from a file (plain text, |-separated)
     - ASCII bar chart of monthly EXPENSE spending for a chosen year
+    - Results as a table, CSV, JSON Lines or fixed-width binary records
 
-  Compile:  gcc -std=c11 -O2 finance_tracker.c -o finance_tracker
-  Run:      ./finance_tracker
+  This file is the interactive menu and command-line front end; the
+  engine lives in finance.c / finance_out.c behind finance.h and builds
+  as the static library libfinance.a.
+
+  Compile:  make                    (libfinance.a + finance_tracker)
+            or: gcc -std=c11 -O2 -pthread financetracker.c finance.c finance_out.c finance_daemon.c finance_pool.c finance_gen.c finance_stats.c finance_mem.c finance_trace.c finance_replay.c finance_lsm.c finance_pack.c finance_cache.c finance_tier.c finance_ext.c -o finance_tracker -lm
+  Run:      ./finance_tracker              (interactive menu)
+            ./finance_tracker help         (non-interactive subcommands)
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
 
-#define MAX_TRANSACTIONS 2000
-#define STR_LEN 64
-#define NOTE_LEN 128
-#define FILE_NAME "finance_data.txt"
-
-typedef enum { INCOME = 0, EXPENSE = 1 } TxType;
+#include "finance.h"
 
-typedef struct {
-    int y, m, d;                  // date: year, month, day
-    TxType type;                  // 0 income, 1 expense
-    char category[STR_LEN];       // e.g., Food, Rent, Salary
-    double amount;                // positive amount
-    char note[NOTE_LEN];          // optional note
-} Transaction;
+#define FILE_NAME "finance_data.txt"
 
-static Transaction txs[MAX_TRANSACTIONS];
-static int txCount = 0;
+static Ledger *ledger = NULL;
+static Writer *out = NULL;           // stdout writer in the current format
+static RowSet hits = {0};            // reused across queries
+static const char *dataFile = FILE_NAME;
+static const char *sockPath = NULL;  // -s: forward commands to a daemon
+static double opTimeout = 0.0;       // -t: seconds per long operation, 0 = none
+static const char *statsFile = NULL; // -S: write operation statistics here at exit
+static const char *traceFile = NULL; // -T: record a trace, written here at exit
+static const char *recordFile = NULL; // -R: append the session's operations here
+static FinRecorder *recorder = NULL;
+static FinBuf recReq = {0};          // payload of the operation being recorded
+static int pageOffset = 0;           // -p: first result row to print
+static int pageLimit = -1;           // -p: rows to print, -1 = all
+static FinTier *tier = NULL;         // archive next to dataFile, if any (or -A)
+static int hotYears = 0;             // -A: years kept in the data file on save, 0 = unchanged
+static int rearchive = 0;            // archive YEARS: move the split even if the archive has one
+static long long extBudget = 0;      // -M: bytes for external sorts and groupings, 0 = load instead
 
 /* ----------------------- Utility I/O helpers ----------------------- */
 
@@ -69,28 +89,280 @@ static double read_double(const char *prompt, double minV) {
     }
 }
 
-static int valid_date(int y, int m, int d) {
-    if (y < 1900 || y > 3000) return 0;
-    if (m < 1 || m > 12) return 0;
-    int mdays[] = {0,31,28,31,30,31,30,31,31,30,31,30,31};
-    int leap = ( (y%4==0 && y%100!=0) || (y%400==0) );
-    if (leap) mdays[2] = 29;
-    if (d < 1 || d > mdays[m]) return 0;
-    return 1;
+/* ----------------------- Background operations ------------------ */
+/* Long menu operations run on a worker thread under a FinControl. The
+   menu thread meanwhile shows progress on stderr and turns Ctrl-C into
+   a cancel request. The engine stops at its next checkpoint; sorts and
+   loads publish nothing partial, so an abort never loses data. Outside
+   an operation Ctrl-C still ends the program. */
+
+static _Atomic(FinControl *) activeCtl = NULL;  // what Ctrl-C cancels
+static pthread_mutex_t opLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t opDone;        // on CLOCK_MONOTONIC; see op_init()
+static int progressShown = 0;        // guarded by opLock; -1 once output began
+
+static void on_sigint(int sig) {
+    FinControl *c = atomic_load(&activeCtl);
+    if (!c) { signal(sig, SIG_DFL); raise(sig); return; }
+    fin_control_cancel(c);
+    signal(sig, on_sigint);
 }
 
-/* ----------------------- Core operations -------------------------- */
+/* Called before an operation writes results: erases the progress line
+   and keeps it from coming back over the output. */
+static void op_output_begin(void) {
+    pthread_mutex_lock(&opLock);
+    if (progressShown > 0) fprintf(stderr, "\r%60s\r", "");
+    progressShown = -1;
+    pthread_mutex_unlock(&opLock);
+}
 
-static void add_transaction(void) {
-    if (txCount >= MAX_TRANSACTIONS) {
-        printf("Storage full.\n");
-        return;
+typedef struct {
+    int (*fn)(void *);
+    void *arg;
+    int result;
+    FinControl *ctl;
+    int done;                        // guarded by opLock
+} BgOp;
+
+static void *op_main(void *p) {
+    BgOp *op = p;
+    fin_control_attach(op->ctl);
+    op->result = op->fn(op->arg);
+    pthread_mutex_lock(&opLock);
+    op->done = 1;
+    pthread_cond_signal(&opDone);
+    pthread_mutex_unlock(&opLock);
+    return NULL;
+}
+
+static void show_progress(const BgOp *op, const char *what) {
+    long done, total;
+    fin_control_progress(op->ctl, &done, &total);
+    if (total <= 0 || !isatty(STDERR_FILENO)) return;
+    int pct = done >= total ? 100 : (int)(100.0 * (double)done / (double)total);
+    fprintf(stderr, "\r%s... %3d%%  (Ctrl-C cancels)", what, pct);
+    progressShown = 1;
+}
+
+/* Runs fn(arg) on a worker thread and waits for it, showing progress
+   after the first 300 ms. Returns fn's result; reports and returns
+   FIN_CANCELLED if it was cancelled or timed out. */
+static int run_op(const char *what, int (*fn)(void *), void *arg) {
+    BgOp op = { fn, arg, 0, fin_control_new(opTimeout), 0 };
+    pthread_t tid;
+    if (!op.ctl) { printf("Out of memory.\n"); return -1; }
+    progressShown = 0;
+    atomic_store(&activeCtl, op.ctl);
+    if (pthread_create(&tid, NULL, op_main, &op) != 0) {
+        FinControl *prev = fin_control_attach(op.ctl);  // no thread: run it here
+        op.result = fn(arg);
+        fin_control_attach(prev);
+    } else {
+        pthread_mutex_lock(&opLock);
+        for (int ticks = 1; !op.done; ++ticks) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            ts.tv_nsec += 100000000L;
+            if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+            pthread_cond_timedwait(&opDone, &opLock, &ts);
+            if (!op.done && ticks >= 3 && progressShown >= 0) show_progress(&op, what);
+        }
+        if (progressShown > 0) fprintf(stderr, "\r%60s\r", "");
+        pthread_mutex_unlock(&opLock);
+        pthread_join(tid, NULL);
+    }
+    atomic_store(&activeCtl, NULL);
+    if (op.result == FIN_CANCELLED) {
+        if (fin_control_status(op.ctl) == FIN_STOP_TIMEOUT) printf("\nTimed out after %g s.\n", opTimeout);
+        else printf("\nCancelled.\n");
+    }
+    fin_control_free(op.ctl);
+    return op.result;
+}
+
+/* ----------------------- Tiered storage ------------------------- */
+
+/* Brings archived years y0..y1 into the ledger before an operation
+   reads them; 1 ok, 0 after reporting a failure, or FIN_CANCELLED. */
+static int need_years(int y0, int y1) {
+    if (!tier) return 1;
+    int r = fin_tier_fault(tier, ledger, y0, y1);
+    if (r >= 0 || r == FIN_CANCELLED) return r >= 0 ? 1 : r;
+    fprintf(stderr, "Cannot read the archive of '%s': %s\n", dataFile, strerror(errno));
+    return 0;
+}
+
+static int need_all(void) { return need_years(1900, 3000); }
+
+/* No rows in the ledger or its archive. */
+static int ledger_empty(void) {
+    if (ledger_count(ledger)) return 0;
+    if (!tier) return 1;
+    FinTierStats st;
+    fin_tier_stats(tier, &st);
+    return st.archivedRows == 0;
+}
+
+/* Saves the hot years to dataFile and the rest to its archive. The
+   split is the archive's own unless there is none yet or the archive
+   command asks for a new one, so the same -A gives the same files
+   whatever the date of the save. */
+static int save_ledger(void) {
+    if (!tier) return ledger_save(ledger, dataFile);
+    int hotFrom = 0;
+    if (hotYears && (rearchive || !fin_tier_hot_from(tier))) {
+        time_t now = time(NULL);
+        struct tm *tm = localtime(&now);
+        hotFrom = (tm ? tm->tm_year + 1900 : 1970) - hotYears + 1;
+    }
+    return fin_tier_save(tier, ledger, hotFrom);
+}
+
+/* Opens the archive after a (re)load; nothing in it is resident yet. */
+static int open_tier(void) {
+    char archive[4096];
+    fin_tier_close(tier);
+    tier = NULL;
+    snprintf(archive, sizeof(archive), "%s" FIN_ARCHIVE_SUFFIX, dataFile);
+    if (!hotYears && access(archive, F_OK) != 0) return 1;
+    if ((tier = fin_tier_open(dataFile))) return 1;
+    fprintf(stderr, "Cannot open '%s': %s\n", archive, errno == EINVAL ? "not a packed ledger, or damaged" : strerror(errno));
+    return 0;
+}
+
+static void print_tier(FILE *f) {
+    FinTierStats st;
+    fin_tier_stats(tier, &st);
+    if (!st.hotFrom) { fprintf(f, "Archive:         empty\n"); return; }
+    fprintf(f, "Archive:         %lld row(s) before %d in %lld bytes (%ld blocks)\n",
+            st.archivedRows, st.hotFrom, st.archiveBytes, st.archiveBlocks);
+    fprintf(f, "Resident:        %d archived year(s), %lld row(s); %llu fault(s) read %llu block(s), skipped %llu\n",
+            st.residentYears, st.residentRows, st.faults, st.blocksRead, st.blocksSkipped);
+}
+
+/* ----------------------- Session recording ---------------------- */
+
+/* Appends recReq to the -R log as a request for op and clears it. */
+static void record(FinOp op) {
+    if (recorder && !fin_record(recorder, op, recReq.data, recReq.len)) {
+        fprintf(stderr, "Recording to '%s' failed; recording stopped.\n", recordFile);
+        fin_record_close(recorder);
+        recorder = NULL;
+    }
+    recReq.len = 0;
+}
+
+static void record_add(int y, int m, int d, TxType type, const char *category, double amount, const char *note) {
+    Transaction t = {0};
+    unsigned char rec[BIN_ROW_LEN];
+    t.y = y; t.m = m; t.d = d;
+    t.type = type;
+    t.amount = amount;
+    strncpy(t.category, category, STR_LEN-1);
+    strncpy(t.note, note, NOTE_LEN-1);
+    fin_encode_row(rec, 0, &t);
+    finbuf_put(&recReq, rec, BIN_ROW_LEN);
+    record(OP_ADD);
+}
+
+/* The slice [*lo, *hi) of n result rows that -p selects. */
+static void page_of(int n, int *lo, int *hi) {
+    *lo = pageOffset < n ? pageOffset : n;
+    *hi = pageLimit >= 0 && pageLimit < n - *lo ? *lo + pageLimit : n;
+}
+
+static void page_note(int lo, int hi, int n) {
+    if (hi == lo && n) fprintf(stderr, "No rows at offset %d of %d.\n", lo, n);
+    else if (hi - lo < n) fprintf(stderr, "Rows %d-%d of %d.\n", lo + 1, hi, n);
+}
+
+/* Streams a query result; returns its row count (0 on allocation
+   failure) or FIN_CANCELLED. Call inside the read section that ran the
+   query so ids match rows. Queries only collect row ids from the
+   encoded columns; wide rows are read for the printed page alone. */
+static int emit_hits(int found) {
+    if (found == FIN_CANCELLED) return found;
+    if (found < 0) { fprintf(stderr, "Out of memory.\n"); return 0; }
+    int lo, hi;
+    page_of(hits.count, &lo, &hi);
+    RowSet page = { hits.ids + lo, hi - lo, hi - lo };
+    op_output_begin();
+    writer_begin_rows(out);
+    writer_rowset(out, ledger, &page);
+    writer_end(out);
+    page_note(lo, hi, hits.count);
+    return fin_checkpoint(0) ? FIN_CANCELLED : found;
+}
+
+static int search_text(SearchField field, const char *q) {
+    int r = need_all();
+    if (r != 1) return r;
+    finbuf_put_le(&recReq, field, 1);
+    finbuf_put(&recReq, q, strlen(q));
+    record(OP_SEARCH_TEXT);
+    ledger_read_begin(ledger);
+    int n = emit_hits(ledger_search_text(ledger, field, q, &hits));
+    ledger_read_end(ledger);
+    return n;
+}
+
+static int search_date(int y, int m, int d) {
+    int r = need_years(y, y);
+    if (r != 1) return r;
+    finbuf_put_le(&recReq, (unsigned)y, 2);
+    finbuf_put_le(&recReq, (unsigned)m, 1);
+    finbuf_put_le(&recReq, (unsigned)d, 1);
+    record(OP_SEARCH_DATE);
+    ledger_read_begin(ledger);
+    int n = emit_hits(ledger_search_date(ledger, y, m, d, &hits));
+    ledger_read_end(ledger);
+    return n;
+}
+
+static int filter_expenses(double thr) {
+    int r = need_all();
+    if (r != 1) return r;
+    finbuf_put_f64(&recReq, thr);
+    record(OP_FILTER);
+    ledger_read_begin(ledger);
+    int n = emit_hits(ledger_filter_expenses(ledger, thr, &hits));
+    ledger_read_end(ledger);
+    return n;
+}
+
+/* Streams every row of one snapshot to w (only the -p page when w is
+   stdout; exports get everything); 1 ok, 0 on I/O error, or
+   FIN_CANCELLED. */
+static int write_all_rows(Writer *w) {
+    int r = need_all();
+    if (r != 1) return r;
+    unsigned long long t0 = w == out ? fin_stat_begin() : 0;   // exports record themselves
+    if (w == out) record(OP_LIST);
+    ledger_read_begin(ledger);
+    int n = ledger_count(ledger), lo = 0, hi = n;
+    if (w == out) page_of(n, &lo, &hi);
+    fin_progress_begin(hi - lo);
+    if (w == out) op_output_begin();
+    writer_begin_rows(w);
+    for (int i = lo; i < hi; ++i) {
+        if ((i - lo) % 4096 == 0 && i > lo && fin_checkpoint(4096)) break;
+        writer_row(w, i, ledger_row(ledger, i));
     }
+    int ok = writer_end(w);
+    ledger_read_end(ledger);
+    if (w == out) page_note(lo, hi, n);
+    fin_stat_end(STAT_LIST, t0, n, hi - lo, 0, 0);
+    return fin_checkpoint(0) ? FIN_CANCELLED : ok;
+}
+
+/* ----------------------- Core operations -------------------------- */
 
+static void add_transaction(void) {
     int y = read_int("Year (e.g., 2025): ", 1900, 3000);
     int m = read_int("Month (1-12): ", 1, 12);
     int d = read_int("Day (1-31): ", 1, 31);
-    if (!valid_date(y, m, d)) {
+    if (!fin_valid_date(y, m, d)) {
         printf("Invalid date.\n");
         return;
     }
@@ -106,191 +378,105 @@ static void add_transaction(void) {
 
     char note[NOTE_LEN];
     read_line("Note (optional, no '|' please): ", note, sizeof(note));
-    // Replace '|' if present to keep file format simple
-    for (char *p = note; *p; ++p) if (*p == '|') *p = '/';
-    for (char *p = category; *p; ++p) if (*p == '|') *p = '/';
-
-    txs[txCount++] = (Transaction){ y, m, d, (TxType)t, {0}, amount, {0} };
-    strncpy(txs[txCount-1].category, category, STR_LEN-1);
-    strncpy(txs[txCount-1].note, note, NOTE_LEN-1);
 
-    printf("Transaction added. Total = %d\n", txCount);
-}
-
-static void print_header(void) {
-    printf("Idx  Date        Type     Category               Amount      Note\n");
-    printf("---- ----------- -------- ---------------------- ----------- ------------------------------\n");
+    if (!ledger_add(ledger, y, m, d, (TxType)t, category, amount, note)) {
+        printf("Out of memory.\n");
+        return;
+    }
+    record_add(y, m, d, (TxType)t, category, amount, note);
+    printf("Transaction added. Total = %d\n", ledger_count(ledger));
 }
 
-static void print_transaction(int i, const Transaction *t) {
-    printf("%-4d %04d-%02d-%02d %-8s %-22s %11.2f %s\n",
-           i, t->y, t->m, t->d, t->type==INCOME?"INCOME":"EXPENSE",
-           t->category, t->amount, t->note);
+static int op_list(void *arg) {
+    (void)arg;
+    return write_all_rows(out);
 }
 
 static void list_all(void) {
-    if (txCount == 0) { printf("No transactions.\n"); return; }
-    print_header();
-    for (int i = 0; i < txCount; ++i) print_transaction(i, &txs[i]);
+    if (ledger_empty()) { fprintf(stderr, "No transactions.\n"); return; }
+    run_op("Listing", op_list, NULL);
 }
 
 /* ----------------------- Sorting ---------------------------------- */
 
-static int cmp_date(const void *a, const void *b) {
-    const Transaction *x = (const Transaction*)a, *y = (const Transaction*)b;
-    if (x->y != y->y) return (x->y < y->y) ? -1 : 1;
-    if (x->m != y->m) return (x->m < y->m) ? -1 : 1;
-    if (x->d != y->d) return (x->d < y->d) ? -1 : 1;
-    return 0;
-}
-
-static int cmp_amount_desc(const void *a, const void *b) {
-    const Transaction *x = (const Transaction*)a, *y = (const Transaction*)b;
-    if (x->amount < y->amount) return 1;
-    if (x->amount > y->amount) return -1;
-    return 0;
+static int op_sort(void *arg) {
+    int r = need_all();
+    return r == 1 ? ledger_sort(ledger, *(SortKey *)arg) : r;
 }
 
 static void sort_menu(void) {
-    if (txCount == 0) { printf("No transactions to sort.\n"); return; }
+    if (ledger_empty()) { fprintf(stderr, "No transactions to sort.\n"); return; }
     printf("Sort by:\n  1) Date (ascending)\n  2) Amount (descending)\n");
-    int c = read_int("Choose: ", 1, 2);
-    if (c == 1) qsort(txs, txCount, sizeof(Transaction), cmp_date);
-    else        qsort(txs, txCount, sizeof(Transaction), cmp_amount_desc);
-    printf("Sorted.\n");
+    SortKey key = read_int("Choose: ", 1, 2) == 1 ? SORT_DATE : SORT_AMOUNT_DESC;
+    int r = run_op("Sorting", op_sort, &key);
+    if (r == 1) {
+        finbuf_put_le(&recReq, key, 1);
+        record(OP_SORT);
+        printf("Sorted.\n");
+    }
+    else if (r == 0) printf("Out of memory.\n");
+    else if (r == FIN_CANCELLED) printf("Order unchanged.\n");
 }
 
 /* ----------------------- Searching/Filtering ---------------------- */
 
-static void to_lower_str(char *s) {
-    for (; *s; ++s) *s = (char)tolower((unsigned char)*s);
-}
+/* Parameters of a menu query run by run_op(). */
+typedef struct {
+    SearchField field;
+    char q[STR_LEN];
+    int y, m, d;
+    double thr;
+} QueryArgs;
+
+static int op_search_text(void *arg) { QueryArgs *a = arg; return search_text(a->field, a->q); }
+static int op_search_date(void *arg) { QueryArgs *a = arg; return search_date(a->y, a->m, a->d); }
+static int op_filter(void *arg) { QueryArgs *a = arg; return filter_expenses(a->thr); }
 
 static void search_menu(void) {
-    if (txCount == 0) { printf("No data.\n"); return; }
+    if (ledger_empty()) { fprintf(stderr, "No data.\n"); return; }
     printf("Search by:\n  1) Category contains text\n  2) Note contains text\n  3) Date equals (YYYY-MM-DD)\n");
     int c = read_int("Choose: ", 1, 3);
+    QueryArgs a = {0};
 
     if (c == 1 || c == 2) {
-        char q[STR_LEN];
-        read_line("Enter text: ", q, sizeof(q));
-        char ql[STR_LEN]; strncpy(ql, q, sizeof(ql)); ql[STR_LEN-1] = 0; to_lower_str(ql);
-
-        int found = 0;
-        print_header();
-        for (int i = 0; i < txCount; ++i) {
-            char hay[NOTE_LEN];
-            if (c == 1) {
-                strncpy(hay, txs[i].category, sizeof(hay)); hay[NOTE_LEN-1] = 0;
-            } else {
-                strncpy(hay, txs[i].note, sizeof(hay)); hay[NOTE_LEN-1] = 0;
-            }
-            to_lower_str(hay);
-            if (strstr(hay, ql)) { print_transaction(i, &txs[i]); found = 1; }
-        }
-        if (!found) printf("No matches.\n");
+        a.field = (SearchField)c;
+        read_line("Enter text: ", a.q, sizeof(a.q));
+        if (!run_op("Searching", op_search_text, &a)) fprintf(stderr, "No matches.\n");
     } else {
-        int y = read_int("Year: ", 1900, 3000);
-        int m = read_int("Month: ", 1, 12);
-        int d = read_int("Day: ", 1, 31);
-        if (!valid_date(y,m,d)) { printf("Invalid date.\n"); return; }
-        int found = 0;
-        print_header();
-        for (int i = 0; i < txCount; ++i) {
-            if (txs[i].y==y && txs[i].m==m && txs[i].d==d) {
-                print_transaction(i, &txs[i]);
-                found = 1;
-            }
-        }
-        if (!found) printf("No matches.\n");
+        a.y = read_int("Year: ", 1900, 3000);
+        a.m = read_int("Month: ", 1, 12);
+        a.d = read_int("Day: ", 1, 31);
+        if (!fin_valid_date(a.y, a.m, a.d)) { printf("Invalid date.\n"); return; }
+        if (!run_op("Searching", op_search_date, &a)) fprintf(stderr, "No matches.\n");
     }
 }
 
 static void filter_expenses_over(void) {
-    if (txCount == 0) { printf("No data.\n"); return; }
-    double thr = read_double("Show EXPENSES over amount: ", 0.0);
-    int found = 0;
-    print_header();
-    for (int i = 0; i < txCount; ++i) {
-        if (txs[i].type == EXPENSE && txs[i].amount > thr) {
-            print_transaction(i, &txs[i]);
-            found = 1;
-        }
-    }
-    if (!found) printf("No expenses above that amount.\n");
-}
-
-/* ----------------------- Save & Load ------------------------------ */
-/* Format: y|m|d|type|category|amount|note\n
-   type: 0 income, 1 expense
-   '|' in text replaced with '/' on input
-*/
-
-static int save_to_file(const char *fname) {
-    FILE *f = fopen(fname, "w");
-    if (!f) { perror("fopen"); return 0; }
-    for (int i = 0; i < txCount; ++i) {
-        fprintf(f, "%d|%d|%d|%d|%s|%.2f|%s\n",
-            txs[i].y, txs[i].m, txs[i].d, txs[i].type,
-            txs[i].category, txs[i].amount, txs[i].note);
-    }
-    fclose(f);
-    return 1;
-}
-
-static int load_from_file(const char *fname) {
-    FILE *f = fopen(fname, "r");
-    if (!f) { perror("fopen"); return 0; }
-    int n = 0;
-    char line[512];
-    while (fgets(line, sizeof(line), f)) {
-        Transaction t = {0};
-        char category[STR_LEN] = {0};
-        char note[NOTE_LEN] = {0};
-        int typeInt = 0;
-        double amount = 0.0;
-
-        // Parse | separated, note/category may have spaces
-        // Using sscanf with scansets to stop at '|' ( %[^\|] )
-        int matched = sscanf(line,
-            "%d|%d|%d|%d|%63[^|]|%lf|%127[^\n]",
-            &t.y, &t.m, &t.d, &typeInt, category, &amount, note);
-
-        if (matched >= 6) {
-            t.type = (typeInt==1)?EXPENSE:INCOME;
-            strncpy(t.category, category, STR_LEN-1);
-            t.amount = amount;
-            if (matched == 7) strncpy(t.note, note, NOTE_LEN-1); else t.note[0] = '\0';
-            if (valid_date(t.y,t.m,t.d) && t.amount >= 0.0) {
-                if (n < MAX_TRANSACTIONS) txs[n++] = t;
-            }
-        }
-    }
-    fclose(f);
-    txCount = n;
-    return 1;
+    if (ledger_empty()) { fprintf(stderr, "No data.\n"); return; }
+    QueryArgs a = {0};
+    a.thr = read_double("Show EXPENSES over amount: ", 0.0);
+    if (!run_op("Filtering", op_filter, &a)) fprintf(stderr, "No expenses above that amount.\n");
 }
 
 /* ----------------------- ASCII Monthly Chart ---------------------- */
 
-static void monthly_spending_chart(void) {
-    if (txCount == 0) { printf("No data.\n"); return; }
-    int year = read_int("Enter year for EXPENSE chart: ", 1900, 3000);
-    double sums[13] = {0.0}; // 1..12
-    for (int i = 0; i < txCount; ++i) {
-        if (txs[i].type == EXPENSE && txs[i].y == year) {
-            if (txs[i].m >=1 && txs[i].m <=12) sums[txs[i].m] += txs[i].amount;
+/* Prints the chart (or its aggregates in a machine format). */
+static void print_chart(int year, const double sums[13]) {
+    if (writer_format(out) != FMT_TABLE) {
+        writer_begin_agg(out, "month", "expense");
+        for (int m = 1; m <= 12; ++m) {
+            char key[BIN_AGG_KEYLEN];
+            snprintf(key, sizeof(key), "%04d-%02d", year, m);
+            writer_agg(out, key, sums[m]);
         }
+        writer_end(out);
+        return;
     }
+
     // Find max to scale bars
     double maxv = 0.0;
     for (int m = 1; m <= 12; ++m) if (sums[m] > maxv) maxv = sums[m];
 
-    if (maxv == 0.0) {
-        printf("No expenses recorded for %d.\n", year);
-        return;
-    }
-
     const char *mon[13] = {"","Jan","Feb","Mar","Apr","May","Jun","Jul","Aug","Sep","Oct","Nov","Dec"};
     int maxWidth = 50; // characters
     printf("\nMonthly Expense Chart for %d (each # ~ scaled)\n", year);
@@ -306,30 +492,199 @@ static void monthly_spending_chart(void) {
     printf("%.2f\n\n", total);
 }
 
+/* Returns 0 if the year has no expenses, or FIN_CANCELLED. */
+static int expense_chart(int year) {
+    double sums[13]; // 1..12
+    int r = need_years(year, year);
+    if (r != 1) return r;
+    finbuf_put_le(&recReq, (unsigned)year, 2);
+    record(OP_CHART);
+    int any = ledger_monthly_expenses(ledger, year, sums);
+    if (any <= 0) return any;
+    op_output_begin();
+    print_chart(year, sums);
+    return 1;
+}
+
+static int op_chart(void *arg) { return expense_chart(*(int *)arg); }
+
+static void monthly_spending_chart(void) {
+    if (ledger_empty()) { fprintf(stderr, "No data.\n"); return; }
+    int year = read_int("Enter year for EXPENSE chart: ", 1900, 3000);
+    if (!run_op("Summing", op_chart, &year)) fprintf(stderr, "No expenses recorded for %d.\n", year);
+}
+
 /* ----------------------- Summary totals --------------------------- */
 
-static void show_summary(void) {
-    double income = 0.0, expense = 0.0;
-    for (int i = 0; i < txCount; ++i) {
-        if (txs[i].type == INCOME) income += txs[i].amount;
-        else expense += txs[i].amount;
+static void print_summary(double income, double expense) {
+    if (writer_format(out) != FMT_TABLE) {
+        writer_begin_agg(out, "total", "amount");
+        writer_agg(out, "income", income);
+        writer_agg(out, "expense", expense);
+        writer_agg(out, "savings", income - expense);
+        writer_end(out);
+        return;
     }
     printf("Summary (all time): Income = %.2f | Expense = %.2f | Savings = %.2f\n",
            income, expense, income - expense);
 }
 
+static void print_range(const char *from, const char *to, int rows, double income, double expense) {
+    if (writer_format(out) != FMT_TABLE) {
+        writer_begin_agg(out, "total", "amount");
+        writer_agg(out, "income", income);
+        writer_agg(out, "expense", expense);
+        writer_agg(out, "net", income - expense);
+        writer_end(out);
+        return;
+    }
+    printf("%s to %s (%d record(s)): Income = %.2f | Expense = %.2f | Net = %.2f\n",
+           from, to, rows, income, expense, income - expense);
+}
+
+static void show_summary(void) {
+    double income, expense;
+    if (need_all() != 1) return;
+    record(OP_SUMMARY);
+    ledger_totals(ledger, &income, &expense);
+    print_summary(income, expense);
+}
+
+/* ----------------------- Output format / export ------------------ */
+
+static void choose_format(void) {
+    printf("Output format:\n  0) table\n  1) csv\n  2) jsonl (JSON Lines)\n  3) binary (fixed-width records)\n");
+    writer_set_format(out, (OutFormat)read_int("Choose: ", 0, 3));
+    printf("Output format set to %s.\n", FMT_NAMES[writer_format(out)]);
+}
+
+/* Streams every transaction to a file in the current output format;
+   1 ok, 0 on error, or FIN_CANCELLED (the file is then incomplete). */
+static int export_to_file(const char *fname) {
+    unsigned long long t0 = fin_stat_begin();
+    OutFormat fmt = writer_format(out);
+    FILE *f = fopen(fname, fmt == FMT_BINARY ? "wb" : "w");
+    if (!f) { perror("fopen"); return 0; }
+    Writer *w = writer_new(f, fmt);
+    if (!w) { fclose(f); return 0; }
+    int ok = write_all_rows(w);
+    writer_free(w);
+    long bytes = ftell(f);
+    if (fclose(f) != 0) ok = 0;
+    int n = ledger_count(ledger);
+    fin_stat_end(STAT_EXPORT, t0, n, ok == 1 ? n : 0, 0, bytes);
+    return ok;
+}
+
+static int op_export(void *arg) { return export_to_file(arg); }
+
+static void export_menu(void) {
+    char fname[256];
+    read_line("Export file name: ", fname, sizeof(fname));
+    if (fname[0] == '\0') { fprintf(stderr, "No file name given.\n"); return; }
+    int r = run_op("Exporting", op_export, fname);
+    if (r == 1)
+        printf("Exported %d record(s) to '%s' as %s.\n", ledger_count(ledger), fname, FMT_NAMES[writer_format(out)]);
+    else if (r == FIN_CANCELLED) printf("'%s' is incomplete.\n", fname);
+    else printf("Export failed.\n");
+}
+
+/* ----------------------- Statistics ------------------------------ */
+
+static int write_stats(const char *fname) {
+    FILE *f = fopen(fname, "w");
+    if (!f) { perror("fopen"); return 0; }
+    int ok = fin_stats_write_json(f);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "Writing statistics to '%s' failed.\n", fname);
+    return ok;
+}
+
+/* Stops the pool first, so no thread is still recording. */
+static int write_trace(const char *fname) {
+    fin_pool_shutdown();
+    fin_trace_stop();
+    FILE *f = fopen(fname, "w");
+    if (!f) { perror("fopen"); return 0; }
+    int ok = fin_trace_write_json(f);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) fprintf(stderr, "Writing the trace to '%s' failed.\n", fname);
+    return ok;
+}
+
+static void stats_menu(void) {
+    printf("%-16s %7s %10s %10s %10s %10s %12s %12s\n",
+           "Operation", "Calls", "Mean ms", "p50 ms", "p99 ms", "Max ms", "Rows scanned", "Rows out");
+    for (int op = 0; op < STAT_OPS; ++op) {
+        FinOpStats s;
+        fin_stats_get((FinStat)op, &s);
+        if (!s.calls) continue;
+        printf("%-16s %7llu %10.3f %10.3f %10.3f %10.3f %12llu %12llu\n",
+               FIN_STAT_NAMES[op], s.calls, s.totalNs / 1e6 / s.calls, s.p50Ns / 1e6,
+               s.p99Ns / 1e6, s.maxNs / 1e6, s.rowsScanned, s.rowsReturned);
+        if (s.bytesRead || s.bytesWritten)
+            printf("%-16s %7s bytes read %llu, written %llu\n", "", "", s.bytesRead, s.bytesWritten);
+    }
+    char fname[256];
+    read_line("Save as JSON to file (blank to skip): ", fname, sizeof(fname));
+    if (fname[0] && write_stats(fname)) printf("Statistics written to '%s'.\n", fname);
+    if (read_int("Reset counters? (0 no, 1 yes): ", 0, 1)) fin_stats_reset();
+}
+
+/* ----------------------- Memory report --------------------------- */
+
+static void print_memory_report(FILE *f) {
+    LedgerMemUsage u;
+    long long total = fin_mem_total();
+    ledger_mem_usage(ledger, &u);
+    fprintf(f, "%-14s %14s %14s %10s %10s\n", "Subsystem", "Bytes", "Peak", "Allocs", "Frees");
+    for (int k = 0; k < MEM_TAGS; ++k) {
+        FinMemStats s;
+        fin_mem_get((FinMemTag)k, &s);
+        if (!s.allocs) continue;
+        fprintf(f, "%-14s %14lld %14lld %10llu %10llu\n", FIN_MEM_NAMES[k], s.bytes, s.peak, s.allocs, s.frees);
+    }
+    fprintf(f, "%-14s %14lld\n\n", "total", total);
+    fprintf(f, "Rows:            %ld (%lld of %lld reserved bytes used)\n",
+           u.rows, u.rowBytesUsed, u.rowBytesReserved);
+    fprintf(f, "Encoded columns: %lld of those bytes\n", u.columnBytes);
+    fprintf(f, "Text fields:     %lld of %lld bytes hold text (%.1f%%)\n", u.textBytesUsed, u.textBytesReserved,
+           u.textBytesReserved ? 100.0 * u.textBytesUsed / u.textBytesReserved : 0.0);
+    fprintf(f, "Old snapshots:   %lld bytes awaiting readers\n", u.retiredBytes);
+    if (u.rows)
+        fprintf(f, "Bytes per row:   %.1f in the record store, %.1f overall\n",
+               (double)u.rowBytesReserved / u.rows, (double)total / u.rows);
+    if (tier) print_tier(f);
+}
+
 /* ----------------------- Delete / Edit (optional helpers) -------- */
 
 static void delete_by_index(void) {
-    if (txCount == 0) { printf("No data.\n"); return; }
-    int idx = read_int("Index to delete: ", 0, txCount-1);
-    for (int i = idx; i < txCount-1; ++i) txs[i] = txs[i+1];
-    txCount--;
-    printf("Deleted. Remaining = %d\n", txCount);
+    if (ledger_empty()) { fprintf(stderr, "No data.\n"); return; }
+    if (need_all() != 1) return;
+    int idx = read_int("Index to delete: ", 0, ledger_count(ledger)-1);
+    if (!ledger_delete(ledger, idx)) { fprintf(stderr, "Delete failed: out of memory.\n"); return; }
+    finbuf_put_le(&recReq, (unsigned)idx, 4);
+    record(OP_DELETE);
+    printf("Deleted. Remaining = %d\n", ledger_count(ledger));
 }
 
 /* ----------------------- Menu ------------------------------------ */
 
+static int op_load(void *arg) {
+    int r = ledger_load(ledger, arg);
+    if ((r >= 0 || (r == -1 && errno == ENOENT)) && !open_tier()) return -1;
+    return r;
+}
+
+/* Returns rows loaded, -1 after reporting the error, or FIN_CANCELLED. */
+static int load_from_file(const char *fname) {
+    int r = run_op("Loading", op_load, (void *)fname);
+    if (r >= 0) record(OP_LOAD);
+    if (r == -1) perror("fopen");
+    return r;
+}
+
 static void menu(void) {
     for (;;) {
         printf("\n==== Personal Finance Tracker ====\n");
@@ -343,8 +698,12 @@ static void menu(void) {
         printf("8) Monthly expense ASCII chart\n");
         printf("9) Summary totals\n");
         printf("10) Delete by index\n");
+        printf("11) Output format (current: %s)\n", FMT_NAMES[writer_format(out)]);
+        printf("12) Export all to file\n");
+        printf("13) Operation statistics\n");
+        printf("14) Memory report\n");
         printf("0) Exit\n");
-        int c = read_int("Choose: ", 0, 10);
+        int c = read_int("Choose: ", 0, 14);
         switch (c) {
             case 1: add_transaction(); break;
             case 2: list_all(); break;
@@ -352,26 +711,1099 @@ static void menu(void) {
             case 4: search_menu(); break;
             case 5: filter_expenses_over(); break;
             case 6:
-                if (save_to_file(FILE_NAME)) printf("Saved to '%s'.\n", FILE_NAME);
-                else printf("Save failed.\n");
+                record(OP_SAVE);
+                if (save_ledger()) printf("Saved to '%s'.\n", dataFile);
+                else { perror("fopen"); printf("Save failed.\n"); }
                 break;
-            case 7:
-                if (load_from_file(FILE_NAME)) printf("Loaded from '%s'. %d records.\n", FILE_NAME, txCount);
+            case 7: {
+                int r = load_from_file(dataFile);
+                if (r >= 0) printf("Loaded from '%s'. %d records.\n", dataFile, ledger_count(ledger));
+                else if (r == FIN_CANCELLED) printf("Ledger unchanged.\n");
                 else printf("Load failed.\n");
                 break;
+            }
             case 8: monthly_spending_chart(); break;
             case 9: show_summary(); break;
             case 10: delete_by_index(); break;
+            case 11: choose_format(); break;
+            case 12: export_menu(); break;
+            case 13: stats_menu(); break;
+            case 14: print_memory_report(stdout); break;
             case 0: printf("Goodbye!\n"); return;
             default: break;
         }
     }
 }
 
-int main(void) {
-    // Try to load existing data on startup (optional)
-    load_from_file(FILE_NAME); // ignore error if file doesn't exist
-    printf("Welcome! %d existing record(s) loaded (if any) from %s.\n", txCount, FILE_NAME);
-    menu();
+/* ----------------------- Command line --------------------------- */
+/* Subcommands run one operation against the data file and exit, without
+   the banner or menu. Results go to stdout in the chosen format; status
+   messages go to stderr so they never mix with CSV/JSON/binary output.
+   Exit status: 0 success, 1 failure or no results, 2 usage error.
+*/
+
+static void usage(FILE *f) {
+    fprintf(f,
+        "Usage: finance_tracker [-f DATAFILE] [-o table|csv|jsonl|binary] [-s SOCKET]\n"
+        "                       [-j THREADS] [-t SECONDS] [-S STATS.json] [-T TRACE.json]\n"
+        "                       [-R SESSION.log] [-p [OFFSET,]LIMIT] [-A YEARS] [-M MB]\n"
+        "                       [COMMAND ARGS...]\n"
+        "Without a command the interactive menu starts. With -s, add, list,\n"
+        "search, filter, chart, summary, range and save go to a running daemon.\n"
+        "-j sets the worker threads for loads, scans and sorts (default: one\n"
+        "per core, or $FIN_THREADS). -t aborts any load, sort, query or\n"
+        "export that runs longer than SECONDS; in the menu Ctrl-C does too.\n"
+        "-S writes per-operation latency histograms and row/byte counters as\n"
+        "JSON to STATS.json on exit (the menu also shows them). -T records a\n"
+        "timeline of operations and their stages on every thread and writes it\n"
+        "to TRACE.json on exit, for chrome://tracing or ui.perfetto.dev.\n"
+        "-R appends the operations this run performs (add, list, sort, search,\n"
+        "filter, chart, summary, range, save, load, delete; not import or\n"
+        "export) to SESSION.log, for the replay command.\n"
+        "-p prints only LIMIT (at least 1) rows of each list, search or filter\n"
+        "result, starting OFFSET rows in (default 0), and notes the slice on\n"
+        "stderr; only the printed rows are read from the ledger.\n"
+        "-A keeps the last YEARS years in DATAFILE and moves older ones to\n"
+        "DATAFILE" FIN_ARCHIVE_SUFFIX " (packed) on save; the archive records that\n"
+        "split and later saves keep it until 'archive YEARS' moves it. Once an\n"
+        "archive exists, only the data file is loaded and archived years are\n"
+        "read back when an operation first needs them (not by a daemon, which\n"
+        "serves the data file alone).\n"
+        "-M runs list, search, filter, chart, summary, range, totals and export\n"
+        "over the files without loading them, in about MB of memory: sorts\n"
+        "merge sorted runs and groupings spill hash partitions to temporary\n"
+        "files in $TMPDIR; other commands load the ledger as usual.\n"
+        "-o binary refuses to print to a terminal; redirect stdout.\n"
+        "Commands:\n"
+        "  add YYYY-MM-DD income|expense CATEGORY AMOUNT [NOTE]\n"
+        "  list [date|amount]             list all, optionally sorted\n"
+        "  search category|note TEXT\n"
+        "  search date YYYY-MM-DD\n"
+        "  filter AMOUNT                  expenses over AMOUNT\n"
+        "  chart YEAR                     monthly expenses for YEAR\n"
+        "  summary                        all-time totals\n"
+        "  range FROM TO                  income and expense dated FROM..TO (YYYY-MM-DD)\n"
+        "  totals category|month|year     rows, income, expense and net per group (the\n"
+        "                                 -o formats give the net)\n"
+        "  import FILE                    append records saved in the data file format,\n"
+        "                                 skipping ones already in the ledger\n"
+        "  export FILE                    write all records in the -o format\n"
+        "  pack FILE                      write the ledger as a packed (compressed\n"
+        "                                 column) file; -f accepts packed files, and\n"
+        "                                 saves to one keep it packed\n"
+        "  memory [json]                  memory in use per subsystem and per row\n"
+        "  archive [YEARS]                archive state; with YEARS, move all but the\n"
+        "                                 last YEARS years to the archive now\n"
+        "  daemon [SOCKET]                keep the ledger resident and serve requests\n"
+        "                                 on a Unix socket (default " FIN_DEFAULT_SOCKET ")\n"
+        "  save                           (with -s) make the daemon save its ledger\n"
+        "  generate ROWS FILE [SEED [YEARS]]\n"
+        "                                 write a synthetic ledger (data file format,\n"
+        "                                 or binary records with -o binary)\n"
+        "  lsm DIR init leveled|tiered [FANOUT [MEMTABLE_ROWS]]\n"
+        "                                 create a log-structured store in DIR (a store\n"
+        "                                 is created with defaults on first use)\n"
+        "  lsm DIR ingest FILE...         append records in the data file format\n"
+        "  lsm DIR date YYYY-MM-DD        rows of one day (bloom filters, fences)\n"
+        "  lsm DIR range FROM TO | list   rows in date order; the index is the\n"
+        "                                 row's sequence number\n"
+        "  lsm DIR delete YYYY-MM-DD SEQ\n"
+        "  lsm DIR compact                merge everything into one run\n"
+        "  lsm DIR stats [json]           levels, write amplification, lookup cost\n"
+        "  paged FILE CACHE_MB FROM TO [FROM TO]...\n"
+        "                                 rows of each date range of a packed FILE,\n"
+        "                                 reading blocks on demand through a block\n"
+        "                                 cache of CACHE_MB; cache use goes to stderr\n"
+        "  replay LOG [json]              run a recorded session against the ledger as\n"
+        "                                 fast as possible and report per-operation\n"
+        "                                 latencies (saves go to a scratch file)\n"
+        "  help\n");
+}
+
+static int parse_date_arg(const char *s, int *y, int *m, int *d) {
+    char tail;
+    if (sscanf(s, "%d-%d-%d%c", y, m, d, &tail) != 3) return 0;
+    return fin_valid_date(*y, *m, *d);
+}
+
+/* OP_RANGE_SUM payload. */
+static void put_range(FinBuf *b, int y0, int m0, int d0, int y1, int m1, int d1) {
+    finbuf_put_le(b, (unsigned)y0, 2);
+    finbuf_put_le(b, (unsigned)m0, 1);
+    finbuf_put_le(b, (unsigned)d0, 1);
+    finbuf_put_le(b, (unsigned)y1, 2);
+    finbuf_put_le(b, (unsigned)m1, 1);
+    finbuf_put_le(b, (unsigned)d1, 1);
+}
+
+static int parse_amount_arg(const char *s, double *v) {
+    char *end;
+    errno = 0;
+    *v = strtod(s, &end);
+    return errno == 0 && end != s && *end == '\0' && *v >= 0.0;
+}
+
+/* Loads the data file; a missing file is an empty ledger. */
+static int load_data_quiet(void) {
+    int r = ledger_load(ledger, dataFile);
+    if (r >= 0 || (r == -1 && errno == ENOENT)) return open_tier();
+    if (r == FIN_CANCELLED) return 0;
+    fprintf(stderr, "Cannot read '%s': %s\n", dataFile, strerror(errno));
+    return 0;
+}
+
+static int save_data(void) {
+    record(OP_SAVE);
+    if (save_ledger()) return 1;
+    fprintf(stderr, "Save to '%s' failed.\n", dataFile);
+    return 0;
+}
+
+/* ----------------------- Daemon client --------------------------- */
+
+static int remote_fd = -1;
+static FinBuf remoteReq = {0}, remoteResp = {0};
+
+/* Sends remoteReq as op; returns the reply status or -1 after reporting. */
+static int remote_call(FinOp op) {
+    if (remote_fd < 0 && (remote_fd = fin_client_connect(sockPath)) < 0) {
+        fprintf(stderr, "Cannot connect to '%s': %s\n", sockPath, strerror(errno));
+        return -1;
+    }
+    if (recorder) finbuf_put(&recReq, remoteReq.data, remoteReq.len);
+    record(op);
+    int st = fin_client_call(remote_fd, op, remoteReq.data, remoteReq.len, &remoteResp);
+    remoteReq.len = 0;
+    if (st < 0) fprintf(stderr, "Daemon request failed: %s\n", strerror(errno));
+    else if (st != FIN_ST_OK) fprintf(stderr, "Daemon rejected the request.\n");
+    return st;
+}
+
+/* Streams the rows of a query reply, asking for the next slice with
+   OP_PAGE until the -p page (or the result) is complete; returns the
+   number of matches, 0 for none or an error. */
+static int remote_rows(FinOp op) {
+    FinBuf query = {0};
+    int total = -1, at = pageOffset, lo = 0, hi = 0;
+    if (!finbuf_put(&query, remoteReq.data, remoteReq.len)) { fprintf(stderr, "Out of memory.\n"); return 0; }
+    writer_begin_rows(out);
+    for (;;) {
+        remoteReq.len = 0;
+        finbuf_put_le(&remoteReq, (unsigned)at, 4);
+        finbuf_put_le(&remoteReq, (unsigned)op, 1);
+        finbuf_put(&remoteReq, query.data, query.len);
+        if (remote_call(OP_PAGE) != FIN_ST_OK || remoteResp.len < 8) { total = -1; break; }
+        int n = (int)fin_get_le(remoteResp.data + 4, 4);
+        if (remoteResp.len != 8 + (size_t)n * BIN_ROW_LEN) { fprintf(stderr, "Malformed reply.\n"); total = -1; break; }
+        if (total < 0) {
+            total = (int)fin_get_le(remoteResp.data, 4);
+            page_of(total, &lo, &hi);
+        }
+        for (int k = 0; k < n && at < hi; ++k, ++at) {
+            Transaction t;
+            int idx;
+            fin_decode_row(remoteResp.data + 8 + (size_t)k * BIN_ROW_LEN, &idx, &t);
+            writer_row(out, idx, &t);
+        }
+        if (n == 0 || at >= hi) break;
+    }
+    writer_end(out);
+    finbuf_free(&query);
+    if (total < 0) return 0;
+    page_note(lo, hi, total);
+    return total;
+}
+
+static int run_remote(int argc, char **argv) {
+    const char *cmd = argv[0];
+    int y, m, d;
+
+    if (strcmp(cmd, "add") == 0 && (argc == 5 || argc == 6)) {
+        Transaction t = {0};
+        unsigned char rec[BIN_ROW_LEN];
+        if (!parse_date_arg(argv[1], &t.y, &t.m, &t.d)) { fprintf(stderr, "Invalid date '%s'.\n", argv[1]); return 2; }
+        if (strcmp(argv[2], "income") == 0) t.type = INCOME;
+        else if (strcmp(argv[2], "expense") == 0) t.type = EXPENSE;
+        else { fprintf(stderr, "Type must be 'income' or 'expense'.\n"); return 2; }
+        if (!parse_amount_arg(argv[4], &t.amount) || t.amount <= 0.0) { fprintf(stderr, "Amount must be positive.\n"); return 2; }
+        strncpy(t.category, argv[3], STR_LEN-1);
+        if (argc == 6) strncpy(t.note, argv[5], NOTE_LEN-1);
+        fin_encode_row(rec, 0, &t);
+        finbuf_put(&remoteReq, rec, BIN_ROW_LEN);
+        return remote_call(OP_ADD) == FIN_ST_OK ? 0 : 1;
+    }
+    if (strcmp(cmd, "list") == 0 && argc == 1) {
+        remote_rows(OP_LIST);
+        return remoteResp.len >= 4 ? 0 : 1;
+    }
+    if (strcmp(cmd, "search") == 0 && argc == 3) {
+        if (strcmp(argv[1], "date") == 0) {
+            if (!parse_date_arg(argv[2], &y, &m, &d)) { fprintf(stderr, "Invalid date '%s'.\n", argv[2]); return 2; }
+            finbuf_put_le(&remoteReq, (unsigned)y, 2);
+            finbuf_put_le(&remoteReq, (unsigned)m, 1);
+            finbuf_put_le(&remoteReq, (unsigned)d, 1);
+            return remote_rows(OP_SEARCH_DATE) ? 0 : 1;
+        }
+        if (strcmp(argv[1], "category") == 0) finbuf_put_le(&remoteReq, FIELD_CATEGORY, 1);
+        else if (strcmp(argv[1], "note") == 0) finbuf_put_le(&remoteReq, FIELD_NOTE, 1);
+        else { usage(stderr); return 2; }
+        finbuf_put(&remoteReq, argv[2], strlen(argv[2]));
+        return remote_rows(OP_SEARCH_TEXT) ? 0 : 1;
+    }
+    if (strcmp(cmd, "filter") == 0 && argc == 2) {
+        double thr;
+        if (!parse_amount_arg(argv[1], &thr)) { fprintf(stderr, "Invalid amount '%s'.\n", argv[1]); return 2; }
+        finbuf_put_f64(&remoteReq, thr);
+        return remote_rows(OP_FILTER) ? 0 : 1;
+    }
+    if (strcmp(cmd, "chart") == 0 && argc == 2) {
+        double sums[13] = {0.0};
+        int any = 0;
+        if (sscanf(argv[1], "%d", &y) != 1 || y < 1900 || y > 3000) { fprintf(stderr, "Invalid year '%s'.\n", argv[1]); return 2; }
+        finbuf_put_le(&remoteReq, (unsigned)y, 2);
+        if (remote_call(OP_CHART) != FIN_ST_OK || remoteResp.len != 12 * 8) return 1;
+        for (int k = 1; k <= 12; ++k) {
+            sums[k] = fin_get_f64(remoteResp.data + (k - 1) * 8);
+            if (sums[k] > 0.0) any = 1;
+        }
+        if (!any) { fprintf(stderr, "No expenses recorded for %d.\n", y); return 1; }
+        print_chart(y, sums);
+        return 0;
+    }
+    if (strcmp(cmd, "summary") == 0 && argc == 1) {
+        if (remote_call(OP_SUMMARY) != FIN_ST_OK || remoteResp.len != 16) return 1;
+        print_summary(fin_get_f64(remoteResp.data), fin_get_f64(remoteResp.data + 8));
+        return 0;
+    }
+    if (strcmp(cmd, "save") == 0 && argc == 1) {
+        return remote_call(OP_SAVE) == FIN_ST_OK ? 0 : 1;
+    }
+    if (strcmp(cmd, "range") == 0 && argc == 3) {
+        int y1, m1, d1;
+        if (!parse_date_arg(argv[1], &y, &m, &d)) { fprintf(stderr, "Invalid date '%s'.\n", argv[1]); return 2; }
+        if (!parse_date_arg(argv[2], &y1, &m1, &d1)) { fprintf(stderr, "Invalid date '%s'.\n", argv[2]); return 2; }
+        put_range(&remoteReq, y, m, d, y1, m1, d1);
+        if (remote_call(OP_RANGE_SUM) != FIN_ST_OK || remoteResp.len != 20) return 1;
+        print_range(argv[1], argv[2], (int)fin_get_le(remoteResp.data, 4),
+                    fin_get_f64(remoteResp.data + 4), fin_get_f64(remoteResp.data + 12));
+        return 0;
+    }
+    usage(stderr);
+    return 2;
+}
+
+/* generate ROWS FILE [SEED [YEARS]]: a synthetic ledger ending in 2025. */
+static int generate(int argc, char **argv) {
+    GenSpec spec = { 1, 0, 2016, 10, writer_format(out) == FMT_BINARY };
+    char *end;
+    spec.rows = strtol(argv[1], &end, 10);
+    if (*end || spec.rows < 0) { fprintf(stderr, "Invalid row count '%s'.\n", argv[1]); return 2; }
+    if (argc >= 4 && (spec.seed = strtoull(argv[3], &end, 10), *end)) {
+        fprintf(stderr, "Invalid seed '%s'.\n", argv[3]);
+        return 2;
+    }
+    if (argc == 5) {
+        spec.years = (int)strtol(argv[4], &end, 10);
+        if (*end || spec.years < 1 || spec.years > 100) { fprintf(stderr, "Invalid year count '%s'.\n", argv[4]); return 2; }
+        spec.startYear = 2025 - spec.years + 1;
+    }
+    FILE *f = fopen(argv[2], spec.binary ? "wb" : "w");
+    if (!f) { fprintf(stderr, "Cannot write '%s': %s\n", argv[2], strerror(errno)); return 1; }
+    int r = fin_generate(f, &spec);
+    if (fclose(f) != 0 && r == 1) r = 0;
+    if (r == 0) fprintf(stderr, "Generating '%s' failed.\n", argv[2]);
+    if (r != 1) return 1;
+    fprintf(stderr, "Generated %ld record(s) in '%s'.\n", spec.rows, argv[2]);
+    return 0;
+}
+
+/* replay LOG [json]: runs a recorded session against the -f ledger.
+   Saves go to a scratch copy next to the log, so the data file is left
+   alone while loads still see the state the session saved. */
+static int replay(int argc, char **argv) {
+    char scratch[4096];
+    FinReplayStats st;
+    snprintf(scratch, sizeof(scratch), "%s.replay-data", argv[1]);
+    if (!load_data_quiet()) return 1;
+    if (!ledger_save(ledger, scratch)) { fprintf(stderr, "Cannot write '%s': %s\n", scratch, strerror(errno)); return 1; }
+    long n = fin_replay(ledger, argv[1], scratch, &st);
+    remove(scratch);
+    if (n == -1) {
+        fprintf(stderr, "Cannot replay '%s': %s\n", argv[1], errno == EINVAL ? "not a session log" : strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "Replayed %ld request(s) in %.3f ms (%.0f/s), %ld failed.\n", st.requests, st.wallNs / 1e6,
+            st.wallNs ? st.requests * 1e9 / st.wallNs : 0.0, st.failed);
+    if (argc == 3) {
+        if (!fin_replay_write_json(stdout, &st)) return 1;
+    } else {
+        printf("%-12s %8s %10s %10s %10s %10s %10s %10s\n",
+               "Operation", "Count", "Mean ms", "Min ms", "p50 ms", "p90 ms", "p99 ms", "Max ms");
+        for (int op = 0; op < FIN_OPS; ++op) {
+            const FinReplayOpStats *o = &st.ops[op];
+            if (!o->count) continue;
+            printf("%-12s %8llu %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", FIN_OP_NAMES[op], o->count,
+                   o->totalNs / 1e6 / o->count, o->minNs / 1e6, o->p50Ns / 1e6, o->p90Ns / 1e6,
+                   o->p99Ns / 1e6, o->maxNs / 1e6);
+        }
+    }
+    return n == FIN_CANCELLED ? 1 : 0;
+}
+
+/* ----------------------- LSM store ------------------------------- */
+
+static int lsm_emit(void *ctx, unsigned long long seq, const Transaction *t) {
+    (void)ctx;
+    writer_row(out, (int)seq, t);
+    return 0;
+}
+
+/* Appends every record of the data-format files to the store. */
+static int lsm_ingest(FinLsm *db, int nFiles, char **files) {
+    long stored = 0, rejected = 0;
+    Ledger *tmp = ledger_new();
+    if (!tmp) { fprintf(stderr, "Out of memory.\n"); return 1; }
+    for (int f = 0; f < nFiles; ++f) {
+        int n = ledger_load(tmp, files[f]);
+        if (n < 0) { fprintf(stderr, "Cannot read '%s': %s\n", files[f], strerror(errno)); ledger_free(tmp); return 1; }
+        ledger_read_begin(tmp);
+        for (int i = 0; i < n; i += BATCH_CHUNK) {
+            int bad, k = n - i < BATCH_CHUNK ? n - i : BATCH_CHUNK;
+            int r = fin_lsm_put(db, ledger_row(tmp, i), k, &bad);
+            if (r < 0) {
+                ledger_read_end(tmp);
+                ledger_free(tmp);
+                fprintf(stderr, "Writing to the store failed: %s\n", strerror(errno));
+                return 1;
+            }
+            stored += r;
+            rejected += bad;
+        }
+        ledger_read_end(tmp);
+    }
+    ledger_free(tmp);
+    fprintf(stderr, "Ingested %ld record(s), rejected %ld.\n", stored, rejected);
+    return 0;
+}
+
+static void print_lsm_stats(FinLsm *db) {
+    FinLsmStats s;
+    fin_lsm_stats(db, &s);
+    printf("Policy: %s, fanout %d; %ld row(s) in the memtable\n",
+           s.policy == LSM_TIERED ? "tiered" : "leveled", s.fanout, s.memtableRows);
+    printf("%-6s %6s %12s %14s\n", "Level", "Runs", "Entries", "Bytes");
+    for (int l = 0; l < LSM_MAX_LEVELS; ++l)
+        if (s.runs[l]) printf("L%-5d %6d %12lld %14lld\n", l, s.runs[l], s.entries[l], s.bytes[l]);
+    printf("Written: %llu user bytes; WAL %llu, %llu flush(es) %llu, %llu compaction(s) %llu (read %llu)\n",
+           s.userBytes, s.walBytes, s.flushes, s.flushBytes, s.compactions, s.compactWriteBytes,
+           s.compactReadBytes);
+    printf("Write amplification: %.2f\n", s.writeAmp);
+    if (s.lookups)
+        printf("Lookups: %llu; runs probed %.2f, bloom skips %.2f, false positives %.2f per lookup\n",
+               s.lookups, (double)s.runsProbed / s.lookups, (double)s.bloomSkips / s.lookups,
+               (double)s.bloomFalsePositives / s.lookups);
+    printf("Blocks read: %llu\n", s.blocksRead);
+}
+
+/* lsm DIR COMMAND ...: the log-structured store in directory DIR. */
+static int lsm_command(int argc, char **argv) {
+    const char *sub = argv[2];
+    FinLsmOptions opt = { LSM_LEVELED, 0, 0, 0 };
+    int y, m, d, y1, m1, d1, rc = 0;
+    char *end;
+
+    if (strcmp(sub, "init") == 0) {
+        if (argc < 4 || argc > 6) { usage(stderr); return 2; }
+        if (strcmp(argv[3], "tiered") == 0) opt.policy = LSM_TIERED;
+        else if (strcmp(argv[3], "leveled") != 0) { usage(stderr); return 2; }
+        if (argc >= 5 && ((opt.fanout = (int)strtol(argv[4], &end, 10)) < 2 || *end)) {
+            fprintf(stderr, "Invalid fanout '%s'.\n", argv[4]);
+            return 2;
+        }
+        if (argc == 6 && ((opt.memtableRows = strtol(argv[5], &end, 10)) < 1 || *end)) {
+            fprintf(stderr, "Invalid memtable size '%s'.\n", argv[5]);
+            return 2;
+        }
+    }
+    FinLsm *db = fin_lsm_open(argv[1], &opt);
+    if (!db) { fprintf(stderr, "Cannot open store '%s': %s\n", argv[1], strerror(errno)); return 1; }
+
+    if (strcmp(sub, "init") == 0) {
+        FinLsmStats s;
+        fin_lsm_stats(db, &s);
+        if (s.policy != opt.policy || (opt.fanout && s.fanout != opt.fanout))
+            fprintf(stderr, "Store '%s' already exists; its options are unchanged.\n", argv[1]);
+    } else if (strcmp(sub, "ingest") == 0 && argc >= 4) {
+        rc = lsm_ingest(db, argc - 3, argv + 3);
+    } else if ((strcmp(sub, "date") == 0 && argc == 4) || (strcmp(sub, "range") == 0 && argc == 5)
+               || (strcmp(sub, "list") == 0 && argc == 3)) {
+        if (sub[0] == 'l') { y = 1900; m = d = 1; y1 = 3000; m1 = 12; d1 = 31; }
+        else if (!parse_date_arg(argv[3], &y, &m, &d)) { fprintf(stderr, "Invalid date '%s'.\n", argv[3]); rc = 2; }
+        else if (sub[0] == 'd') { y1 = y; m1 = m; d1 = d; }
+        else if (!parse_date_arg(argv[4], &y1, &m1, &d1)) { fprintf(stderr, "Invalid date '%s'.\n", argv[4]); rc = 2; }
+        if (!rc) {
+            writer_begin_rows(out);
+            long n = fin_lsm_scan(db, y, m, d, y1, m1, d1, lsm_emit, NULL);
+            if (!writer_end(out) || n < 0) rc = 1;
+            if (n < 0) fprintf(stderr, "Reading the store failed: %s\n", strerror(errno));
+            else if (n == 0) rc = 1;
+        }
+    } else if (strcmp(sub, "delete") == 0 && argc == 5) {
+        unsigned long long seq = strtoull(argv[4], &end, 10);
+        if (!parse_date_arg(argv[3], &y, &m, &d) || *end) { usage(stderr); rc = 2; }
+        else if (!fin_lsm_delete(db, y, m, d, seq)) { fprintf(stderr, "Delete failed: %s\n", strerror(errno)); rc = 1; }
+    } else if (strcmp(sub, "compact") == 0 && argc == 3) {
+        if (!fin_lsm_compact(db)) { fprintf(stderr, "Compaction failed: %s\n", strerror(errno)); rc = 1; }
+    } else if (strcmp(sub, "stats") == 0 && (argc == 3 || (argc == 4 && strcmp(argv[3], "json") == 0))) {
+        if (argc == 4) rc = fin_lsm_write_stats_json(stdout, db) ? 0 : 1;
+        else print_lsm_stats(db);
+    } else {
+        usage(stderr);
+        rc = 2;
+    }
+    if (!fin_lsm_close(db)) {
+        fprintf(stderr, "Closing store '%s' failed: %s\n", argv[1], strerror(errno));
+        if (rc == 0) rc = 1;
+    }
+    return rc;
+}
+
+/* ----------------------- Paged files ----------------------------- */
+
+static int paged_emit(void *ctx, long idx, const Transaction *t) {
+    (void)ctx;
+    writer_row(out, (int)idx, t);
+    return 0;
+}
+
+/* paged FILE CACHE_MB FROM TO...: date ranges of a packed file, read in
+   blocks on demand. */
+static int paged_command(int argc, char **argv) {
+    char *end;
+    double mb = strtod(argv[2], &end);
+    if (*end || !(mb >= 0.0 && mb < 1e9)) { fprintf(stderr, "Invalid cache size '%s'.\n", argv[2]); return 2; }
+    int nRanges = (argc - 3) / 2, (*dates)[6] = fin_malloc(MEM_RESULTS, (size_t)nRanges * sizeof(*dates));
+    if (!dates) { fprintf(stderr, "Out of memory.\n"); return 1; }
+    for (int k = 0; k < nRanges; ++k) {
+        int *v = dates[k];
+        for (int j = 0; j < 2; ++j) {
+            if (!parse_date_arg(argv[3 + 2 * k + j], &v[3 * j], &v[3 * j + 1], &v[3 * j + 2])) {
+                fprintf(stderr, "Invalid date '%s'.\n", argv[3 + 2 * k + j]);
+                fin_free(dates);
+                return 2;
+            }
+        }
+    }
+    FinCache *cache = fin_cache_new((long long)(mb * 1048576.0), fin_pool_threads());
+    FinPaged *p = cache ? fin_paged_open(argv[1], cache) : NULL;
+    if (!p) {
+        fprintf(stderr, "Cannot open '%s': %s\n", argv[1], errno == EINVAL ? "not a packed ledger, or damaged" : strerror(errno));
+        fin_cache_free(cache);
+        fin_free(dates);
+        return 1;
+    }
+    int rc = 0;
+    long total = 0;
+    writer_begin_rows(out);
+    for (int k = 0; k < nRanges && !rc; ++k) {
+        int *v = dates[k];
+        long n = fin_paged_scan(p, v[0], v[1], v[2], v[3], v[4], v[5], paged_emit, NULL);
+        if (n < 0) {
+            fprintf(stderr, "Reading '%s' failed: %s\n", argv[1], strerror(errno));
+            rc = 1;
+        }
+        total += n > 0 ? n : 0;
+    }
+    if (!writer_end(out)) rc = 1;
+
+    FinPagedStats ps;
+    FinCacheStats cs;
+    fin_paged_stats(p, &ps);
+    fin_cache_stats(cache, &cs);
+    fprintf(stderr, "%ld row(s) from %d range(s); blocks: %llu scanned, %llu skipped of %ld, %llu read (%llu bytes)\n",
+            total, nRanges, ps.blocksScanned, ps.blocksSkipped, ps.blocks, ps.blocksRead, ps.bytesRead);
+    fprintf(stderr, "Cache: %llu hit(s), %llu miss(es), %llu eviction(s); %lld of %lld bytes in use (%lld hot)\n",
+            cs.hits, cs.misses, cs.evictions, cs.bytes, cs.budget, cs.hotBytes);
+    fin_paged_close(p);
+    fin_cache_free(cache);
+    fin_free(dates);
+    return rc;
+}
+
+/* ----------------------- External memory -------------------------- */
+/* With -M the report commands stream the data file (its archive first)
+   instead of loading it, and their sorts and groupings stay within
+   extBudget bytes, spilling to temporary files. */
+
+typedef struct {
+    FinExtRowFn fn;
+    void *ctx;
+    long long base;
+    int stopped;
+} ExtFiles;
+
+static int ext_file_row(void *ctx, long long idx, const Transaction *t) {
+    ExtFiles *s = ctx;
+    s->stopped = s->fn(s->ctx, s->base + idx, t);
+    return s->stopped;
+}
+
+/* Visits the archived rows, then the data file's; returns the rows
+   visited, -1 (reported) or FIN_CANCELLED. */
+static long long ext_scan(FinExtRowFn fn, void *ctx) {
+    char archive[4096];
+    snprintf(archive, sizeof(archive), "%s" FIN_ARCHIVE_SUFFIX, dataFile);
+    const char *files[2] = { archive, dataFile };
+    ExtFiles s = { fn, ctx, 0, 0 };
+    for (int i = 0; i < 2 && !s.stopped; ++i) {
+        long long n = fin_ext_scan(files[i], ext_file_row, &s);
+        if (n == FIN_CANCELLED) return n;
+        if (n < 0 && errno == ENOENT) continue;
+        if (n < 0) {
+            fprintf(stderr, "Cannot read '%s': %s\n", files[i], errno == EINVAL ? "damaged" : strerror(errno));
+            return -1;
+        }
+        s.base += n;
+    }
+    return s.base;
+}
+
+/* grouped: st is from fin_ext_agg_stats(), else fin_ext_sort_stats(). */
+static void ext_note(const FinExtStats *st, int grouped) {
+    if (grouped)
+        fprintf(stderr, "Grouped %lld row(s) into %lld group(s): %ld spill(s), %ld partition(s)",
+                st->rows, st->groups, st->spills, st->partitions);
+    else
+        fprintf(stderr, "Sorted %lld row(s): %ld run(s), %ld merge(s)", st->rows, st->runs, st->merges);
+    fprintf(stderr, "; %.1f MB written and %.1f MB read in temporary files (budget %.1f MB)\n",
+            st->bytesWritten / 1048576.0, st->bytesRead / 1048576.0, st->budget / 1048576.0);
+}
+
+typedef struct {
+    Writer *w;
+    int (*match)(const Transaction *t, const void *arg);   // NULL: every row
+    const void *arg;
+    long long hits, lo, hi;       // hits [lo, hi) are written; hi -1: all
+    int stopAtHi;                 // the total is known, so stop after the page
+} ExtRows;
+
+static int ext_row_out(void *ctx, long long idx, const Transaction *t) {
+    ExtRows *o = ctx;
+    if (o->match && !o->match(t, o->arg)) return 0;
+    long long k = o->hits++;
+    if (k >= o->lo && (o->hi < 0 || k < o->hi)) writer_row(o->w, (int)idx, t);
+    return o->stopAtHi && o->hi >= 0 && o->hits >= o->hi;
+}
+
+typedef struct {
+    FinExtSort *s;
+    int err;
+} ExtSortIn;
+
+static int ext_sort_row(void *ctx, long long idx, const Transaction *t) {
+    ExtSortIn *in = ctx;
+    (void)idx;
+    if (!fin_ext_sort_add(in->s, t)) in->err = errno;
+    return in->err;
+}
+
+/* Writes the matching rows (all if match is NULL) to w, sorted by *key
+   if given; only the -p page when w is stdout. The index shown is the
+   row's position in the files, or in the sorted output. Returns the
+   rows matched, -1 on failure or FIN_CANCELLED. */
+static long long ext_rows(Writer *w, const SortKey *key,
+                          int (*match)(const Transaction *t, const void *arg), const void *arg) {
+    ExtRows o = { w, match, arg, 0, 0, -1, 0 };
+    long long n;
+    if (w == out) {
+        o.lo = pageOffset;
+        if (pageLimit >= 0) o.hi = (long long)pageOffset + pageLimit;
+        op_output_begin();
+    }
+    writer_begin_rows(w);
+    if (!key) {
+        n = ext_scan(ext_row_out, &o);
+        if (n >= 0) n = o.hits;
+    } else {
+        ExtSortIn in = { fin_ext_sort_new(*key, extBudget), 0 };
+        if (!in.s) { fprintf(stderr, "Out of memory.\n"); return -1; }
+        n = ext_scan(ext_sort_row, &in);
+        if (n >= 0 && in.err) {
+            fprintf(stderr, "External sort failed: %s\n", strerror(in.err));
+            n = -1;
+        }
+        o.stopAtHi = 1;
+        long long r = n >= 0 ? fin_ext_sort_finish(in.s, ext_row_out, &o) : n;
+        if (r == -1 && n >= 0) fprintf(stderr, "External sort failed: %s\n", strerror(errno));
+        if (r < 0) n = r;
+        FinExtStats st;
+        fin_ext_sort_stats(in.s, &st);
+        if (n >= 0) ext_note(&st, 0);
+        fin_ext_sort_free(in.s);
+    }
+    if (!writer_end(w) && n >= 0) n = -1;
+    if (n >= 0 && w == out) {
+        int lo, hi, total = n > INT_MAX ? INT_MAX : (int)n;
+        page_of(total, &lo, &hi);
+        page_note(lo, hi, total);
+    }
+    return n;
+}
+
+typedef struct {
+    SearchField field;
+    char q[STR_LEN];              // lower case
+    int y, m, d;
+    double thr;
+} ExtQuery;
+
+static int ext_match_text(const Transaction *t, const void *arg) {
+    const ExtQuery *q = arg;
+    char hay[NOTE_LEN];
+    const char *s = q->field == FIELD_CATEGORY ? t->category : t->note;
+    size_t i = 0;
+    for (; s[i] && i < sizeof(hay) - 1; ++i) hay[i] = (char)tolower((unsigned char)s[i]);
+    hay[i] = '\0';
+    return strstr(hay, q->q) != NULL;
+}
+
+static int ext_match_date(const Transaction *t, const void *arg) {
+    const ExtQuery *q = arg;
+    return t->y == q->y && t->m == q->m && t->d == q->d;
+}
+
+static int ext_match_expense(const Transaction *t, const void *arg) {
+    return t->type == EXPENSE && t->amount > ((const ExtQuery *)arg)->thr;
+}
+
+typedef struct {
+    int from, to;                 // YYYYMMDD, inclusive
+    int year;                     // chart year, or 0
+    long long rows, yearExpenses;
+    long long income, expense, months[13];    // cents
+} ExtSums;
+
+static int ext_sum_row(void *ctx, long long idx, const Transaction *t) {
+    ExtSums *s = ctx;
+    int key = t->y * 10000 + t->m * 100 + t->d;
+    (void)idx;
+    if (key < s->from || key > s->to) return 0;
+    s->rows++;
+    if (t->type == INCOME) s->income += fin_cents(t->amount);
+    else {
+        s->expense += fin_cents(t->amount);
+        if (t->y == s->year) { s->months[t->m] += fin_cents(t->amount); s->yearExpenses++; }
+    }
+    return 0;
+}
+
+static int ext_sums(ExtSums *s, int y0, int m0, int d0, int y1, int m1, int d1) {
+    memset(s, 0, sizeof(*s));
+    s->from = y0 * 10000 + m0 * 100 + d0;
+    s->to = y1 * 10000 + m1 * 100 + d1;
+    if (y0 == y1 && m0 == 1 && d0 == 1 && m1 == 12 && d1 == 31) s->year = y0;
+    return ext_scan(ext_sum_row, s) >= 0;
+}
+
+static const char *const GROUP_NAMES[] = { "category", "month", "year" };
+
+static int parse_group(const char *s, FinGroupKey *by) {
+    for (int k = 0; k < 3; ++k)
+        if (strcmp(s, GROUP_NAMES[k]) == 0) { *by = (FinGroupKey)k; return 1; }
+    return 0;
+}
+
+static int print_group(void *ctx, const FinGroup *g) {
+    (void)ctx;
+    double income = (double)g->income / 100.0, expense = (double)g->expense / 100.0;
+    double net = (double)(g->income - g->expense) / 100.0;
+    if (writer_format(out) != FMT_TABLE) writer_agg(out, g->key, net);
+    else printf("%-24s %9lld %14.2f %14.2f %14.2f\n", g->key, g->rows, income, expense, net);
+    return 0;
+}
+
+typedef struct {
+    FinExtAgg *a;
+    int err;
+} ExtAggIn;
+
+static int ext_group_row(void *ctx, long long idx, const Transaction *t) {
+    ExtAggIn *in = ctx;
+    (void)idx;
+    if (!fin_ext_agg_add(in->a, t)) in->err = errno;
+    return in->err;
+}
+
+/* totals category|month|year: rows, income, expense and net per group,
+   of the loaded ledger or, with -M, of the files within the budget. */
+static int totals(FinGroupKey by) {
+    ExtAggIn in = { fin_ext_agg_new(by, extBudget), 0 };
+    long long r;
+    if (!in.a) { fprintf(stderr, "Out of memory.\n"); return 1; }
+    if (extBudget) r = ext_scan(ext_group_row, &in);
+    else if ((r = need_all()) == 1) {
+        ledger_read_begin(ledger);
+        int n = ledger_count(ledger);
+        for (int i = 0; i < n && !in.err; ++i) ext_group_row(&in, i, ledger_row(ledger, i));
+        ledger_read_end(ledger);
+    }
+    if (r >= 0 && in.err) fprintf(stderr, "Grouping failed: %s\n", strerror(in.err));
+    if (r < 0 || in.err) { fin_ext_agg_free(in.a); return 1; }
+
+    op_output_begin();
+    if (writer_format(out) != FMT_TABLE) writer_begin_agg(out, GROUP_NAMES[by], "net");
+    else printf("%-24s %9s %14s %14s %14s\n", GROUP_NAMES[by], "rows", "income", "expense", "net");
+    r = fin_ext_agg_finish(in.a, print_group, NULL);
+    if (r == -1) fprintf(stderr, "Grouping failed: %s\n", strerror(errno));
+    if (writer_format(out) != FMT_TABLE && !writer_end(out) && r >= 0) r = -1;
+    FinExtStats st;
+    fin_ext_agg_stats(in.a, &st);
+    if (extBudget && r >= 0) ext_note(&st, 1);
+    fin_ext_agg_free(in.a);
+    return r > 0 ? 0 : 1;
+}
+
+/* The report commands under -M; -1 for commands that load the ledger. */
+static int run_external(int argc, char **argv) {
+    const char *cmd = argv[0];
+    int y, m, d;
+    ExtQuery q = {0};
+    ExtSums s;
+    if (strcmp(cmd, "list") == 0 && argc <= 2) {
+        SortKey key = SORT_DATE;
+        if (argc == 2 && strcmp(argv[1], "amount") == 0) key = SORT_AMOUNT_DESC;
+        else if (argc == 2 && strcmp(argv[1], "date") != 0) { usage(stderr); return 2; }
+        return ext_rows(out, argc == 2 ? &key : NULL, NULL, NULL) >= 0 ? 0 : 1;
+    }
+    if (strcmp(cmd, "search") == 0 && argc == 3) {
+        long long found;
+        if (strcmp(argv[1], "category") == 0 || strcmp(argv[1], "note") == 0) {
+            q.field = argv[1][0] == 'c' ? FIELD_CATEGORY : FIELD_NOTE;
+            for (int i = 0; argv[2][i] && i < STR_LEN - 1; ++i) q.q[i] = (char)tolower((unsigned char)argv[2][i]);
+            found = ext_rows(out, NULL, ext_match_text, &q);
+        } else if (strcmp(argv[1], "date") == 0) {
+            if (!parse_date_arg(argv[2], &q.y, &q.m, &q.d)) { fprintf(stderr, "Invalid date '%s'.\n", argv[2]); return 2; }
+            found = ext_rows(out, NULL, ext_match_date, &q);
+        } else { usage(stderr); return 2; }
+        return found > 0 ? 0 : 1;
+    }
+    if (strcmp(cmd, "filter") == 0 && argc == 2) {
+        if (!parse_amount_arg(argv[1], &q.thr)) { fprintf(stderr, "Invalid amount '%s'.\n", argv[1]); return 2; }
+        return ext_rows(out, NULL, ext_match_expense, &q) > 0 ? 0 : 1;
+    }
+    if (strcmp(cmd, "chart") == 0 && argc == 2) {
+        if (sscanf(argv[1], "%d", &y) != 1 || y < 1900 || y > 3000) { fprintf(stderr, "Invalid year '%s'.\n", argv[1]); return 2; }
+        if (!ext_sums(&s, y, 1, 1, y, 12, 31)) return 1;
+        if (!s.yearExpenses) { fprintf(stderr, "No expenses recorded for %d.\n", y); return 1; }
+        double months[13];
+        for (int k = 0; k < 13; ++k) months[k] = (double)s.months[k] / 100.0;
+        op_output_begin();
+        print_chart(y, months);
+        return 0;
+    }
+    if (strcmp(cmd, "summary") == 0 && argc == 1) {
+        if (!ext_sums(&s, 1900, 1, 1, 3000, 12, 31)) return 1;
+        print_summary((double)s.income / 100.0, (double)s.expense / 100.0);
+        return 0;
+    }
+    if (strcmp(cmd, "range") == 0 && argc == 3) {
+        int y1, m1, d1;
+        if (!parse_date_arg(argv[1], &y, &m, &d)) { fprintf(stderr, "Invalid date '%s'.\n", argv[1]); return 2; }
+        if (!parse_date_arg(argv[2], &y1, &m1, &d1)) { fprintf(stderr, "Invalid date '%s'.\n", argv[2]); return 2; }
+        if (!ext_sums(&s, y, m, d, y1, m1, d1)) return 1;
+        print_range(argv[1], argv[2], s.rows > INT_MAX ? INT_MAX : (int)s.rows,
+                    (double)s.income / 100.0, (double)s.expense / 100.0);
+        return 0;
+    }
+    if (strcmp(cmd, "export") == 0 && argc == 2) {
+        OutFormat fmt = writer_format(out);
+        FILE *f = fopen(argv[1], fmt == FMT_BINARY ? "wb" : "w");
+        Writer *w = f ? writer_new(f, fmt) : NULL;
+        long long n = w ? ext_rows(w, NULL, NULL, NULL) : -1;
+        writer_free(w);
+        if (f && fclose(f) != 0) n = -1;
+        if (n == -1) fprintf(stderr, "Export to '%s' failed.\n", argv[1]);
+        return n >= 0 ? 0 : 1;
+    }
+    return -1;
+}
+
+/* Whether the command (or the menu, with none) prints records to stdout in
+   the -o format. */
+static int prints_records(int argc, char **argv) {
+    static const char *const cmds[] = { "list", "search", "filter", "chart", "summary", "range", "totals" };
+    if (!argc) return 1;
+    for (size_t k = 0; k < sizeof(cmds) / sizeof(cmds[0]); ++k)
+        if (strcmp(argv[0], cmds[k]) == 0) return 1;
     return 0;
 }
+
+static int run_command(int argc, char **argv) {
+    const char *cmd = argv[0];
+    int y, m, d;
+
+    if (strcmp(cmd, "help") == 0) { usage(stdout); return 0; }
+    if (strcmp(cmd, "generate") == 0 && argc >= 3 && argc <= 5) return generate(argc, argv);
+    if (strcmp(cmd, "lsm") == 0 && argc >= 3) return lsm_command(argc, argv);
+    if (strcmp(cmd, "paged") == 0 && argc >= 5 && argc % 2 == 1) return paged_command(argc, argv);
+    if (sockPath) return run_remote(argc, argv);
+    if (strcmp(cmd, "replay") == 0 && (argc == 2 || (argc == 3 && strcmp(argv[2], "json") == 0)))
+        return replay(argc, argv);
+    if (extBudget) {
+        FinGroupKey by;
+        if (strcmp(cmd, "totals") == 0 && argc == 2 && parse_group(argv[1], &by)) return totals(by);
+        int rc = run_external(argc, argv);
+        if (rc >= 0) return rc;
+    }
+    if (!load_data_quiet()) return 1;
+    record(OP_LOAD);
+
+    if (strcmp(cmd, "add") == 0 && (argc == 5 || argc == 6)) {
+        double amount;
+        TxType type;
+        if (!parse_date_arg(argv[1], &y, &m, &d)) { fprintf(stderr, "Invalid date '%s'.\n", argv[1]); return 2; }
+        if (strcmp(argv[2], "income") == 0) type = INCOME;
+        else if (strcmp(argv[2], "expense") == 0) type = EXPENSE;
+        else { fprintf(stderr, "Type must be 'income' or 'expense'.\n"); return 2; }
+        if (!parse_amount_arg(argv[4], &amount) || amount <= 0.0) { fprintf(stderr, "Amount must be positive.\n"); return 2; }
+        if (!ledger_add(ledger, y, m, d, type, argv[3], amount, argc == 6 ? argv[5] : "")) {
+            fprintf(stderr, "Out of memory.\n");
+            return 1;
+        }
+        record_add(y, m, d, type, argv[3], amount, argc == 6 ? argv[5] : "");
+        return save_data() ? 0 : 1;
+    }
+    if (strcmp(cmd, "list") == 0 && argc <= 2) {
+        if (argc == 2) {
+            SortKey key;
+            if (strcmp(argv[1], "date") == 0) key = SORT_DATE;
+            else if (strcmp(argv[1], "amount") == 0) key = SORT_AMOUNT_DESC;
+            else { usage(stderr); return 2; }
+            int r = need_all();
+            if (r == 1) r = ledger_sort(ledger, key);
+            if (r == 0) fprintf(stderr, "Out of memory.\n");
+            if (r != 1) return 1;
+            finbuf_put_le(&recReq, key, 1);
+            record(OP_SORT);
+        }
+        return write_all_rows(out) == 1 ? 0 : 1;
+    }
+    if (strcmp(cmd, "search") == 0 && argc == 3) {
+        int found;
+        if (strcmp(argv[1], "category") == 0) found = search_text(FIELD_CATEGORY, argv[2]);
+        else if (strcmp(argv[1], "note") == 0) found = search_text(FIELD_NOTE, argv[2]);
+        else if (strcmp(argv[1], "date") == 0) {
+            if (!parse_date_arg(argv[2], &y, &m, &d)) { fprintf(stderr, "Invalid date '%s'.\n", argv[2]); return 2; }
+            found = search_date(y, m, d);
+        } else { usage(stderr); return 2; }
+        return found > 0 ? 0 : 1;
+    }
+    if (strcmp(cmd, "filter") == 0 && argc == 2) {
+        double thr;
+        if (!parse_amount_arg(argv[1], &thr)) { fprintf(stderr, "Invalid amount '%s'.\n", argv[1]); return 2; }
+        return filter_expenses(thr) > 0 ? 0 : 1;
+    }
+    if (strcmp(cmd, "chart") == 0 && argc == 2) {
+        if (sscanf(argv[1], "%d", &y) != 1 || y < 1900 || y > 3000) { fprintf(stderr, "Invalid year '%s'.\n", argv[1]); return 2; }
+        int r = expense_chart(y);
+        if (r > 0) return 0;
+        if (r == 0) fprintf(stderr, "No expenses recorded for %d.\n", y);
+        return 1;
+    }
+    if (strcmp(cmd, "summary") == 0 && argc == 1) {
+        show_summary();
+        return 0;
+    }
+    if (strcmp(cmd, "range") == 0 && argc == 3) {
+        int y1, m1, d1;
+        double income, expense;
+        if (!parse_date_arg(argv[1], &y, &m, &d)) { fprintf(stderr, "Invalid date '%s'.\n", argv[1]); return 2; }
+        if (!parse_date_arg(argv[2], &y1, &m1, &d1)) { fprintf(stderr, "Invalid date '%s'.\n", argv[2]); return 2; }
+        if (need_years(y, y1) != 1) return 1;
+        put_range(&recReq, y, m, d, y1, m1, d1);
+        record(OP_RANGE_SUM);
+        int rows = ledger_range_totals(ledger, y, m, d, y1, m1, d1, &income, &expense);
+        if (rows < 0) return 1;
+        print_range(argv[1], argv[2], rows, income, expense);
+        return 0;
+    }
+    if (strcmp(cmd, "totals") == 0 && argc == 2) {
+        FinGroupKey by;
+        if (!parse_group(argv[1], &by)) { usage(stderr); return 2; }
+        return totals(by);
+    }
+    if (strcmp(cmd, "import") == 0 && argc == 2) {
+        IngestStats st;
+        if (need_all() != 1) return 1;                    // duplicates may be archived
+        int added = ledger_import(ledger, argv[1], &st);
+        if (added == FIN_CANCELLED) return 1;
+        if (added < 0) { fprintf(stderr, "Cannot read '%s': %s\n", argv[1], strerror(errno)); return 1; }
+        if (!save_data()) return 1;
+        fprintf(stderr, "Imported %d record(s), skipped %ld duplicate(s) and %ld bad line(s). Total = %d\n",
+                added, st.duplicates, st.malformed + st.rejected, ledger_count(ledger));
+        return 0;
+    }
+    if (strcmp(cmd, "export") == 0 && argc == 2) {
+        int r = export_to_file(argv[1]);
+        if (r == 0) fprintf(stderr, "Export to '%s' failed.\n", argv[1]);
+        if (r != 1) return 1;
+        return 0;
+    }
+    if (strcmp(cmd, "pack") == 0 && argc == 2) {
+        if (!ledger_save_packed(ledger, argv[1])) { fprintf(stderr, "Cannot write '%s': %s\n", argv[1], strerror(errno)); return 1; }
+        FILE *f = fopen(argv[1], "rb");
+        long bytes = f && fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+        if (f) fclose(f);
+        int n = ledger_count(ledger);
+        fprintf(stderr, "Packed %d record(s) into '%s': %ld bytes, %.1f per record.\n",
+                n, argv[1], bytes, n ? (double)bytes / n : 0.0);
+        return 0;
+    }
+    if (strcmp(cmd, "memory") == 0 && (argc == 1 || (argc == 2 && strcmp(argv[1], "json") == 0))) {
+        if (argc == 2) return fin_mem_write_json(stdout, ledger) ? 0 : 1;
+        print_memory_report(stdout);
+        return 0;
+    }
+    if (strcmp(cmd, "archive") == 0 && argc <= 2) {
+        if (argc == 2) {
+            char *end;
+            hotYears = (int)strtol(argv[1], &end, 10);
+            if (*end || hotYears < 1) { fprintf(stderr, "Invalid year count '%s'.\n", argv[1]); return 2; }
+            rearchive = 1;
+            if (!open_tier()) return 1;
+            if (!save_data()) return 1;
+        }
+        if (tier) print_tier(stdout);
+        else printf("No archive for '%s'.\n", dataFile);
+        return 0;
+    }
+    if (strcmp(cmd, "daemon") == 0 && argc <= 2) {
+        const char *path = argc == 2 ? argv[1] : FIN_DEFAULT_SOCKET;
+        fprintf(stderr, "Serving %d record(s) from '%s' on '%s'.\n", ledger_count(ledger), dataFile, path);
+        fin_control_attach(NULL);            // -t bounds the load, not the daemon
+        if (!fin_daemon_run(ledger, path, dataFile)) { fprintf(stderr, "Daemon failed: %s\n", strerror(errno)); return 1; }
+        return 0;
+    }
+    usage(stderr);
+    return 2;
+}
+
+/* -p [OFFSET,]LIMIT */
+static int parse_page(const char *s) {
+    char *end;
+    long a = strtol(s, &end, 10), b = -1;
+    if (end == s || a < 0 || a > INT_MAX) return 0;
+    if (*end == ',') {
+        const char *t = end + 1;
+        b = strtol(t, &end, 10);
+        if (end == t || b < 0 || b > INT_MAX) return 0;
+    }
+    if (*end || (b < 0 ? a : b) == 0) return 0;         // a zero limit prints nothing
+    pageOffset = b < 0 ? 0 : (int)a;
+    pageLimit = b < 0 ? (int)a : (int)b;
+    return 1;
+}
+
+/* -M MB */
+static int parse_budget(const char *s) {
+    char *end;
+    double mb = strtod(s, &end);
+    if (end == s || *end || !(mb > 0.0 && mb < 1e9)) return 0;
+    extBudget = (long long)(mb * 1048576.0);
+    return 1;
+}
+
+/* Progress ticks wait on the monotonic clock, so setting the wall clock
+   neither stalls nor floods them. */
+static void op_init(void) {
+    pthread_condattr_t a;
+    pthread_condattr_init(&a);
+    pthread_condattr_setclock(&a, CLOCK_MONOTONIC);
+    pthread_cond_init(&opDone, &a);
+    pthread_condattr_destroy(&a);
+}
+
+int main(int argc, char **argv) {
+    OutFormat fmt = FMT_TABLE;
+    int argi = 1, rc, threads = 0;
+    char *end;
+    FinControl *cliCtl = NULL;
+    while (argi < argc && argv[argi][0] == '-') {
+        if (strcmp(argv[argi], "-f") == 0 && argi + 1 < argc) dataFile = argv[argi + 1];
+        else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc && fin_parse_format(argv[argi + 1], &fmt)) {}
+        else if (strcmp(argv[argi], "-s") == 0 && argi + 1 < argc) sockPath = argv[argi + 1];
+        else if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc
+                 && (threads = (int)strtol(argv[argi + 1], &end, 10)) > 0 && !*end) {}
+        else if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc
+                 && (opTimeout = strtod(argv[argi + 1], &end)) > 0 && !*end) {}
+        else if (strcmp(argv[argi], "-S") == 0 && argi + 1 < argc) statsFile = argv[argi + 1];
+        else if (strcmp(argv[argi], "-T") == 0 && argi + 1 < argc) traceFile = argv[argi + 1];
+        else if (strcmp(argv[argi], "-R") == 0 && argi + 1 < argc) recordFile = argv[argi + 1];
+        else if (strcmp(argv[argi], "-p") == 0 && argi + 1 < argc && parse_page(argv[argi + 1])) {}
+        else if (strcmp(argv[argi], "-A") == 0 && argi + 1 < argc
+                 && (hotYears = (int)strtol(argv[argi + 1], &end, 10)) > 0 && !*end) {}
+        else if (strcmp(argv[argi], "-M") == 0 && argi + 1 < argc && parse_budget(argv[argi + 1])) {}
+        else { usage(stderr); return 2; }
+        argi += 2;
+    }
+    if (fmt == FMT_BINARY && isatty(STDOUT_FILENO) && prints_records(argc - argi, argv + argi)) {
+        fprintf(stderr, "Not writing binary records to a terminal; redirect stdout.\n");
+        return 2;
+    }
+    op_init();
+    if (traceFile) {
+        fin_trace_start(0);
+        fin_trace_thread_name("main");
+    }
+    if (threads) fin_pool_init(threads);
+    if (recordFile && !(recorder = fin_record_open(recordFile))) {
+        fprintf(stderr, "Cannot record to '%s': %s\n", recordFile,
+                errno == EINVAL ? "not a session log" : strerror(errno));
+        return 1;
+    }
+
+    ledger = ledger_new();
+    out = writer_new(stdout, fmt);
+    if (!ledger || !out) { fprintf(stderr, "Out of memory.\n"); return 1; }
+
+    if (argi < argc) {
+        if (opTimeout > 0 && (cliCtl = fin_control_new(opTimeout))) fin_control_attach(cliCtl);
+        rc = run_command(argc - argi, argv + argi);
+        if (cliCtl && fin_control_status(cliCtl) == FIN_STOP_TIMEOUT) {
+            fprintf(stderr, "Timed out after %g s.\n", opTimeout);
+            rc = 1;
+        }
+        fin_control_attach(NULL);
+        fin_control_free(cliCtl);
+    } else {
+        signal(SIGINT, on_sigint);
+        // Try to load existing data on startup (optional)
+        load_from_file(dataFile); // ignore error if file doesn't exist
+        printf("Welcome! %d existing record(s) loaded (if any) from %s.\n", ledger_count(ledger), dataFile);
+        if (tier) {
+            FinTierStats st;
+            fin_tier_stats(tier, &st);
+            if (st.archivedRows)
+                printf("%lld record(s) dated before %d stay archived until needed.\n", st.archivedRows, st.hotFrom);
+        }
+        menu();
+        rc = 0;
+    }
+
+    if (statsFile && !write_stats(statsFile) && rc == 0) rc = 1;
+    if (traceFile && !write_trace(traceFile) && rc == 0) rc = 1;
+    if (recorder && !fin_record_close(recorder)) {
+        fprintf(stderr, "Recording to '%s' failed.\n", recordFile);
+        if (rc == 0) rc = 1;
+    }
+    if (remote_fd >= 0) close(remote_fd);
+    finbuf_free(&recReq);
+    finbuf_free(&remoteReq);
+    finbuf_free(&remoteResp);
+    writer_free(out);
+    rowset_free(&hits);
+    fin_tier_close(tier);
+    ledger_free(ledger);
+    fin_pool_shutdown();
+    return rc;
+}
@@ -0,0 +1,60 @@
+/* Shared helpers for the tests in this directory: CHECK() records a
+   failure and carries on, so one run reports every broken expectation. */
+#ifndef CHECK_H
+#define CHECK_H
+
+#include "../finance.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+#define CHECK(c) do { if (!(c)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #c); failures++; } } while (0)
+
+/* A synthetic ledger of rows rows (fin_generate), in date order. */
+static inline Ledger *gen_ledger(long rows, unsigned long long seed) {
+    GenSpec spec = { seed, rows, 2016, 10, 0 };
+    FILE *f = tmpfile();
+    Ledger *L = ledger_new();
+    if (!f || !L || fin_generate(f, &spec) != 1) { fprintf(stderr, "cannot generate a ledger\n"); exit(2); }
+    rewind(f);
+    if (ledger_read_stream(L, f) != rows) { fprintf(stderr, "cannot read the generated ledger\n"); exit(2); }
+    fclose(f);
+    return L;
+}
+
+static inline int same_row(const Transaction *a, const Transaction *b) {
+    return a->y == b->y && a->m == b->m && a->d == b->d && a->type == b->type
+        && fin_cents(a->amount) == fin_cents(b->amount)
+        && strcmp(a->category, b->category) == 0 && strcmp(a->note, b->note) == 0;
+}
+
+/* 1 if A and B hold the same rows in the same order. */
+static inline int same_ledger(const Ledger *A, const Ledger *B) {
+    int n = ledger_count(A);
+    if (n != ledger_count(B)) return 0;
+    for (int i = 0; i < n; ++i) if (!same_row(ledger_row(A, i), ledger_row(B, i))) return 0;
+    return 1;
+}
+
+/* A fresh directory under $TMPDIR (or /tmp); rm -r'd by tmp_remove(). */
+static inline const char *tmp_dir(char *buf, size_t n) {
+    const char *base = getenv("TMPDIR");
+    snprintf(buf, n, "%s/fintest.XXXXXX", base && *base ? base : "/tmp");
+    if (!mkdtemp(buf)) { perror("mkdtemp"); exit(2); }
+    return buf;
+}
+
+static inline void tmp_remove(const char *dir) {
+    char cmd[4200];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+    if (system(cmd) != 0) fprintf(stderr, "cannot remove %s\n", dir);
+}
+
+static inline int report(const char *name) {
+    if (failures) return 1;
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif
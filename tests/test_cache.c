@@ -0,0 +1,109 @@
+/* Block cache under a budget of a few blocks: it stays within budget,
+   always returns the right bytes, never evicts a pinned block, keeps a
+   reused pair of blocks through a long one-off scan, and drops a file's
+   blocks even while one is pinned. */
+#define _POSIX_C_SOURCE 200809L
+#include "check.h"
+
+#define BLOCK 1000
+
+typedef struct {
+    unsigned long long block;
+    long *loads;
+} Load;
+
+static unsigned char *load(void *ctx, size_t *len) {
+    Load *l = ctx;
+    unsigned char *p = fin_malloc(MEM_CACHE, BLOCK);
+    if (!p) return NULL;
+    memset(p, (int)(l->block % 251), BLOCK);
+    (*l->loads)++;
+    *len = BLOCK;
+    return p;
+}
+
+static int holds(const unsigned char *p, size_t len, unsigned long long block) {
+    if (!p || len != BLOCK) return 0;
+    for (size_t i = 0; i < len; ++i) if (p[i] != (unsigned char)(block % 251)) return 0;
+    return 1;
+}
+
+/* Gets and checks one block; pinned if pin is non-NULL, else released. */
+static const unsigned char *get(FinCache *c, unsigned long long file, unsigned long long block, long *loads,
+                                FinCacheRef **pin) {
+    Load l = { block, loads };
+    FinCacheRef *ref = NULL;
+    size_t len = 0;
+    const unsigned char *p = fin_cache_get(c, file, block, load, &l, &len, &ref);
+    CHECK(holds(p, len, block));
+    if (pin) *pin = ref;
+    else fin_cache_release(ref);
+    return p;
+}
+
+int main(void) {
+    long long budget = 4 * BLOCK;             // three blocks and their overhead
+    FinCache *c = fin_cache_new(budget, 1);
+    CHECK(c != NULL);
+    if (!c) return 1;
+    unsigned long long file = fin_cache_file_id();
+    FinCacheStats st;
+    long loads = 0;
+
+    // Within budget after every access, with evictions doing the work.
+    for (unsigned long long b = 0; b < 200; ++b) {
+        get(c, file, b, &loads, NULL);
+        fin_cache_stats(c, &st);
+        CHECK(st.bytes <= budget);
+    }
+    CHECK(loads == 200);
+    CHECK(st.evictions >= 190);
+
+    // A pinned block survives a scan and still holds its bytes.
+    FinCacheRef *pin;
+    const unsigned char *kept = get(c, file, 1000, &loads, &pin);
+    for (unsigned long long b = 2000; b < 2100; ++b) get(c, file, b, &loads, NULL);
+    CHECK(holds(kept, BLOCK, 1000));
+    fin_cache_release(pin);
+    fin_cache_stats(c, &st);
+    CHECK(st.bytes <= budget);
+
+    // Two blocks used again and again turn hot and outlast a one-off scan.
+    for (int r = 0; r < 4; ++r) {
+        get(c, file, 5000, &loads, NULL);
+        get(c, file, 5001, &loads, NULL);
+        for (unsigned long long b = 6000 + 10 * (unsigned)r; b < 6010 + 10 * (unsigned)r; ++b) get(c, file, b, &loads, NULL);
+    }
+    for (unsigned long long b = 7000; b < 7500; ++b) get(c, file, b, &loads, NULL);
+    long before = loads;
+    get(c, file, 5000, &loads, NULL);
+    get(c, file, 5001, &loads, NULL);
+    CHECK(loads == before);
+    fin_cache_stats(c, &st);
+    CHECK(st.promotions + st.ghostHits > 0);
+
+    // Dropping the file frees what is not pinned; the pinned block stays
+    // readable until it is released.
+    kept = get(c, file, 9000, &loads, &pin);
+    fin_cache_drop_file(c, file);
+    fin_cache_stats(c, &st);
+    CHECK(st.blocks == 0 && st.bytes == 0);
+    CHECK(holds(kept, BLOCK, 9000));
+    fin_cache_release(pin);
+    before = loads;
+    get(c, file, 9000, &loads, NULL);
+    CHECK(loads == before + 1);
+    fin_cache_free(c);
+
+    // A zero budget caches nothing once a block is released.
+    c = fin_cache_new(0, 4);
+    CHECK(c != NULL);
+    if (c) {
+        loads = 0;
+        for (int r = 0; r < 3; ++r) get(c, file, 1, &loads, NULL);
+        fin_cache_stats(c, &st);
+        CHECK(loads == 3 && st.bytes == 0);
+        fin_cache_free(c);
+    }
+    return report("test_cache");
+}
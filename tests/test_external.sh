@@ -0,0 +1,47 @@
+#!/bin/sh
+# -M must print what the in-memory commands print: every report command,
+# in every text format, over a text and a packed copy of one ledger, with
+# a budget small enough that sorts merge runs from temporary files.
+set -u
+BIN=${BIN:-./finance_tracker}
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/fintest.XXXXXX") || exit 2
+trap 'rm -rf "$DIR"' EXIT
+fail=0
+
+"$BIN" -f "$DIR/text" generate 60000 "$DIR/text" 75 >/dev/null 2>&1 || exit 2
+"$BIN" -f "$DIR/text" pack "$DIR/packed" >/dev/null 2>&1 || exit 2
+
+compare() {    # compare FILE ARGS...
+    file=$1; shift
+    "$BIN" -f "$file" "$@" >"$DIR/mem" 2>/dev/null; a=$?
+    "$BIN" -f "$file" -M 1 "$@" >"$DIR/ext" 2>/dev/null; b=$?
+    if [ $a -ne $b ] || ! cmp -s "$DIR/mem" "$DIR/ext"; then
+        echo "test_external: -M differs on $(basename "$file"): $*" >&2
+        fail=1
+    fi
+}
+
+for file in "$DIR/text" "$DIR/packed"; do
+    for fmt in table csv jsonl; do
+        compare "$file" -o $fmt list
+        compare "$file" -o $fmt list date
+        compare "$file" -o $fmt list amount
+        compare "$file" -o $fmt -p 1000,25 list amount
+        compare "$file" -o $fmt search category groc
+        compare "$file" -o $fmt search note coffee
+        compare "$file" -o $fmt search date 2021-03-04
+        compare "$file" -o $fmt filter 500
+        compare "$file" -o $fmt chart 2024
+        compare "$file" -o $fmt summary
+        compare "$file" -o $fmt range 2018-02-03 2022-11-30
+        compare "$file" -o $fmt totals category
+        compare "$file" -o $fmt totals month
+        compare "$file" -o $fmt totals year
+    done
+    "$BIN" -f "$file" -o csv export "$DIR/mem.csv" >/dev/null 2>&1
+    "$BIN" -f "$file" -o csv -M 1 export "$DIR/ext.csv" >/dev/null 2>&1
+    cmp -s "$DIR/mem.csv" "$DIR/ext.csv" || { echo "test_external: -M differs on $(basename "$file"): export" >&2; fail=1; }
+done
+
+[ $fail -eq 0 ] && echo "test_external: ok"
+exit $fail
@@ -0,0 +1,90 @@
+/* Import pipeline: a read error or an overlong line.
+   A stream that fails part way must leave the ledger as it was and
+   report the error; a line longer than a read block must arrive whole. */
+#define _GNU_SOURCE
+#include "check.h"
+#include <errno.h>
+
+typedef struct {
+    const char *text;
+    size_t len, at, failAt;       // read() fails with EIO once at reaches failAt
+} Source;
+
+static ssize_t source_read(void *c, char *buf, size_t n) {
+    Source *s = c;
+    if (s->at >= s->failAt) { errno = EIO; return -1; }
+    if (n > s->len - s->at) n = s->len - s->at;
+    if (n > s->failAt - s->at) n = s->failAt - s->at;
+    memcpy(buf, s->text + s->at, n);
+    s->at += n;
+    return (ssize_t)n;
+}
+
+static FILE *source_open(Source *s) {
+    cookie_io_functions_t io = { .read = source_read };
+    return fopencookie(s, "r", io);
+}
+
+static char *lines(int n, size_t *len) {
+    char *t = malloc((size_t)n * 64), *p = t;
+    for (int i = 0; i < n; ++i) p += sprintf(p, "2024|%d|%d|1|Food|%d.25|row %d\n", i % 12 + 1, i % 28 + 1, i, i);
+    *len = (size_t)(p - t);
+    return t;
+}
+
+static void test_read_error(void) {
+    Ledger *L = ledger_new();
+    CHECK(ledger_add(L, 2020, 1, 1, INCOME, "Salary", 100.0, "before"));
+    size_t len;
+    char *t = lines(100000, &len);                 // several read blocks
+    Source s = { t, len, 0, len - 1000 };
+    FILE *f = source_open(&s);
+    IngestStats st;
+    errno = 0;
+    int r = ledger_ingest(L, f, 0, &st);
+    CHECK(r == -1);
+    CHECK(errno == EIO);
+    CHECK(ledger_count(L) == 1);
+    CHECK(strcmp(ledger_row(L, 0)->note, "before") == 0);
+    fclose(f);
+
+    s.at = 0;                                     // and a clean read of the same text stores it all
+    s.failAt = (size_t)-1;
+    f = source_open(&s);
+    CHECK(ledger_ingest(L, f, 0, &st) == 100000);
+    CHECK(ledger_count(L) == 100001);
+    fclose(f);
+    free(t);
+    ledger_free(L);
+}
+
+static void test_overlong_line(void) {
+    size_t big = 3u << 20;                        // longer than a read block
+    char *t = malloc(big + 256), *p = t;
+    p += sprintf(p, "2024|1|2|1|Food|1.00|first\n2024|1|3|1|Food|2.00|");
+    memset(p, 'x', big);
+    p += big;
+    p += sprintf(p, "\n2024|1|4|1|Food|3.00|last\n");
+    Source s = { t, (size_t)(p - t), 0, (size_t)-1 };
+    FILE *f = source_open(&s);
+    Ledger *L = ledger_new();
+    IngestStats st;
+    CHECK(ledger_ingest(L, f, 0, &st) == 3);
+    CHECK(st.lines == 3);
+    CHECK(st.malformed == 0);
+    CHECK(ledger_count(L) == 3);
+    if (ledger_count(L) == 3) {
+        CHECK(ledger_row(L, 1)->amount == 2.0);
+        CHECK(ledger_row(L, 1)->note[0] == 'x');
+        CHECK(strcmp(ledger_row(L, 2)->note, "last") == 0);
+    }
+    fclose(f);
+    free(t);
+    ledger_free(L);
+}
+
+int main(void) {
+    test_read_error();
+    test_overlong_line();
+    return report("test_ingest");
+}
@@ -0,0 +1,100 @@
+/* LSM store: rows put through many flushes and compactions, some of them
+   deleted, come back after a reopen exactly as the ledger holds them, in
+   date order, under both compaction policies; one-day lookups match
+   ledger_search_date(). */
+#define _POSIX_C_SOURCE 200809L
+#include "check.h"
+
+#define ROWS 40000
+
+typedef struct {
+    Transaction *rows;
+    unsigned long long *seqs;
+    long n;
+} Scan;
+
+static int collect(void *ctx, unsigned long long seq, const Transaction *t) {
+    Scan *s = ctx;
+    s->rows[s->n] = *t;
+    s->seqs[s->n++] = seq;
+    return 0;
+}
+
+static long scan_all(FinLsm *db, Scan *s) {
+    s->n = 0;
+    return fin_lsm_scan(db, 1900, 1, 1, 3000, 12, 31, collect, s);
+}
+
+static void test_policy(const Ledger *L, FinLsmPolicy policy) {
+    char dir[4096];
+    tmp_dir(dir, sizeof(dir));
+    FinLsmOptions opt = { policy, 2048, 3, 10 };
+    FinLsm *db = fin_lsm_open(dir, &opt);
+    CHECK(db != NULL);
+    if (!db) return;
+    ledger_read_begin(L);
+    for (int i = 0; i < ROWS; i += 1000) CHECK(fin_lsm_put(db, ledger_row(L, i), 1000, NULL) == 1000);
+    ledger_read_end(L);
+
+    Scan s = { malloc(ROWS * sizeof(Transaction)), malloc(ROWS * sizeof(unsigned long long)), 0 };
+    CHECK(scan_all(db, &s) == ROWS);
+    int same = s.n == ROWS;
+    for (long i = 0; same && i < ROWS; ++i) same = same_row(&s.rows[i], ledger_row(L, (int)i));
+    CHECK(same);
+
+    // Delete every tenth row, then reopen: the WAL and runs must agree.
+    unsigned char *gone = calloc(ROWS, 1);
+    for (long i = 0; i < s.n; i += 10) {
+        CHECK(fin_lsm_delete(db, s.rows[i].y, s.rows[i].m, s.rows[i].d, s.seqs[i]));
+        gone[i] = 1;
+    }
+    CHECK(fin_lsm_close(db));
+    db = fin_lsm_open(dir, NULL);
+    CHECK(db != NULL);
+    if (db) {
+        FinLsmStats st;
+        fin_lsm_stats(db, &st);
+        CHECK(st.policy == policy);
+        CHECK(st.flushes > 0 && st.compactions > 0);
+        long live = scan_all(db, &s), k = 0;
+        CHECK(live == ROWS - ROWS / 10);
+        same = 1;
+        for (long i = 0; same && i < ROWS; ++i) {
+            if (gone[i]) continue;
+            same = k < s.n && same_row(&s.rows[k++], ledger_row(L, (int)i));
+        }
+        CHECK(same);
+
+        // One-day lookups go through the bloom filters; compare with the ledger.
+        RowSet rs = {0};
+        const int days[][3] = { {2016, 1, 1}, {2019, 7, 4}, {2022, 2, 28}, {2025, 12, 31}, {2030, 1, 1} };
+        for (int d = 0; d < 5; ++d) {
+            s.n = 0;
+            long got = fin_lsm_scan(db, days[d][0], days[d][1], days[d][2], days[d][0], days[d][1], days[d][2], collect, &s);
+            int want = ledger_search_date(L, days[d][0], days[d][1], days[d][2], &rs), kept = 0;
+            for (int i = 0; i < want; ++i) {
+                if (gone[rs.ids[i]]) continue;
+                CHECK(kept < s.n && same_row(&s.rows[kept], ledger_row(L, rs.ids[i])));
+                kept++;
+            }
+            CHECK(got == kept);
+        }
+        rowset_free(&rs);
+
+        CHECK(fin_lsm_compact(db));
+        CHECK(scan_all(db, &s) == live);
+        CHECK(fin_lsm_close(db));
+    }
+    free(gone);
+    free(s.rows);
+    free(s.seqs);
+    tmp_remove(dir);
+}
+
+int main(void) {
+    Ledger *L = gen_ledger(ROWS, 69);
+    test_policy(L, LSM_LEVELED);
+    test_policy(L, LSM_TIERED);
+    ledger_free(L);
+    return report("test_lsm");
+}
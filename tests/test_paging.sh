@@ -0,0 +1,48 @@
+#!/bin/sh
+# -p pages, concatenated, must print what one unpaged run prints, for a
+# result several FIN_PAGE_ROWS (4096) replies long; so must a daemon
+# client, which fetches such a result with OP_PAGE.
+set -u
+BIN=${BIN:-./finance_tracker}
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/fintest.XXXXXX") || exit 2
+PID=
+trap '[ -n "$PID" ] && kill $PID 2>/dev/null; rm -rf "$DIR"' EXIT
+fail=0
+
+"$BIN" -f "$DIR/text" generate 30000 "$DIR/text" 72 >/dev/null 2>&1 || exit 2
+
+pages() {      # pages SIZE ARGS... : the body of every -p page in turn
+    size=$1; shift
+    total=$("$BIN" -f "$DIR/text" -o csv "$@" 2>/dev/null | wc -l)
+    off=0
+    while [ $off -lt $total ]; do
+        "$BIN" -f "$DIR/text" -o csv -p $off,$size "$@" 2>/dev/null | tail -n +2
+        off=$((off + size))
+    done
+}
+
+check() {      # check local|remote ARGS... (remote: also through the daemon)
+    where=$1; shift
+    "$BIN" -f "$DIR/text" -o csv "$@" 2>/dev/null | tail -n +2 >"$DIR/full"
+    [ $(wc -l <"$DIR/full") -gt 8192 ] || { echo "test_paging: too few rows for: $*" >&2; fail=1; }
+    for size in 4096 5000; do
+        pages $size "$@" >"$DIR/paged"
+        cmp -s "$DIR/full" "$DIR/paged" || { echo "test_paging: -p $size pages differ: $*" >&2; fail=1; }
+    done
+    [ $where = remote ] || return
+    "$BIN" -s "$DIR/sock" -o csv "$@" 2>/dev/null | tail -n +2 >"$DIR/remote"
+    cmp -s "$DIR/full" "$DIR/remote" || { echo "test_paging: daemon differs: $*" >&2; fail=1; }
+}
+
+"$BIN" -f "$DIR/text" daemon "$DIR/sock" >/dev/null 2>&1 &
+PID=$!
+n=0
+while [ ! -S "$DIR/sock" ] && [ $n -lt 50 ]; do sleep 0.1; n=$((n + 1)); done
+
+check remote list
+check local list amount
+check remote filter 20
+check remote search category e
+
+[ $fail -eq 0 ] && echo "test_paging: ok"
+exit $fail
@@ -0,0 +1,181 @@
+/* Queries on the encoded column blocks return what a plain scan of the
+   rows returns: over full blocks whose dates, amounts or both fall back
+   to the rows, a partial last block, sub-cent amounts and thresholds
+   next to them, before and after a delete and a sort. OP_PAGE pages of
+   a result larger than FIN_PAGE_ROWS add up to the whole result. */
+#define _POSIX_C_SOURCE 200809L
+#include "check.h"
+
+#define SCAN_BLOCK 16384                 // as in finance.c
+#define ROWS       (3 * SCAN_BLOCK + 5000)
+
+static const char *const CATS[] = { "Groceries", "Rent", "Salary", "Coffee", "Fuel", "Dining", "Misc" };
+static const char *const NOTES[] = { "", "morning coffee", "weekly shop", "COFFEE beans", "refund" };
+
+static unsigned long long rng = 71;
+
+static unsigned next(void) {
+    rng = rng * 6364136223846793005ull + 1442695040888963407ull;
+    return (unsigned)(rng >> 33);
+}
+
+/* Block 0 holds a huge amount (its amounts take the row path), block 1
+   sub-cent amounts, block 2 a date too far ahead for its date offsets;
+   every block has amounts right at the filter thresholds below. Only
+   block 3, the partial one, always takes the row path. */
+static Ledger *build(void) {
+    static const double EDGE[] = { 100.0, 100.01, 99.99, 0.01, 1234.56 };
+    Ledger *L = ledger_new();
+    if (!L) exit(2);
+    for (int i = 0; i < ROWS; ++i) {
+        int block = i / SCAN_BLOCK, y = 2020 + (int)(next() % 3), m = 1 + (int)(next() % 12), d = 1 + (int)(next() % 28);
+        double amount = (double)(next() % 200000) / 100.0;
+        if (i % 101 == 0) amount = EDGE[(i / 101) % 5];
+        if (block == 1 && i % 97 == 0) amount = i % 2 ? 100.005 : amount + 0.0025;
+        if (block == 0 && i == 777) amount = 999999999.99;
+        if (block == 2 && i == 2 * SCAN_BLOCK + 5) y = 2200;
+        TxType type = next() % 3 ? EXPENSE : INCOME;
+        if (!ledger_add(L, y, m, d, type, CATS[next() % 7], amount, NOTES[next() % 5])) exit(2);
+    }
+    return L;
+}
+
+/* A query's ids must be every index the predicate accepts, in order. */
+static int same_ids(const Ledger *L, const RowSet *rs, int found, int (*pred)(const Transaction *, const void *),
+                    const void *arg) {
+    int k = 0;
+    if (found != rs->count) return 0;
+    for (int i = 0; i < ledger_count(L); ++i) {
+        if (!pred(ledger_row(L, i), arg)) continue;
+        if (k >= rs->count || rs->ids[k] != i) return 0;
+        k++;
+    }
+    return k == rs->count;
+}
+
+static int pred_expense_over(const Transaction *t, const void *arg) {
+    return t->type == EXPENSE && t->amount > *(const double *)arg;
+}
+
+static int pred_date(const Transaction *t, const void *arg) {
+    const int *ymd = arg;
+    return t->y == ymd[0] && t->m == ymd[1] && t->d == ymd[2];
+}
+
+static int contains(const char *s, const char *q) {
+    char a[NOTE_LEN], b[NOTE_LEN];
+    size_t k;
+    for (k = 0; s[k] && k < sizeof(a) - 1; ++k) a[k] = (char)(s[k] >= 'A' && s[k] <= 'Z' ? s[k] + 32 : s[k]);
+    a[k] = '\0';
+    for (k = 0; q[k] && k < sizeof(b) - 1; ++k) b[k] = (char)(q[k] >= 'A' && q[k] <= 'Z' ? q[k] + 32 : q[k]);
+    b[k] = '\0';
+    return strstr(a, b) != NULL;
+}
+
+static int pred_category(const Transaction *t, const void *arg) { return contains(t->category, arg); }
+static int pred_note(const Transaction *t, const void *arg) { return contains(t->note, arg); }
+
+static void check_queries(const Ledger *L) {
+    static const double THRESH[] = { -1.0, 0.0, 0.005, 99.99, 100.0, 100.004, 100.005, 100.0051, 1234.56, 1999.99, 1e15 };
+    static const int DATES[][3] = { { 2020, 1, 1 }, { 2021, 6, 15 }, { 2022, 12, 28 }, { 2200, 0, 0 }, { 2019, 5, 5 } };
+    static const char *const TEXT[] = { "groc", "COFFEE", "e", "nothing" };
+    RowSet rs = {0};
+
+    for (size_t k = 0; k < sizeof(THRESH) / sizeof(THRESH[0]); ++k)
+        CHECK(same_ids(L, &rs, ledger_filter_expenses(L, THRESH[k], &rs), pred_expense_over, &THRESH[k]));
+    for (size_t k = 0; k < sizeof(DATES) / sizeof(DATES[0]); ++k)
+        CHECK(same_ids(L, &rs, ledger_search_date(L, DATES[k][0], DATES[k][1], DATES[k][2], &rs), pred_date, DATES[k]));
+    const Transaction *far = ledger_row(L, 2 * SCAN_BLOCK + 5);
+    int old[3] = { far->y, far->m, far->d };
+    CHECK(same_ids(L, &rs, ledger_search_date(L, old[0], old[1], old[2], &rs), pred_date, old));
+    for (size_t k = 0; k < sizeof(TEXT) / sizeof(TEXT[0]); ++k) {
+        CHECK(same_ids(L, &rs, ledger_search_text(L, FIELD_CATEGORY, TEXT[k], &rs), pred_category, TEXT[k]));
+        CHECK(same_ids(L, &rs, ledger_search_text(L, FIELD_NOTE, TEXT[k], &rs), pred_note, TEXT[k]));
+    }
+    rowset_free(&rs);
+
+    // Aggregates sum whole cents, so a plain sum of fin_cents() is exact.
+    static const int RANGES[][6] = { { 2020, 1, 1, 2022, 12, 31 }, { 2021, 3, 4, 2021, 9, 30 }, { 1800, 1, 1, 2100, 1, 1 } };
+    for (size_t k = 0; k < sizeof(RANGES) / sizeof(RANGES[0]); ++k) {
+        const int *r = RANGES[k];
+        long long inc = 0, exp = 0;
+        int n = 0, lo = r[0] * 10000 + r[1] * 100 + r[2], hi = r[3] * 10000 + r[4] * 100 + r[5];
+        for (int i = 0; i < ledger_count(L); ++i) {
+            const Transaction *t = ledger_row(L, i);
+            int key = t->y * 10000 + t->m * 100 + t->d;
+            if (key < lo || key > hi) continue;
+            n++;
+            if (t->type == INCOME) inc += fin_cents(t->amount); else exp += fin_cents(t->amount);
+        }
+        double gotInc, gotExp;
+        CHECK(ledger_range_totals(L, r[0], r[1], r[2], r[3], r[4], r[5], &gotInc, &gotExp) == n);
+        CHECK(gotInc == (double)inc / 100.0 && gotExp == (double)exp / 100.0);
+    }
+    for (int year = 2020; year <= 2022; ++year) {
+        long long want[13] = {0};
+        double sums[13];
+        for (int i = 0; i < ledger_count(L); ++i) {
+            const Transaction *t = ledger_row(L, i);
+            if (t->y == year && t->type == EXPENSE && t->m >= 1 && t->m <= 12) want[t->m] += fin_cents(t->amount);
+        }
+        CHECK(ledger_monthly_expenses(L, year, sums) == 1);
+        for (int mo = 1; mo <= 12; ++mo) CHECK(sums[mo] == (double)want[mo] / 100.0);
+    }
+}
+
+/* Sends op (payload p, n) and then OP_PAGE for the rest; 1 if the pages
+   hold the rows the query selects, in order, with their ids. */
+static int pages_add_up(Ledger *L, int op, const unsigned char *p, size_t n, const RowSet *want) {
+    FinBuf req = {0}, out = {0};
+    RowSet hits = {0};
+    int got = 0, pages = 0, ok = 1;
+    for (;;) {
+        req.len = 0;
+        if (got) {
+            finbuf_put_le(&req, (unsigned)got, 4);
+            finbuf_put_le(&req, (unsigned)op, 1);
+        }
+        finbuf_put(&req, p, n);
+        out.len = 0;
+        fin_serve_request(L, NULL, &hits, got ? OP_PAGE : op, req.data, req.len, &out);
+        if (out.len < 13 || out.data[4] != FIN_ST_OK) { ok = 0; break; }
+        int total = (int)fin_get_le(out.data + 5, 4), count = (int)fin_get_le(out.data + 9, 4);
+        if (total != want->count || count > FIN_PAGE_ROWS || out.len != 13 + (size_t)count * BIN_ROW_LEN) { ok = 0; break; }
+        for (int k = 0; k < count && ok; ++k) {
+            int idx;
+            Transaction t;
+            fin_decode_row(out.data + 13 + (size_t)k * BIN_ROW_LEN, &idx, &t);
+            ok = got + k < want->count && idx == want->ids[got + k] && same_row(&t, ledger_row(L, idx));
+        }
+        got += count;
+        pages++;
+        if (!ok || !count || got >= total) break;
+    }
+    ok = ok && got == want->count && pages == (want->count + FIN_PAGE_ROWS - 1) / FIN_PAGE_ROWS;
+    finbuf_free(&req);
+    finbuf_free(&out);
+    rowset_free(&hits);
+    return ok;
+}
+
+int main(void) {
+    Ledger *L = build();
+    check_queries(L);
+    CHECK(ledger_delete(L, 5));
+    check_queries(L);
+    CHECK(ledger_sort(L, SORT_AMOUNT_DESC) == 1);
+    check_queries(L);
+
+    RowSet want = {0};
+    FinBuf thr = {0};
+    CHECK(ledger_select_all(L, &want) > 3 * FIN_PAGE_ROWS);
+    CHECK(pages_add_up(L, OP_LIST, NULL, 0, &want));
+    finbuf_put_f64(&thr, 100.0);
+    CHECK(ledger_filter_expenses(L, 100.0, &want) > 3 * FIN_PAGE_ROWS);
+    CHECK(pages_add_up(L, OP_FILTER, thr.data, thr.len, &want));
+    finbuf_free(&thr);
+    rowset_free(&want);
+
+    ledger_free(L);
+    return report("test_scan");
+}
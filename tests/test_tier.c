@@ -0,0 +1,118 @@
+/* Tiered storage: save splits a ledger into data file and archive, a
+   reload holds only the hot years, faulting brings the rest back in date
+   order whatever order the years are faulted in, and additions to an
+   archived year survive a save and reload. The split is kept in the
+   archive across reopens. */
+#define _POSIX_C_SOURCE 200809L
+#include "check.h"
+
+static int cmp_row(const void *a, const void *b) {
+    const Transaction *x = a, *y = b;
+    long long kx = x->y * 10000LL + x->m * 100 + x->d, ky = y->y * 10000LL + y->m * 100 + y->d;
+    if (kx != ky) return kx < ky ? -1 : 1;
+    if (x->type != y->type) return x->type < y->type ? -1 : 1;
+    long long cx = fin_cents(x->amount), cy = fin_cents(y->amount);
+    if (cx != cy) return cx < cy ? -1 : 1;
+    int c = strcmp(x->category, y->category);
+    return c ? c : strcmp(x->note, y->note);
+}
+
+/* The same rows, ignoring the order of rows sharing a date (the archive
+   is sorted by date, not stably). */
+static int same_rows(const Ledger *A, const Ledger *B) {
+    int n = ledger_count(A);
+    if (n != ledger_count(B)) return 0;
+    Transaction *a = malloc((size_t)n * sizeof(Transaction) + 1), *b = malloc((size_t)n * sizeof(Transaction) + 1);
+    for (int i = 0; i < n; ++i) { a[i] = *ledger_row(A, i); b[i] = *ledger_row(B, i); }
+    qsort(a, (size_t)n, sizeof(Transaction), cmp_row);
+    qsort(b, (size_t)n, sizeof(Transaction), cmp_row);
+    int same = 1;
+    for (int i = 0; same && i < n; ++i) same = same_row(&a[i], &b[i]);
+    free(a);
+    free(b);
+    return same;
+}
+
+static int in_date_order(const Ledger *L) {
+    int n = ledger_count(L);
+    for (int i = 1; i < n; ++i) {
+        const Transaction *p = ledger_row(L, i - 1), *t = ledger_row(L, i);
+        if (p->y * 10000 + p->m * 100 + p->d > t->y * 10000 + t->m * 100 + t->d) return 0;
+    }
+    return 1;
+}
+
+static int count_from(const Ledger *L, int year) {
+    int n = ledger_count(L), k = 0;
+    for (int i = 0; i < n; ++i) k += ledger_row(L, i)->y >= year;
+    return k;
+}
+
+/* Loads the data file and opens its archive. */
+static FinTier *reload(const char *data, Ledger *L) {
+    CHECK(ledger_load(L, data) >= 0);
+    FinTier *t = fin_tier_open(data);
+    CHECK(t != NULL);
+    return t;
+}
+
+int main(void) {
+    char dir[4096], data[4200];
+    tmp_dir(dir, sizeof(dir));
+    snprintf(data, sizeof(data), "%s/ledger.txt", dir);
+    Ledger *all = gen_ledger(60000, 74);
+    int hot = count_from(all, 2023);
+
+    FinTier *t = fin_tier_open(data);              // no archive yet
+    CHECK(t && fin_tier_hot_from(t) == 0);
+    CHECK(fin_tier_save(t, all, 2023));
+    fin_tier_close(t);
+
+    Ledger *A = ledger_new(), *B = ledger_new();
+    FinTier *ta = reload(data, A), *tb = reload(data, B);
+    if (!ta || !tb) return report("test_tier");
+    CHECK(fin_tier_hot_from(ta) == 2023);
+    CHECK(ledger_count(A) == hot && count_from(A, 2023) == hot);
+
+    // Fault two years in opposite orders: the same rows in the same order.
+    CHECK(fin_tier_fault(ta, A, 2019, 2019) > 0);
+    CHECK(fin_tier_fault(ta, A, 2017, 2017) > 0);
+    CHECK(fin_tier_fault(tb, B, 2017, 2017) > 0);
+    CHECK(fin_tier_fault(tb, B, 2019, 2019) > 0);
+    CHECK(same_ledger(A, B));
+    CHECK(in_date_order(A));
+    CHECK(fin_tier_fault(ta, A, 2019, 2019) == 0);  // already resident
+
+    CHECK(fin_tier_fault_all(ta, A) > 0);
+    CHECK(fin_tier_fault_all(tb, B) > 0);
+    CHECK(same_ledger(A, B));
+    CHECK(in_date_order(A));
+    CHECK(same_rows(A, all));
+    fin_tier_close(tb);
+
+    // An addition to an archived year that is not resident is merged on save.
+    fin_tier_close(ta);
+    ta = reload(data, A);
+    CHECK(ledger_add(A, 2018, 3, 3, EXPENSE, "Late", 12.34, "added after archiving"));
+    CHECK(fin_tier_save(ta, A, 0));
+    fin_tier_close(ta);
+    ta = reload(data, A);
+    CHECK(fin_tier_hot_from(ta) == 2023);
+    CHECK(ledger_count(A) == hot);
+    CHECK(fin_tier_fault_all(ta, A) == ledger_count(all) - hot + 1);
+    CHECK(ledger_count(A) == ledger_count(all) + 1);
+
+    // Moving the split forward is recorded in the archive.
+    CHECK(fin_tier_save(ta, A, 2025));
+    fin_tier_close(ta);
+    ta = reload(data, A);
+    CHECK(fin_tier_hot_from(ta) == 2025);
+    CHECK(ledger_count(A) == count_from(all, 2025));
+    fin_tier_close(ta);
+
+    ledger_free(A);
+    ledger_free(B);
+    ledger_free(all);
+    tmp_remove(dir);
+    return report("test_tier");
+}